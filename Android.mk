@@ -344,6 +344,7 @@ include $(CLEAR_VARS)
 
 LOCAL_SRC_FILES :=                     	\
        tools/intel_gtt.c          	\
+       lib/intel_gtt_rle.c		\
        lib/intel_pci.c 			\
        lib/intel_gpu_tools.h         	\
        tools/intel_reg.h               	\
@@ -0,0 +1,739 @@
+/*
+ * Copyright © 2006 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "ralloc.h"
+#include "gen4asm.h"
+#include "brw_asm.h"
+#include "brw_eu.h"
+#include "brw_cfg.h"
+
+#define HASH_INITIAL_SIZE 64
+
+struct hash_item {
+	char *key;
+	void *value;
+	struct hash_item *next;
+};
+
+/* All the addresses a (possibly duplicated) label is defined at, ascending */
+struct label_item {
+	char *name;
+	int *addr;
+	int count;
+	int size;
+};
+
+// jump distance used in branch instructions as JIP or UIP
+static int jump_distance(struct gen4asm_state *state, int offset)
+{
+    // Gen4- bspec: the jump distance is in number of sixteen-byte units
+    // Gen5+ bspec: the jump distance is in number of eight-byte units
+    if(IS_GENp(5))
+        offset *= 2;
+    return offset;
+}
+
+/* FNV-1a, folding case when the table compares keys case-insensitively */
+static unsigned int hash(const struct hash_table *t, const char *key)
+{
+    unsigned int ret = 2166136261u;
+
+    while (*key) {
+	unsigned char c = *key++;
+
+	if (t->ignore_case)
+	    c = tolower(c);
+	ret = (ret ^ c) * 16777619u;
+    }
+    return ret & (t->size - 1);
+}
+
+static int key_equal(const struct hash_table *t, const char *a, const char *b)
+{
+    return t->ignore_case ? strcasecmp(a, b) == 0 : strcmp(a, b) == 0;
+}
+
+static void *find_hash_item(struct hash_table *t, const char *key)
+{
+    struct hash_item *p;
+
+    if (t->count == 0)
+	return NULL;
+
+    for(p = t->buckets[hash(t, key)]; p; p = p->next)
+	if(key_equal(t, p->key, key))
+	    return p->value;
+    return NULL;
+}
+
+static void resize_hash_table(struct hash_table *t, unsigned int size)
+{
+    struct hash_item **old = t->buckets;
+    unsigned int old_size = t->size, i;
+
+    t->buckets = calloc(size, sizeof(*t->buckets));
+    t->size = size;
+    if (t->buckets == NULL) {
+	fprintf(stderr, "Out of memory growing symbol table\n");
+	exit(1);
+    }
+
+    for (i = 0; i < old_size; i++) {
+	struct hash_item *p = old[i], *next;
+
+	for (; p; p = next) {
+	    unsigned int index = hash(t, p->key);
+
+	    next = p->next;
+	    p->next = t->buckets[index];
+	    t->buckets[index] = p;
+	}
+    }
+    free(old);
+}
+
+static void insert_hash_item(struct hash_table *t, char *key, void *v)
+{
+    struct hash_item *p;
+    int index;
+
+    if (t->count >= t->size)
+	resize_hash_table(t, t->size ? t->size * 2 : HASH_INITIAL_SIZE);
+
+    index = hash(t, key);
+    p = malloc(sizeof(*p));
+    p->key = key;
+    p->value = v;
+    p->next = t->buckets[index];
+    t->buckets[index] = p;
+    t->count++;
+}
+
+static void free_hash_table(struct hash_table *t, void (*free_value)(void *))
+{
+    struct hash_item *p, *next;
+    unsigned int i;
+    for (i = 0; i < t->size; i++) {
+	p = t->buckets[i];
+	while(p) {
+	    next = p->next;
+	    if (free_value)
+		free_value(p->value);
+	    free(p);
+	    p = next;
+	}
+    }
+    free(t->buckets);
+    t->buckets = NULL;
+    t->size = t->count = 0;
+}
+
+static void free_register(void *v)
+{
+    struct declared_register *reg = v;
+
+    free(reg->name);
+    free(reg);
+}
+
+struct declared_register *find_register(struct gen4asm_state *state,
+					 char *name)
+{
+    return find_hash_item(&state->declared_register_table, name);
+}
+
+void insert_register(struct gen4asm_state *state,
+		     struct declared_register *reg)
+{
+    insert_hash_item(&state->declared_register_table, reg->name, reg);
+}
+
+/* Labels are added in program order, so each address list stays sorted */
+static void add_label(struct gen4asm_state *state, struct program_label *label)
+{
+    struct label_item *l;
+
+    l = find_hash_item(&state->label_table, label->name);
+    if (l == NULL) {
+	l = calloc(1, sizeof(*l));
+	l->name = label->name;
+	insert_hash_item(&state->label_table, l->name, l);
+    }
+
+    if (l->count == l->size) {
+	l->size = l->size ? l->size * 2 : 1;
+	l->addr = realloc(l->addr, l->size * sizeof(*l->addr));
+	if (l->addr == NULL) {
+	    fprintf(stderr, "Out of memory adding label %s\n", l->name);
+	    exit(1);
+	}
+    }
+    l->addr[l->count++] = label->offset;
+}
+
+/* Some assembly code have duplicated labels.
+   Start from start_addr. Search as a loop. Return the first label found. */
+static int label_to_addr(struct gen4asm_state *state, char *name,
+			 int start_addr, int *addr)
+{
+    /* return the first label just after start_addr, or the first label from the head */
+    struct label_item *l = find_hash_item(&state->label_table, name);
+    int lo, hi;
+
+    if (l == NULL) {
+        fprintf(stderr, "Can't find label %s\n", name);
+        return -1;
+    }
+
+    lo = 0;
+    hi = l->count;
+    while (lo < hi) {
+	int mid = lo + (hi - lo) / 2;
+
+	if (l->addr[mid] >= start_addr)
+	    hi = mid;
+	else
+	    lo = mid + 1;
+    }
+
+    *addr = lo < l->count ? l->addr[lo] : l->addr[0];
+    return 0;
+}
+
+static void free_label(void *v)
+{
+    struct label_item *l = v;
+
+    free(l->addr);
+    free(l);
+}
+
+static int is_entry_point(struct gen4asm_state *state,
+			  struct program_label *label)
+{
+	return find_hash_item(&state->entry_point_table, label->name) != NULL;
+}
+
+/*
+ * Assign an instruction offset to every label and relocation, and copy the
+ * instructions into a new array, padded with NOPs so that each entry point
+ * label lands on a multiple of 4 instructions.
+ *
+ * Labels and instructions are visited in program order; the label side
+ * table is merged in by instruction index.
+ */
+static struct brw_instruction *layout_program(struct gen4asm_state *state,
+					      unsigned *num_insn)
+{
+	struct brw_program *p = &state->program;
+	struct brw_instruction *out;
+	unsigned i = 0, l = 0, r = 0, n = 0;
+	int inst_offset = 0;
+
+	out = calloc(p->num_insn + 3 * p->num_label + 1, sizeof(*out));
+	if (out == NULL) {
+		fprintf(stderr, "Out of memory laying out program\n");
+		exit(1);
+	}
+
+	for (;;) {
+		int label = l < p->num_label && p->label[l].insn <= i;
+		int padded = 0;
+
+		if (!label && i >= p->num_insn)
+			break;
+
+		if (label) {
+			p->label[l++].offset = inst_offset;
+		} else {
+			for (; r < p->num_reloc && p->reloc[r].insn == i; r++) {
+				p->reloc[r].insn = n;
+				p->reloc[r].offset = inst_offset;
+			}
+			out[n++] = p->insn[i++];
+		}
+
+		if (l < p->num_label && p->label[l].insn <= i &&
+		    is_entry_point(state, &p->label[l])) {
+			// insert NOP instructions until (inst_offset+1) % 4 == 0
+			while (((inst_offset+1) % 4) != 0) {
+				out[n++].header.opcode = BRW_OPCODE_NOP;
+				inst_offset++;
+				padded = 1;
+			}
+		}
+		if (!label || padded)
+			inst_offset++;
+	}
+
+	*num_insn = n;
+	return out;
+}
+
+
+/* Resolve the branch targets now that every label has an offset */
+static int relocate_program(struct gen4asm_state *state,
+			    struct brw_instruction *insn)
+{
+	struct brw_program *p = &state->program;
+	unsigned int i;
+
+	for (i = 0; i < p->num_reloc; i++) {
+	    struct program_reloc *r = &p->reloc[i];
+	    struct relocation *reloc = &r->reloc;
+	    struct brw_instruction *inst = &insn[r->insn];
+
+	    int addr;
+
+	    if (reloc->first_reloc_target) {
+		if (label_to_addr(state, reloc->first_reloc_target, r->offset, &addr))
+		    return -1;
+		reloc->first_reloc_offset = addr - r->offset;
+	    }
+
+	    if (reloc->second_reloc_target) {
+		if (label_to_addr(state, reloc->second_reloc_target, r->offset, &addr))
+		    return -1;
+		reloc->second_reloc_offset = addr - r->offset;
+	    }
+
+	    if (reloc->second_reloc_offset) {
+		// this is a branch instruction with two offset arguments
+		inst->bits3.break_cont.jip = jump_distance(state, reloc->first_reloc_offset);
+		inst->bits3.break_cont.uip = jump_distance(state, reloc->second_reloc_offset);
+	    } else if (reloc->first_reloc_offset) {
+		// this is a branch instruction with one offset argument
+		int offset = reloc->first_reloc_offset;
+		/* bspec: Unlike other flow control instructions, the offset used by JMPI is relative to the incremented instruction pointer rather than the IP value for the instruction itself. */
+
+		int is_jmpi = inst->header.opcode == BRW_OPCODE_JMPI; // target relative to the post-incremented IP, so delta == 1 if JMPI
+		if(is_jmpi)
+		    offset --;
+		offset = jump_distance(state, offset);
+		if (is_jmpi && (state->gen_level == 75))
+			offset = offset * 8;
+
+		if(!IS_GENp(6)) {
+		    inst->bits3.JIP = offset;
+		    if(inst->header.opcode == BRW_OPCODE_ELSE)
+			inst->bits3.break_cont.uip = 1; /* Set the istack pop count, which must always be 1. */
+		} else if(IS_GENx(6)) {
+		    /* TODO: endif JIP pos is not in Gen6 spec. may be bits1 */
+		    int opcode = inst->header.opcode;
+		    if(opcode == BRW_OPCODE_CALL || opcode == BRW_OPCODE_JMPI)
+			inst->bits3.JIP = offset; // for CALL, JMPI
+		    else
+			inst->bits1.branch_gen6.jump_count = offset; // for CASE,ELSE,FORK,IF,WHILE
+		} else if(IS_GENp(7)) {
+		    int opcode = inst->header.opcode;
+		    /* Gen7 JMPI Restrictions in bspec:
+		     * The JIP data type must be Signed DWord
+		     */
+		    if(opcode == BRW_OPCODE_JMPI)
+			inst->bits3.JIP = offset;
+		    else
+			inst->bits3.break_cont.jip = offset;
+		}
+	    }
+	}
+
+
+	return 0;
+}
+
+/*
+ * Runs the peephole optimizer over the relocated program, whose label
+ * offsets are still in instructions, and swaps in the result.  Programs
+ * it can't handle, mostly ones with jumps out of them, are left as they
+ * are.
+ */
+static void optimize_program(struct gen4asm_state *state,
+			     struct brw_instruction **insn,
+			     unsigned int *num_insn,
+			     struct brw_asm_opt_stats *stats)
+{
+	struct brw_program *program = &state->program;
+	struct brw_cfg_opt_stats opt;
+	struct brw_instruction *out;
+	int *offsets;
+	bool *aligned;
+	unsigned int i;
+	int n = -1;
+
+	offsets = malloc((program->num_label + 1) * sizeof(*offsets));
+	aligned = malloc((program->num_label + 1) * sizeof(*aligned));
+	if (offsets && aligned) {
+		for (i = 0; i < program->num_label; i++) {
+			offsets[i] = program->label[i].offset;
+			aligned[i] = is_entry_point(state, &program->label[i]);
+		}
+		n = brw_cfg_optimize(&state->brw_context, *insn, *num_insn,
+				     offsets, aligned, program->num_label,
+				     &out, &opt);
+	}
+
+	if (n < 0) {
+		fprintf(stderr, "%s: jumps leave the program, not optimizing\n",
+			state->input_filename);
+	} else {
+		for (i = 0; i < program->num_label; i++)
+			program->label[i].offset = offsets[i];
+		stats->instructions = *num_insn;
+		stats->copies = opt.copies;
+		stats->folded = opt.folded;
+		stats->dead = opt.dead;
+		stats->nops = opt.nops;
+		free(*insn);
+		*insn = out;
+		*num_insn = n;
+	}
+
+	free(offsets);
+	free(aligned);
+}
+
+/*
+ * Schedules the relocated program in place; its label offsets are still
+ * in instructions, and stay where they are.
+ */
+static int schedule_program(struct gen4asm_state *state,
+			    struct brw_instruction *insn,
+			    unsigned int num_insn,
+			    struct brw_asm_sched_stats *stats)
+{
+	struct brw_program *program = &state->program;
+	struct brw_cfg_sched_stats sched;
+	int *offsets;
+	unsigned int i;
+	int err;
+
+	offsets = malloc((program->num_label + 1) * sizeof(*offsets));
+	if (offsets == NULL)
+		return -1;
+	for (i = 0; i < program->num_label; i++)
+		offsets[i] = program->label[i].offset;
+	err = brw_cfg_schedule(&state->brw_context, insn, num_insn, offsets,
+			       program->num_label, &sched);
+	free(offsets);
+	if (err)
+		return -1;
+
+	stats->instructions = num_insn;
+	stats->moved = sched.moved;
+	stats->before = sched.before;
+	stats->after = sched.after;
+	return 0;
+}
+
+/*
+ * Compacts the laid out program in place and moves the labels, whose
+ * offsets are in bytes by now, with their instructions.  Returns the
+ * compacted size, or 0 if we ran out of memory.
+ *
+ * If report isn't NULL, what did and didn't compact and why is written
+ * there first.
+ */
+static size_t compact_program(struct gen4asm_state *state,
+			      struct brw_instruction *insn,
+			      unsigned int num_insn, FILE *report)
+{
+	struct brw_compile *p = &state->compile;
+	struct brw_instruction *store = p->store;
+	struct brw_program *program = &state->program;
+	int *offsets;
+	unsigned int i;
+	size_t size;
+
+	offsets = malloc((program->num_label + 1) * sizeof(*offsets));
+	if (offsets == NULL)
+		return 0;
+	for (i = 0; i < program->num_label; i++)
+		offsets[i] = program->label[i].offset;
+
+	if (report) {
+		struct brw_compaction_stats stats;
+
+		memset(&stats, 0, sizeof(stats));
+		for (i = 0; i < num_insn; i++)
+			brw_compaction_stats_add(p, &stats, &insn[i]);
+		brw_compaction_stats_print(report, state->input_filename,
+					   &stats);
+		brw_compaction_stats_fini(&stats);
+	}
+
+	p->store = insn;
+	p->nr_insn = num_insn;
+	p->next_insn_offset = num_insn * sizeof(*insn);
+	brw_compact_instructions(p, program->num_label, offsets);
+	size = p->next_insn_offset;
+	p->store = store;
+
+	/* an odd compacted instruction at the end is followed by a NOP */
+	assert(size % 16 == 0);
+
+	for (i = 0; i < program->num_label; i++)
+		program->label[i].offset = offsets[i];
+	free(offsets);
+
+	return size;
+}
+
+int brw_asm_assemble(const struct brw_asm_options *options,
+		     const char *source, size_t size,
+		     struct brw_asm_result *result)
+{
+	struct gen4asm_state *state;
+	struct brw_instruction *insn = NULL;
+	struct brw_asm_opt_stats opt;
+	struct brw_asm_sched_stats sched;
+	unsigned int num_insn, i;
+	size_t code_size;
+	int err;
+
+	memset(result, 0, sizeof(*result));
+
+	if (options->compact && options->num_entry_points) {
+		fprintf(stderr, "%s: entry points can't be aligned in a "
+			"compacted program\n",
+			options->filename ? options->filename : "<stdin>");
+		return -1;
+	}
+
+	state = calloc(1, sizeof(*state));
+	if (state == NULL)
+		return -1;
+
+	state->gen_level = options->gen;
+	state->advanced_flag = options->advanced;
+	state->warning_flags = WARN_ALWAYS;
+	if (options->warn_all)
+		state->warning_flags |= WARN_ALL;
+	state->input_filename = options->filename ? options->filename : "<stdin>";
+	state->program_defaults.register_type = BRW_REGISTER_TYPE_F;
+	state->declared_register_table.ignore_case = 1;
+
+	for (i = 0; i < options->num_entry_points; i++) {
+		char *str;
+
+		if (find_hash_item(&state->entry_point_table,
+				   options->entry_points[i]))
+			continue;
+		str = strdup(options->entry_points[i]);
+		insert_hash_item(&state->entry_point_table, str, str);
+	}
+
+	brw_init_context(&state->brw_context, state->gen_level);
+	state->mem_ctx = ralloc_context(NULL);
+	brw_init_compile(&state->brw_context, &state->compile, state->mem_ctx);
+
+	err = lex_init(state, source, size);
+	if (err == 0) {
+		err = yyparse(state);
+		lex_fini(state);
+	}
+	if (err || state->errors) {
+		err = -1;
+		goto out;
+	}
+
+	insn = layout_program(state, &num_insn);
+
+	for (i = 0; i < state->program.num_label; i++)
+		add_label(state, &state->program.label[i]);
+
+	err = relocate_program(state, insn);
+	if (err)
+		goto out;
+
+	memset(&opt, 0, sizeof(opt));
+	if (options->optimize)
+		optimize_program(state, &insn, &num_insn, &opt);
+
+	memset(&sched, 0, sizeof(sched));
+	if (options->schedule && num_insn) {
+		err = schedule_program(state, insn, num_insn, &sched);
+		if (err)
+			goto out;
+	}
+
+	for (i = 0; i < state->program.num_label; i++)
+		state->program.label[i].offset *= sizeof(*insn);
+
+	code_size = num_insn * sizeof(*insn);
+	if (options->compact && state->gen_level >= 60 && num_insn) {
+		code_size = compact_program(state, insn, num_insn,
+					    options->compaction_report);
+		if (code_size == 0) {
+			err = -1;
+			goto out;
+		}
+	}
+
+	result->labels = calloc(state->program.num_label + 1,
+				sizeof(*result->labels));
+	if (result->labels == NULL) {
+		err = -1;
+		goto out;
+	}
+	for (i = 0; i < state->program.num_label; i++) {
+		struct program_label *label = &state->program.label[i];
+
+		/* the label table only borrows the name */
+		result->labels[i].name = label->name;
+		result->labels[i].offset = label->offset;
+		label->name = NULL;
+	}
+	result->num_labels = state->program.num_label;
+	result->code = insn;
+	result->size = code_size;
+	result->uncompacted_size = num_insn * sizeof(*insn);
+	result->opt = opt;
+	result->sched = sched;
+	insn = NULL;
+
+out:
+	/* label names are shared with the label table, so free them last */
+	free_hash_table(&state->entry_point_table, free);
+	free_hash_table(&state->declared_register_table, free_register);
+	free_hash_table(&state->label_table, free_label);
+	brw_program_free(&state->program);
+	ralloc_free(state->mem_ctx);
+	free(insn);
+	free(state);
+
+	return err;
+}
+
+void brw_asm_result_fini(struct brw_asm_result *result)
+{
+	unsigned int i;
+
+	for (i = 0; i < result->num_labels; i++)
+		free(result->labels[i].name);
+	free(result->labels);
+	free(result->code);
+	memset(result, 0, sizeof(*result));
+}
+
+int brw_asm_write_container(FILE *output, long int gen,
+			    const struct brw_asm_result *result)
+{
+	struct brw_asm_container_header *header;
+	struct brw_asm_container_label *labels;
+	size_t total, strtab_size = 0;
+	unsigned int i;
+	char *buf, *strtab;
+	int err = 0;
+
+	for (i = 0; i < result->num_labels; i++)
+		strtab_size += strlen(result->labels[i].name) + 1;
+
+	total = sizeof(*header) + result->size +
+		result->num_labels * sizeof(*labels) + strtab_size;
+	buf = calloc(1, total);
+	if (buf == NULL)
+		return -1;
+
+	header = (void *)buf;
+	memcpy(header->magic, BRW_ASM_CONTAINER_MAGIC, sizeof(header->magic));
+	header->version = BRW_ASM_CONTAINER_VERSION;
+	header->gen = gen;
+	header->code_offset = sizeof(*header);
+	header->code_size = result->size;
+	header->labels_offset = header->code_offset + header->code_size;
+	header->num_labels = result->num_labels;
+	header->strtab_offset = header->labels_offset +
+		header->num_labels * sizeof(*labels);
+	header->strtab_size = strtab_size;
+
+	memcpy(buf + header->code_offset, result->code, result->size);
+
+	labels = (void *)(buf + header->labels_offset);
+	strtab = buf + header->strtab_offset;
+	for (i = 0; i < result->num_labels; i++) {
+		size_t len = strlen(result->labels[i].name) + 1;
+
+		labels[i].name = strtab - (buf + header->strtab_offset);
+		labels[i].offset = result->labels[i].offset;
+		memcpy(strtab, result->labels[i].name, len);
+		strtab += len;
+	}
+
+	if (fwrite(buf, 1, total, output) != total)
+		err = -1;
+	free(buf);
+
+	return err;
+}
+
+int brw_asm_parse_container(const void *data, size_t size,
+			    struct brw_asm_container *container)
+{
+	const struct brw_asm_container_header *header = data;
+	const char *base = data;
+	unsigned int i;
+
+	if (size < sizeof(*header) ||
+	    memcmp(header->magic, BRW_ASM_CONTAINER_MAGIC,
+		   sizeof(header->magic)) != 0 ||
+	    header->version != BRW_ASM_CONTAINER_VERSION)
+		return -1;
+
+	/* every part must lie inside the buffer, at its natural alignment */
+	if (header->code_offset % 16 || header->code_size % 8 ||
+	    header->code_offset > size ||
+	    header->code_size > size - header->code_offset ||
+	    header->labels_offset % 4 ||
+	    header->labels_offset > size ||
+	    header->num_labels > (size - header->labels_offset) /
+				 sizeof(struct brw_asm_container_label) ||
+	    header->strtab_offset > size ||
+	    header->strtab_size > size - header->strtab_offset)
+		return -1;
+
+	container->gen = header->gen;
+	container->code = base + header->code_offset;
+	container->size = header->code_size;
+	container->labels = (const void *)(base + header->labels_offset);
+	container->num_labels = header->num_labels;
+	container->strtab = base + header->strtab_offset;
+
+	/* names must be NUL terminated inside the string table */
+	for (i = 0; i < container->num_labels; i++) {
+		uint32_t name = container->labels[i].name;
+
+		if (name >= header->strtab_size ||
+		    memchr(container->strtab + name, 0,
+			   header->strtab_size - name) == NULL)
+			return -1;
+	}
+
+	return 0;
+}
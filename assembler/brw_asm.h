@@ -0,0 +1,154 @@
+/*
+ * Copyright © 2013 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef __BRW_ASM_H__
+#define __BRW_ASM_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * In-process interface to the gen4 assembler.
+ *
+ * brw_asm_assemble() assembles a whole source buffer into a binary blob.
+ * All state lives in the call, so any number of assemblies may run
+ * concurrently, one per thread.  Diagnostics go to stderr, prefixed with
+ * the file name given in the options.
+ */
+
+struct brw_asm_options {
+	long int gen;			/* 10 * generation, e.g. 45 or 75 */
+	int advanced;			/* sub-registers in data element units */
+	int warn_all;			/* enable the optional warnings */
+	int compact;			/* compact instructions on gen6+ */
+	int optimize;			/* peephole optimize the program */
+	int schedule;			/* reorder it to hide latency */
+	FILE *compaction_report;	/* why instructions didn't compact */
+	const char *filename;		/* for diagnostics, may be NULL */
+
+	/* labels to align on a 4 instruction boundary, may be NULL */
+	const char * const *entry_points;
+	unsigned int num_entry_points;
+};
+
+struct brw_asm_label {
+	char *name;
+	unsigned int offset;		/* in bytes */
+};
+
+/* What the optimizer did, see brw_cfg_optimize() */
+struct brw_asm_opt_stats {
+	unsigned int instructions;	/* before, padding included */
+	unsigned int copies;
+	unsigned int folded;
+	unsigned int dead;
+	unsigned int nops;
+};
+
+/* What the scheduler did, see brw_cfg_schedule() */
+struct brw_asm_sched_stats {
+	unsigned int instructions;
+	unsigned int moved;
+	unsigned int before, after;	/* estimated cycles */
+};
+
+struct brw_asm_result {
+	void *code;			/* 16 bytes per instruction, 8 if compacted */
+	size_t size;			/* in bytes, a multiple of 16 */
+	size_t uncompacted_size;	/* what size would be without compaction */
+	struct brw_asm_opt_stats opt;	/* if optimized */
+	struct brw_asm_sched_stats sched; /* if scheduled */
+
+	/* every label definition, duplicates included, in program order */
+	struct brw_asm_label *labels;
+	unsigned int num_labels;
+};
+
+/**
+ * Assembles \c size bytes of source.  Returns 0 and fills in \c result on
+ * success, or returns -1 with \c result zeroed if the source had errors.
+ *
+ * Compaction moves instructions off 16 byte boundaries, so it can't be
+ * combined with entry points, which are padded to 64 bytes.
+ */
+int brw_asm_assemble(const struct brw_asm_options *options,
+		     const char *source, size_t size,
+		     struct brw_asm_result *result);
+
+void brw_asm_result_fini(struct brw_asm_result *result);
+
+/**
+ * Binary container for an assembled program, loosely after ELF: a fixed
+ * header, then the code (16 byte aligned), then the label table and the
+ * string table holding the label names.  Fields are 32 bit words in
+ * the host's byte order, like the code; offsets are in bytes from the
+ * start of the container.
+ */
+#define BRW_ASM_CONTAINER_MAGIC		"\177GEN4ASM"
+#define BRW_ASM_CONTAINER_VERSION	1
+
+struct brw_asm_container_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t gen;			/* 10 * generation */
+	uint32_t code_offset;
+	uint32_t code_size;
+	uint32_t labels_offset;
+	uint32_t num_labels;
+	uint32_t strtab_offset;
+	uint32_t strtab_size;
+	uint32_t reserved[2];
+};
+
+struct brw_asm_container_label {
+	uint32_t name;			/* offset in the string table */
+	uint32_t offset;		/* in bytes from the start of the code */
+};
+
+/* A parsed container, pointing into the caller's buffer */
+struct brw_asm_container {
+	long int gen;
+	const void *code;
+	size_t size;
+	const struct brw_asm_container_label *labels;
+	unsigned int num_labels;
+	const char *strtab;
+};
+
+/**
+ * Writes the result as a container with a single fwrite().  Returns 0 on
+ * success, -1 if we ran out of memory or the write failed.
+ */
+int brw_asm_write_container(FILE *output, long int gen,
+			    const struct brw_asm_result *result);
+
+/**
+ * Checks that the \c size bytes at \c data are a well formed container and
+ * points \c container at its parts.  Returns -1 if they aren't.
+ */
+int brw_asm_parse_container(const void *data, size_t size,
+			    struct brw_asm_container *container);
+
+#endif /* __BRW_ASM_H__ */
@@ -0,0 +1,1018 @@
+/*
+ * Copyright © 2013 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "brw_cfg.h"
+#include "brw_eu.h"
+
+/* How an instruction leaves its block */
+enum flow {
+	FLOW_NONE,			/* not at all, it falls through */
+	FLOW_BRANCH,			/* to its targets or the next one */
+	FLOW_JUMP,			/* to its targets only */
+	FLOW_END,			/* nowhere: EOT or RET */
+};
+
+static const unsigned int type_size[8] = {
+	[BRW_REGISTER_TYPE_UD] = 4,
+	[BRW_REGISTER_TYPE_D] = 4,
+	[BRW_REGISTER_TYPE_UW] = 2,
+	[BRW_REGISTER_TYPE_W] = 2,
+	[BRW_REGISTER_TYPE_UB] = 1,
+	[BRW_REGISTER_TYPE_B] = 1,
+	[BRW_REGISTER_TYPE_HF] = 2,
+	[BRW_REGISTER_TYPE_F] = 4,
+};
+
+/* Decodes the 0, 1, 2, 4... encoding of region strides */
+static unsigned int decode_stride(unsigned int encoding)
+{
+	return encoding ? 1 << (encoding - 1) : 0;
+}
+
+static bool is_send(const struct brw_instruction *insn)
+{
+	return insn->header.opcode == BRW_OPCODE_SEND ||
+	       insn->header.opcode == BRW_OPCODE_SENDC;
+}
+
+/* Whether the flow control fields overlay the operands */
+static bool is_flow_control(unsigned int opcode)
+{
+	switch (opcode) {
+	case BRW_OPCODE_JMPI:
+	case BRW_OPCODE_BRD:
+	case BRW_OPCODE_IF:
+	case BRW_OPCODE_IFF:
+	case BRW_OPCODE_ELSE:
+	case BRW_OPCODE_ENDIF:
+	case BRW_OPCODE_DO:
+	case BRW_OPCODE_WHILE:
+	case BRW_OPCODE_BREAK:
+	case BRW_OPCODE_CONTINUE:
+	case BRW_OPCODE_HALT:
+	case BRW_OPCODE_PUSH:
+	case BRW_OPCODE_POP:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static bool is_eot(const struct brw_cfg *cfg,
+		   const struct brw_instruction *insn)
+{
+	if (!is_send(insn))
+		return false;
+	if (cfg->gen >= 50)
+		return insn->bits3.generic_gen5.end_of_thread;
+	return insn->bits3.generic.end_of_thread;
+}
+
+static int sfid(const struct brw_cfg *cfg, const struct brw_instruction *insn)
+{
+	if (cfg->gen >= 60)
+		return insn->header.destreg__conditionalmod;
+	else if (cfg->gen >= 50)
+		return insn->bits2.send_gen5.sfid;
+	return insn->bits3.generic.msg_target;
+}
+
+/*
+ * Where the instruction can go, with its targets as byte offsets from
+ * itself; 0 means there's no target.  Follows the encodings
+ * relocate_program() and the compactor write.
+ */
+static enum flow insn_flow(const struct brw_cfg *cfg,
+			   const struct brw_instruction *insn,
+			   int64_t target[2])
+{
+	int unit = cfg->gen >= 50 ? 8 : 16;
+	unsigned int opcode = insn->header.opcode;
+
+	target[0] = target[1] = 0;
+
+	switch (opcode) {
+	case BRW_OPCODE_JMPI:
+		/* relative to the next instruction, in bytes on Haswell */
+		if (cfg->gen == 75)
+			target[0] = 16 + (int64_t)insn->bits3.JIP;
+		else
+			target[0] = 16 + (int64_t)insn->bits3.JIP * unit;
+		return insn->header.predicate_control ? FLOW_BRANCH : FLOW_JUMP;
+	case BRW_OPCODE_CALL:
+		if (cfg->gen >= 70)
+			target[0] = insn->bits3.break_cont.jip * unit;
+		else
+			target[0] = (int64_t)insn->bits3.JIP * unit;
+		return FLOW_BRANCH;
+	case BRW_OPCODE_RET:
+		return FLOW_END;
+	case BRW_OPCODE_BRD:
+		if (cfg->gen < 70)
+			return FLOW_NONE;
+		/* fall through */
+	case BRW_OPCODE_IF:
+	case BRW_OPCODE_IFF:
+	case BRW_OPCODE_ELSE:
+	case BRW_OPCODE_ENDIF:
+	case BRW_OPCODE_WHILE:
+	case BRW_OPCODE_BREAK:
+	case BRW_OPCODE_CONTINUE:
+	case BRW_OPCODE_HALT:
+		if (cfg->gen >= 70 || (cfg->gen >= 60 &&
+		    (opcode == BRW_OPCODE_BREAK ||
+		     opcode == BRW_OPCODE_CONTINUE ||
+		     opcode == BRW_OPCODE_HALT))) {
+			target[0] = insn->bits3.break_cont.jip * unit;
+			target[1] = insn->bits3.break_cont.uip * unit;
+		} else if (cfg->gen >= 60) {
+			target[0] = insn->bits1.branch_gen6.jump_count * unit;
+		} else if (opcode != BRW_OPCODE_ENDIF) {
+			target[0] = insn->bits3.if_else.jump_count * unit;
+		}
+		/* any channel may go either way */
+		return FLOW_BRANCH;
+	default:
+		return is_eot(cfg, insn) ? FLOW_END : FLOW_NONE;
+	}
+}
+
+void brw_cfg_get_jumps(const struct brw_cfg *cfg,
+		       const struct brw_instruction *insn, int64_t jump[2])
+{
+	insn_flow(cfg, insn, jump);
+}
+
+/* Stores a 16 bit jump field, or returns -1 if it doesn't fit */
+static int set_jump16(int64_t jump, int unit, int *field)
+{
+	if (jump % unit || jump / unit < INT16_MIN || jump / unit > INT16_MAX)
+		return -1;
+	*field = jump / unit;
+	return 0;
+}
+
+int brw_cfg_set_jumps(const struct brw_cfg *cfg,
+		      struct brw_instruction *insn, const int64_t jump[2])
+{
+	int unit = cfg->gen >= 50 ? 8 : 16;
+	unsigned int opcode = insn->header.opcode;
+	int64_t old[2];
+	int field[2] = { 0, 0 };
+
+	insn_flow(cfg, insn, old);
+	if ((old[0] && set_jump16(jump[0], unit, &field[0])) ||
+	    (old[1] && set_jump16(jump[1], unit, &field[1])))
+		return -1;
+
+	switch (opcode) {
+	case BRW_OPCODE_JMPI:
+		if (cfg->gen == 75)
+			insn->bits3.JIP = jump[0] - 16;
+		else
+			insn->bits3.JIP = (jump[0] - 16) / unit;
+		return 0;
+	case BRW_OPCODE_CALL:
+		if (cfg->gen >= 70)
+			insn->bits3.break_cont.jip = field[0];
+		else
+			insn->bits3.JIP = field[0];
+		return 0;
+	case BRW_OPCODE_BRD:
+	case BRW_OPCODE_IF:
+	case BRW_OPCODE_IFF:
+	case BRW_OPCODE_ELSE:
+	case BRW_OPCODE_ENDIF:
+	case BRW_OPCODE_WHILE:
+	case BRW_OPCODE_BREAK:
+	case BRW_OPCODE_CONTINUE:
+	case BRW_OPCODE_HALT:
+		if (cfg->gen >= 70 || (cfg->gen >= 60 &&
+		    (opcode == BRW_OPCODE_BREAK ||
+		     opcode == BRW_OPCODE_CONTINUE ||
+		     opcode == BRW_OPCODE_HALT))) {
+			if (old[0])
+				insn->bits3.break_cont.jip = field[0];
+			if (old[1])
+				insn->bits3.break_cont.uip = field[1];
+		} else if (cfg->gen >= 60) {
+			if (old[0])
+				insn->bits1.branch_gen6.jump_count = field[0];
+		} else if (old[0]) {
+			insn->bits3.if_else.jump_count = field[0];
+		}
+		return 0;
+	default:
+		return 0;
+	}
+}
+
+/* Marks bytes [byte, byte + bytes) from register nr of the file */
+static void add_reg(struct brw_reg_set *set, unsigned int file,
+		    unsigned int nr, unsigned int byte, unsigned int bytes)
+{
+	unsigned int r, last;
+
+	if (bytes == 0)
+		bytes = 1;
+
+	switch (file) {
+	case BRW_GENERAL_REGISTER_FILE:
+		last = nr + (byte + bytes - 1) / REG_SIZE;
+		for (r = nr + byte / REG_SIZE; r <= last; r++)
+			brw_reg_set_add_grf(set, r);
+		break;
+	case BRW_MESSAGE_REGISTER_FILE:
+		nr &= ~BRW_MRF_COMPR4;
+		last = nr + (byte + bytes - 1) / REG_SIZE;
+		for (r = nr + byte / REG_SIZE; r <= last; r++)
+			if (r < BRW_CFG_NUM_MRF)
+				set->mrf |= 1 << r;
+		break;
+	case BRW_ARCHITECTURE_REGISTER_FILE:
+		switch (nr & 0xf0) {
+		case BRW_ARF_ADDRESS:
+			set->address |= 1;
+			break;
+		case BRW_ARF_ACCUMULATOR:
+			set->acc |= 1 << (nr & 1);
+			break;
+		case BRW_ARF_FLAG:
+			set->flag |= 1 << (nr & 1);
+			break;
+		case BRW_ARF_NULL:
+			break;
+		default:
+			set->other |= 1;
+			break;
+		}
+		break;
+	}
+}
+
+/* Bytes covered by an align1 region of exec_size channels */
+static unsigned int region_bytes(unsigned int exec_size, unsigned int vstride,
+				 unsigned int width, unsigned int hstride,
+				 unsigned int size)
+{
+	unsigned int height;
+
+	if (width == 0 || width > exec_size)
+		width = exec_size;
+	height = exec_size / width;
+	return ((width - 1) * hstride + (height - 1) * vstride + 1) * size;
+}
+
+static void add_src0(struct brw_cfg_insn *ci, unsigned int exec_size)
+{
+	const struct brw_instruction *insn = &ci->insn;
+	unsigned int file = insn->bits1.da1.src0_reg_file;
+	unsigned int size = type_size[insn->bits1.da1.src0_reg_type];
+
+	if (file == BRW_IMMEDIATE_VALUE)
+		return;
+	if (insn->bits2.da1.src0_address_mode != BRW_ADDRESS_DIRECT) {
+		ci->indirect = true;
+		ci->read.address |= 1;
+	} else if (insn->header.access_mode == BRW_ALIGN_1) {
+		add_reg(&ci->read, file, insn->bits2.da1.src0_reg_nr,
+			insn->bits2.da1.src0_subreg_nr,
+			region_bytes(exec_size,
+				     decode_stride(insn->bits2.da1.src0_vert_stride),
+				     1 << insn->bits2.da1.src0_width,
+				     decode_stride(insn->bits2.da1.src0_horiz_stride),
+				     size));
+	} else {
+		add_reg(&ci->read, file, insn->bits2.da16.src0_reg_nr,
+			insn->bits2.da16.src0_subreg_nr * 16,
+			insn->bits2.da16.src0_vert_stride ?
+			exec_size * size : 4 * size);
+	}
+}
+
+static void add_src1(struct brw_cfg_insn *ci, unsigned int exec_size)
+{
+	const struct brw_instruction *insn = &ci->insn;
+	unsigned int file = insn->bits1.da1.src1_reg_file;
+	unsigned int size = type_size[insn->bits1.da1.src1_reg_type];
+
+	if (file == BRW_IMMEDIATE_VALUE)
+		return;
+	if (insn->bits3.da1.src1_address_mode != BRW_ADDRESS_DIRECT) {
+		ci->indirect = true;
+		ci->read.address |= 1;
+	} else if (insn->header.access_mode == BRW_ALIGN_1) {
+		add_reg(&ci->read, file, insn->bits3.da1.src1_reg_nr,
+			insn->bits3.da1.src1_subreg_nr,
+			region_bytes(exec_size,
+				     decode_stride(insn->bits3.da1.src1_vert_stride),
+				     1 << insn->bits3.da1.src1_width,
+				     decode_stride(insn->bits3.da1.src1_horiz_stride),
+				     size));
+	} else {
+		add_reg(&ci->read, file, insn->bits3.da16.src1_reg_nr,
+			insn->bits3.da16.src1_subreg_nr * 16,
+			insn->bits3.da16.src1_vert_stride ?
+			exec_size * size : 4 * size);
+	}
+}
+
+/*
+ * LINE and PLN take their coefficients from elements .0, .1 and .3 of
+ * src0 whatever its region, and PLN reads y from the register after x,
+ * two registers per eight channels in all.
+ */
+static void add_interp(struct brw_cfg_insn *ci, unsigned int exec_size)
+{
+	const struct brw_instruction *insn = &ci->insn;
+	unsigned int size = type_size[insn->bits1.da1.src0_reg_type];
+
+	if (insn->bits1.da1.src0_reg_file != BRW_IMMEDIATE_VALUE &&
+	    insn->bits2.da1.src0_address_mode == BRW_ADDRESS_DIRECT) {
+		if (insn->header.access_mode == BRW_ALIGN_1)
+			add_reg(&ci->read, insn->bits1.da1.src0_reg_file,
+				insn->bits2.da1.src0_reg_nr,
+				insn->bits2.da1.src0_subreg_nr, 4 * size);
+		else
+			add_reg(&ci->read, insn->bits1.da1.src0_reg_file,
+				insn->bits2.da16.src0_reg_nr,
+				insn->bits2.da16.src0_subreg_nr * 16, 4 * size);
+	}
+
+	if (insn->header.opcode == BRW_OPCODE_PLN &&
+	    insn->bits1.da1.src1_reg_file != BRW_IMMEDIATE_VALUE &&
+	    insn->bits3.da1.src1_address_mode == BRW_ADDRESS_DIRECT)
+		add_reg(&ci->read, insn->bits1.da1.src1_reg_file,
+			insn->bits3.da1.src1_reg_nr, 0,
+			(exec_size > 8 ? exec_size / 8 : 1) * 2 * REG_SIZE);
+}
+
+static void add_dst(struct brw_cfg_insn *ci, unsigned int exec_size)
+{
+	const struct brw_instruction *insn = &ci->insn;
+	unsigned int file = insn->bits1.da1.dest_reg_file;
+	unsigned int size = type_size[insn->bits1.da1.dest_reg_type];
+	unsigned int byte, bytes;
+
+	if (insn->bits1.da1.dest_address_mode != BRW_ADDRESS_DIRECT) {
+		ci->indirect = true;
+		ci->read.address |= 1;
+		ci->partial_write = true;
+		return;
+	}
+
+	if (insn->header.access_mode == BRW_ALIGN_1) {
+		byte = insn->bits1.da1.dest_subreg_nr;
+		bytes = region_bytes(exec_size, 0, exec_size,
+				     decode_stride(insn->bits1.da1.dest_horiz_stride),
+				     size);
+	} else {
+		byte = insn->bits1.da16.dest_subreg_nr * 16;
+		bytes = exec_size * size;
+		if (insn->bits1.da16.dest_writemask != 0xf)
+			ci->partial_write = true;
+	}
+	if (byte % REG_SIZE || bytes % REG_SIZE)
+		ci->partial_write = true;
+	add_reg(&ci->write, file, insn->bits1.da1.dest_reg_nr, byte, bytes);
+}
+
+/* MAD, LRP and the other three source instructions, align16 GRFs only */
+static void add_3src(struct brw_cfg_insn *ci, unsigned int exec_size)
+{
+	const struct brw_instruction *insn = &ci->insn;
+	unsigned int bytes = exec_size * 4;
+
+	add_reg(&ci->write, insn->bits1.da3src.dest_reg_file ?
+		BRW_MESSAGE_REGISTER_FILE : BRW_GENERAL_REGISTER_FILE,
+		insn->bits1.da3src.dest_reg_nr,
+		insn->bits1.da3src.dest_subreg_nr * 4, bytes);
+	if (insn->bits1.da3src.dest_writemask != 0xf ||
+	    insn->bits1.da3src.dest_subreg_nr || bytes % REG_SIZE)
+		ci->partial_write = true;
+
+	add_reg(&ci->read, BRW_GENERAL_REGISTER_FILE,
+		insn->bits2.da3src.src0_reg_nr,
+		insn->bits2.da3src.src0_subreg_nr * 4,
+		insn->bits2.da3src.src0_rep_ctrl ? 4 : bytes);
+	add_reg(&ci->read, BRW_GENERAL_REGISTER_FILE,
+		insn->bits3.da3src.src1_reg_nr,
+		(insn->bits2.da3src.src1_subreg_nr_low |
+		 insn->bits3.da3src.src1_subreg_nr_high << 2) * 4,
+		insn->bits2.da3src.src1_rep_ctrl ? 4 : bytes);
+	add_reg(&ci->read, BRW_GENERAL_REGISTER_FILE,
+		insn->bits3.da3src.src2_reg_nr,
+		insn->bits3.da3src.src2_subreg_nr * 4,
+		insn->bits3.da3src.src2_rep_ctrl ? 4 : bytes);
+}
+
+/*
+ * SEND reads its message, mlen registers, and writes its response, rlen
+ * GRFs.  Before gen6 the message is in MRFs named by the conditional
+ * modifier field, with src0 copied into the first one.
+ */
+static void add_send(const struct brw_cfg *cfg, struct brw_cfg_insn *ci)
+{
+	const struct brw_instruction *insn = &ci->insn;
+	unsigned int mlen, rlen;
+
+	if (cfg->gen >= 50) {
+		mlen = insn->bits3.generic_gen5.msg_length;
+		rlen = insn->bits3.generic_gen5.response_length;
+	} else {
+		mlen = insn->bits3.generic.msg_length;
+		rlen = insn->bits3.generic.response_length;
+	}
+	ci->sfid = sfid(cfg, insn);
+	ci->mlen = mlen;
+	ci->rlen = rlen;
+
+	if (cfg->gen >= 60) {
+		add_reg(&ci->read, insn->bits1.da1.src0_reg_file,
+			insn->bits2.da1.src0_reg_nr, 0, mlen * REG_SIZE);
+	} else if (mlen) {
+		add_reg(&ci->read, BRW_MESSAGE_REGISTER_FILE,
+			insn->header.destreg__conditionalmod, 0,
+			mlen * REG_SIZE);
+		add_reg(&ci->read, insn->bits1.da1.src0_reg_file,
+			insn->bits2.da1.src0_reg_nr, 0, REG_SIZE);
+	}
+
+	if (rlen)
+		add_reg(&ci->write, insn->bits1.da1.dest_reg_file,
+			insn->bits1.da1.dest_reg_nr, 0, rlen * REG_SIZE);
+}
+
+void brw_cfg_decode_insn(const struct brw_cfg *cfg, struct brw_cfg_insn *ci)
+{
+	const struct brw_instruction *insn = &ci->insn;
+	unsigned int opcode = insn->header.opcode;
+	unsigned int exec_size = 1 << insn->header.execution_size;
+	bool three_src = cfg->gen >= 60 && opcode_descs[opcode].nsrc == 3;
+	unsigned int flag = 0;
+
+	memset(&ci->read, 0, sizeof(ci->read));
+	memset(&ci->write, 0, sizeof(ci->write));
+	ci->partial_write = false;
+	ci->indirect = false;
+	ci->sfid = -1;
+	ci->mlen = ci->rlen = 0;
+	if (cfg->gen >= 70)
+		flag = three_src ? insn->bits1.da3src.flag_reg_nr :
+				   insn->bits2.da1.flag_reg_nr;
+
+	if (insn->header.predicate_control) {
+		ci->read.flag |= 1 << flag;
+		ci->partial_write = true;
+	}
+
+	if (is_flow_control(opcode))
+		return;
+
+	if (is_send(insn)) {
+		add_send(cfg, ci);
+		return;
+	}
+
+	if (three_src) {
+		add_3src(ci, exec_size);
+	} else {
+		if (opcode_descs[opcode].ndst)
+			add_dst(ci, exec_size);
+		if (opcode_descs[opcode].nsrc > 0)
+			add_src0(ci, exec_size);
+		if (opcode_descs[opcode].nsrc > 1)
+			add_src1(ci, exec_size);
+		if (opcode == BRW_OPCODE_LINE || opcode == BRW_OPCODE_PLN)
+			add_interp(ci, exec_size);
+	}
+
+	/* the math function lives where the conditional modifier would */
+	if (insn->header.destreg__conditionalmod &&
+	    !(cfg->gen >= 60 && opcode == BRW_OPCODE_MATH))
+		ci->write.flag |= 1 << flag;
+
+	if (insn->header.acc_wr_control)
+		ci->write.acc |= 1;
+	switch (opcode) {
+	case BRW_OPCODE_MAC:
+	case BRW_OPCODE_SADA2:
+		ci->read.acc |= 1;
+		break;
+	case BRW_OPCODE_MACH:
+		ci->read.acc |= 1;
+		/* fall through */
+	case BRW_OPCODE_ADDC:
+	case BRW_OPCODE_SUBB:
+		ci->write.acc |= 1;
+		break;
+	}
+}
+
+int brw_cfg_find_insn(const struct brw_cfg *cfg, unsigned int offset)
+{
+	unsigned int lo = 0, hi = cfg->num_insn;
+
+	while (lo < hi) {
+		unsigned int mid = lo + (hi - lo) / 2;
+
+		if (cfg->insn[mid].offset == offset)
+			return mid;
+		if (cfg->insn[mid].offset < offset)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return -1;
+}
+
+/* Index of the instruction a jump from ci lands on, or -1 */
+static int find_target(const struct brw_cfg *cfg,
+		       const struct brw_cfg_insn *ci, int64_t target)
+{
+	int64_t offset = ci->offset + target;
+
+	if (offset < 0 || offset > UINT32_MAX)
+		return -1;
+	return brw_cfg_find_insn(cfg, offset);
+}
+
+static void add_succ(struct brw_cfg_block *block, unsigned int succ)
+{
+	unsigned int i;
+
+	for (i = 0; i < block->num_succ; i++)
+		if (block->succ[i] == succ)
+			return;
+	block->succ[block->num_succ++] = succ;
+}
+
+static int decode_program(struct brw_cfg *cfg, struct brw_context *brw,
+			  const void *code, size_t size)
+{
+	const unsigned char *bytes = code;
+	size_t offset = 0;
+
+	cfg->insn = calloc(size / 8 + 1, sizeof(*cfg->insn));
+	if (cfg->insn == NULL)
+		return -1;
+
+	while (offset < size) {
+		struct brw_cfg_insn *ci = &cfg->insn[cfg->num_insn];
+		struct brw_compact_instruction compacted;
+		uint32_t dw0;
+
+		if (size - offset < 8)
+			return -1;
+		memcpy(&dw0, bytes + offset, sizeof(dw0));
+
+		/* cmpt_control is bit 29 in both forms */
+		if (cfg->gen >= 60 && (dw0 & (1u << 29))) {
+			memcpy(&compacted, bytes + offset, 8);
+			brw_uncompact_instruction(&brw->intel, &ci->insn,
+						  &compacted);
+			ci->size = 8;
+		} else {
+			if (size - offset < 16)
+				return -1;
+			memcpy(&ci->insn, bytes + offset, 16);
+			ci->size = 16;
+		}
+		ci->offset = offset;
+		brw_cfg_decode_insn(cfg, ci);
+
+		offset += ci->size;
+		cfg->num_insn++;
+	}
+
+	return 0;
+}
+
+/* Counts the loops, one per block some later block jumps back to */
+static int find_loops(struct brw_cfg *cfg)
+{
+	unsigned int *latch, b, i;
+
+	/* the last block of each loop, plus one */
+	latch = calloc(cfg->num_block, sizeof(*latch));
+	if (latch == NULL)
+		return -1;
+
+	for (b = 0; b < cfg->num_block; b++)
+		for (i = 0; i < cfg->block[b].num_succ; i++)
+			if (cfg->block[b].succ[i] <= b)
+				latch[cfg->block[b].succ[i]] = b + 1;
+
+	for (b = 0; b < cfg->num_block; b++) {
+		if (!latch[b])
+			continue;
+		cfg->num_loops++;
+		for (i = b; i < latch[b]; i++)
+			cfg->block[i].loop_depth++;
+	}
+
+	free(latch);
+	return 0;
+}
+
+int brw_cfg_build(struct brw_cfg *cfg, struct brw_context *brw,
+		  const void *code, size_t size)
+{
+	bool *leader = NULL;
+	unsigned int i, b;
+	int64_t target[2];
+	int t;
+
+	memset(cfg, 0, sizeof(*cfg));
+	cfg->gen = brw->intel.gen * 10 + (brw->intel.is_haswell ? 5 : 0);
+
+	if (decode_program(cfg, brw, code, size))
+		goto fail;
+
+	/* Blocks start at the entry, at jump targets and after jumps */
+	leader = calloc(cfg->num_insn + 1, sizeof(*leader));
+	if (leader == NULL)
+		goto fail;
+	leader[0] = true;
+	for (i = 0; i < cfg->num_insn; i++) {
+		struct brw_cfg_insn *ci = &cfg->insn[i];
+
+		if (insn_flow(cfg, &ci->insn, target) == FLOW_NONE)
+			continue;
+		leader[i + 1] = true;
+		for (t = 0; t < 2; t++) {
+			int index;
+
+			if (!target[t])
+				continue;
+			index = find_target(cfg, ci, target[t]);
+			if (index < 0)
+				cfg->unresolved++;
+			else
+				leader[index] = true;
+		}
+	}
+
+	for (i = 0; i < cfg->num_insn; i++)
+		cfg->num_block += leader[i];
+	cfg->block = calloc(cfg->num_block + 1, sizeof(*cfg->block));
+	if (cfg->block == NULL)
+		goto fail;
+
+	for (i = 0, b = 0; i < cfg->num_insn; i++) {
+		if (leader[i] && i) {
+			cfg->block[b].end = i;
+			cfg->block[++b].start = i;
+		}
+		cfg->insn[i].block = b;
+	}
+	if (cfg->num_insn)
+		cfg->block[b].end = cfg->num_insn;
+
+	for (b = 0; b < cfg->num_block; b++) {
+		struct brw_cfg_block *block = &cfg->block[b];
+		struct brw_cfg_insn *last = &cfg->insn[block->end - 1];
+		enum flow flow = insn_flow(cfg, &last->insn, target);
+
+		/* RET, running off the end and jumps out all leave */
+		if (flow == FLOW_END) {
+			block->exit = !is_eot(cfg, &last->insn);
+			continue;
+		}
+		if (flow != FLOW_JUMP) {
+			if (b + 1 < cfg->num_block)
+				add_succ(block, b + 1);
+			else
+				block->exit = true;
+		}
+		if (flow == FLOW_NONE)
+			continue;
+		for (t = 0; t < 2; t++) {
+			int index;
+
+			if (!target[t])
+				continue;
+			index = find_target(cfg, last, target[t]);
+			if (index >= 0)
+				add_succ(block, cfg->insn[index].block);
+			else
+				block->exit = true;
+		}
+	}
+
+	if (find_loops(cfg))
+		goto fail;
+
+	free(leader);
+	return 0;
+
+fail:
+	free(leader);
+	brw_cfg_fini(cfg);
+	return -1;
+}
+
+void brw_cfg_fini(struct brw_cfg *cfg)
+{
+	free(cfg->insn);
+	free(cfg->block);
+	memset(cfg, 0, sizeof(*cfg));
+}
+
+/*
+ * GRFs the block reads before writing them, and GRFs it overwrites whole.
+ * Predicated and partial writes leave the old value live, and addressing
+ * through a0 may read any GRF.
+ */
+static void block_use_def(const struct brw_cfg *cfg, unsigned int b,
+			  uint64_t use[2], uint64_t def[2])
+{
+	const struct brw_cfg_block *block = &cfg->block[b];
+	unsigned int i, w;
+
+	use[0] = use[1] = def[0] = def[1] = 0;
+	for (i = block->start; i < block->end; i++) {
+		const struct brw_cfg_insn *ci = &cfg->insn[i];
+
+		for (w = 0; w < 2; w++) {
+			use[w] |= (ci->indirect ? ~0ull : ci->read.grf[w]) &
+				  ~def[w];
+			if (!ci->partial_write)
+				def[w] |= ci->write.grf[w];
+		}
+	}
+}
+
+void brw_cfg_liveness(struct brw_cfg *cfg)
+{
+	uint64_t (*use)[2], (*def)[2];
+	unsigned int b, i, w;
+	bool progress;
+
+	use = calloc(cfg->num_block + 1, sizeof(*use));
+	def = calloc(cfg->num_block + 1, sizeof(*def));
+	if (use == NULL || def == NULL)
+		goto out;
+
+	for (b = 0; b < cfg->num_block; b++) {
+		block_use_def(cfg, b, use[b], def[b]);
+		memset(&cfg->block[b].live_in, 0, sizeof(struct brw_reg_set));
+		memset(&cfg->block[b].live_out, 0, sizeof(struct brw_reg_set));
+	}
+
+	/* Backwards, so that most blocks see their successors' final sets */
+	do {
+		progress = false;
+		for (b = cfg->num_block; b-- > 0;) {
+			struct brw_cfg_block *block = &cfg->block[b];
+
+			for (w = 0; w < 2; w++) {
+				uint64_t out = block->exit ? ~0ull : 0, in;
+
+				for (i = 0; i < block->num_succ; i++)
+					out |= cfg->block[block->succ[i]].live_in.grf[w];
+				in = use[b][w] | (out & ~def[b][w]);
+				if (in != block->live_in.grf[w] ||
+				    out != block->live_out.grf[w])
+					progress = true;
+				block->live_in.grf[w] = in;
+				block->live_out.grf[w] = out;
+			}
+		}
+	} while (progress);
+
+out:
+	free(use);
+	free(def);
+}
+
+static unsigned int popcount(const uint64_t grf[2])
+{
+	return __builtin_popcountll(grf[0]) + __builtin_popcountll(grf[1]);
+}
+
+struct live_range {
+	int first, last;		/* instruction indices, -1 if never live */
+};
+
+/*
+ * Walks each block backwards from its live-out set, giving the number of
+ * GRFs live across every instruction and the span each GRF is live over.
+ */
+static void register_pressure(const struct brw_cfg *cfg,
+			      unsigned int *pressure,
+			      struct live_range *range)
+{
+	unsigned int b, i, r, w;
+
+	for (r = 0; r < BRW_CFG_NUM_GRF; r++)
+		range[r].first = range[r].last = -1;
+
+	for (b = 0; b < cfg->num_block; b++) {
+		const struct brw_cfg_block *block = &cfg->block[b];
+		uint64_t live[2] = { block->live_out.grf[0],
+				     block->live_out.grf[1] };
+
+		for (i = block->end; i-- > block->start;) {
+			const struct brw_cfg_insn *ci = &cfg->insn[i];
+			uint64_t across[2];
+
+			for (w = 0; w < 2; w++) {
+				across[w] = live[w] | ci->read.grf[w] |
+					    ci->write.grf[w];
+				if (!ci->partial_write)
+					live[w] &= ~ci->write.grf[w];
+				live[w] |= ci->read.grf[w];
+			}
+			pressure[i] = popcount(across);
+
+			for (r = 0; r < BRW_CFG_NUM_GRF; r++) {
+				if (!((across[r / 64] >> (r % 64)) & 1))
+					continue;
+				if (range[r].first < 0 || (int)i < range[r].first)
+					range[r].first = i;
+				if ((int)i > range[r].last)
+					range[r].last = i;
+			}
+		}
+	}
+}
+
+void brw_cfg_dump_report(FILE *out, struct brw_cfg *cfg)
+{
+	unsigned int *pressure, opcodes[128], sends[16];
+	struct live_range range[BRW_CFG_NUM_GRF];
+	unsigned int b, i, n, compacted = 0, max = 0, max_insn = 0;
+	const char *name;
+
+	brw_cfg_liveness(cfg);
+	pressure = calloc(cfg->num_insn + 1, sizeof(*pressure));
+	if (pressure == NULL)
+		return;
+	register_pressure(cfg, pressure, range);
+
+	for (i = 0; i < cfg->num_insn; i++) {
+		compacted += cfg->insn[i].size == 8;
+		if (pressure[i] > max) {
+			max = pressure[i];
+			max_insn = i;
+		}
+	}
+
+	fprintf(out, "%u instructions (%u compacted), %u blocks, %u loops",
+		cfg->num_insn, compacted, cfg->num_block, cfg->num_loops);
+	if (cfg->unresolved)
+		fprintf(out, ", %u jumps out of the program", cfg->unresolved);
+	fprintf(out, "\n");
+	if (cfg->num_insn)
+		fprintf(out, "max pressure: %u GRFs at 0x%04x\n",
+			max, cfg->insn[max_insn].offset);
+
+	for (b = 0; b < cfg->num_block; b++) {
+		const struct brw_cfg_block *block = &cfg->block[b];
+		unsigned int block_max = 0;
+
+		memset(opcodes, 0, sizeof(opcodes));
+		memset(sends, 0, sizeof(sends));
+		for (i = block->start; i < block->end; i++) {
+			const struct brw_cfg_insn *ci = &cfg->insn[i];
+
+			opcodes[ci->insn.header.opcode]++;
+			if (ci->sfid >= 0)
+				sends[ci->sfid]++;
+			if (pressure[i] > block_max)
+				block_max = pressure[i];
+		}
+
+		n = block->end - block->start;
+		fprintf(out, "\nblock %u: 0x%04x-0x%04x, %u instruction%s",
+			b, cfg->insn[block->start].offset,
+			cfg->insn[block->end - 1].offset, n, n == 1 ? "" : "s");
+		if (block->loop_depth)
+			fprintf(out, ", loop depth %u", block->loop_depth);
+		fprintf(out, "\n\tsuccessors:");
+		for (i = 0; i < block->num_succ; i++)
+			fprintf(out, " %u%s", block->succ[i],
+				block->succ[i] <= b ? " (back)" : "");
+		if (!block->num_succ)
+			fprintf(out, " none");
+
+		fprintf(out, "\n\tmix:");
+		for (n = 0; n < 128; n++) {
+			if (!opcodes[n])
+				continue;
+			name = opcode_descs[n].name;
+			if (name)
+				fprintf(out, " %s %u", name, opcodes[n]);
+			else
+				fprintf(out, " op%u %u", n, opcodes[n]);
+		}
+
+		for (n = 0, i = 0; n < 16; n++)
+			i += sends[n];
+		if (i) {
+			fprintf(out, "\n\tsends:");
+			for (n = 0; n < 16; n++) {
+				if (!sends[n])
+					continue;
+				name = brw_disasm_sfid_name(n, cfg->gen / 10);
+				if (name)
+					fprintf(out, " %s %u", name, sends[n]);
+				else
+					fprintf(out, " sfid%u %u", n, sends[n]);
+			}
+		}
+		fprintf(out, "\n\tmax live: %u GRFs\n", block_max);
+	}
+
+	fprintf(out, "\nlive ranges:\n");
+	for (n = 0; n < BRW_CFG_NUM_GRF; n++) {
+		if (range[n].first < 0)
+			continue;
+		fprintf(out, "\tg%u: 0x%04x-0x%04x\n", n,
+			cfg->insn[range[n].first].offset,
+			cfg->insn[range[n].last].offset);
+	}
+
+	free(pressure);
+}
+
+/* Quotes str for a dot label, ending each line on the left */
+static void dot_escape(FILE *out, const char *str)
+{
+	for (; *str; str++) {
+		switch (*str) {
+		case '"':
+		case '\\':
+			fputc('\\', out);
+			fputc(*str, out);
+			break;
+		case '\n':
+			fputs("\\l", out);
+			break;
+		default:
+			fputc(*str, out);
+		}
+	}
+}
+
+void brw_cfg_dump_dot(FILE *out, struct brw_cfg *cfg)
+{
+	struct brw_disasm_buf buf;
+	unsigned int b, i;
+
+	memset(&buf, 0, sizeof(buf));
+
+	fprintf(out, "digraph cfg {\n");
+	fprintf(out, "\tnode [shape=box, fontname=monospace];\n");
+	for (b = 0; b < cfg->num_block; b++) {
+		const struct brw_cfg_block *block = &cfg->block[b];
+
+		for (i = block->start; i < block->end; i++)
+			brw_disasm_buf(&buf, &cfg->insn[i].insn, cfg->gen / 10);
+
+		fprintf(out, "\tb%u [label=\"block %u, 0x%04x\\l", b, b,
+			cfg->insn[block->start].offset);
+		if (buf.str)
+			dot_escape(out, buf.str);
+		fprintf(out, "\"];\n");
+		buf.len = 0;
+		buf.column = 0;
+	}
+
+	for (b = 0; b < cfg->num_block; b++) {
+		const struct brw_cfg_block *block = &cfg->block[b];
+
+		for (i = 0; i < block->num_succ; i++)
+			fprintf(out, "\tb%u -> b%u%s;\n", b, block->succ[i],
+				block->succ[i] <= b ? " [style=dashed]" : "");
+	}
+	fprintf(out, "}\n");
+
+	brw_disasm_buf_fini(&buf);
+}
@@ -0,0 +1,246 @@
+/*
+ * Copyright © 2013 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef __BRW_CFG_H__
+#define __BRW_CFG_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "brw_context.h"
+#include "brw_structs.h"
+
+/**
+ * Basic blocks and control flow graph of an assembled program, with the
+ * registers each instruction touches, for static analysis of kernels.
+ *
+ * Jumps are followed with the same encodings relocate_program() in
+ * brw_asm.c writes: in 16 byte units on gen4, 8 byte units from gen5 on,
+ * JMPI relative to the next instruction and Haswell JMPI in bytes.
+ */
+
+#define BRW_CFG_NUM_GRF		128
+#define BRW_CFG_NUM_MRF		16
+
+/* Registers as one index each: GRFs, then MRFs, flags, accumulators, a0 */
+#define BRW_CFG_SLOT_MRF	BRW_CFG_NUM_GRF
+#define BRW_CFG_SLOT_FLAG	(BRW_CFG_SLOT_MRF + BRW_CFG_NUM_MRF)
+#define BRW_CFG_SLOT_ACC	(BRW_CFG_SLOT_FLAG + 2)
+#define BRW_CFG_SLOT_ADDRESS	(BRW_CFG_SLOT_ACC + 2)
+#define BRW_CFG_NUM_SLOTS	(BRW_CFG_SLOT_ADDRESS + 1)
+
+/* Registers an instruction reads or writes */
+struct brw_reg_set {
+	uint64_t grf[BRW_CFG_NUM_GRF / 64];
+	uint16_t mrf;
+	uint8_t flag;			/* f0 and f1 */
+	uint8_t acc;			/* acc0 and acc1 */
+	uint8_t address;		/* a0 */
+	uint8_t other;			/* any other ARF: cr0, sr0, tm0, ... */
+};
+
+struct brw_cfg_insn {
+	struct brw_instruction insn;	/* uncompacted */
+	unsigned int offset;		/* in bytes */
+	unsigned int size;		/* 8 if compacted, else 16 */
+	unsigned int block;
+
+	struct brw_reg_set read;
+	struct brw_reg_set write;
+	bool partial_write;		/* predicated, or not whole registers */
+	bool indirect;			/* registers addressed through a0 */
+
+	int sfid;			/* shared function of a SEND, else -1 */
+	unsigned int mlen, rlen;	/* SEND message and response lengths */
+
+	/* after brw_cfg_estimate(), in cycles from the start of the block */
+	unsigned int issue;
+	unsigned int stall;		/* waiting for its operands */
+	unsigned int ready;		/* its results can be read */
+};
+
+#define BRW_CFG_MAX_SUCC	3	/* fall through, JIP and UIP */
+
+struct brw_cfg_block {
+	unsigned int start, end;	/* instruction indices, end excluded */
+	unsigned int succ[BRW_CFG_MAX_SUCC];
+	unsigned int num_succ;
+	unsigned int loop_depth;
+	bool exit;			/* leaves the program other than by EOT */
+
+	/* GRFs live on entry and exit, after brw_cfg_liveness() */
+	struct brw_reg_set live_in;
+	struct brw_reg_set live_out;
+
+	/* after brw_cfg_estimate() */
+	unsigned int cycles;		/* until every result is written */
+	unsigned int stalls;
+	bool critical;			/* on the longest path */
+};
+
+struct brw_cfg {
+	int gen;			/* 10 * generation, e.g. 75 */
+
+	struct brw_cfg_insn *insn;
+	unsigned int num_insn;
+
+	struct brw_cfg_block *block;
+	unsigned int num_block;
+
+	unsigned int num_loops;
+	unsigned int unresolved;	/* jumps outside the program */
+};
+
+/**
+ * Decodes \c size bytes of code for the context's generation and splits it
+ * into basic blocks.  Returns 0, or -1 if the code is truncated or we ran
+ * out of memory.
+ */
+int brw_cfg_build(struct brw_cfg *cfg, struct brw_context *brw,
+		  const void *code, size_t size);
+void brw_cfg_fini(struct brw_cfg *cfg);
+
+/* Index of the instruction at byte offset, or -1 */
+int brw_cfg_find_insn(const struct brw_cfg *cfg, unsigned int offset);
+
+/*
+ * Recomputes the registers an instruction touches, after it was changed.
+ * Jumps and the instruction's size must stay the same.
+ */
+void brw_cfg_decode_insn(const struct brw_cfg *cfg, struct brw_cfg_insn *ci);
+
+/*
+ * Byte offsets of a jump's targets from the instruction, 0 where it has
+ * none, and re-encoding them.  Setting returns -1 if they don't fit.
+ */
+void brw_cfg_get_jumps(const struct brw_cfg *cfg,
+		       const struct brw_instruction *insn, int64_t jump[2]);
+int brw_cfg_set_jumps(const struct brw_cfg *cfg,
+		      struct brw_instruction *insn, const int64_t jump[2]);
+
+/*
+ * Fills in the live_in/live_out GRF sets of every block.  Everything is
+ * live where the program exits other than by ending the thread.
+ */
+void brw_cfg_liveness(struct brw_cfg *cfg);
+
+static inline void brw_reg_set_add_grf(struct brw_reg_set *set,
+				       unsigned int nr)
+{
+	if (nr < BRW_CFG_NUM_GRF)
+		set->grf[nr / 64] |= 1ull << (nr % 64);
+}
+
+static inline bool brw_reg_set_has_grf(const struct brw_reg_set *set,
+				       unsigned int nr)
+{
+	return nr < BRW_CFG_NUM_GRF && (set->grf[nr / 64] >> (nr % 64)) & 1;
+}
+
+static inline bool brw_reg_set_intersects(const struct brw_reg_set *a,
+					  const struct brw_reg_set *b)
+{
+	return (a->grf[0] & b->grf[0]) || (a->grf[1] & b->grf[1]) ||
+	       (a->mrf & b->mrf) || (a->flag & b->flag) ||
+	       (a->acc & b->acc) || (a->address & b->address) ||
+	       (a->other & b->other);
+}
+
+/* Lists the slots of a register set, returns how many there are */
+unsigned int brw_reg_set_slots(const struct brw_reg_set *set,
+			       unsigned short *slot);
+
+/**
+ * Static cycle estimate.  Each block is issued in order from a clean
+ * scoreboard: instructions wait for the registers they read, and for
+ * earlier writes to their destination unless NoDDChk is set, and writes
+ * with NoDDClr hold their registers until the next write lands.  Returns
+ * the cycles along the longest path through the graph, counting each
+ * loop body once.
+ */
+unsigned int brw_cfg_estimate(struct brw_cfg *cfg);
+
+/*
+ * The estimate's model: cycles an instruction occupies the pipeline, and
+ * the cycles after that until its results can be read.
+ */
+unsigned int brw_cfg_issue_cycles(const struct brw_cfg *cfg,
+				  const struct brw_cfg_insn *ci);
+unsigned int brw_cfg_latency(const struct brw_cfg *cfg,
+			     const struct brw_cfg_insn *ci);
+
+struct brw_cfg_opt_stats {
+	unsigned int copies;		/* operands read from a copy's source */
+	unsigned int folded;		/* operations on immediates */
+	unsigned int dead;		/* instructions whose results aren't read */
+	unsigned int nops;		/* alignment padding */
+};
+
+/**
+ * Peephole optimization of a laid out, uncompacted program: copy and
+ * immediate propagation and folding within blocks, dead write removal,
+ * and dropping the NOPs padding labels that must be 4 instruction
+ * aligned (offsets, in instructions, where \c aligned is set), which are
+ * padded again afterwards.  Labels and jumps are moved along.
+ *
+ * Returns the number of instructions in the new program in \c *out, or
+ * -1 if the program has jumps leaving it or one no longer fits.
+ */
+int brw_cfg_optimize(struct brw_context *brw,
+		     const struct brw_instruction *insn, unsigned int num_insn,
+		     int *offsets, const bool *aligned,
+		     unsigned int num_offsets, struct brw_instruction **out,
+		     struct brw_cfg_opt_stats *stats);
+
+struct brw_cfg_sched_stats {
+	unsigned int moved;		/* instructions in a new place */
+	unsigned int before, after;	/* brw_cfg_estimate() cycles */
+};
+
+/**
+ * List scheduling within the blocks of a laid out, uncompacted program,
+ * in place, to hide SEND and math latency behind independent work.
+ * Instructions wait for the registers they read and, unless they have
+ * NoDDChk, for earlier writes to theirs; SENDs stay in order.  Flow
+ * control, the end of the thread, NOPs, indirect addressing and the
+ * label offsets (in instructions) stay put.  Blocks the estimate says
+ * got slower are left as they were, and ties go to program order, so
+ * the result is deterministic.  Returns -1 if we ran out of memory.
+ */
+int brw_cfg_schedule(struct brw_context *brw, struct brw_instruction *insn,
+		     unsigned int num_insn, const int *offsets,
+		     unsigned int num_offsets,
+		     struct brw_cfg_sched_stats *stats);
+
+/* Analysis report: blocks, instruction mix, SENDs, register pressure */
+void brw_cfg_dump_report(FILE *out, struct brw_cfg *cfg);
+
+/* Estimated cycles of each block and instruction, and the critical path */
+void brw_cfg_dump_estimate(FILE *out, struct brw_cfg *cfg);
+
+/* Graphviz description of the graph, with each block's disassembly */
+void brw_cfg_dump_dot(FILE *out, struct brw_cfg *cfg);
+
+#endif /* __BRW_CFG_H__ */
@@ -0,0 +1,288 @@
+/*
+ * Copyright © 2013 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "brw_cfg.h"
+#include "brw_eu.h"
+
+/*
+ * Rough latencies in cycles, after the last cycle an instruction issues.
+ * They're meant to rank variants of a kernel, not to predict the
+ * hardware: memory latency depends on what else the GPU is doing.
+ */
+#define LATENCY_ALU		12
+#define LATENCY_MATH		22
+#define LATENCY_MATH_POW	24
+#define LATENCY_MATH_INT_DIV	36
+#define LATENCY_SAMPLER		200
+#define LATENCY_MEMORY		200	/* data port reads and the URB */
+#define LATENCY_WRITE		50	/* messages without a response */
+#define LATENCY_MISC		20	/* gateway, thread spawner */
+
+struct scoreboard {
+	unsigned int ready[BRW_CFG_NUM_SLOTS];
+	bool held[BRW_CFG_NUM_SLOTS];	/* last written with NoDDClr */
+};
+
+unsigned int brw_reg_set_slots(const struct brw_reg_set *set,
+			       unsigned short *slot)
+{
+	unsigned int n = 0, r;
+
+	for (r = 0; r < BRW_CFG_NUM_GRF; r++)
+		if (brw_reg_set_has_grf(set, r))
+			slot[n++] = r;
+	for (r = 0; r < BRW_CFG_NUM_MRF; r++)
+		if (set->mrf & (1 << r))
+			slot[n++] = BRW_CFG_SLOT_MRF + r;
+	for (r = 0; r < 2; r++) {
+		if (set->flag & (1 << r))
+			slot[n++] = BRW_CFG_SLOT_FLAG + r;
+		if (set->acc & (1 << r))
+			slot[n++] = BRW_CFG_SLOT_ACC + r;
+	}
+	if (set->address)
+		slot[n++] = BRW_CFG_SLOT_ADDRESS;
+	return n;
+}
+
+static unsigned int math_latency(unsigned int function)
+{
+	switch (function) {
+	case BRW_MATH_FUNCTION_POW:
+		return LATENCY_MATH_POW;
+	case BRW_MATH_FUNCTION_INT_DIV_QUOTIENT_AND_REMAINDER:
+	case BRW_MATH_FUNCTION_INT_DIV_QUOTIENT:
+	case BRW_MATH_FUNCTION_INT_DIV_REMAINDER:
+		return LATENCY_MATH_INT_DIV;
+	default:
+		return LATENCY_MATH;
+	}
+}
+
+static unsigned int send_latency(const struct brw_cfg *cfg,
+				 const struct brw_cfg_insn *ci)
+{
+	switch (ci->sfid) {
+	case BRW_SFID_MATH:
+		if (cfg->gen < 60)
+			return math_latency(ci->insn.bits3.math.function);
+		return LATENCY_MISC;
+	case BRW_SFID_SAMPLER:
+	case GEN6_SFID_VME:
+		return LATENCY_SAMPLER;
+	case BRW_SFID_MESSAGE_GATEWAY:
+	case BRW_SFID_THREAD_SPAWNER:
+	case BRW_SFID_NULL:
+		return LATENCY_MISC;
+	default:
+		return ci->rlen ? LATENCY_MEMORY : LATENCY_WRITE;
+	}
+}
+
+/*
+ * Four channels a cycle, a cycle per message register for SENDs, and the
+ * math box runs at half rate.
+ */
+unsigned int brw_cfg_issue_cycles(const struct brw_cfg *cfg,
+				  const struct brw_cfg_insn *ci)
+{
+	unsigned int opcode = ci->insn.header.opcode;
+	unsigned int cycles = (1 << ci->insn.header.execution_size) / 4;
+
+	if (ci->sfid >= 0)
+		return ci->mlen ? ci->mlen : 1;
+	if (cycles == 0)
+		cycles = 1;
+	if (cfg->gen >= 60 && opcode == BRW_OPCODE_MATH)
+		cycles *= 2;
+	return cycles;
+}
+
+unsigned int brw_cfg_latency(const struct brw_cfg *cfg,
+			     const struct brw_cfg_insn *ci)
+{
+	if (ci->sfid >= 0)
+		return send_latency(cfg, ci);
+	if (cfg->gen >= 60 && ci->insn.header.opcode == BRW_OPCODE_MATH)
+		return math_latency(ci->insn.header.destreg__conditionalmod);
+	return LATENCY_ALU;
+}
+
+static void estimate_block(const struct brw_cfg *cfg,
+			   struct brw_cfg_block *block)
+{
+	struct scoreboard sb;
+	unsigned short slot[BRW_CFG_NUM_SLOTS];
+	unsigned int i, s, n, cycle = 0;
+
+	memset(&sb, 0, sizeof(sb));
+	block->cycles = 0;
+	block->stalls = 0;
+
+	for (i = block->start; i < block->end; i++) {
+		struct brw_cfg_insn *ci = &cfg->insn[i];
+		unsigned int control = ci->insn.header.dependency_control;
+		unsigned int start = cycle, ready;
+
+		/* read after write, and write after write unless NoDDChk */
+		n = brw_reg_set_slots(&ci->read, slot);
+		for (s = 0; s < n; s++)
+			if (sb.ready[slot[s]] > start)
+				start = sb.ready[slot[s]];
+		n = brw_reg_set_slots(&ci->write, slot);
+		if (!(control & BRW_DEPENDENCY_NOTCHECKED))
+			for (s = 0; s < n; s++)
+				if (sb.ready[slot[s]] > start)
+					start = sb.ready[slot[s]];
+
+		ci->issue = start;
+		ci->stall = start - cycle;
+		cycle = start + brw_cfg_issue_cycles(cfg, ci);
+		ci->ready = cycle + brw_cfg_latency(cfg, ci);
+
+		/* registers held by NoDDClr stay busy until the chain ends */
+		for (s = 0; s < n; s++) {
+			ready = ci->ready;
+			if (sb.held[slot[s]] && sb.ready[slot[s]] > ready)
+				ready = sb.ready[slot[s]];
+			sb.ready[slot[s]] = ready;
+			sb.held[slot[s]] = control & BRW_DEPENDENCY_NOTCLEARED;
+		}
+
+		block->stalls += ci->stall;
+		if (cycle > block->cycles)
+			block->cycles = cycle;
+		if (n && ci->ready > block->cycles)
+			block->cycles = ci->ready;
+	}
+}
+
+unsigned int brw_cfg_estimate(struct brw_cfg *cfg)
+{
+	unsigned int *length, *prev, b, i, last = 0;
+
+	for (b = 0; b < cfg->num_block; b++) {
+		estimate_block(cfg, &cfg->block[b]);
+		cfg->block[b].critical = false;
+	}
+	if (cfg->num_block == 0)
+		return 0;
+
+	/*
+	 * Longest path from the entry over forward edges, which go to
+	 * higher block numbers; prev is the block before, plus one.
+	 */
+	length = calloc(cfg->num_block, sizeof(*length));
+	prev = calloc(cfg->num_block, sizeof(*prev));
+	if (length == NULL || prev == NULL) {
+		free(length);
+		free(prev);
+		return 0;
+	}
+
+	length[0] = cfg->block[0].cycles;
+	for (b = 0; b < cfg->num_block; b++) {
+		const struct brw_cfg_block *block = &cfg->block[b];
+
+		if (b && !prev[b])
+			continue;		/* only reachable through loops */
+		if (length[b] > length[last])
+			last = b;
+		for (i = 0; i < block->num_succ; i++) {
+			unsigned int succ = block->succ[i];
+			unsigned int l = length[b] + cfg->block[succ].cycles;
+
+			if (succ > b && (!prev[succ] || l > length[succ])) {
+				length[succ] = l;
+				prev[succ] = b + 1;
+			}
+		}
+	}
+
+	for (b = last;; b = prev[b] - 1) {
+		cfg->block[b].critical = true;
+		if (!prev[b])
+			break;
+	}
+
+	b = length[last];
+	free(length);
+	free(prev);
+	return b;
+}
+
+void brw_cfg_dump_estimate(FILE *out, struct brw_cfg *cfg)
+{
+	struct brw_disasm_buf buf;
+	unsigned int b, i, cycles, stalls = 0;
+	const char *line, *end;
+
+	cycles = brw_cfg_estimate(cfg);
+	for (b = 0; b < cfg->num_block; b++)
+		if (cfg->block[b].critical)
+			stalls += cfg->block[b].stalls;
+
+	fprintf(out, "%u cycles along the critical path, %u of them stalled "
+		"(loops counted once)\ncritical path:", cycles, stalls);
+	for (b = 0; b < cfg->num_block; b++)
+		if (cfg->block[b].critical)
+			fprintf(out, " %u", b);
+	fprintf(out, "\n");
+
+	memset(&buf, 0, sizeof(buf));
+	for (b = 0; b < cfg->num_block; b++) {
+		const struct brw_cfg_block *block = &cfg->block[b];
+
+		fprintf(out, "\nblock %u%s: %u cycles, %u stalled\n", b,
+			block->critical ? " (critical)" : "",
+			block->cycles, block->stalls);
+
+		/* issue cycle and stall, then the disassembly */
+		for (i = block->start; i < block->end; i++) {
+			struct brw_cfg_insn *ci = &cfg->insn[i];
+
+			buf.len = 0;
+			buf.column = 0;
+			brw_disasm_buf(&buf, &ci->insn, cfg->gen / 10);
+			if (buf.str == NULL)
+				continue;
+			for (line = buf.str; *line; line = *end ? end + 1 : end) {
+				end = strchr(line, '\n');
+				if (end == NULL)
+					end = line + strlen(line);
+				if (line == buf.str)
+					fprintf(out, "%6u %4u  ", ci->issue, ci->stall);
+				else
+					fprintf(out, "%13s", "");
+				fwrite(line, 1, end - line, out);
+				fputc('\n', out);
+			}
+		}
+	}
+	brw_disasm_buf_fini(&buf);
+}
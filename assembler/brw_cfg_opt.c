@@ -0,0 +1,712 @@
+/*
+ * Copyright © 2013 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "brw_cfg.h"
+#include "brw_eu.h"
+
+/*
+ * Peephole passes over a laid out, relocated program.  Everything works
+ * on whole instructions in align1 with direct GRF operands, and leaves
+ * anything it doesn't fully understand alone: hand written kernels do
+ * odd things on purpose.
+ */
+
+#define MAX_COPIES	16
+#define MAX_PASSES	8
+
+/* A MOV whose destination still holds its source */
+struct copy {
+	unsigned int dst;		/* GRF the destination starts at */
+	unsigned int type;
+	unsigned int exec_size;		/* header encodings */
+	unsigned int compression;
+	bool mask_disable;
+
+	bool imm;
+	uint32_t value;			/* if imm */
+	unsigned int nr, subreg;	/* else the source region */
+	unsigned int vstride, width, hstride;
+
+	struct brw_reg_set regs;	/* GRFs of both */
+};
+
+/* A direct align1 source operand, strides decoded */
+struct operand {
+	unsigned int file, type;
+	unsigned int nr, subreg;
+	unsigned int vstride, width, hstride;
+	bool direct;
+	bool modifiers;			/* abs or negate */
+};
+
+struct opt {
+	struct brw_cfg cfg;
+	bool *deleted;
+	struct brw_cfg_opt_stats *stats;
+
+	struct copy copies[MAX_COPIES];
+	unsigned int num_copies;
+};
+
+static unsigned int decode_stride(unsigned int encoding)
+{
+	return encoding ? 1 << (encoding - 1) : 0;
+}
+
+static void get_src(const struct brw_instruction *insn, int n,
+		    struct operand *op)
+{
+	if (n == 0) {
+		op->file = insn->bits1.da1.src0_reg_file;
+		op->type = insn->bits1.da1.src0_reg_type;
+		op->nr = insn->bits2.da1.src0_reg_nr;
+		op->subreg = insn->bits2.da1.src0_subreg_nr;
+		op->vstride = insn->bits2.da1.src0_vert_stride;
+		op->width = insn->bits2.da1.src0_width;
+		op->hstride = insn->bits2.da1.src0_horiz_stride;
+		op->direct = insn->bits2.da1.src0_address_mode ==
+			     BRW_ADDRESS_DIRECT;
+		op->modifiers = insn->bits2.da1.src0_abs ||
+				insn->bits2.da1.src0_negate;
+	} else {
+		op->file = insn->bits1.da1.src1_reg_file;
+		op->type = insn->bits1.da1.src1_reg_type;
+		op->nr = insn->bits3.da1.src1_reg_nr;
+		op->subreg = insn->bits3.da1.src1_subreg_nr;
+		op->vstride = insn->bits3.da1.src1_vert_stride;
+		op->width = insn->bits3.da1.src1_width;
+		op->hstride = insn->bits3.da1.src1_horiz_stride;
+		op->direct = insn->bits3.da1.src1_address_mode ==
+			     BRW_ADDRESS_DIRECT;
+		op->modifiers = insn->bits3.da1.src1_abs ||
+				insn->bits3.da1.src1_negate;
+	}
+}
+
+static void set_src_region(struct brw_instruction *insn, int n,
+			   unsigned int nr, unsigned int subreg,
+			   unsigned int vstride, unsigned int width,
+			   unsigned int hstride)
+{
+	if (n == 0) {
+		insn->bits2.da1.src0_reg_nr = nr;
+		insn->bits2.da1.src0_subreg_nr = subreg;
+		insn->bits2.da1.src0_vert_stride = vstride;
+		insn->bits2.da1.src0_width = width;
+		insn->bits2.da1.src0_horiz_stride = hstride;
+	} else {
+		insn->bits3.da1.src1_reg_nr = nr;
+		insn->bits3.da1.src1_subreg_nr = subreg;
+		insn->bits3.da1.src1_vert_stride = vstride;
+		insn->bits3.da1.src1_width = width;
+		insn->bits3.da1.src1_horiz_stride = hstride;
+	}
+}
+
+static bool is_scalar(unsigned int vstride, unsigned int width,
+		      unsigned int hstride)
+{
+	return vstride == 0 && width == 0 && hstride == 0;
+}
+
+/* Whether the region reads exec_size consecutive elements */
+static bool is_contiguous(unsigned int vstride, unsigned int width,
+			  unsigned int hstride, unsigned int exec_size)
+{
+	unsigned int w = 1 << width;
+
+	return decode_stride(hstride) == 1 &&
+	       (decode_stride(vstride) == w || w >= (1u << exec_size));
+}
+
+static bool is_dword_type(unsigned int type)
+{
+	return type == BRW_REGISTER_TYPE_UD || type == BRW_REGISTER_TYPE_D ||
+	       type == BRW_REGISTER_TYPE_F;
+}
+
+/* No side effects beyond writing the destination */
+static bool is_alu(const struct brw_cfg *cfg, unsigned int opcode)
+{
+	switch (opcode) {
+	case BRW_OPCODE_MOV:
+	case BRW_OPCODE_SEL:
+	case BRW_OPCODE_NOT:
+	case BRW_OPCODE_AND:
+	case BRW_OPCODE_OR:
+	case BRW_OPCODE_XOR:
+	case BRW_OPCODE_SHR:
+	case BRW_OPCODE_SHL:
+	case BRW_OPCODE_ASR:
+	case BRW_OPCODE_ADD:
+	case BRW_OPCODE_MUL:
+	case BRW_OPCODE_AVG:
+	case BRW_OPCODE_FRC:
+	case BRW_OPCODE_RNDU:
+	case BRW_OPCODE_RNDD:
+	case BRW_OPCODE_RNDE:
+	case BRW_OPCODE_RNDZ:
+	case BRW_OPCODE_MAC:
+	case BRW_OPCODE_MACH:
+	case BRW_OPCODE_LZD:
+	case BRW_OPCODE_SAD2:
+	case BRW_OPCODE_SADA2:
+	case BRW_OPCODE_DP4:
+	case BRW_OPCODE_DPH:
+	case BRW_OPCODE_DP3:
+	case BRW_OPCODE_DP2:
+		return true;
+	/*
+	 * LINE and PLN read more than their regions say, .3 of src0 and
+	 * the register after src1 for PLN, so no operand of theirs can be
+	 * rewritten as if it were a plain region.
+	 */
+	case BRW_OPCODE_LINE:
+	case BRW_OPCODE_PLN:
+		return false;
+	case BRW_OPCODE_MATH:
+	case BRW_OPCODE_MAD:
+	case BRW_OPCODE_LRP:
+		return cfg->gen >= 60;
+	default:
+		return false;
+	}
+}
+
+/* The plain part of an instruction: no predicate, flag or acc updates */
+static bool is_plain(const struct brw_instruction *insn)
+{
+	return insn->header.access_mode == BRW_ALIGN_1 &&
+	       !insn->header.predicate_control &&
+	       !insn->header.destreg__conditionalmod &&
+	       !insn->header.saturate &&
+	       !insn->header.acc_wr_control &&
+	       !insn->header.dependency_control;
+}
+
+/* A MOV to a whole GRF region from another or from an immediate */
+static bool get_copy(const struct brw_cfg_insn *ci, struct copy *copy)
+{
+	const struct brw_instruction *insn = &ci->insn;
+	struct operand src;
+
+	if (insn->header.opcode != BRW_OPCODE_MOV || !is_plain(insn) ||
+	    insn->bits1.da1.dest_reg_file != BRW_GENERAL_REGISTER_FILE ||
+	    insn->bits1.da1.dest_address_mode != BRW_ADDRESS_DIRECT ||
+	    insn->bits1.da1.dest_subreg_nr != 0 ||
+	    insn->bits1.da1.dest_horiz_stride != 1)
+		return false;
+
+	get_src(insn, 0, &src);
+	if (src.type != insn->bits1.da1.dest_reg_type || src.modifiers)
+		return false;
+
+	memset(copy, 0, sizeof(*copy));
+	copy->dst = insn->bits1.da1.dest_reg_nr;
+	copy->type = src.type;
+	copy->exec_size = insn->header.execution_size;
+	copy->compression = insn->header.compression_control;
+	copy->mask_disable = insn->header.mask_control == BRW_MASK_DISABLE;
+
+	if (src.file == BRW_IMMEDIATE_VALUE) {
+		if (!is_dword_type(src.type))
+			return false;
+		copy->imm = true;
+		copy->value = insn->bits3.ud;
+	} else {
+		if (src.file != BRW_GENERAL_REGISTER_FILE || !src.direct ||
+		    !(is_scalar(src.vstride, src.width, src.hstride) ||
+		      is_contiguous(src.vstride, src.width, src.hstride,
+				    copy->exec_size)))
+			return false;
+		/* a MOV onto its own source isn't a copy of anything */
+		if (brw_reg_set_intersects(&ci->read, &ci->write))
+			return false;
+		copy->nr = src.nr;
+		copy->subreg = src.subreg;
+		copy->vstride = src.vstride;
+		copy->width = src.width;
+		copy->hstride = src.hstride;
+	}
+
+	copy->regs.grf[0] = ci->read.grf[0] | ci->write.grf[0];
+	copy->regs.grf[1] = ci->read.grf[1] | ci->write.grf[1];
+	return true;
+}
+
+/*
+ * The copy whose destination the operand reads exactly, with the same
+ * channels enabled, or NULL.
+ */
+static const struct copy *find_copy(const struct opt *opt,
+				    const struct brw_instruction *insn,
+				    const struct operand *src)
+{
+	unsigned int i, exec_size = insn->header.execution_size;
+	bool scalar;
+
+	if (src->file != BRW_GENERAL_REGISTER_FILE || !src->direct ||
+	    src->subreg != 0)
+		return NULL;
+	scalar = is_scalar(src->vstride, src->width, src->hstride);
+	if (!scalar && !is_contiguous(src->vstride, src->width,
+				      src->hstride, exec_size))
+		return NULL;
+
+	for (i = 0; i < opt->num_copies; i++) {
+		const struct copy *copy = &opt->copies[i];
+
+		if (copy->dst != src->nr || copy->type != src->type)
+			continue;
+		/* channel 0 is only known written if they all were */
+		if (scalar)
+			return copy->mask_disable ? copy : NULL;
+		if (copy->exec_size != exec_size ||
+		    copy->compression != insn->header.compression_control)
+			return NULL;
+		if (copy->mask_disable ||
+		    insn->header.mask_control == BRW_MASK_ENABLE)
+			return copy;
+		return NULL;
+	}
+	return NULL;
+}
+
+static void set_imm(struct brw_instruction *insn, int n, uint32_t value)
+{
+	if (n == 0) {
+		insn->bits1.da1.src0_reg_file = BRW_IMMEDIATE_VALUE;
+		/* keep the gen7 flag register, which shares the dword */
+		insn->bits2.ud &= ~((1u << 25) - 1);
+	} else {
+		insn->bits1.da1.src1_reg_file = BRW_IMMEDIATE_VALUE;
+	}
+	insn->bits3.ud = value;
+}
+
+/*
+ * Reads of a copy's destination read its source instead.  Immediates
+ * can only go where the encoding has room for one: the only source of a
+ * MOV, or src1 of a two source instruction.
+ */
+static bool propagate(struct opt *opt, struct brw_cfg_insn *ci)
+{
+	struct brw_instruction *insn = &ci->insn;
+	unsigned int opcode = insn->header.opcode;
+	int nsrc = opcode_descs[opcode].nsrc;
+	bool progress = false;
+	int n;
+
+	if (!is_alu(&opt->cfg, opcode) || nsrc > 2 ||
+	    opcode == BRW_OPCODE_MATH ||
+	    insn->header.access_mode != BRW_ALIGN_1)
+		return false;
+
+	for (n = 0; n < nsrc; n++) {
+		const struct copy *copy;
+		struct operand src;
+		bool scalar;
+
+		get_src(insn, n, &src);
+		copy = find_copy(opt, insn, &src);
+		if (copy == NULL)
+			continue;
+
+		scalar = is_scalar(src.vstride, src.width, src.hstride);
+		if (copy->imm) {
+			if (src.modifiers ||
+			    (n == 0 && opcode != BRW_OPCODE_MOV) ||
+			    (n == 1 && insn->bits1.da1.src0_reg_file ==
+			     BRW_IMMEDIATE_VALUE))
+				continue;
+			set_imm(insn, n, copy->value);
+		} else if (scalar || is_scalar(copy->vstride, copy->width,
+					       copy->hstride)) {
+			set_src_region(insn, n, copy->nr, copy->subreg,
+				       0, 0, 0);
+		} else {
+			set_src_region(insn, n, copy->nr, copy->subreg,
+				       copy->vstride, copy->width,
+				       copy->hstride);
+		}
+		opt->stats->copies++;
+		progress = true;
+	}
+	return progress;
+}
+
+/* Evaluates op on two immediates of the type, false if it can't */
+static bool fold_value(unsigned int opcode, unsigned int type,
+		       uint32_t a, uint32_t b, uint32_t *result)
+{
+	if (type == BRW_REGISTER_TYPE_F) {
+		float x, y, r;
+
+		memcpy(&x, &a, sizeof(x));
+		memcpy(&y, &b, sizeof(y));
+		if (opcode == BRW_OPCODE_ADD)
+			r = x + y;
+		else if (opcode == BRW_OPCODE_MUL)
+			r = x * y;
+		else
+			return false;
+
+		/* the EU flushes denormals, and NaNs are best left alone */
+		if ((fpclassify(x) != FP_NORMAL && x != 0) ||
+		    (fpclassify(y) != FP_NORMAL && y != 0) ||
+		    (fpclassify(r) != FP_NORMAL && r != 0))
+			return false;
+		memcpy(result, &r, sizeof(r));
+		return true;
+	}
+
+	switch (opcode) {
+	case BRW_OPCODE_ADD:
+		*result = a + b;
+		return true;
+	case BRW_OPCODE_AND:
+		*result = a & b;
+		return true;
+	case BRW_OPCODE_OR:
+		*result = a | b;
+		return true;
+	case BRW_OPCODE_XOR:
+		*result = a ^ b;
+		return true;
+	case BRW_OPCODE_SHL:
+		*result = a << (b & 31);
+		return true;
+	case BRW_OPCODE_SHR:
+		*result = a >> (b & 31);
+		return true;
+	case BRW_OPCODE_ASR:
+		if (type != BRW_REGISTER_TYPE_D)
+			return false;
+		*result = (uint32_t)((int32_t)a >> (b & 31));
+		return true;
+	default:
+		return false;
+	}
+}
+
+/* An operation on a known immediate and an immediate becomes a MOV */
+static bool fold(struct opt *opt, struct brw_cfg_insn *ci)
+{
+	struct brw_instruction *insn = &ci->insn;
+	const struct copy *copy;
+	struct operand src0, src1;
+	uint32_t value;
+
+	if (opcode_descs[insn->header.opcode].nsrc != 2 || !is_plain(insn) ||
+	    !is_alu(&opt->cfg, insn->header.opcode))
+		return false;
+
+	get_src(insn, 0, &src0);
+	get_src(insn, 1, &src1);
+	if (src1.file != BRW_IMMEDIATE_VALUE || src1.modifiers ||
+	    src0.modifiers || src0.type != src1.type)
+		return false;
+	copy = find_copy(opt, insn, &src0);
+	if (copy == NULL || !copy->imm ||
+	    !fold_value(insn->header.opcode, src0.type, copy->value,
+			insn->bits3.ud, &value))
+		return false;
+
+	insn->header.opcode = BRW_OPCODE_MOV;
+	insn->bits1.da1.src1_reg_file = 0;
+	insn->bits1.da1.src1_reg_type = 0;
+	set_imm(insn, 0, value);
+	opt->stats->folded++;
+	return true;
+}
+
+static void forget_copies(struct opt *opt, const struct brw_cfg_insn *ci)
+{
+	unsigned int i;
+
+	if (ci->indirect) {
+		opt->num_copies = 0;
+		return;
+	}
+
+	for (i = 0; i < opt->num_copies;) {
+		const struct brw_reg_set *regs = &opt->copies[i].regs;
+
+		if ((regs->grf[0] & ci->write.grf[0]) ||
+		    (regs->grf[1] & ci->write.grf[1]))
+			opt->copies[i] = opt->copies[--opt->num_copies];
+		else
+			i++;
+	}
+}
+
+/* Copy propagation and folding, within each block */
+static bool local_pass(struct opt *opt)
+{
+	struct brw_cfg *cfg = &opt->cfg;
+	unsigned int b, i;
+	bool progress = false;
+
+	for (b = 0; b < cfg->num_block; b++) {
+		const struct brw_cfg_block *block = &cfg->block[b];
+
+		opt->num_copies = 0;
+		for (i = block->start; i < block->end; i++) {
+			struct brw_cfg_insn *ci = &cfg->insn[i];
+			bool changed;
+
+			if (opt->deleted[i])
+				continue;
+
+			changed = propagate(opt, ci);
+			if (fold(opt, ci))
+				changed = true;
+			if (changed) {
+				brw_cfg_decode_insn(cfg, ci);
+				progress = true;
+			}
+
+			forget_copies(opt, ci);
+			if (opt->num_copies < MAX_COPIES &&
+			    get_copy(ci, &opt->copies[opt->num_copies]))
+				opt->num_copies++;
+		}
+	}
+	return progress;
+}
+
+/* MOV of a region onto itself */
+static bool is_self_move(const struct brw_cfg_insn *ci)
+{
+	const struct brw_instruction *insn = &ci->insn;
+	struct operand src;
+
+	if (insn->header.opcode != BRW_OPCODE_MOV || !is_plain(insn) ||
+	    insn->bits1.da1.dest_address_mode != BRW_ADDRESS_DIRECT ||
+	    insn->bits1.da1.dest_horiz_stride != 1)
+		return false;
+	get_src(insn, 0, &src);
+	return src.file == insn->bits1.da1.dest_reg_file &&
+	       src.file == BRW_GENERAL_REGISTER_FILE && src.direct &&
+	       !src.modifiers && src.type == insn->bits1.da1.dest_reg_type &&
+	       src.nr == insn->bits1.da1.dest_reg_nr &&
+	       src.subreg == insn->bits1.da1.dest_subreg_nr &&
+	       is_contiguous(src.vstride, src.width, src.hstride,
+			     insn->header.execution_size);
+}
+
+/* Writes GRFs and nothing else, through no address register */
+static bool only_writes_grfs(const struct brw_cfg *cfg,
+			     const struct brw_cfg_insn *ci)
+{
+	const struct brw_reg_set *w = &ci->write;
+
+	return is_alu(cfg, ci->insn.header.opcode) && !ci->indirect &&
+	       !ci->insn.header.dependency_control &&
+	       !w->mrf && !w->flag && !w->acc && !w->address &&
+	       (w->grf[0] || w->grf[1]);
+}
+
+static void delete_insn(struct opt *opt, unsigned int i)
+{
+	struct brw_cfg_insn *ci = &opt->cfg.insn[i];
+
+	opt->deleted[i] = true;
+	memset(&ci->read, 0, sizeof(ci->read));
+	memset(&ci->write, 0, sizeof(ci->write));
+	ci->partial_write = true;
+	opt->stats->dead++;
+}
+
+/* Writes of GRFs nothing reads before they're overwritten */
+static bool dead_pass(struct opt *opt)
+{
+	struct brw_cfg *cfg = &opt->cfg;
+	unsigned int b, i, w;
+	bool progress = false;
+
+	brw_cfg_liveness(cfg);
+
+	for (b = 0; b < cfg->num_block; b++) {
+		const struct brw_cfg_block *block = &cfg->block[b];
+		uint64_t live[2] = { block->live_out.grf[0],
+				     block->live_out.grf[1] };
+
+		for (i = block->end; i-- > block->start;) {
+			struct brw_cfg_insn *ci = &cfg->insn[i];
+
+			if (opt->deleted[i])
+				continue;
+
+			/* jumps past the end would land nowhere */
+			if (i + 1 < cfg->num_insn &&
+			    (is_self_move(ci) ||
+			     (only_writes_grfs(cfg, ci) &&
+			      !(ci->write.grf[0] & live[0]) &&
+			      !(ci->write.grf[1] & live[1])))) {
+				delete_insn(opt, i);
+				progress = true;
+				continue;
+			}
+
+			for (w = 0; w < 2; w++) {
+				if (!ci->partial_write)
+					live[w] &= ~ci->write.grf[w];
+				live[w] |= ci->indirect ? ~0ull : ci->read.grf[w];
+			}
+		}
+	}
+	return progress;
+}
+
+static bool is_nop(const struct brw_cfg_insn *ci)
+{
+	return ci->insn.header.opcode == BRW_OPCODE_NOP;
+}
+
+/* NOPs right before an aligned label are padding, redone when laid out */
+static void drop_padding(struct opt *opt, const int *offsets,
+			 const bool *aligned, unsigned int num_offsets)
+{
+	unsigned int l;
+	int i;
+
+	for (l = 0; l < num_offsets; l++) {
+		if (!aligned[l])
+			continue;
+		for (i = offsets[l] - 1;
+		     i >= 0 && !opt->deleted[i] && is_nop(&opt->cfg.insn[i]);
+		     i--) {
+			opt->deleted[i] = true;
+			opt->stats->nops++;
+		}
+	}
+}
+
+/*
+ * Copies what's left to a new array, padding aligned labels to a 4
+ * instruction boundary again, and moves the labels and jumps along.
+ */
+static int lay_out(struct opt *opt, int *offsets, const bool *aligned,
+		   unsigned int num_offsets, struct brw_instruction **out)
+{
+	struct brw_cfg *cfg = &opt->cfg;
+	struct brw_instruction *insn;
+	unsigned int *map, i, l = 0, m = 0, first;
+	int64_t jump[2];
+	int t;
+
+	map = calloc(cfg->num_insn + 1, sizeof(*map));
+	insn = calloc(cfg->num_insn + 3 * num_offsets + 1, sizeof(*insn));
+	if (map == NULL || insn == NULL)
+		goto fail;
+
+	for (i = 0; i <= cfg->num_insn; i++) {
+		for (first = l; l < num_offsets && offsets[l] <= (int)i; l++)
+			if (aligned[l])
+				while (m % 4)
+					insn[m++].header.opcode = BRW_OPCODE_NOP;
+		for (; first < l; first++)
+			offsets[first] = m;
+
+		map[i] = m;
+		if (i < cfg->num_insn && !opt->deleted[i])
+			insn[m++] = cfg->insn[i].insn;
+	}
+
+	for (i = 0; i < cfg->num_insn; i++) {
+		if (opt->deleted[i])
+			continue;
+		brw_cfg_get_jumps(cfg, &cfg->insn[i].insn, jump);
+		for (t = 0; t < 2; t++) {
+			int target;
+
+			if (!jump[t])
+				continue;
+			target = brw_cfg_find_insn(cfg, cfg->insn[i].offset +
+						   jump[t]);
+			jump[t] = ((int64_t)map[target] - map[i]) *
+				  sizeof(*insn);
+		}
+		if (brw_cfg_set_jumps(cfg, &insn[map[i]], jump))
+			goto fail;
+	}
+
+	free(map);
+	*out = insn;
+	return m;
+
+fail:
+	free(map);
+	free(insn);
+	return -1;
+}
+
+int brw_cfg_optimize(struct brw_context *brw,
+		     const struct brw_instruction *insn, unsigned int num_insn,
+		     int *offsets, const bool *aligned,
+		     unsigned int num_offsets, struct brw_instruction **out,
+		     struct brw_cfg_opt_stats *stats)
+{
+	struct opt opt;
+	unsigned int pass;
+	bool progress;
+	int ret = -1;
+
+	memset(&opt, 0, sizeof(opt));
+	memset(stats, 0, sizeof(*stats));
+	opt.stats = stats;
+
+	if (brw_cfg_build(&opt.cfg, brw, insn, num_insn * sizeof(*insn)))
+		return -1;
+
+	/* can't move what jumps land on if we don't know where that is */
+	if (opt.cfg.unresolved)
+		goto out;
+
+	opt.deleted = calloc(num_insn + 1, sizeof(*opt.deleted));
+	if (opt.deleted == NULL)
+		goto out;
+
+	drop_padding(&opt, offsets, aligned, num_offsets);
+	for (pass = 0; pass < MAX_PASSES; pass++) {
+		progress = local_pass(&opt);
+		if (dead_pass(&opt))
+			progress = true;
+		if (!progress)
+			break;
+	}
+
+	ret = lay_out(&opt, offsets, aligned, num_offsets, out);
+
+out:
+	free(opt.deleted);
+	brw_cfg_fini(&opt.cfg);
+	return ret;
+}
@@ -0,0 +1,391 @@
+/*
+ * Copyright © 2013 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "brw_cfg.h"
+#include "brw_eu.h"
+
+/*
+ * List scheduling of straight runs of instructions, against the same
+ * model brw_cfg_estimate() uses.  Runs end at labels, flow control,
+ * the end of the thread and anything we don't understand, which all stay
+ * where they are, and are cut into MAX_REGION instruction pieces to keep
+ * the quadratic parts cheap.
+ */
+
+#define MAX_REGION	256
+
+struct edge {
+	unsigned short from, to;	/* within the region */
+	unsigned int delay;		/* cycles from issuing from to issuing to */
+};
+
+struct node {
+	unsigned int cycles;		/* issue cycles */
+	unsigned int height;		/* cycles from issue to the region's end */
+	unsigned int earliest;		/* issue cycle its predecessors allow */
+	unsigned int preds;		/* not yet scheduled */
+	unsigned int first_succ, num_succ;
+};
+
+struct region {
+	const struct brw_cfg *cfg;
+	const struct brw_cfg_insn *insn;	/* the run, in program order */
+	unsigned int n;
+
+	struct node node[MAX_REGION];
+	struct edge *edge;		/* sorted by from once built */
+	unsigned int num_edges, max_edges;
+
+	/* for each slot: its last writer and the readers since, plus one */
+	unsigned short writer[BRW_CFG_NUM_SLOTS];
+	unsigned short *readers[BRW_CFG_NUM_SLOTS];
+	unsigned int num_readers[BRW_CFG_NUM_SLOTS];
+	unsigned short last_send;
+};
+
+static bool is_barrier(const struct brw_cfg *cfg,
+		       const struct brw_cfg_block *block, unsigned int i)
+{
+	const struct brw_cfg_insn *ci = &cfg->insn[i];
+	unsigned int opcode = ci->insn.header.opcode;
+
+	/* the other ARFs have no slots, and cr0 changes how floats round */
+	if (opcode_descs[opcode].name == NULL || ci->indirect ||
+	    ci->read.other || ci->write.other ||
+	    opcode == BRW_OPCODE_NOP ||
+	    (opcode >= BRW_OPCODE_JMPI && opcode <= BRW_OPCODE_WAIT))
+		return true;
+
+	/* SENDs ending the thread end their block, and have no successors */
+	return i == block->end - 1 && block->num_succ == 0;
+}
+
+static int add_edge(struct region *r, unsigned int from, unsigned int to,
+		    unsigned int delay)
+{
+	if (r->num_edges == r->max_edges) {
+		unsigned int max = r->max_edges ? r->max_edges * 2 : 1024;
+		struct edge *edge = realloc(r->edge, max * sizeof(*edge));
+
+		if (edge == NULL)
+			return -1;
+		r->edge = edge;
+		r->max_edges = max;
+	}
+	r->edge[r->num_edges].from = from;
+	r->edge[r->num_edges].to = to;
+	r->edge[r->num_edges].delay = delay;
+	r->num_edges++;
+	return 0;
+}
+
+/* The cycles after issuing i until what it writes can be read */
+static unsigned int result_delay(const struct region *r, unsigned int i)
+{
+	return brw_cfg_issue_cycles(r->cfg, &r->insn[i]) +
+	       brw_cfg_latency(r->cfg, &r->insn[i]);
+}
+
+/*
+ * Edges for reading after writing and writing after writing, which also
+ * wait for the result unless the second write has NoDDChk, and writing
+ * after reading.  SENDs stay in order, as memory is invisible to us.
+ */
+static int build_dag(struct region *r)
+{
+	unsigned short slot[BRW_CFG_NUM_SLOTS];
+	unsigned int i, j, s, n, w;
+
+	for (s = 0; s < BRW_CFG_NUM_SLOTS; s++) {
+		r->writer[s] = 0;
+		r->num_readers[s] = 0;
+	}
+	r->last_send = 0;
+	r->num_edges = 0;
+
+	for (i = 0; i < r->n; i++) {
+		const struct brw_cfg_insn *ci = &r->insn[i];
+		bool checked = !(ci->insn.header.dependency_control &
+				 BRW_DEPENDENCY_NOTCHECKED);
+
+		n = brw_reg_set_slots(&ci->read, slot);
+		for (s = 0; s < n; s++) {
+			w = r->writer[slot[s]];
+			if (w && add_edge(r, w - 1, i, result_delay(r, w - 1)))
+				return -1;
+		}
+
+		n = brw_reg_set_slots(&ci->write, slot);
+		for (s = 0; s < n; s++) {
+			w = r->writer[slot[s]];
+			if (w && add_edge(r, w - 1, i,
+					  checked ? result_delay(r, w - 1) : 0))
+				return -1;
+			for (j = 0; j < r->num_readers[slot[s]]; j++)
+				if (add_edge(r, r->readers[slot[s]][j], i, 0))
+					return -1;
+		}
+
+		if (ci->sfid >= 0) {
+			if (r->last_send && add_edge(r, r->last_send - 1, i, 0))
+				return -1;
+			r->last_send = i + 1;
+		}
+
+		/* only now, so instructions reading what they write work */
+		for (s = 0; s < n; s++) {
+			r->writer[slot[s]] = i + 1;
+			r->num_readers[slot[s]] = 0;
+		}
+		n = brw_reg_set_slots(&ci->read, slot);
+		for (s = 0; s < n; s++)
+			r->readers[slot[s]][r->num_readers[slot[s]]++] = i;
+	}
+	return 0;
+}
+
+static int compare_edges(const void *a, const void *b)
+{
+	const struct edge *x = a, *y = b;
+
+	if (x->from != y->from)
+		return x->from - y->from;
+	return x->to - y->to;
+}
+
+/* Indexes the edges by their first node, and finds each node's height */
+static void index_dag(struct region *r)
+{
+	unsigned int i, e;
+
+	if (r->num_edges)
+		qsort(r->edge, r->num_edges, sizeof(*r->edge), compare_edges);
+
+	for (i = 0; i < r->n; i++) {
+		r->node[i].cycles = brw_cfg_issue_cycles(r->cfg, &r->insn[i]);
+		r->node[i].earliest = 0;
+		r->node[i].preds = 0;
+		r->node[i].num_succ = 0;
+	}
+	for (e = 0; e < r->num_edges; e++) {
+		struct node *from = &r->node[r->edge[e].from];
+
+		if (from->num_succ++ == 0)
+			from->first_succ = e;
+		r->node[r->edge[e].to].preds++;
+	}
+
+	/* edges only go forward, so the successors are done first */
+	for (i = r->n; i-- > 0;) {
+		struct node *node = &r->node[i];
+
+		node->height = result_delay(r, i);
+		for (e = node->first_succ;
+		     e < node->first_succ + node->num_succ; e++) {
+			unsigned int h = r->edge[e].delay +
+					 r->node[r->edge[e].to].height;
+
+			if (h > node->height)
+				node->height = h;
+		}
+	}
+}
+
+/*
+ * Issues, at each step, the ready instruction that can start soonest;
+ * of those, the one with the longest path to the end, then the first
+ * in program order.  Returns the new order in order[].
+ */
+static void schedule_region(struct region *r, unsigned int *order)
+{
+	unsigned int ready[MAX_REGION], num_ready = 0;
+	unsigned int i, k, e, best, cycle = 0;
+
+	for (i = 0; i < r->n; i++)
+		if (r->node[i].preds == 0)
+			ready[num_ready++] = i;
+
+	for (k = 0; k < r->n; k++) {
+		unsigned int pick = 0, start, best_start = ~0u;
+		struct node *node;
+
+		best = 0;
+		for (i = 0; i < num_ready; i++) {
+			node = &r->node[ready[i]];
+			start = node->earliest > cycle ? node->earliest : cycle;
+			if (start < best_start ||
+			    (start == best_start &&
+			     (node->height > r->node[best].height ||
+			      (node->height == r->node[best].height &&
+			       ready[i] < best)))) {
+				best = ready[i];
+				best_start = start;
+				pick = i;
+			}
+		}
+
+		ready[pick] = ready[--num_ready];
+		order[k] = best;
+		node = &r->node[best];
+		cycle = best_start + node->cycles;
+
+		for (e = node->first_succ;
+		     e < node->first_succ + node->num_succ; e++) {
+			struct node *succ = &r->node[r->edge[e].to];
+			unsigned int earliest = best_start + r->edge[e].delay;
+
+			if (earliest > succ->earliest)
+				succ->earliest = earliest;
+			if (--succ->preds == 0)
+				ready[num_ready++] = r->edge[e].to;
+		}
+	}
+}
+
+/* Reorders the n instructions from start on */
+static int schedule_run(struct region *r, struct brw_cfg *cfg,
+			unsigned int start, unsigned int n)
+{
+	struct brw_cfg_insn tmp[MAX_REGION];
+	unsigned int order[MAX_REGION];
+	unsigned int i;
+
+	if (n < 2)
+		return 0;
+	r->insn = &cfg->insn[start];
+	r->n = n;
+	if (build_dag(r))
+		return -1;
+	index_dag(r);
+	schedule_region(r, order);
+
+	memcpy(tmp, r->insn, n * sizeof(*tmp));
+	for (i = 0; i < n; i++) {
+		unsigned int offset = cfg->insn[start + i].offset;
+
+		cfg->insn[start + i] = tmp[order[i]];
+		cfg->insn[start + i].offset = offset;
+	}
+	return 0;
+}
+
+/* Schedules a block between its barriers and labels */
+static int schedule_block(struct region *r, struct brw_cfg *cfg,
+			  struct brw_cfg_block *block, const bool *label)
+{
+	unsigned int i, start = block->start;
+
+	for (i = block->start; i <= block->end; i++) {
+		if (i < block->end && is_barrier(cfg, block, i)) {
+			if (schedule_run(r, cfg, start, i - start))
+				return -1;
+			start = i + 1;
+		} else if (i == block->end || i - start == MAX_REGION ||
+			   (i > start && label[i])) {
+			if (schedule_run(r, cfg, start, i - start))
+				return -1;
+			start = i;
+		}
+	}
+	return 0;
+}
+
+int brw_cfg_schedule(struct brw_context *brw, struct brw_instruction *insn,
+		     unsigned int num_insn, const int *offsets,
+		     unsigned int num_offsets, struct brw_cfg_sched_stats *stats)
+{
+	struct brw_cfg cfg;
+	struct brw_cfg_insn *saved = NULL;
+	struct region *r;
+	unsigned int *before = NULL;
+	bool *label = NULL;
+	unsigned int i, b, s;
+	int ret = -1;
+
+	memset(stats, 0, sizeof(*stats));
+	if (brw_cfg_build(&cfg, brw, insn, num_insn * sizeof(*insn)))
+		return -1;
+
+	r = calloc(1, sizeof(*r));
+	label = calloc(num_insn + 1, sizeof(*label));
+	before = calloc(cfg.num_block + 1, sizeof(*before));
+	saved = malloc((num_insn + 1) * sizeof(*saved));
+	if (r == NULL || label == NULL || before == NULL || saved == NULL)
+		goto out;
+	r->cfg = &cfg;
+	for (s = 0; s < BRW_CFG_NUM_SLOTS; s++) {
+		r->readers[s] = malloc(MAX_REGION * sizeof(*r->readers[s]));
+		if (r->readers[s] == NULL)
+			goto out;
+	}
+
+	for (i = 0; i < num_offsets; i++)
+		if (offsets[i] >= 0 && (unsigned int)offsets[i] < num_insn)
+			label[offsets[i]] = true;
+
+	stats->before = brw_cfg_estimate(&cfg);
+	for (b = 0; b < cfg.num_block; b++)
+		before[b] = cfg.block[b].cycles;
+	memcpy(saved, cfg.insn, num_insn * sizeof(*saved));
+
+	for (b = 0; b < cfg.num_block; b++)
+		if (schedule_block(r, &cfg, &cfg.block[b], label))
+			goto out;
+
+	/* keep the old order of blocks the model says got slower */
+	brw_cfg_estimate(&cfg);
+	for (b = 0; b < cfg.num_block; b++) {
+		const struct brw_cfg_block *block = &cfg.block[b];
+
+		if (block->cycles > before[b])
+			memcpy(&cfg.insn[block->start], &saved[block->start],
+			       (block->end - block->start) * sizeof(*saved));
+	}
+	stats->after = brw_cfg_estimate(&cfg);
+
+	for (i = 0; i < num_insn; i++) {
+		if (memcmp(&cfg.insn[i].insn, &saved[i].insn,
+			   sizeof(insn[i])) != 0)
+			stats->moved++;
+		insn[i] = cfg.insn[i].insn;
+	}
+	ret = 0;
+
+out:
+	if (r) {
+		for (s = 0; s < BRW_CFG_NUM_SLOTS; s++)
+			free(r->readers[s]);
+		free(r->edge);
+		free(r);
+	}
+	free(label);
+	free(before);
+	free(saved);
+	brw_cfg_fini(&cfg);
+	return ret;
+}
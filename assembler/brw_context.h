@@ -31,6 +31,7 @@
 #define __BRW_CONTEXT_H__
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 
 #include "brw_structs.h"
@@ -52,9 +53,30 @@ struct intel_context
    bool needs_ff_sync;
 };
 
+/**
+ * Reverse lookup of one compaction table, filled in by
+ * brw_init_compaction_tables(): an open-addressed hash from the
+ * uncompacted bits to their index in the table.
+ */
+#define BRW_COMPACTION_HASH_BITS 6
+
+struct brw_compaction_table
+{
+   const uint32_t *table;
+   uint32_t keys[1 << BRW_COMPACTION_HASH_BITS];
+   int8_t index[1 << BRW_COMPACTION_HASH_BITS];	/* -1 if the slot is free */
+};
+
 struct brw_context
 {
    struct intel_context intel;
+
+   struct {
+      struct brw_compaction_table control_index;
+      struct brw_compaction_table datatype;
+      struct brw_compaction_table subreg;
+      struct brw_compaction_table src_index;
+   } compaction;
 };
 
 bool
@@ -69,7 +91,19 @@ struct opcode_desc {
 
 extern const struct opcode_desc opcode_descs[128];
 
+/* Disassembly output, grown as needed and always NUL terminated */
+struct brw_disasm_buf {
+    char	*str;
+    size_t	len;
+    size_t	size;
+    int		column;		/* of the end of str, for padding */
+};
+
 int brw_disasm (FILE *file, struct brw_instruction *inst, int gen);
+int brw_disasm_buf (struct brw_disasm_buf *buf, struct brw_instruction *inst, int gen);
+void brw_disasm_buf_append (struct brw_disasm_buf *buf, const char *str);
+void brw_disasm_buf_fini (struct brw_disasm_buf *buf);
+const char *brw_disasm_sfid_name (int sfid, int gen);
 
 #ifdef __cplusplus
 } /* end of extern "C" */
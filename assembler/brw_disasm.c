@@ -306,6 +306,14 @@ static const char * const target_function_gen6[16] = {
     [GEN7_SFID_DATAPORT_DATA_CACHE] = "data"
 };
 
+/* Name of a SEND's shared function, or NULL if it has none */
+const char *brw_disasm_sfid_name (int sfid, int gen)
+{
+    if (sfid < 0 || sfid > 15)
+	return NULL;
+    return gen >= 6 ? target_function_gen6[sfid] : target_function[sfid];
+}
+
 static const char * const dp_rc_msg_type_gen6[16] = {
     [BRW_DATAPORT_READ_MESSAGE_OWORD_BLOCK_READ] = "OWORD block read",
     [GEN6_DATAPORT_READ_MESSAGE_RENDER_UNORM_READ] = "RT UNORM read",
@@ -392,73 +400,175 @@ static const char * const sampler_target_format[4] = {
 };
 
 
-static int column;
+/*
+ * Output goes to a growable buffer rather than straight to a FILE, so
+ * that brw_disasm_buf() keeps no state between calls and whole chunks of
+ * a program can be formatted on different threads.
+ */
+static bool grow (struct brw_disasm_buf *buf, size_t len)
+{
+    char    *str;
+    size_t  size;
+
+    if (buf->len + len < buf->size)
+	return true;
+
+    size = buf->size ? buf->size : 256;
+    while (size <= buf->len + len)
+	size *= 2;
+    str = realloc (buf->str, size);
+    if (str == NULL)
+	return false;
+    buf->str = str;
+    buf->size = size;
+    return true;
+}
+
+static void append (struct brw_disasm_buf *buf, const char *str, size_t len)
+{
+    if (!grow (buf, len))
+	return;
+    memcpy (buf->str + buf->len, str, len);
+    buf->len += len;
+    buf->str[buf->len] = '\0';
+}
 
-static int string (FILE *file, const char *string)
+void brw_disasm_buf_append (struct brw_disasm_buf *buf, const char *str)
 {
-    fputs (string, file);
-    column += strlen (string);
+    append (buf, str, strlen (str));
+}
+
+void brw_disasm_buf_fini (struct brw_disasm_buf *buf)
+{
+    free (buf->str);
+    memset (buf, 0, sizeof (*buf));
+}
+
+static int string (struct brw_disasm_buf *buf, const char *string)
+{
+    size_t  len = strlen (string);
+
+    append (buf, string, len);
+    buf->column += len;
     return 0;
 }
 
-static int format (FILE *f, const char *format, ...) PRINTFLIKE(2, 3);
-static int format (FILE *f, const char *format, ...)
+/* Formats straight into the buffer; the result counts towards the column
+ * unless it's an error message, which never did.
+ */
+static void vformat (struct brw_disasm_buf *buf, int column,
+		     const char *format, va_list args)
+{
+    va_list copy;
+    int	    len;
+
+    /* most things fit in what's left, so only go round again if not */
+    if (!grow (buf, 64))
+	return;
+    va_copy (copy, args);
+    len = vsnprintf (buf->str + buf->len, buf->size - buf->len, format, copy);
+    va_end (copy);
+    if (len < 0)
+	return;
+    if (buf->len + len >= buf->size) {
+	if (!grow (buf, len))
+	    return;
+	vsnprintf (buf->str + buf->len, len + 1, format, args);
+    }
+    buf->len += len;
+    if (column)
+	buf->column += len;
+}
+
+static int format (struct brw_disasm_buf *buf, const char *format, ...) PRINTFLIKE(2, 3);
+static int format (struct brw_disasm_buf *buf, const char *format, ...)
 {
-    char    buf[1024];
     va_list	args;
+
     va_start (args, format);
+    vformat (buf, 1, format, args);
+    va_end (args);
+    return 0;
+}
+
+static void error (struct brw_disasm_buf *buf, const char *format, ...) PRINTFLIKE(2, 3);
+static void error (struct brw_disasm_buf *buf, const char *format, ...)
+{
+    va_list	args;
 
-    vsnprintf (buf, sizeof (buf) - 1, format, args);
+    va_start (args, format);
+    vformat (buf, 0, format, args);
     va_end (args);
-    string (f, buf);
+}
+
+/* Register and subregister numbers are most of what gets formatted */
+static int number (struct brw_disasm_buf *buf, const char *prefix,
+		   unsigned n)
+{
+    char    str[16], *p = str + sizeof (str);
+
+    *--p = '\0';
+    do
+	*--p = '0' + n % 10;
+    while (n /= 10);
+    string (buf, prefix);
+    string (buf, p);
     return 0;
 }
 
-static int newline (FILE *f)
+static int newline (struct brw_disasm_buf *buf)
 {
-    putc ('\n', f);
-    column = 0;
+    append (buf, "\n", 1);
+    buf->column = 0;
     return 0;
 }
 
-static int pad (FILE *f, int c)
+static int pad (struct brw_disasm_buf *buf, int c)
 {
-    do
-	string (f, " ");
-    while (column < c);
+    static const char spaces[] = "                                "
+				 "                                ";
+    int n = c > buf->column ? c - buf->column : 1;
+
+    while (n > 0) {
+	int len = n < (int) sizeof (spaces) - 1 ? n : sizeof (spaces) - 1;
+
+	append (buf, spaces, len);
+	buf->column += len;
+	n -= len;
+    }
     return 0;
 }
 
-static int control (FILE *file, const char *name, const char * const ctrl[],
-                    unsigned id, int *space)
+static int control (struct brw_disasm_buf *buf, const char *name,
+		    const char * const ctrl[], unsigned id, int *space)
 {
     if (!ctrl[id]) {
-	fprintf (file, "*** invalid %s value %d ",
-		 name, id);
+	error (buf, "*** invalid %s value %d ",
+	       name, id);
 	return 1;
     }
     if (ctrl[id][0])
     {
 	if (space && *space)
-	    string (file, " ");
-	string (file, ctrl[id]);
+	    string (buf, " ");
+	string (buf, ctrl[id]);
 	if (space)
 	    *space = 1;
     }
     return 0;
 }
 
-static int print_opcode (FILE *file, int id)
+static int print_opcode (struct brw_disasm_buf *buf, int id)
 {
     if (!opcode[id].name) {
-	format (file, "*** invalid opcode value %d ", id);
+	format (buf, "*** invalid opcode value %d ", id);
 	return 1;
     }
-    string (file, opcode[id].name);
+    string (buf, opcode[id].name);
     return 0;
 }
 
-static int reg (FILE *file, unsigned _reg_file, unsigned _reg_nr)
+static int reg (struct brw_disasm_buf *buf, unsigned _reg_file, unsigned _reg_nr)
 {
     int	err = 0;
 
@@ -469,48 +579,48 @@ static int reg (FILE *file, unsigned _reg_file, unsigned _reg_nr)
     if (_reg_file == BRW_ARCHITECTURE_REGISTER_FILE) {
 	switch (_reg_nr & 0xf0) {
 	case BRW_ARF_NULL:
-	    string (file, "null");
+	    string (buf, "null");
 	    return -1;
 	case BRW_ARF_ADDRESS:
-	    format (file, "a%d", _reg_nr & 0x0f);
+	    number (buf, "a", _reg_nr & 0x0f);
 	    break;
 	case BRW_ARF_ACCUMULATOR:
-	    format (file, "acc%d", _reg_nr & 0x0f);
+	    number (buf, "acc", _reg_nr & 0x0f);
 	    break;
 	case BRW_ARF_FLAG:
-	    format (file, "f%d", _reg_nr & 0x0f);
+	    number (buf, "f", _reg_nr & 0x0f);
 	    break;
 	case BRW_ARF_MASK:
-	    format (file, "mask%d", _reg_nr & 0x0f);
+	    number (buf, "mask", _reg_nr & 0x0f);
 	    break;
 	case BRW_ARF_MASK_STACK:
-	    format (file, "msd%d", _reg_nr & 0x0f);
+	    number (buf, "msd", _reg_nr & 0x0f);
 	    break;
 	case BRW_ARF_STATE:
-	    format (file, "sr%d", _reg_nr & 0x0f);
+	    number (buf, "sr", _reg_nr & 0x0f);
 	    break;
 	case BRW_ARF_CONTROL:
-	    format (file, "cr%d", _reg_nr & 0x0f);
+	    number (buf, "cr", _reg_nr & 0x0f);
 	    break;
 	case BRW_ARF_NOTIFICATION_COUNT:
-	    format (file, "n%d", _reg_nr & 0x0f);
+	    number (buf, "n", _reg_nr & 0x0f);
 	    break;
 	case BRW_ARF_IP:
-	    string (file, "ip");
+	    string (buf, "ip");
 	    return -1;
 	    break;
 	default:
-	    format (file, "ARF%d", _reg_nr);
+	    number (buf, "ARF", _reg_nr);
 	    break;
 	}
     } else {
-	err  |= control (file, "src reg file", reg_file, _reg_file, NULL);
-	format (file, "%d", _reg_nr);
+	err  |= control (buf, "src reg file", reg_file, _reg_file, NULL);
+	number (buf, "", _reg_nr);
     }
     return err;
 }
 
-static int dest (FILE *file, struct brw_instruction *inst)
+static int dest (struct brw_disasm_buf *buf, struct brw_instruction *inst)
 {
     int	err = 0;
 
@@ -518,53 +628,53 @@ static int dest (FILE *file, struct brw_instruction *inst)
     {
 	if (inst->bits1.da1.dest_address_mode == BRW_ADDRESS_DIRECT)
 	{
-	    err |= reg (file, inst->bits1.da1.dest_reg_file, inst->bits1.da1.dest_reg_nr);
+	    err |= reg (buf, inst->bits1.da1.dest_reg_file, inst->bits1.da1.dest_reg_nr);
 	    if (err == -1)
 		return 0;
 	    if (inst->bits1.da1.dest_subreg_nr)
-		format (file, ".%d", inst->bits1.da1.dest_subreg_nr /
-				     reg_type_size[inst->bits1.da1.dest_reg_type]);
-	    format (file, "<%s>", horiz_stride[inst->bits1.da1.dest_horiz_stride]);
-	    err |= control (file, "dest reg encoding", reg_encoding, inst->bits1.da1.dest_reg_type, NULL);
+		number (buf, ".", inst->bits1.da1.dest_subreg_nr /
+				  reg_type_size[inst->bits1.da1.dest_reg_type]);
+	    format (buf, "<%s>", horiz_stride[inst->bits1.da1.dest_horiz_stride]);
+	    err |= control (buf, "dest reg encoding", reg_encoding, inst->bits1.da1.dest_reg_type, NULL);
 	}
 	else
 	{
-	    string (file, "g[a0");
+	    string (buf, "g[a0");
 	    if (inst->bits1.ia1.dest_subreg_nr)
-		format (file, ".%d", inst->bits1.ia1.dest_subreg_nr /
-					reg_type_size[inst->bits1.ia1.dest_reg_type]);
+		number (buf, ".", inst->bits1.ia1.dest_subreg_nr /
+				  reg_type_size[inst->bits1.ia1.dest_reg_type]);
 	    if (inst->bits1.ia1.dest_indirect_offset)
-		format (file, " %d", inst->bits1.ia1.dest_indirect_offset);
-	    string (file, "]");
-	    format (file, "<%s>", horiz_stride[inst->bits1.ia1.dest_horiz_stride]);
-	    err |= control (file, "dest reg encoding", reg_encoding, inst->bits1.ia1.dest_reg_type, NULL);
+		format (buf, " %d", inst->bits1.ia1.dest_indirect_offset);
+	    string (buf, "]");
+	    format (buf, "<%s>", horiz_stride[inst->bits1.ia1.dest_horiz_stride]);
+	    err |= control (buf, "dest reg encoding", reg_encoding, inst->bits1.ia1.dest_reg_type, NULL);
 	}
     }
     else
     {
 	if (inst->bits1.da16.dest_address_mode == BRW_ADDRESS_DIRECT)
 	{
-	    err |= reg (file, inst->bits1.da16.dest_reg_file, inst->bits1.da16.dest_reg_nr);
+	    err |= reg (buf, inst->bits1.da16.dest_reg_file, inst->bits1.da16.dest_reg_nr);
 	    if (err == -1)
 		return 0;
 	    if (inst->bits1.da16.dest_subreg_nr)
-		format (file, ".%d", inst->bits1.da16.dest_subreg_nr /
-				     reg_type_size[inst->bits1.da16.dest_reg_type]);
-	    string (file, "<1>");
-	    err |= control (file, "writemask", writemask, inst->bits1.da16.dest_writemask, NULL);
-	    err |= control (file, "dest reg encoding", reg_encoding, inst->bits1.da16.dest_reg_type, NULL);
+		number (buf, ".", inst->bits1.da16.dest_subreg_nr /
+				  reg_type_size[inst->bits1.da16.dest_reg_type]);
+	    string (buf, "<1>");
+	    err |= control (buf, "writemask", writemask, inst->bits1.da16.dest_writemask, NULL);
+	    err |= control (buf, "dest reg encoding", reg_encoding, inst->bits1.da16.dest_reg_type, NULL);
 	}
 	else
 	{
 	    err = 1;
-	    string (file, "Indirect align16 address mode not supported");
+	    string (buf, "Indirect align16 address mode not supported");
 	}
     }
 
     return 0;
 }
 
-static int dest_3src (FILE *file, struct brw_instruction *inst)
+static int dest_3src (struct brw_disasm_buf *buf, struct brw_instruction *inst)
 {
     int	err = 0;
     uint32_t reg_file;
@@ -574,51 +684,51 @@ static int dest_3src (FILE *file, struct brw_instruction *inst)
     else
        reg_file = BRW_GENERAL_REGISTER_FILE;
 
-    err |= reg (file, reg_file, inst->bits1.da3src.dest_reg_nr);
+    err |= reg (buf, reg_file, inst->bits1.da3src.dest_reg_nr);
     if (err == -1)
        return 0;
     if (inst->bits1.da3src.dest_subreg_nr)
-       format (file, ".%d", inst->bits1.da3src.dest_subreg_nr);
-    string (file, "<1>");
-    err |= control (file, "writemask", writemask, inst->bits1.da3src.dest_writemask, NULL);
-    err |= control (file, "dest reg encoding", reg_encoding, BRW_REGISTER_TYPE_F, NULL);
+       number (buf, ".", inst->bits1.da3src.dest_subreg_nr);
+    string (buf, "<1>");
+    err |= control (buf, "writemask", writemask, inst->bits1.da3src.dest_writemask, NULL);
+    err |= control (buf, "dest reg encoding", reg_encoding, BRW_REGISTER_TYPE_F, NULL);
 
     return 0;
 }
 
-static int src_align1_region (FILE *file,
+static int src_align1_region (struct brw_disasm_buf *buf,
 			      unsigned _vert_stride, unsigned _width, unsigned _horiz_stride)
 {
     int err = 0;
-    string (file, "<");
-    err |= control (file, "vert stride", vert_stride, _vert_stride, NULL);
-    string (file, ",");
-    err |= control (file, "width", width, _width, NULL);
-    string (file, ",");
-    err |= control (file, "horiz_stride", horiz_stride, _horiz_stride, NULL);
-    string (file, ">");
+    string (buf, "<");
+    err |= control (buf, "vert stride", vert_stride, _vert_stride, NULL);
+    string (buf, ",");
+    err |= control (buf, "width", width, _width, NULL);
+    string (buf, ",");
+    err |= control (buf, "horiz_stride", horiz_stride, _horiz_stride, NULL);
+    string (buf, ">");
     return err;
 }
 
-static int src_da1 (FILE *file, unsigned type, unsigned _reg_file,
+static int src_da1 (struct brw_disasm_buf *buf, unsigned type, unsigned _reg_file,
 		    unsigned _vert_stride, unsigned _width, unsigned _horiz_stride,
 		    unsigned reg_num, unsigned sub_reg_num, unsigned __abs, unsigned _negate)
 {
     int err = 0;
-    err |= control (file, "negate", negate, _negate, NULL);
-    err |= control (file, "abs", _abs, __abs, NULL);
+    err |= control (buf, "negate", negate, _negate, NULL);
+    err |= control (buf, "abs", _abs, __abs, NULL);
 
-    err |= reg (file, _reg_file, reg_num);
+    err |= reg (buf, _reg_file, reg_num);
     if (err == -1)
 	return 0;
     if (sub_reg_num)
-	format (file, ".%d", sub_reg_num / reg_type_size[type]); /* use formal style like spec */
-    src_align1_region (file, _vert_stride, _width, _horiz_stride);
-    err |= control (file, "src reg encoding", reg_encoding, type, NULL);
+	number (buf, ".", sub_reg_num / reg_type_size[type]); /* use formal style like spec */
+    src_align1_region (buf, _vert_stride, _width, _horiz_stride);
+    err |= control (buf, "src reg encoding", reg_encoding, type, NULL);
     return err;
 }
 
-static int src_ia1 (FILE *file,
+static int src_ia1 (struct brw_disasm_buf *buf,
 		    unsigned type,
 		    unsigned _reg_file,
 		    int _addr_imm,
@@ -631,21 +741,21 @@ static int src_ia1 (FILE *file,
 		    unsigned _vert_stride)
 {
     int err = 0;
-    err |= control (file, "negate", negate, _negate, NULL);
-    err |= control (file, "abs", _abs, __abs, NULL);
+    err |= control (buf, "negate", negate, _negate, NULL);
+    err |= control (buf, "abs", _abs, __abs, NULL);
 
-    string (file, "g[a0");
+    string (buf, "g[a0");
     if (_addr_subreg_nr)
-	format (file, ".%d", _addr_subreg_nr);
+	number (buf, ".", _addr_subreg_nr);
     if (_addr_imm)
-	format (file, " %d", _addr_imm);
-    string (file, "]");
-    src_align1_region (file, _vert_stride, _width, _horiz_stride);
-    err |= control (file, "src reg encoding", reg_encoding, type, NULL);
+	format (buf, " %d", _addr_imm);
+    string (buf, "]");
+    src_align1_region (buf, _vert_stride, _width, _horiz_stride);
+    err |= control (buf, "src reg encoding", reg_encoding, type, NULL);
     return err;
 }
 
-static int src_da16 (FILE *file,
+static int src_da16 (struct brw_disasm_buf *buf,
 		     unsigned _reg_type,
 		     unsigned _reg_file,
 		     unsigned _vert_stride,
@@ -659,19 +769,19 @@ static int src_da16 (FILE *file,
 		     unsigned swz_w)
 {
     int err = 0;
-    err |= control (file, "negate", negate, _negate, NULL);
-    err |= control (file, "abs", _abs, __abs, NULL);
+    err |= control (buf, "negate", negate, _negate, NULL);
+    err |= control (buf, "abs", _abs, __abs, NULL);
 
-    err |= reg (file, _reg_file, _reg_nr);
+    err |= reg (buf, _reg_file, _reg_nr);
     if (err == -1)
 	return 0;
     if (_subreg_nr)
 	/* bit4 for subreg number byte addressing. Make this same meaning as
 	   in da1 case, so output looks consistent. */
-	format (file, ".%d", 16 / reg_type_size[_reg_type]);
-    string (file, "<");
-    err |= control (file, "vert stride", vert_stride, _vert_stride, NULL);
-    string (file, ",4,1>");
+	number (buf, ".", 16 / reg_type_size[_reg_type]);
+    string (buf, "<");
+    err |= control (buf, "vert stride", vert_stride, _vert_stride, NULL);
+    string (buf, ",4,1>");
     /*
      * Three kinds of swizzle display:
      *  identity - nothing printed
@@ -687,22 +797,22 @@ static int src_da16 (FILE *file,
     }
     else if (swz_x == swz_y && swz_x == swz_z && swz_x == swz_w)
     {
-	string (file, ".");
-	err |= control (file, "channel select", chan_sel, swz_x, NULL);
+	string (buf, ".");
+	err |= control (buf, "channel select", chan_sel, swz_x, NULL);
     }
     else
     {
-	string (file, ".");
-	err |= control (file, "channel select", chan_sel, swz_x, NULL);
-	err |= control (file, "channel select", chan_sel, swz_y, NULL);
-	err |= control (file, "channel select", chan_sel, swz_z, NULL);
-	err |= control (file, "channel select", chan_sel, swz_w, NULL);
+	string (buf, ".");
+	err |= control (buf, "channel select", chan_sel, swz_x, NULL);
+	err |= control (buf, "channel select", chan_sel, swz_y, NULL);
+	err |= control (buf, "channel select", chan_sel, swz_z, NULL);
+	err |= control (buf, "channel select", chan_sel, swz_w, NULL);
     }
-    err |= control (file, "src da16 reg type", reg_encoding, _reg_type, NULL);
+    err |= control (buf, "src da16 reg type", reg_encoding, _reg_type, NULL);
     return err;
 }
 
-static int src0_3src (FILE *file, struct brw_instruction *inst)
+static int src0_3src (struct brw_disasm_buf *buf, struct brw_instruction *inst)
 {
     int err = 0;
     unsigned swz_x = (inst->bits2.da3src.src0_swizzle >> 0) & 0x3;
@@ -710,16 +820,16 @@ static int src0_3src (FILE *file, struct brw_instruction *inst)
     unsigned swz_z = (inst->bits2.da3src.src0_swizzle >> 4) & 0x3;
     unsigned swz_w = (inst->bits2.da3src.src0_swizzle >> 6) & 0x3;
 
-    err |= control (file, "negate", negate, inst->bits1.da3src.src0_negate, NULL);
-    err |= control (file, "abs", _abs, inst->bits1.da3src.src0_abs, NULL);
+    err |= control (buf, "negate", negate, inst->bits1.da3src.src0_negate, NULL);
+    err |= control (buf, "abs", _abs, inst->bits1.da3src.src0_abs, NULL);
 
-    err |= reg (file, BRW_GENERAL_REGISTER_FILE, inst->bits2.da3src.src0_reg_nr);
+    err |= reg (buf, BRW_GENERAL_REGISTER_FILE, inst->bits2.da3src.src0_reg_nr);
     if (err == -1)
 	return 0;
     if (inst->bits2.da3src.src0_subreg_nr)
-	format (file, ".%d", inst->bits2.da3src.src0_subreg_nr);
-    string (file, "<4,1,1>");
-    err |= control (file, "src da16 reg type", reg_encoding,
+	number (buf, ".", inst->bits2.da3src.src0_subreg_nr);
+    string (buf, "<4,1,1>");
+    err |= control (buf, "src da16 reg type", reg_encoding,
 		    BRW_REGISTER_TYPE_F, NULL);
     /*
      * Three kinds of swizzle display:
@@ -736,21 +846,21 @@ static int src0_3src (FILE *file, struct brw_instruction *inst)
     }
     else if (swz_x == swz_y && swz_x == swz_z && swz_x == swz_w)
     {
-	string (file, ".");
-	err |= control (file, "channel select", chan_sel, swz_x, NULL);
+	string (buf, ".");
+	err |= control (buf, "channel select", chan_sel, swz_x, NULL);
     }
     else
     {
-	string (file, ".");
-	err |= control (file, "channel select", chan_sel, swz_x, NULL);
-	err |= control (file, "channel select", chan_sel, swz_y, NULL);
-	err |= control (file, "channel select", chan_sel, swz_z, NULL);
-	err |= control (file, "channel select", chan_sel, swz_w, NULL);
+	string (buf, ".");
+	err |= control (buf, "channel select", chan_sel, swz_x, NULL);
+	err |= control (buf, "channel select", chan_sel, swz_y, NULL);
+	err |= control (buf, "channel select", chan_sel, swz_z, NULL);
+	err |= control (buf, "channel select", chan_sel, swz_w, NULL);
     }
     return err;
 }
 
-static int src1_3src (FILE *file, struct brw_instruction *inst)
+static int src1_3src (struct brw_disasm_buf *buf, struct brw_instruction *inst)
 {
     int err = 0;
     unsigned swz_x = (inst->bits2.da3src.src1_swizzle >> 0) & 0x3;
@@ -760,18 +870,18 @@ static int src1_3src (FILE *file, struct brw_instruction *inst)
     unsigned src1_subreg_nr = (inst->bits2.da3src.src1_subreg_nr_low |
 			     (inst->bits3.da3src.src1_subreg_nr_high << 2));
 
-    err |= control (file, "negate", negate, inst->bits1.da3src.src1_negate,
+    err |= control (buf, "negate", negate, inst->bits1.da3src.src1_negate,
 		    NULL);
-    err |= control (file, "abs", _abs, inst->bits1.da3src.src1_abs, NULL);
+    err |= control (buf, "abs", _abs, inst->bits1.da3src.src1_abs, NULL);
 
-    err |= reg (file, BRW_GENERAL_REGISTER_FILE,
+    err |= reg (buf, BRW_GENERAL_REGISTER_FILE,
 		inst->bits3.da3src.src1_reg_nr);
     if (err == -1)
 	return 0;
     if (src1_subreg_nr)
-	format (file, ".%d", src1_subreg_nr);
-    string (file, "<4,1,1>");
-    err |= control (file, "src da16 reg type", reg_encoding,
+	number (buf, ".", src1_subreg_nr);
+    string (buf, "<4,1,1>");
+    err |= control (buf, "src da16 reg type", reg_encoding,
 		    BRW_REGISTER_TYPE_F, NULL);
     /*
      * Three kinds of swizzle display:
@@ -788,22 +898,22 @@ static int src1_3src (FILE *file, struct brw_instruction *inst)
     }
     else if (swz_x == swz_y && swz_x == swz_z && swz_x == swz_w)
     {
-	string (file, ".");
-	err |= control (file, "channel select", chan_sel, swz_x, NULL);
+	string (buf, ".");
+	err |= control (buf, "channel select", chan_sel, swz_x, NULL);
     }
     else
     {
-	string (file, ".");
-	err |= control (file, "channel select", chan_sel, swz_x, NULL);
-	err |= control (file, "channel select", chan_sel, swz_y, NULL);
-	err |= control (file, "channel select", chan_sel, swz_z, NULL);
-	err |= control (file, "channel select", chan_sel, swz_w, NULL);
+	string (buf, ".");
+	err |= control (buf, "channel select", chan_sel, swz_x, NULL);
+	err |= control (buf, "channel select", chan_sel, swz_y, NULL);
+	err |= control (buf, "channel select", chan_sel, swz_z, NULL);
+	err |= control (buf, "channel select", chan_sel, swz_w, NULL);
     }
     return err;
 }
 
 
-static int src2_3src (FILE *file, struct brw_instruction *inst)
+static int src2_3src (struct brw_disasm_buf *buf, struct brw_instruction *inst)
 {
     int err = 0;
     unsigned swz_x = (inst->bits3.da3src.src2_swizzle >> 0) & 0x3;
@@ -811,18 +921,18 @@ static int src2_3src (FILE *file, struct brw_instruction *inst)
     unsigned swz_z = (inst->bits3.da3src.src2_swizzle >> 4) & 0x3;
     unsigned swz_w = (inst->bits3.da3src.src2_swizzle >> 6) & 0x3;
 
-    err |= control (file, "negate", negate, inst->bits1.da3src.src2_negate,
+    err |= control (buf, "negate", negate, inst->bits1.da3src.src2_negate,
 		    NULL);
-    err |= control (file, "abs", _abs, inst->bits1.da3src.src2_abs, NULL);
+    err |= control (buf, "abs", _abs, inst->bits1.da3src.src2_abs, NULL);
 
-    err |= reg (file, BRW_GENERAL_REGISTER_FILE,
+    err |= reg (buf, BRW_GENERAL_REGISTER_FILE,
 		inst->bits3.da3src.src2_reg_nr);
     if (err == -1)
 	return 0;
     if (inst->bits3.da3src.src2_subreg_nr)
-	format (file, ".%d", inst->bits3.da3src.src2_subreg_nr);
-    string (file, "<4,1,1>");
-    err |= control (file, "src da16 reg type", reg_encoding,
+	number (buf, ".", inst->bits3.da3src.src2_subreg_nr);
+    string (buf, "<4,1,1>");
+    err |= control (buf, "src da16 reg type", reg_encoding,
 		    BRW_REGISTER_TYPE_F, NULL);
     /*
      * Three kinds of swizzle display:
@@ -839,59 +949,59 @@ static int src2_3src (FILE *file, struct brw_instruction *inst)
     }
     else if (swz_x == swz_y && swz_x == swz_z && swz_x == swz_w)
     {
-	string (file, ".");
-	err |= control (file, "channel select", chan_sel, swz_x, NULL);
+	string (buf, ".");
+	err |= control (buf, "channel select", chan_sel, swz_x, NULL);
     }
     else
     {
-	string (file, ".");
-	err |= control (file, "channel select", chan_sel, swz_x, NULL);
-	err |= control (file, "channel select", chan_sel, swz_y, NULL);
-	err |= control (file, "channel select", chan_sel, swz_z, NULL);
-	err |= control (file, "channel select", chan_sel, swz_w, NULL);
+	string (buf, ".");
+	err |= control (buf, "channel select", chan_sel, swz_x, NULL);
+	err |= control (buf, "channel select", chan_sel, swz_y, NULL);
+	err |= control (buf, "channel select", chan_sel, swz_z, NULL);
+	err |= control (buf, "channel select", chan_sel, swz_w, NULL);
     }
     return err;
 }
 
-static int imm (FILE *file, unsigned type, struct brw_instruction *inst) {
+static int imm (struct brw_disasm_buf *buf, unsigned type, struct brw_instruction *inst) {
     switch (type) {
     case BRW_REGISTER_TYPE_UD:
-	format (file, "0x%08xUD", inst->bits3.ud);
+	format (buf, "0x%08xUD", inst->bits3.ud);
 	break;
     case BRW_REGISTER_TYPE_D:
-	format (file, "%dD", inst->bits3.d);
+	format (buf, "%dD", inst->bits3.d);
 	break;
     case BRW_REGISTER_TYPE_UW:
-	format (file, "0x%04xUW", (uint16_t) inst->bits3.ud);
+	format (buf, "0x%04xUW", (uint16_t) inst->bits3.ud);
 	break;
     case BRW_REGISTER_TYPE_W:
-	format (file, "%dW", (int16_t) inst->bits3.d);
+	format (buf, "%dW", (int16_t) inst->bits3.d);
 	break;
     case BRW_REGISTER_TYPE_UB:
-	format (file, "0x%02xUB", (int8_t) inst->bits3.ud);
+	format (buf, "0x%02xUB", (int8_t) inst->bits3.ud);
 	break;
     case BRW_REGISTER_TYPE_VF:
-	format (file, "Vector Float");
+	format (buf, "Vector Float");
 	break;
     case BRW_REGISTER_TYPE_V:
-	format (file, "0x%08xV", inst->bits3.ud);
+	format (buf, "0x%08xV", inst->bits3.ud);
 	break;
     case BRW_REGISTER_TYPE_F:
-	format (file, "%-gF", inst->bits3.f);
+	format (buf, "%-gF", inst->bits3.f);
     }
     return 0;
 }
 
-static int src0 (FILE *file, struct brw_instruction *inst)
+static int src0 (struct brw_disasm_buf *buf, struct brw_instruction *inst)
 {
     if (inst->bits1.da1.src0_reg_file == BRW_IMMEDIATE_VALUE)
-	return imm (file, inst->bits1.da1.src0_reg_type,
+	return imm (buf, inst->bits1.da1.src0_reg_type,
 		    inst);
     else if (inst->header.access_mode == BRW_ALIGN_1)
     {
 	if (inst->bits2.da1.src0_address_mode == BRW_ADDRESS_DIRECT)
 	{
-	    return src_da1 (file,
+	    return src_da1 (buf,
 			    inst->bits1.da1.src0_reg_type,
 			    inst->bits1.da1.src0_reg_file,
 			    inst->bits2.da1.src0_vert_stride,
@@ -904,7 +1014,7 @@ static int src0 (FILE *file, struct brw_instruction *inst)
 	}
 	else
 	{
-	    return src_ia1 (file,
+	    return src_ia1 (buf,
 			    inst->bits1.ia1.src0_reg_type,
 			    inst->bits1.ia1.src0_reg_file,
 			    inst->bits2.ia1.src0_indirect_offset,
@@ -921,7 +1031,7 @@ static int src0 (FILE *file, struct brw_instruction *inst)
     {
 	if (inst->bits2.da16.src0_address_mode == BRW_ADDRESS_DIRECT)
 	{
-	    return src_da16 (file,
+	    return src_da16 (buf,
 			     inst->bits1.da16.src0_reg_type,
 			     inst->bits1.da16.src0_reg_file,
 			     inst->bits2.da16.src0_vert_stride,
@@ -936,22 +1046,22 @@ static int src0 (FILE *file, struct brw_instruction *inst)
 	}
 	else
 	{
-	    string (file, "Indirect align16 address mode not supported");
+	    string (buf, "Indirect align16 address mode not supported");
 	    return 1;
 	}
     }
 }
 
-static int src1 (FILE *file, struct brw_instruction *inst)
+static int src1 (struct brw_disasm_buf *buf, struct brw_instruction *inst)
 {
     if (inst->bits1.da1.src1_reg_file == BRW_IMMEDIATE_VALUE)
-	return imm (file, inst->bits1.da1.src1_reg_type,
+	return imm (buf, inst->bits1.da1.src1_reg_type,
 		    inst);
     else if (inst->header.access_mode == BRW_ALIGN_1)
     {
 	if (inst->bits3.da1.src1_address_mode == BRW_ADDRESS_DIRECT)
 	{
-	    return src_da1 (file,
+	    return src_da1 (buf,
 			    inst->bits1.da1.src1_reg_type,
 			    inst->bits1.da1.src1_reg_file,
 			    inst->bits3.da1.src1_vert_stride,
@@ -964,7 +1074,7 @@ static int src1 (FILE *file, struct brw_instruction *inst)
 	}
 	else
 	{
-	    return src_ia1 (file,
+	    return src_ia1 (buf,
 			    inst->bits1.ia1.src1_reg_type,
 			    inst->bits1.ia1.src1_reg_file,
 			    inst->bits3.ia1.src1_indirect_offset,
@@ -981,7 +1091,7 @@ static int src1 (FILE *file, struct brw_instruction *inst)
     {
 	if (inst->bits3.da16.src1_address_mode == BRW_ADDRESS_DIRECT)
 	{
-	    return src_da16 (file,
+	    return src_da16 (buf,
 			     inst->bits1.da16.src1_reg_type,
 			     inst->bits1.da16.src1_reg_file,
 			     inst->bits3.da16.src1_vert_stride,
@@ -996,7 +1106,7 @@ static int src1 (FILE *file, struct brw_instruction *inst)
 	}
 	else
 	{
-	    string (file, "Indirect align16 address mode not supported");
+	    string (buf, "Indirect align16 address mode not supported");
 	    return 1;
 	}
     }
@@ -1011,7 +1121,7 @@ int esize[6] = {
 	[5] = 32,
 };
 
-static int qtr_ctrl(FILE *file, struct brw_instruction *inst)
+static int qtr_ctrl(struct brw_disasm_buf *buf, struct brw_instruction *inst)
 {
     int qtr_ctl = inst->header.compression_control;
     int exec_size = esize[inst->header.execution_size];
@@ -1019,58 +1129,58 @@ static int qtr_ctrl(FILE *file, struct brw_instruction *inst)
     if (exec_size == 8) {
 	switch (qtr_ctl) {
 	case 0:
-	    string (file, " 1Q");
+	    string (buf, " 1Q");
 	    break;
 	case 1:
-	    string (file, " 2Q");
+	    string (buf, " 2Q");
 	    break;
 	case 2:
-	    string (file, " 3Q");
+	    string (buf, " 3Q");
 	    break;
 	case 3:
-	    string (file, " 4Q");
+	    string (buf, " 4Q");
 	    break;
 	}
     } else if (exec_size == 16){
 	if (qtr_ctl < 2)
-	    string (file, " 1H");
+	    string (buf, " 1H");
 	else
-	    string (file, " 2H");
+	    string (buf, " 2H");
     }
     return 0;
 }
 
-int brw_disasm (FILE *file, struct brw_instruction *inst, int gen)
+int brw_disasm_buf (struct brw_disasm_buf *buf, struct brw_instruction *inst, int gen)
 {
     int	err = 0;
     int space = 0;
 
     if (inst->header.predicate_control) {
-	string (file, "(");
-	err |= control (file, "predicate inverse", pred_inv, inst->header.predicate_inverse, NULL);
-	format (file, "f%d", gen >= 7 ? inst->bits2.da1.flag_reg_nr : 0);
+	string (buf, "(");
+	err |= control (buf, "predicate inverse", pred_inv, inst->header.predicate_inverse, NULL);
+	number (buf, "f", gen >= 7 ? inst->bits2.da1.flag_reg_nr : 0);
 	if (inst->bits2.da1.flag_subreg_nr)
-	    format (file, ".%d", inst->bits2.da1.flag_subreg_nr);
+	    number (buf, ".", inst->bits2.da1.flag_subreg_nr);
 	if (inst->header.access_mode == BRW_ALIGN_1)
-	    err |= control (file, "predicate control align1", pred_ctrl_align1,
+	    err |= control (buf, "predicate control align1", pred_ctrl_align1,
 			    inst->header.predicate_control, NULL);
 	else
-	    err |= control (file, "predicate control align16", pred_ctrl_align16,
+	    err |= control (buf, "predicate control align16", pred_ctrl_align16,
 			    inst->header.predicate_control, NULL);
-	string (file, ") ");
+	string (buf, ") ");
     }
 
-    err |= print_opcode (file, inst->header.opcode);
-    err |= control (file, "saturate", saturate, inst->header.saturate, NULL);
-    err |= control (file, "debug control", debug_ctrl, inst->header.debug_control, NULL);
+    err |= print_opcode (buf, inst->header.opcode);
+    err |= control (buf, "saturate", saturate, inst->header.saturate, NULL);
+    err |= control (buf, "debug control", debug_ctrl, inst->header.debug_control, NULL);
 
     if (inst->header.opcode == BRW_OPCODE_MATH) {
-	string (file, " ");
-	err |= control (file, "function", math_function,
+	string (buf, " ");
+	err |= control (buf, "function", math_function,
 			inst->header.destreg__conditionalmod, NULL);
     } else if (inst->header.opcode != BRW_OPCODE_SEND &&
 	       inst->header.opcode != BRW_OPCODE_SENDC) {
-	err |= control (file, "conditional modifier", conditional_modifier,
+	err |= control (buf, "conditional modifier", conditional_modifier,
 			inst->header.destreg__conditionalmod, NULL);
 
         /* If we're using the conditional modifier, print which flags reg is
@@ -1081,62 +1191,62 @@ int brw_disasm (FILE *file, struct brw_instruction *inst, int gen)
             (gen < 6 || (inst->header.opcode != BRW_OPCODE_SEL &&
                          inst->header.opcode != BRW_OPCODE_IF &&
                          inst->header.opcode != BRW_OPCODE_WHILE))) {
-	    format (file, ".f%d", gen >= 7 ? inst->bits2.da1.flag_reg_nr : 0);
+	    number (buf, ".f", gen >= 7 ? inst->bits2.da1.flag_reg_nr : 0);
 	    if (inst->bits2.da1.flag_subreg_nr)
-		format (file, ".%d", inst->bits2.da1.flag_subreg_nr);
+		number (buf, ".", inst->bits2.da1.flag_subreg_nr);
         }
     }
 
     if (inst->header.opcode != BRW_OPCODE_NOP) {
-	string (file, "(");
-	err |= control (file, "execution size", exec_size, inst->header.execution_size, NULL);
-	string (file, ")");
+	string (buf, "(");
+	err |= control (buf, "execution size", exec_size, inst->header.execution_size, NULL);
+	string (buf, ")");
     }
 
     if (inst->header.opcode == BRW_OPCODE_SEND && gen < 6)
-	format (file, " %d", inst->header.destreg__conditionalmod);
+	format (buf, " %d", inst->header.destreg__conditionalmod);
 
     if (opcode[inst->header.opcode].nsrc == 3) {
-       pad (file, 16);
-       err |= dest_3src (file, inst);
+       pad (buf, 16);
+       err |= dest_3src (buf, inst);
 
-       pad (file, 32);
-       err |= src0_3src (file, inst);
+       pad (buf, 32);
+       err |= src0_3src (buf, inst);
 
-       pad (file, 48);
-       err |= src1_3src (file, inst);
+       pad (buf, 48);
+       err |= src1_3src (buf, inst);
 
-       pad (file, 64);
-       err |= src2_3src (file, inst);
+       pad (buf, 64);
+       err |= src2_3src (buf, inst);
     } else {
        if (opcode[inst->header.opcode].ndst > 0) {
-	  pad (file, 16);
-	  err |= dest (file, inst);
+	  pad (buf, 16);
+	  err |= dest (buf, inst);
        } else if (gen == 7 && (inst->header.opcode == BRW_OPCODE_ELSE ||
 			       inst->header.opcode == BRW_OPCODE_ENDIF ||
 			       inst->header.opcode == BRW_OPCODE_WHILE)) {
-	  format (file, " %d", inst->bits3.break_cont.jip);
+	  format (buf, " %d", inst->bits3.break_cont.jip);
        } else if (gen == 6 && (inst->header.opcode == BRW_OPCODE_IF ||
 			       inst->header.opcode == BRW_OPCODE_ELSE ||
 			       inst->header.opcode == BRW_OPCODE_ENDIF ||
 			       inst->header.opcode == BRW_OPCODE_WHILE)) {
-	  format (file, " %d", inst->bits1.branch_gen6.jump_count);
+	  format (buf, " %d", inst->bits1.branch_gen6.jump_count);
        } else if ((gen >= 6 && (inst->header.opcode == BRW_OPCODE_BREAK ||
                                 inst->header.opcode == BRW_OPCODE_CONTINUE ||
                                 inst->header.opcode == BRW_OPCODE_HALT)) ||
                   (gen == 7 && inst->header.opcode == BRW_OPCODE_IF)) {
-	  format (file, " %d %d", inst->bits3.break_cont.uip, inst->bits3.break_cont.jip);
+	  format (buf, " %d %d", inst->bits3.break_cont.uip, inst->bits3.break_cont.jip);
        } else if (inst->header.opcode == BRW_OPCODE_JMPI) {
-	  format (file, " %d", inst->bits3.d);
+	  format (buf, " %d", inst->bits3.d);
        }
 
        if (opcode[inst->header.opcode].nsrc > 0) {
-	  pad (file, 32);
-	  err |= src0 (file, inst);
+	  pad (buf, 32);
+	  err |= src0 (buf, inst);
        }
        if (opcode[inst->header.opcode].nsrc > 1) {
-	  pad (file, 48);
-	  err |= src1 (file, inst);
+	  pad (buf, 48);
+	  err |= src1 (buf, inst);
        }
     }
 
@@ -1151,72 +1261,72 @@ int brw_disasm (FILE *file, struct brw_instruction *inst, int gen)
 	else
 	    target = inst->bits3.generic.msg_target;
 
-	newline (file);
-	pad (file, 16);
+	newline (buf);
+	pad (buf, 16);
 	space = 0;
 
 	if (gen >= 6) {
-	   err |= control (file, "target function", target_function_gen6,
+	   err |= control (buf, "target function", target_function_gen6,
 			   target, &space);
 	} else {
-	   err |= control (file, "target function", target_function,
+	   err |= control (buf, "target function", target_function,
 			   target, &space);
 	}
 
 	switch (target) {
 	case BRW_SFID_MATH:
-	    err |= control (file, "math function", math_function,
+	    err |= control (buf, "math function", math_function,
 			    inst->bits3.math.function, &space);
-	    err |= control (file, "math saturate", math_saturate,
+	    err |= control (buf, "math saturate", math_saturate,
 			    inst->bits3.math.saturate, &space);
-	    err |= control (file, "math signed", math_signed,
+	    err |= control (buf, "math signed", math_signed,
 			    inst->bits3.math.int_type, &space);
-	    err |= control (file, "math scalar", math_scalar,
+	    err |= control (buf, "math scalar", math_scalar,
 			    inst->bits3.math.data_type, &space);
-	    err |= control (file, "math precision", math_precision,
+	    err |= control (buf, "math precision", math_precision,
 			    inst->bits3.math.precision, &space);
 	    break;
 	case BRW_SFID_SAMPLER:
 	    if (gen >= 7) {
-		format (file, " (%d, %d, %d, %d)",
+		format (buf, " (%d, %d, %d, %d)",
 			inst->bits3.sampler_gen7.binding_table_index,
 			inst->bits3.sampler_gen7.sampler,
 			inst->bits3.sampler_gen7.msg_type,
 			inst->bits3.sampler_gen7.simd_mode);
 	    } else if (gen >= 5) {
-		format (file, " (%d, %d, %d, %d)",
+		format (buf, " (%d, %d, %d, %d)",
 			inst->bits3.sampler_gen5.binding_table_index,
 			inst->bits3.sampler_gen5.sampler,
 			inst->bits3.sampler_gen5.msg_type,
 			inst->bits3.sampler_gen5.simd_mode);
 	    } else if (0 /* FINISHME: is_g4x */) {
-		format (file, " (%d, %d)",
+		format (buf, " (%d, %d)",
 			inst->bits3.sampler_g4x.binding_table_index,
 			inst->bits3.sampler_g4x.sampler);
 	    } else {
-		format (file, " (%d, %d, ",
+		format (buf, " (%d, %d, ",
 			inst->bits3.sampler.binding_table_index,
 			inst->bits3.sampler.sampler);
-		err |= control (file, "sampler target format",
+		err |= control (buf, "sampler target format",
 				sampler_target_format,
 				inst->bits3.sampler.return_format, NULL);
-		string (file, ")");
+		string (buf, ")");
 	    }
 	    break;
 	case BRW_SFID_DATAPORT_READ:
 	    if (gen >= 6) {
-		format (file, " (%d, %d, %d, %d)",
+		format (buf, " (%d, %d, %d, %d)",
 			inst->bits3.gen6_dp.binding_table_index,
 			inst->bits3.gen6_dp.msg_control,
 			inst->bits3.gen6_dp.msg_type,
 			inst->bits3.gen6_dp.send_commit_msg);
 	    } else if (gen >= 5 /* FINISHME: || is_g4x */) {
-		format (file, " (%d, %d, %d)",
+		format (buf, " (%d, %d, %d)",
 			inst->bits3.dp_read_gen5.binding_table_index,
 			inst->bits3.dp_read_gen5.msg_control,
 			inst->bits3.dp_read_gen5.msg_type);
 	    } else {
-		format (file, " (%d, %d, %d)",
+		format (buf, " (%d, %d, %d)",
 			inst->bits3.dp_read.binding_table_index,
 			inst->bits3.dp_read.msg_control,
 			inst->bits3.dp_read.msg_type);
@@ -1225,30 +1335,30 @@ int brw_disasm (FILE *file, struct brw_instruction *inst, int gen)
 
 	case BRW_SFID_DATAPORT_WRITE:
 	    if (gen >= 7) {
-		format (file, " (");
+		format (buf, " (");
 
-		err |= control (file, "DP rc message type",
+		err |= control (buf, "DP rc message type",
 				dp_rc_msg_type_gen6,
 				inst->bits3.gen7_dp.msg_type, &space);
 
-		format (file, ", %d, %d, %d)",
+		format (buf, ", %d, %d, %d)",
 			inst->bits3.gen7_dp.binding_table_index,
 			inst->bits3.gen7_dp.msg_control,
 			inst->bits3.gen7_dp.msg_type);
 	    } else if (gen == 6) {
-		format (file, " (");
+		format (buf, " (");
 
-		err |= control (file, "DP rc message type",
+		err |= control (buf, "DP rc message type",
 				dp_rc_msg_type_gen6,
 				inst->bits3.gen6_dp.msg_type, &space);
 
-		format (file, ", %d, %d, %d, %d)",
+		format (buf, ", %d, %d, %d, %d)",
 			inst->bits3.gen6_dp.binding_table_index,
 			inst->bits3.gen6_dp.msg_control,
 			inst->bits3.gen6_dp.msg_type,
 			inst->bits3.gen6_dp.send_commit_msg);
 	    } else {
-		format (file, " (%d, %d, %d, %d)",
+		format (buf, " (%d, %d, %d, %d)",
 			inst->bits3.dp_write.binding_table_index,
 			(inst->bits3.dp_write.last_render_target << 3) |
 			inst->bits3.dp_write.msg_control,
@@ -1259,29 +1369,29 @@ int brw_disasm (FILE *file, struct brw_instruction *inst, int gen)
 
 	case BRW_SFID_URB:
 	    if (gen >= 5) {
-		format (file, " %d", inst->bits3.urb_gen5.offset);
+		format (buf, " %d", inst->bits3.urb_gen5.offset);
 	    } else {
-		format (file, " %d", inst->bits3.urb.offset);
+		format (buf, " %d", inst->bits3.urb.offset);
 	    }
 
 	    space = 1;
 	    if (gen >= 5) {
-		err |= control (file, "urb opcode", urb_opcode,
+		err |= control (buf, "urb opcode", urb_opcode,
 				inst->bits3.urb_gen5.opcode, &space);
 	    }
-	    err |= control (file, "urb swizzle", urb_swizzle,
+	    err |= control (buf, "urb swizzle", urb_swizzle,
 			    inst->bits3.urb.swizzle_control, &space);
-	    err |= control (file, "urb allocate", urb_allocate,
+	    err |= control (buf, "urb allocate", urb_allocate,
 			    inst->bits3.urb.allocate, &space);
-	    err |= control (file, "urb used", urb_used,
+	    err |= control (buf, "urb used", urb_used,
 			    inst->bits3.urb.used, &space);
-	    err |= control (file, "urb complete", urb_complete,
+	    err |= control (buf, "urb complete", urb_complete,
 			    inst->bits3.urb.complete, &space);
 	    break;
 	case BRW_SFID_THREAD_SPAWNER:
 	    break;
 	case GEN7_SFID_DATAPORT_DATA_CACHE:
-	    format (file, " (%d, %d, %d)",
+	    format (buf, " (%d, %d, %d)",
 		    inst->bits3.gen7_dp.binding_table_index,
 		    inst->bits3.gen7_dp.msg_control,
 		    inst->bits3.gen7_dp.msg_type);
@@ -1289,60 +1399,72 @@ int brw_disasm (FILE *file, struct brw_instruction *inst, int gen)
 
 
 	default:
-	    format (file, "unsupported target %d", target);
+	    format (buf, "unsupported target %d", target);
 	    break;
 	}
 	if (space)
-	    string (file, " ");
+	    string (buf, " ");
 	if (gen >= 5) {
-	   format (file, "mlen %d",
+	   number (buf, "mlen ",
 		   inst->bits3.generic_gen5.msg_length);
-	   format (file, " rlen %d",
+	   number (buf, " rlen ",
 		   inst->bits3.generic_gen5.response_length);
 	} else {
-	   format (file, "mlen %d",
+	   number (buf, "mlen ",
 		   inst->bits3.generic.msg_length);
-	   format (file, " rlen %d",
+	   number (buf, " rlen ",
 		   inst->bits3.generic.response_length);
 	}
     }
-    pad (file, 64);
+    pad (buf, 64);
     if (inst->header.opcode != BRW_OPCODE_NOP) {
-	string (file, "{");
+	string (buf, "{");
 	space = 1;
-	err |= control(file, "access mode", access_mode, inst->header.access_mode, &space);
+	err |= control(buf, "access mode", access_mode, inst->header.access_mode, &space);
 	if (gen >= 6)
-	    err |= control (file, "write enable control", wectrl, inst->header.mask_control, &space);
+	    err |= control (buf, "write enable control", wectrl, inst->header.mask_control, &space);
 	else
-	    err |= control (file, "mask control", mask_ctrl, inst->header.mask_control, &space);
-	err |= control (file, "dependency control", dep_ctrl, inst->header.dependency_control, &space);
+	    err |= control (buf, "mask control", mask_ctrl, inst->header.mask_control, &space);
+	err |= control (buf, "dependency control", dep_ctrl, inst->header.dependency_control, &space);
 
 	if (gen >= 6)
-	    err |= qtr_ctrl (file, inst);
+	    err |= qtr_ctrl (buf, inst);
 	else {
 	    if (inst->header.compression_control == BRW_COMPRESSION_COMPRESSED &&
 		opcode[inst->header.opcode].ndst > 0 &&
 		inst->bits1.da1.dest_reg_file == BRW_MESSAGE_REGISTER_FILE &&
 		inst->bits1.da1.dest_reg_nr & (1 << 7)) {
-		format (file, " compr4");
+		format (buf, " compr4");
 	    } else {
-		err |= control (file, "compression control", compr_ctrl,
+		err |= control (buf, "compression control", compr_ctrl,
 				inst->header.compression_control, &space);
 	    }
 	}
 
-	err |= control (file, "thread control", thread_ctrl, inst->header.thread_control, &space);
+	err |= control (buf, "thread control", thread_ctrl, inst->header.thread_control, &space);
 	if (gen >= 6)
-	    err |= control (file, "acc write control", accwr, inst->header.acc_wr_control, &space);
+	    err |= control (buf, "acc write control", accwr, inst->header.acc_wr_control, &space);
 	if (inst->header.opcode == BRW_OPCODE_SEND ||
 	    inst->header.opcode == BRW_OPCODE_SENDC)
-	    err |= control (file, "end of thread", end_of_thread,
+	    err |= control (buf, "end of thread", end_of_thread,
 			    inst->bits3.generic.end_of_thread, &space);
 	if (space)
-	    string (file, " ");
-	string (file, "}");
+	    string (buf, " ");
+	string (buf, "}");
     }
-    string (file, ";");
-    newline (file);
+    string (buf, ";");
+    newline (buf);
+    return err;
+}
+
+int brw_disasm (FILE *file, struct brw_instruction *inst, int gen)
+{
+    struct brw_disasm_buf buf;
+    int err;
+
+    memset (&buf, 0, sizeof (buf));
+    err = brw_disasm_buf (&buf, inst, gen);
+    fwrite (buf.str, 1, buf.len, file);
+    brw_disasm_buf_fini (&buf);
     return err;
 }
@@ -403,7 +403,8 @@ brw_set_3src_src2(struct brw_compile *p,
 
 /* brw_eu_compact.c */
 void brw_init_compaction_tables(struct intel_context *intel);
-void brw_compact_instructions(struct brw_compile *p);
+void brw_compact_instructions(struct brw_compile *p,
+			      int num_offsets, int *offsets);
 void brw_uncompact_instruction(struct intel_context *intel,
 			       struct brw_instruction *dst,
 			       struct brw_compact_instruction *src);
@@ -411,6 +412,41 @@ bool brw_try_compact_instruction(struct brw_compile *p,
                                  struct brw_compact_instruction *dst,
                                  struct brw_instruction *src);
 
+/* Why brw_try_compact_instruction() turned an instruction down */
+enum brw_compaction_miss {
+   BRW_COMPACTION_MISS_FLOW_CONTROL,
+   BRW_COMPACTION_MISS_IMMEDIATE,
+   BRW_COMPACTION_MISS_CONTROL_INDEX,
+   BRW_COMPACTION_MISS_DATATYPE,
+   BRW_COMPACTION_MISS_SUBREG,
+   BRW_COMPACTION_MISS_SRC0_INDEX,
+   BRW_COMPACTION_MISS_SRC1_INDEX,
+   BRW_COMPACTION_MISS_COUNT
+};
+
+struct brw_compaction_pattern {
+   uint32_t bits;
+   unsigned int count;
+};
+
+struct brw_compaction_stats {
+   int gen;
+   unsigned int instructions;
+   unsigned int compacted;
+   unsigned int misses[BRW_COMPACTION_MISS_COUNT];
+
+   /* the distinct uncompacted field values behind each table miss */
+   struct brw_compaction_pattern *patterns[BRW_COMPACTION_MISS_COUNT];
+   unsigned int num_patterns[BRW_COMPACTION_MISS_COUNT];
+};
+
+void brw_compaction_stats_add(struct brw_compile *p,
+                              struct brw_compaction_stats *stats,
+                              struct brw_instruction *src);
+void brw_compaction_stats_print(FILE *out, const char *name,
+                                struct brw_compaction_stats *stats);
+void brw_compaction_stats_fini(struct brw_compaction_stats *stats);
+
 void brw_debug_compact_uncompact(struct intel_context *intel,
 				 struct brw_instruction *orig,
 				 struct brw_instruction *uncompacted);
@@ -37,6 +37,7 @@
  * instruction in 8 bytes using some lookup tables for various fields.
  */
 
+#include <stdlib.h>
 #include <string.h>
 
 #include "brw_compat.h"
@@ -323,15 +324,33 @@ static const uint32_t gen7_src_index_table[32] = {
    0b010110001000
 };
 
-static const uint32_t *control_index_table;
-static const uint32_t *datatype_table;
-static const uint32_t *subreg_table;
-static const uint32_t *src_index_table;
+static inline uint32_t
+compaction_hash(uint32_t uncompacted)
+{
+   return (uncompacted * 0x9e3779b1) >> (32 - BRW_COMPACTION_HASH_BITS);
+}
 
+/**
+ * Looks up the index of the uncompacted bits in table, if there is one.
+ */
 static bool
-set_control_index(struct intel_context *intel,
-                  struct brw_compact_instruction *dst,
-                  struct brw_instruction *src)
+compaction_lookup(const struct brw_compaction_table *table,
+                  uint32_t uncompacted, uint32_t *compacted)
+{
+   const uint32_t mask = ARRAY_SIZE(table->keys) - 1;
+
+   for (uint32_t h = compaction_hash(uncompacted); ; h = (h + 1) & mask) {
+      if (table->index[h] < 0)
+	 return false;
+      if (table->keys[h] == uncompacted) {
+	 *compacted = table->index[h];
+	 return true;
+      }
+   }
+}
+
+static uint32_t
+get_control_bits(struct intel_context *intel, struct brw_instruction *src)
 {
    uint32_t *src_u32 = (uint32_t *)src;
    uint32_t uncompacted = 0;
@@ -344,38 +363,22 @@ set_control_index(struct intel_context *intel,
    if (intel->gen >= 7)
       uncompacted |= ((src_u32[2] >> 25) & 0x3) << 17;
 
-   for (int i = 0; i < 32; i++) {
-      if (control_index_table[i] == uncompacted) {
-	 dst->dw0.control_index = i;
-	 return true;
-      }
-   }
-
-   return false;
+   return uncompacted;
 }
 
-static bool
-set_datatype_index(struct brw_compact_instruction *dst,
-                   struct brw_instruction *src)
+static uint32_t
+get_datatype_bits(struct brw_instruction *src)
 {
    uint32_t uncompacted = 0;
 
    uncompacted |= src->bits1.ud & 0x7fff;
    uncompacted |= (src->bits1.ud >> 29) << 15;
 
-   for (int i = 0; i < 32; i++) {
-      if (datatype_table[i] == uncompacted) {
-	 dst->dw0.data_type_index = i;
-	 return true;
-      }
-   }
-
-   return false;
+   return uncompacted;
 }
 
-static bool
-set_subreg_index(struct brw_compact_instruction *dst,
-                 struct brw_instruction *src)
+static uint32_t
+get_subreg_bits(struct brw_instruction *src)
 {
    uint32_t uncompacted = 0;
 
@@ -383,39 +386,91 @@ set_subreg_index(struct brw_compact_instruction *dst,
    uncompacted |= src->bits2.da1.src0_subreg_nr << 5;
    uncompacted |= src->bits3.da1.src1_subreg_nr << 10;
 
-   for (int i = 0; i < 32; i++) {
-      if (subreg_table[i] == uncompacted) {
-	 dst->dw0.sub_reg_index = i;
-	 return true;
-      }
-   }
+   return uncompacted;
+}
+
+static uint32_t
+get_src0_bits(struct brw_instruction *src)
+{
+   return (src->bits2.ud >> 13) & 0xfff;
+}
+
+static uint32_t
+get_src1_bits(struct brw_instruction *src)
+{
+   return (src->bits3.ud >> 13) & 0xfff;
+}
+
+static bool
+set_control_index(struct intel_context *intel,
+                  struct brw_compact_instruction *dst,
+                  struct brw_instruction *src)
+{
+   struct brw_context *brw = (struct brw_context *)intel;
+   uint32_t compacted;
+
+   if (!compaction_lookup(&brw->compaction.control_index,
+                          get_control_bits(intel, src), &compacted))
+      return false;
 
-   return false;
+   dst->dw0.control_index = compacted;
+
+   return true;
+}
+
+static bool
+set_datatype_index(struct intel_context *intel,
+                   struct brw_compact_instruction *dst,
+                   struct brw_instruction *src)
+{
+   struct brw_context *brw = (struct brw_context *)intel;
+   uint32_t compacted;
+
+   if (!compaction_lookup(&brw->compaction.datatype, get_datatype_bits(src),
+                          &compacted))
+      return false;
+
+   dst->dw0.data_type_index = compacted;
+
+   return true;
 }
 
 static bool
-get_src_index(uint32_t uncompacted,
+set_subreg_index(struct intel_context *intel,
+                 struct brw_compact_instruction *dst,
+                 struct brw_instruction *src)
+{
+   struct brw_context *brw = (struct brw_context *)intel;
+   uint32_t compacted;
+
+   if (!compaction_lookup(&brw->compaction.subreg, get_subreg_bits(src),
+                          &compacted))
+      return false;
+
+   dst->dw0.sub_reg_index = compacted;
+
+   return true;
+}
+
+static bool
+get_src_index(struct intel_context *intel,
+              uint32_t uncompacted,
               uint32_t *compacted)
 {
-   for (int i = 0; i < 32; i++) {
-      if (src_index_table[i] == uncompacted) {
-	 *compacted = i;
-	 return true;
-      }
-   }
+   struct brw_context *brw = (struct brw_context *)intel;
 
-   return false;
+   return compaction_lookup(&brw->compaction.src_index, uncompacted,
+                            compacted);
 }
 
 static bool
-set_src0_index(struct brw_compact_instruction *dst,
+set_src0_index(struct intel_context *intel,
+               struct brw_compact_instruction *dst,
                struct brw_instruction *src)
 {
-   uint32_t compacted, uncompacted = 0;
-
-   uncompacted |= (src->bits2.ud >> 13) & 0xfff;
+   uint32_t compacted;
 
-   if (!get_src_index(uncompacted, &compacted))
+   if (!get_src_index(intel, get_src0_bits(src), &compacted))
       return false;
 
    dst->dw0.src0_index = compacted & 0x3;
@@ -425,14 +480,13 @@ set_src0_index(struct brw_compact_instruction *dst,
 }
 
 static bool
-set_src1_index(struct brw_compact_instruction *dst,
+set_src1_index(struct intel_context *intel,
+               struct brw_compact_instruction *dst,
                struct brw_instruction *src)
 {
-   uint32_t compacted, uncompacted = 0;
+   uint32_t compacted;
 
-   uncompacted |= (src->bits3.ud >> 13) & 0xfff;
-
-   if (!get_src_index(uncompacted, &compacted))
+   if (!get_src_index(intel, get_src1_bits(src), &compacted))
       return false;
 
    dst->dw1.src1_index = compacted;
@@ -446,15 +500,9 @@ set_src1_index(struct brw_compact_instruction *dst,
  * It doesn't modify dst unless src is compactable, which is relied on by
  * brw_compact_instructions().
  */
-bool
-brw_try_compact_instruction(struct brw_compile *p,
-                            struct brw_compact_instruction *dst,
-                            struct brw_instruction *src)
+static bool
+is_flow_control(struct intel_context *intel, struct brw_instruction *src)
 {
-   struct brw_context *brw = p->brw;
-   struct intel_context *intel = &brw->intel;
-   struct brw_compact_instruction temp;
-
    if (src->header.opcode == BRW_OPCODE_IF ||
        src->header.opcode == BRW_OPCODE_ELSE ||
        src->header.opcode == BRW_OPCODE_ENDIF ||
@@ -464,12 +512,40 @@ brw_try_compact_instruction(struct brw_compile *p,
       /* FINISHME: The fixup code below, and brw_set_uip_jip and friends, needs
        * to be able to handle compacted flow control instructions..
        */
-      return false;
+      return true;
    }
 
+   /* The assembler doesn't give these an immediate src1, but their jump
+    * targets live in the bits compaction would drop.
+    */
+   return src->header.opcode == BRW_OPCODE_BREAK ||
+          src->header.opcode == BRW_OPCODE_CONTINUE ||
+          src->header.opcode == BRW_OPCODE_CALL ||
+          (intel->gen >= 7 && (src->header.opcode == BRW_OPCODE_BRD ||
+                               src->header.opcode == BRW_OPCODE_BRC));
+}
+
+static bool
+has_immediate(struct brw_instruction *src)
+{
+   return src->bits1.da1.src0_reg_file == BRW_IMMEDIATE_VALUE ||
+          src->bits1.da1.src1_reg_file == BRW_IMMEDIATE_VALUE;
+}
+
+bool
+brw_try_compact_instruction(struct brw_compile *p,
+                            struct brw_compact_instruction *dst,
+                            struct brw_instruction *src)
+{
+   struct brw_context *brw = p->brw;
+   struct intel_context *intel = &brw->intel;
+   struct brw_compact_instruction temp;
+
+   if (is_flow_control(intel, src))
+      return false;
+
    /* FINISHME: immediates */
-   if (src->bits1.da1.src0_reg_file == BRW_IMMEDIATE_VALUE ||
-       src->bits1.da1.src1_reg_file == BRW_IMMEDIATE_VALUE)
+   if (has_immediate(src))
       return false;
 
    memset(&temp, 0, sizeof(temp));
@@ -478,18 +554,18 @@ brw_try_compact_instruction(struct brw_compile *p,
    temp.dw0.debug_control = src->header.debug_control;
    if (!set_control_index(intel, &temp, src))
       return false;
-   if (!set_datatype_index(&temp, src))
+   if (!set_datatype_index(intel, &temp, src))
       return false;
-   if (!set_subreg_index(&temp, src))
+   if (!set_subreg_index(intel, &temp, src))
       return false;
    temp.dw0.acc_wr_control = src->header.acc_wr_control;
    temp.dw0.conditionalmod = src->header.destreg__conditionalmod;
    if (intel->gen <= 6)
       temp.dw0.flag_subreg_nr = src->bits2.da1.flag_subreg_nr;
    temp.dw0.cmpt_ctrl = 1;
-   if (!set_src0_index(&temp, src))
+   if (!set_src0_index(intel, &temp, src))
       return false;
-   if (!set_src1_index(&temp, src))
+   if (!set_src1_index(intel, &temp, src))
       return false;
    temp.dw1.dst_reg_nr = src->bits1.da1.dest_reg_nr;
    temp.dw1.src0_reg_nr = src->bits2.da1.src0_reg_nr;
@@ -500,13 +576,173 @@ brw_try_compact_instruction(struct brw_compile *p,
    return true;
 }
 
+static void
+add_compaction_miss(struct brw_compaction_stats *stats,
+                    enum brw_compaction_miss miss, uint32_t bits)
+{
+   struct brw_compaction_pattern *patterns = stats->patterns[miss];
+   unsigned int n = stats->num_patterns[miss];
+
+   stats->misses[miss]++;
+
+   for (unsigned int i = 0; i < n; i++) {
+      if (patterns[i].bits == bits) {
+	 patterns[i].count++;
+	 return;
+      }
+   }
+
+   /* the array grows in powers of two, from 4 */
+   if (n == 0 || (n >= 4 && (n & (n - 1)) == 0)) {
+      patterns = realloc(patterns, (n ? n * 2 : 4) * sizeof(*patterns));
+      if (patterns == NULL)
+	 return;
+      stats->patterns[miss] = patterns;
+   }
+   patterns[n].bits = bits;
+   patterns[n].count = 1;
+   stats->num_patterns[miss]++;
+}
+
+/**
+ * Records whether src compacts and, if it doesn't, why not.
+ *
+ * Every table lookup that misses is counted, not just the first one
+ * brw_try_compact_instruction() gives up at, so an instruction can show
+ * up under several reasons.
+ */
+void
+brw_compaction_stats_add(struct brw_compile *p,
+                         struct brw_compaction_stats *stats,
+                         struct brw_instruction *src)
+{
+   struct brw_context *brw = p->brw;
+   struct intel_context *intel = &brw->intel;
+   struct brw_compact_instruction temp;
+   uint32_t compacted, bits;
+
+   stats->gen = intel->gen;
+   stats->instructions++;
+
+   if (brw_try_compact_instruction(p, &temp, src)) {
+      stats->compacted++;
+      return;
+   }
+
+   if (is_flow_control(intel, src)) {
+      stats->misses[BRW_COMPACTION_MISS_FLOW_CONTROL]++;
+      return;
+   }
+   if (has_immediate(src)) {
+      stats->misses[BRW_COMPACTION_MISS_IMMEDIATE]++;
+      return;
+   }
+
+   bits = get_control_bits(intel, src);
+   if (!compaction_lookup(&brw->compaction.control_index, bits, &compacted))
+      add_compaction_miss(stats, BRW_COMPACTION_MISS_CONTROL_INDEX, bits);
+   bits = get_datatype_bits(src);
+   if (!compaction_lookup(&brw->compaction.datatype, bits, &compacted))
+      add_compaction_miss(stats, BRW_COMPACTION_MISS_DATATYPE, bits);
+   bits = get_subreg_bits(src);
+   if (!compaction_lookup(&brw->compaction.subreg, bits, &compacted))
+      add_compaction_miss(stats, BRW_COMPACTION_MISS_SUBREG, bits);
+   bits = get_src0_bits(src);
+   if (!compaction_lookup(&brw->compaction.src_index, bits, &compacted))
+      add_compaction_miss(stats, BRW_COMPACTION_MISS_SRC0_INDEX, bits);
+   bits = get_src1_bits(src);
+   if (!compaction_lookup(&brw->compaction.src_index, bits, &compacted))
+      add_compaction_miss(stats, BRW_COMPACTION_MISS_SRC1_INDEX, bits);
+}
+
+static int
+compare_patterns(const void *a, const void *b)
+{
+   const struct brw_compaction_pattern *pa = a, *pb = b;
+
+   if (pa->count != pb->count)
+      return pa->count < pb->count ? 1 : -1;
+   return pa->bits < pb->bits ? -1 : pa->bits > pb->bits;
+}
+
+/**
+ * Prints the compaction ratio and the miss histogram, with the most
+ * common uncompacted bit patterns of each table miss in the same binary
+ * notation as the tables above.
+ */
+void
+brw_compaction_stats_print(FILE *out, const char *name,
+                           struct brw_compaction_stats *stats)
+{
+   static const struct {
+      const char *name;
+      int bits;
+   } reasons[BRW_COMPACTION_MISS_COUNT] = {
+      [BRW_COMPACTION_MISS_FLOW_CONTROL] = { "flow control", 0 },
+      [BRW_COMPACTION_MISS_IMMEDIATE] = { "immediate", 0 },
+      [BRW_COMPACTION_MISS_CONTROL_INDEX] = { "control index", 17 },
+      [BRW_COMPACTION_MISS_DATATYPE] = { "datatype", 18 },
+      [BRW_COMPACTION_MISS_SUBREG] = { "subreg", 15 },
+      [BRW_COMPACTION_MISS_SRC0_INDEX] = { "src0 index", 12 },
+      [BRW_COMPACTION_MISS_SRC1_INDEX] = { "src1 index", 12 },
+   };
+   const unsigned int max_patterns = 8;
+
+   flockfile(out);
+
+   fprintf(out, "%s: %u of %u instructions compacted (%u%%)\n", name,
+           stats->compacted, stats->instructions,
+           stats->instructions ?
+           stats->compacted * 100 / stats->instructions : 0);
+
+   for (int i = 0; i < BRW_COMPACTION_MISS_COUNT; i++) {
+      struct brw_compaction_pattern *patterns = stats->patterns[i];
+      unsigned int n = stats->num_patterns[i];
+
+      int width = reasons[i].bits;
+
+      if (stats->misses[i] == 0)
+	 continue;
+
+      /* gen7 adds the flag register number to the control index */
+      if (i == BRW_COMPACTION_MISS_CONTROL_INDEX && stats->gen >= 7)
+	 width += 2;
+
+      fprintf(out, "%s:   %-20s %8u\n", name, reasons[i].name,
+              stats->misses[i]);
+
+      qsort(patterns, n, sizeof(*patterns), compare_patterns);
+      for (unsigned int j = 0; j < n && j < max_patterns; j++) {
+	 fprintf(out, "%s:     0b", name);
+	 for (int bit = width - 1; bit >= 0; bit--)
+	    fputc('0' + ((patterns[j].bits >> bit) & 1), out);
+	 fprintf(out, " %*u\n", 24 - width, patterns[j].count);
+      }
+      if (n > max_patterns)
+	 fprintf(out, "%s:     ... %u more patterns\n", name,
+                 n - max_patterns);
+   }
+
+   funlockfile(out);
+}
+
+void
+brw_compaction_stats_fini(struct brw_compaction_stats *stats)
+{
+   for (int i = 0; i < BRW_COMPACTION_MISS_COUNT; i++)
+      free(stats->patterns[i]);
+   memset(stats, 0, sizeof(*stats));
+}
+
 static void
 set_uncompacted_control(struct intel_context *intel,
                         struct brw_instruction *dst,
                         struct brw_compact_instruction *src)
 {
+   struct brw_context *brw = (struct brw_context *)intel;
    uint32_t *dst_u32 = (uint32_t *)dst;
-   uint32_t uncompacted = control_index_table[src->dw0.control_index];
+   uint32_t uncompacted =
+      brw->compaction.control_index.table[src->dw0.control_index];
 
    dst_u32[0] |= ((uncompacted >> 0) & 0xffff) << 8;
    dst_u32[0] |= ((uncompacted >> 16) & 0x1) << 31;
@@ -516,10 +752,12 @@ set_uncompacted_control(struct intel_context *intel,
 }
 
 static void
-set_uncompacted_datatype(struct brw_instruction *dst,
+set_uncompacted_datatype(struct intel_context *intel,
+                         struct brw_instruction *dst,
                          struct brw_compact_instruction *src)
 {
-   uint32_t uncompacted = datatype_table[src->dw0.data_type_index];
+   struct brw_context *brw = (struct brw_context *)intel;
+   uint32_t uncompacted = brw->compaction.datatype.table[src->dw0.data_type_index];
 
    dst->bits1.ud &= ~(0x7 << 29);
    dst->bits1.ud |= ((uncompacted >> 15) & 0x7) << 29;
@@ -528,10 +766,12 @@ set_uncompacted_datatype(struct brw_instruction *dst,
 }
 
 static void
-set_uncompacted_subreg(struct brw_instruction *dst,
+set_uncompacted_subreg(struct intel_context *intel,
+                       struct brw_instruction *dst,
                        struct brw_compact_instruction *src)
 {
-   uint32_t uncompacted = subreg_table[src->dw0.sub_reg_index];
+   struct brw_context *brw = (struct brw_context *)intel;
+   uint32_t uncompacted = brw->compaction.subreg.table[src->dw0.sub_reg_index];
 
    dst->bits1.da1.dest_subreg_nr = (uncompacted >> 0)  & 0x1f;
    dst->bits2.da1.src0_subreg_nr = (uncompacted >> 5)  & 0x1f;
@@ -539,20 +779,24 @@ set_uncompacted_subreg(struct brw_instruction *dst,
 }
 
 static void
-set_uncompacted_src0(struct brw_instruction *dst,
+set_uncompacted_src0(struct intel_context *intel,
+                     struct brw_instruction *dst,
                      struct brw_compact_instruction *src)
 {
+   struct brw_context *brw = (struct brw_context *)intel;
    uint32_t compacted = src->dw0.src0_index | src->dw1.src0_index << 2;
-   uint32_t uncompacted = src_index_table[compacted];
+   uint32_t uncompacted = brw->compaction.src_index.table[compacted];
 
    dst->bits2.ud |= uncompacted << 13;
 }
 
 static void
-set_uncompacted_src1(struct brw_instruction *dst,
+set_uncompacted_src1(struct intel_context *intel,
+                     struct brw_instruction *dst,
                      struct brw_compact_instruction *src)
 {
-   uint32_t uncompacted = src_index_table[src->dw1.src1_index];
+   struct brw_context *brw = (struct brw_context *)intel;
+   uint32_t uncompacted = brw->compaction.src_index.table[src->dw1.src1_index];
 
    dst->bits3.ud |= uncompacted << 13;
 }
@@ -568,14 +812,14 @@ brw_uncompact_instruction(struct intel_context *intel,
    dst->header.debug_control = src->dw0.debug_control;
 
    set_uncompacted_control(intel, dst, src);
-   set_uncompacted_datatype(dst, src);
-   set_uncompacted_subreg(dst, src);
+   set_uncompacted_datatype(intel, dst, src);
+   set_uncompacted_subreg(intel, dst, src);
    dst->header.acc_wr_control = src->dw0.acc_wr_control;
    dst->header.destreg__conditionalmod = src->dw0.conditionalmod;
    if (intel->gen <= 6)
       dst->bits2.da1.flag_subreg_nr = src->dw0.flag_subreg_nr;
-   set_uncompacted_src0(dst, src);
-   set_uncompacted_src1(dst, src);
+   set_uncompacted_src0(intel, dst, src);
+   set_uncompacted_src1(intel, dst, src);
    dst->bits1.da1.dest_reg_nr = src->dw1.dst_reg_nr;
    dst->bits2.da1.src0_reg_nr = src->dw1.src0_reg_nr;
    dst->bits3.da1.src1_reg_nr = src->dw1.src1_reg_nr;
@@ -634,9 +878,61 @@ update_uip_jip(struct brw_instruction *insn, int this_old_ip,
                                                    compacted_counts);
 }
 
+/* JIP of a Gen6+ CALL or JMPI, which is a full dword. */
+static void
+update_jip(struct intel_context *intel, struct brw_instruction *insn,
+           int this_old_ip, int *compacted_counts)
+{
+   int scale = 1, next = 0;
+   int target_old_ip;
+
+   /* JMPI is relative to the instruction after it, which it can't be
+    * compacted into since its offset is an immediate.  Haswell counts JMPI
+    * offsets in bytes rather than 8 byte units.
+    */
+   if (insn->header.opcode == BRW_OPCODE_JMPI) {
+      next = 2;
+      if (intel->is_haswell)
+         scale = 8;
+   }
+
+   target_old_ip = this_old_ip + next + insn->bits3.JIP / scale;
+   insn->bits3.JIP -= scale * compacted_between(this_old_ip, target_old_ip,
+                                                compacted_counts);
+}
+
+/**
+ * Hashes the 32 entries of table for compaction_lookup().  Where a value
+ * appears more than once, the first index is kept, as a linear search
+ * would find.
+ */
+static void
+init_compaction_table(struct brw_compaction_table *hash,
+                      const uint32_t *table)
+{
+   const uint32_t mask = ARRAY_SIZE(hash->keys) - 1;
+
+   hash->table = table;
+   memset(hash->index, -1, sizeof(hash->index));
+
+   for (int i = 0; i < 32; i++) {
+      uint32_t h = compaction_hash(table[i]);
+
+      while (hash->index[h] >= 0 && hash->keys[h] != table[i])
+	 h = (h + 1) & mask;
+
+      if (hash->index[h] < 0) {
+	 hash->keys[h] = table[i];
+	 hash->index[h] = i;
+      }
+   }
+}
+
 void
 brw_init_compaction_tables(struct intel_context *intel)
 {
+   struct brw_context *brw = (struct brw_context *)intel;
+
    assert(gen6_control_index_table[ARRAY_SIZE(gen6_control_index_table) - 1] != 0);
    assert(gen6_datatype_table[ARRAY_SIZE(gen6_datatype_table) - 1] != 0);
    assert(gen6_subreg_table[ARRAY_SIZE(gen6_subreg_table) - 1] != 0);
@@ -648,40 +944,61 @@ brw_init_compaction_tables(struct intel_context *intel)
 
    switch (intel->gen) {
    case 7:
-      control_index_table = gen7_control_index_table;
-      datatype_table = gen7_datatype_table;
-      subreg_table = gen7_subreg_table;
-      src_index_table = gen7_src_index_table;
+      init_compaction_table(&brw->compaction.control_index,
+                            gen7_control_index_table);
+      init_compaction_table(&brw->compaction.datatype, gen7_datatype_table);
+      init_compaction_table(&brw->compaction.subreg, gen7_subreg_table);
+      init_compaction_table(&brw->compaction.src_index, gen7_src_index_table);
       break;
    case 6:
-      control_index_table = gen6_control_index_table;
-      datatype_table = gen6_datatype_table;
-      subreg_table = gen6_subreg_table;
-      src_index_table = gen6_src_index_table;
+      init_compaction_table(&brw->compaction.control_index,
+                            gen6_control_index_table);
+      init_compaction_table(&brw->compaction.datatype, gen6_datatype_table);
+      init_compaction_table(&brw->compaction.subreg, gen6_subreg_table);
+      init_compaction_table(&brw->compaction.src_index, gen6_src_index_table);
       break;
    default:
       return;
    }
 }
 
+/**
+ * Compacts the program in p->store and fixes up its jumps.
+ *
+ * \p offsets are \p num_offsets byte offsets of instructions in the
+ * uncompacted program (or of its end), e.g. label positions, and are
+ * updated to where those instructions end up.
+ */
 void
-brw_compact_instructions(struct brw_compile *p)
+brw_compact_instructions(struct brw_compile *p, int num_offsets, int *offsets)
 {
    struct brw_context *brw = p->brw;
    struct intel_context *intel = &brw->intel;
    void *store = p->store;
    /* For an instruction at byte offset 8*i before compaction, this is the number
-    * of compacted instructions that preceded it.
+    * of compacted instructions that preceded it, less any alignment NOPs
+    * inserted.  The extra entry is for the end of the program.
+    *
+    * Assembled kernels can be much larger than the stack, so these aren't
+    * kept there.
     */
-   int compacted_counts[p->next_insn_offset / 8];
+   int *compacted_counts;
    /* For an instruction at byte offset 8*i after compaction, this is the
     * 8-byte offset it was at before compaction.
     */
-   int old_ip[p->next_insn_offset / 8];
+   int *old_ip;
 
    if (intel->gen < 6)
       return;
 
+   compacted_counts = calloc(p->next_insn_offset / 8 + 1, sizeof(int));
+   old_ip = calloc(p->next_insn_offset / 8 + 1, sizeof(int));
+   if (compacted_counts == NULL || old_ip == NULL) {
+      free(compacted_counts);
+      free(old_ip);
+      return;
+   }
+
    int src_offset;
    int offset = 0;
    int compacted_count = 0;
@@ -725,6 +1042,7 @@ brw_compact_instructions(struct brw_compile *p)
             offset += 8;
             old_ip[offset / 8] = src_offset / 8;
             dst = store + offset;
+            compacted_counts[src_offset / 8] = --compacted_count;
          }
 
          /* If we didn't compact this intruction, we need to move it down into
@@ -738,6 +1056,8 @@ brw_compact_instructions(struct brw_compile *p)
       }
    }
 
+   compacted_counts[src_offset / 8] = compacted_count;
+
    /* Fix up control flow offsets. */
    p->next_insn_offset = offset;
    for (offset = 0; offset < p->next_insn_offset;) {
@@ -766,6 +1086,17 @@ brw_compact_instructions(struct brw_compile *p)
             update_uip_jip(insn, this_old_ip, compacted_counts);
          }
          break;
+
+      case BRW_OPCODE_BRD:
+      case BRW_OPCODE_BRC:
+         if (intel->gen >= 7)
+            update_uip_jip(insn, this_old_ip, compacted_counts);
+         break;
+
+      case BRW_OPCODE_CALL:
+      case BRW_OPCODE_JMPI:
+         update_jip(intel, insn, this_old_ip, compacted_counts);
+         break;
       }
 
       if (insn->header.cmpt_control) {
@@ -789,6 +1120,12 @@ brw_compact_instructions(struct brw_compile *p)
    }
    p->nr_insn = p->next_insn_offset / 16;
 
+   for (int i = 0; i < num_offsets; i++)
+      offsets[i] -= 8 * compacted_counts[offsets[i] / 8];
+
+   free(compacted_counts);
+   free(old_ip);
+
    if (0) {
       fprintf(stdout, "dumping compacted program\n");
       brw_dump_compile(p, stdout, 0, p->next_insn_offset);
@@ -0,0 +1,1692 @@
+/*
+ * Copyright © 2013 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#include <inttypes.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "brw_sim.h"
+#include "brw_eu.h"
+
+#define MAX_CHANNELS	BRW_SIM_MAX_CHANNELS
+
+enum sim_file {
+	SIM_NULL,
+	SIM_GRF,
+	SIM_MRF,
+	SIM_ACC,
+	SIM_ADDRESS,
+	SIM_CONTROL,
+	SIM_FLAG,
+	SIM_IMM,
+};
+
+/* Where each channel's element of an operand is */
+struct sim_operand {
+	uint8_t file;
+	uint8_t type;			/* vector immediates as their elements */
+	bool abs, negate;
+	uint16_t offset[MAX_CHANNELS];	/* in bytes from the file's start */
+	uint32_t imm[8];		/* immediates, by channel modulo 8 */
+
+	/* register-indirect: offsets are from a0.address plus displacement */
+	bool indirect;
+	uint8_t address;
+	int16_t displacement;
+};
+
+struct brw_sim_insn {
+	const char *unsupported;	/* why it can't be executed, or NULL */
+	unsigned int opcode;
+	unsigned int exec_size;
+	unsigned int group;		/* channel the execution size starts at */
+	unsigned int nsrc;
+	bool float_exec;		/* arithmetic in float rather than int */
+	unsigned int flag;		/* f0.0, f0.1, f1.0, f1.1 as 0-3 */
+	uint32_t write_mask;		/* channels the align16 writemask keeps */
+	struct sim_operand dst, src[3];
+	int target[2];			/* instruction indices of jumps, or -1 */
+};
+
+union sim_value {
+	float f;
+	int64_t i;
+};
+
+static const unsigned int type_size[8] = {
+	[BRW_REGISTER_TYPE_UD] = 4,
+	[BRW_REGISTER_TYPE_D] = 4,
+	[BRW_REGISTER_TYPE_UW] = 2,
+	[BRW_REGISTER_TYPE_W] = 2,
+	[BRW_REGISTER_TYPE_UB] = 1,
+	[BRW_REGISTER_TYPE_B] = 1,
+	[BRW_REGISTER_TYPE_F] = 4,
+};
+
+static unsigned int decode_stride(unsigned int encoding)
+{
+	return encoding ? 1 << (encoding - 1) : 0;
+}
+
+static unsigned int file_size(unsigned int file)
+{
+	switch (file) {
+	case SIM_GRF:
+		return BRW_CFG_NUM_GRF * REG_SIZE;
+	case SIM_MRF:
+		return BRW_CFG_NUM_MRF * REG_SIZE;
+	case SIM_ACC:
+		return 2 * REG_SIZE;
+	case SIM_ADDRESS:
+	case SIM_CONTROL:
+		return REG_SIZE;
+	case SIM_FLAG:
+		return 8;
+	default:
+		return 0;
+	}
+}
+
+static uint8_t *file_base(struct brw_sim *sim, unsigned int file)
+{
+	switch (file) {
+	case SIM_GRF:
+		return sim->grf;
+	case SIM_MRF:
+		return sim->mrf;
+	case SIM_ACC:
+		return sim->acc;
+	case SIM_ADDRESS:
+		return sim->address;
+	case SIM_CONTROL:
+		return sim->control;
+	case SIM_FLAG:
+		return (uint8_t *)sim->flag;
+	default:
+		return NULL;
+	}
+}
+
+/*
+ * Points the operand at a register file, returning the byte offset of
+ * register nr in it, or -1 if it isn't something we simulate.
+ */
+static int set_file(const struct brw_cfg *cfg, struct sim_operand *op,
+		    unsigned int file, unsigned int nr)
+{
+	switch (file) {
+	case BRW_GENERAL_REGISTER_FILE:
+		op->file = SIM_GRF;
+		return nr * REG_SIZE;
+	case BRW_MESSAGE_REGISTER_FILE:
+		/* gen7 has none, and COMPR4 interleaves the halves */
+		if (cfg->gen >= 70 || (nr & BRW_MRF_COMPR4) ||
+		    nr >= BRW_CFG_NUM_MRF)
+			return -1;
+		op->file = SIM_MRF;
+		return nr * REG_SIZE;
+	case BRW_ARCHITECTURE_REGISTER_FILE:
+		switch (nr & 0xf0) {
+		case BRW_ARF_NULL:
+			op->file = SIM_NULL;
+			return 0;
+		case BRW_ARF_ACCUMULATOR:
+			op->file = SIM_ACC;
+			return (nr & 1) * REG_SIZE;
+		case BRW_ARF_FLAG:
+			op->file = SIM_FLAG;
+			return (nr & 1) * 4;
+		case BRW_ARF_ADDRESS:
+			op->file = SIM_ADDRESS;
+			return 0;
+		case BRW_ARF_CONTROL:
+			op->file = SIM_CONTROL;
+			return 0;
+		default:
+			return -1;
+		}
+	default:
+		return -1;
+	}
+}
+
+/* Checks every channel's element is inside the file */
+static bool in_file(const struct sim_operand *op, unsigned int exec_size)
+{
+	unsigned int c, size = type_size[op->type];
+
+	if (op->file == SIM_NULL || op->file == SIM_IMM)
+		return true;
+	for (c = 0; c < exec_size; c++)
+		if (op->offset[c] + size > file_size(op->file))
+			return false;
+	return true;
+}
+
+/* The restricted 8 bit floats of VF immediates */
+static uint32_t vf_to_float(unsigned int vf)
+{
+	if ((vf & 0x7f) == 0)
+		return (vf & 0x80) << 24;
+	return (vf & 0x80) << 24 | (((vf >> 4) & 7) + 124) << 23 |
+	       (vf & 0xf) << 19;
+}
+
+static const char *decode_imm(struct sim_operand *op, unsigned int type,
+			      uint32_t value)
+{
+	unsigned int i;
+
+	op->file = SIM_IMM;
+	op->type = type;
+	switch (type) {
+	case BRW_REGISTER_TYPE_UD:
+	case BRW_REGISTER_TYPE_D:
+	case BRW_REGISTER_TYPE_F:
+		for (i = 0; i < 8; i++)
+			op->imm[i] = value;
+		return NULL;
+	case BRW_REGISTER_TYPE_UW:
+	case BRW_REGISTER_TYPE_W:
+		for (i = 0; i < 8; i++)
+			op->imm[i] = value & 0xffff;
+		return NULL;
+	case BRW_REGISTER_TYPE_VF:
+		op->type = BRW_REGISTER_TYPE_F;
+		for (i = 0; i < 8; i++)
+			op->imm[i] = vf_to_float(value >> (i % 4 * 8) & 0xff);
+		return NULL;
+	case BRW_REGISTER_TYPE_V:
+		op->type = BRW_REGISTER_TYPE_W;
+		for (i = 0; i < 8; i++)
+			op->imm[i] = (uint32_t)((int32_t)(value << (28 - 4 * i)) >> 28);
+		return NULL;
+	default:
+		return "unsupported immediate type";
+	}
+}
+
+static const char *decode_src_align1(const struct brw_cfg *cfg,
+				     struct sim_operand *op,
+				     unsigned int exec_size,
+				     unsigned int file, unsigned int type,
+				     unsigned int nr, unsigned int subreg,
+				     unsigned int vstride, unsigned int width,
+				     unsigned int hstride)
+{
+	unsigned int c, vs, w, hs, size;
+	int base;
+
+	if (vstride == 0xf)
+		return "VxH regions";
+	if (type_size[type] == 0)
+		return "unsupported register type";
+	base = set_file(cfg, op, file, nr);
+	if (base < 0)
+		return "unsupported register";
+
+	op->type = type;
+	size = type_size[type];
+	vs = decode_stride(vstride);
+	w = 1 << width;
+	hs = decode_stride(hstride);
+	for (c = 0; c < exec_size; c++)
+		op->offset[c] = base + subreg +
+				((c / w) * vs + (c % w) * hs) * size;
+	return in_file(op, exec_size) ? NULL : "region outside the register file";
+}
+
+static const char *decode_src_align16(const struct brw_cfg *cfg,
+				      struct sim_operand *op,
+				      unsigned int exec_size,
+				      unsigned int file, unsigned int type,
+				      unsigned int nr, unsigned int subreg,
+				      unsigned int vstride,
+				      const unsigned int *swizzle)
+{
+	unsigned int c, vs;
+	int base;
+
+	if (type_size[type] != 4)
+		return "align16 on a type that isn't 32 bit";
+	base = set_file(cfg, op, file, nr);
+	if (base < 0)
+		return "unsupported register";
+
+	op->type = type;
+	vs = decode_stride(vstride);
+	for (c = 0; c < exec_size; c++)
+		op->offset[c] = base + subreg + ((c / 4) * vs + swizzle[c % 4]) * 4;
+	return in_file(op, exec_size) ? NULL : "region outside the register file";
+}
+
+static const char *decode_src(const struct brw_cfg *cfg,
+			      struct brw_sim_insn *si,
+			      const struct brw_instruction *insn, int n)
+{
+	struct sim_operand *op = &si->src[n];
+	unsigned int file, type, swizzle[4];
+
+	if (n == 0) {
+		file = insn->bits1.da1.src0_reg_file;
+		type = insn->bits1.da1.src0_reg_type;
+	} else {
+		file = insn->bits1.da1.src1_reg_file;
+		type = insn->bits1.da1.src1_reg_type;
+	}
+	if (file == BRW_IMMEDIATE_VALUE)
+		return decode_imm(op, type, insn->bits3.ud);
+
+	if (n == 0) {
+		if (insn->bits2.da1.src0_address_mode != BRW_ADDRESS_DIRECT) {
+			if (insn->header.access_mode != BRW_ALIGN_1 ||
+			    file != BRW_GENERAL_REGISTER_FILE)
+				return "indirect addressing";
+			op->indirect = true;
+			op->address = insn->bits2.ia1.src0_subreg_nr;
+			op->displacement = insn->bits2.ia1.src0_indirect_offset;
+			op->abs = insn->bits2.ia1.src0_abs;
+			op->negate = insn->bits2.ia1.src0_negate;
+			return decode_src_align1(cfg, op, si->exec_size, file,
+						 type, 0, 0,
+						 insn->bits2.ia1.src0_vert_stride,
+						 insn->bits2.ia1.src0_width,
+						 insn->bits2.ia1.src0_horiz_stride);
+		}
+		op->abs = insn->bits2.da1.src0_abs;
+		op->negate = insn->bits2.da1.src0_negate;
+		if (insn->header.access_mode == BRW_ALIGN_1)
+			return decode_src_align1(cfg, op, si->exec_size, file,
+						 type,
+						 insn->bits2.da1.src0_reg_nr,
+						 insn->bits2.da1.src0_subreg_nr,
+						 insn->bits2.da1.src0_vert_stride,
+						 insn->bits2.da1.src0_width,
+						 insn->bits2.da1.src0_horiz_stride);
+		swizzle[0] = insn->bits2.da16.src0_swz_x;
+		swizzle[1] = insn->bits2.da16.src0_swz_y;
+		swizzle[2] = insn->bits2.da16.src0_swz_z;
+		swizzle[3] = insn->bits2.da16.src0_swz_w;
+		return decode_src_align16(cfg, op, si->exec_size, file, type,
+					  insn->bits2.da16.src0_reg_nr,
+					  insn->bits2.da16.src0_subreg_nr * 16,
+					  insn->bits2.da16.src0_vert_stride,
+					  swizzle);
+	}
+
+	if (insn->bits3.da1.src1_address_mode != BRW_ADDRESS_DIRECT) {
+		if (insn->header.access_mode != BRW_ALIGN_1 ||
+		    file != BRW_GENERAL_REGISTER_FILE)
+			return "indirect addressing";
+		op->indirect = true;
+		op->address = insn->bits3.ia1.src1_subreg_nr;
+		op->displacement = insn->bits3.ia1.src1_indirect_offset;
+		op->abs = insn->bits3.ia1.src1_abs;
+		op->negate = insn->bits3.ia1.src1_negate;
+		return decode_src_align1(cfg, op, si->exec_size, file, type,
+					 0, 0, insn->bits3.ia1.src1_vert_stride,
+					 insn->bits3.ia1.src1_width,
+					 insn->bits3.ia1.src1_horiz_stride);
+	}
+	op->abs = insn->bits3.da1.src1_abs;
+	op->negate = insn->bits3.da1.src1_negate;
+	if (insn->header.access_mode == BRW_ALIGN_1)
+		return decode_src_align1(cfg, op, si->exec_size, file, type,
+					 insn->bits3.da1.src1_reg_nr,
+					 insn->bits3.da1.src1_subreg_nr,
+					 insn->bits3.da1.src1_vert_stride,
+					 insn->bits3.da1.src1_width,
+					 insn->bits3.da1.src1_horiz_stride);
+	swizzle[0] = insn->bits3.da16.src1_swz_x;
+	swizzle[1] = insn->bits3.da16.src1_swz_y;
+	swizzle[2] = insn->bits3.da16.src1_swz_z;
+	swizzle[3] = insn->bits3.da16.src1_swz_w;
+	return decode_src_align16(cfg, op, si->exec_size, file, type,
+				  insn->bits3.da16.src1_reg_nr,
+				  insn->bits3.da16.src1_subreg_nr * 16,
+				  insn->bits3.da16.src1_vert_stride, swizzle);
+}
+
+static const char *decode_dst(const struct brw_cfg *cfg,
+			      struct brw_sim_insn *si,
+			      const struct brw_instruction *insn)
+{
+	struct sim_operand *op = &si->dst;
+	unsigned int c, type = insn->bits1.da1.dest_reg_type;
+	unsigned int stride, subreg;
+	int base;
+
+	if (insn->bits1.da1.dest_address_mode != BRW_ADDRESS_DIRECT)
+		return "indirect addressing";
+	if (type_size[type] == 0)
+		return "unsupported register type";
+	base = set_file(cfg, op, insn->bits1.da1.dest_reg_file,
+			insn->bits1.da1.dest_reg_nr);
+	if (base < 0)
+		return "unsupported register";
+	op->type = type;
+
+	si->write_mask = ~0u;
+	if (insn->header.access_mode == BRW_ALIGN_1) {
+		subreg = insn->bits1.da1.dest_subreg_nr;
+		stride = decode_stride(insn->bits1.da1.dest_horiz_stride);
+	} else {
+		if (type_size[type] != 4)
+			return "align16 on a type that isn't 32 bit";
+		subreg = insn->bits1.da16.dest_subreg_nr * 16;
+		stride = 1;
+		si->write_mask = 0;
+		for (c = 0; c < MAX_CHANNELS; c++)
+			if (insn->bits1.da16.dest_writemask & (1 << (c % 4)))
+				si->write_mask |= 1u << c;
+	}
+	for (c = 0; c < si->exec_size; c++)
+		op->offset[c] = base + subreg + c * stride * type_size[type];
+	return in_file(op, si->exec_size) ? NULL :
+	       "region outside the register file";
+}
+
+/* Three source instructions: align16, 32 bit types only */
+static const char *decode_3src(const struct brw_cfg *cfg,
+			       struct brw_sim_insn *si,
+			       const struct brw_instruction *insn)
+{
+	static const unsigned int types[4] = {
+		BRW_REGISTER_TYPE_F, BRW_REGISTER_TYPE_D,
+		BRW_REGISTER_TYPE_UD, 8
+	};
+	unsigned int type = types[insn->bits1.da3src.src_reg_type];
+	unsigned int nr[3], subreg[3], swz[3], rep[3];
+	unsigned int c, n;
+	int base;
+
+	if (type == 8 || types[insn->bits1.da3src.dest_reg_type] == 8)
+		return "double precision";
+
+	base = set_file(cfg, &si->dst, insn->bits1.da3src.dest_reg_file ?
+			BRW_MESSAGE_REGISTER_FILE : BRW_GENERAL_REGISTER_FILE,
+			insn->bits1.da3src.dest_reg_nr);
+	if (base < 0)
+		return "unsupported register";
+	si->dst.type = types[insn->bits1.da3src.dest_reg_type];
+	si->write_mask = 0;
+	for (c = 0; c < MAX_CHANNELS; c++)
+		if (insn->bits1.da3src.dest_writemask & (1 << (c % 4)))
+			si->write_mask |= 1u << c;
+	for (c = 0; c < si->exec_size; c++)
+		si->dst.offset[c] = base +
+				    insn->bits1.da3src.dest_subreg_nr * 4 + c * 4;
+	if (!in_file(&si->dst, si->exec_size))
+		return "region outside the register file";
+
+	nr[0] = insn->bits2.da3src.src0_reg_nr;
+	subreg[0] = insn->bits2.da3src.src0_subreg_nr;
+	swz[0] = insn->bits2.da3src.src0_swizzle;
+	rep[0] = insn->bits2.da3src.src0_rep_ctrl;
+	nr[1] = insn->bits3.da3src.src1_reg_nr;
+	subreg[1] = insn->bits2.da3src.src1_subreg_nr_low |
+		    insn->bits3.da3src.src1_subreg_nr_high << 2;
+	swz[1] = insn->bits2.da3src.src1_swizzle;
+	rep[1] = insn->bits2.da3src.src1_rep_ctrl;
+	nr[2] = insn->bits3.da3src.src2_reg_nr;
+	subreg[2] = insn->bits3.da3src.src2_subreg_nr;
+	swz[2] = insn->bits3.da3src.src2_swizzle;
+	rep[2] = insn->bits3.da3src.src2_rep_ctrl;
+	si->src[0].abs = insn->bits1.da3src.src0_abs;
+	si->src[0].negate = insn->bits1.da3src.src0_negate;
+	si->src[1].abs = insn->bits1.da3src.src1_abs;
+	si->src[1].negate = insn->bits1.da3src.src1_negate;
+	si->src[2].abs = insn->bits1.da3src.src2_abs;
+	si->src[2].negate = insn->bits1.da3src.src2_negate;
+
+	for (n = 0; n < 3; n++) {
+		struct sim_operand *op = &si->src[n];
+
+		base = set_file(cfg, op, BRW_GENERAL_REGISTER_FILE, nr[n]) +
+		       subreg[n] * 4;
+		op->type = type;
+		for (c = 0; c < si->exec_size; c++)
+			op->offset[c] = base + (rep[n] ? 0 :
+				((c / 4) * 4 + (swz[n] >> (c % 4 * 2) & 3)) * 4);
+		if (!in_file(op, si->exec_size))
+			return "region outside the register file";
+	}
+	return NULL;
+}
+
+static bool is_float_only(unsigned int opcode)
+{
+	switch (opcode) {
+	case BRW_OPCODE_FRC:
+	case BRW_OPCODE_RNDU:
+	case BRW_OPCODE_RNDD:
+	case BRW_OPCODE_RNDE:
+	case BRW_OPCODE_RNDZ:
+	case BRW_OPCODE_LINE:
+	case BRW_OPCODE_PLN:
+	case BRW_OPCODE_DP4:
+	case BRW_OPCODE_DPH:
+	case BRW_OPCODE_DP3:
+	case BRW_OPCODE_DP2:
+	case BRW_OPCODE_MAD:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static bool is_int_only(unsigned int opcode)
+{
+	switch (opcode) {
+	case BRW_OPCODE_NOT:
+	case BRW_OPCODE_AND:
+	case BRW_OPCODE_OR:
+	case BRW_OPCODE_XOR:
+	case BRW_OPCODE_SHR:
+	case BRW_OPCODE_SHL:
+	case BRW_OPCODE_ASR:
+	case BRW_OPCODE_LZD:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static bool is_int_math(unsigned int function)
+{
+	return function == BRW_MATH_FUNCTION_INT_DIV_QUOTIENT_AND_REMAINDER ||
+	       function == BRW_MATH_FUNCTION_INT_DIV_QUOTIENT ||
+	       function == BRW_MATH_FUNCTION_INT_DIV_REMAINDER;
+}
+
+/* Where a jump lands, as an instruction index */
+static int find_target(const struct brw_cfg *cfg, unsigned int i,
+		       int64_t jump)
+{
+	int64_t offset = cfg->insn[i].offset + jump;
+
+	if (jump == 0 || offset < 0 || offset > UINT32_MAX)
+		return -1;
+	return brw_cfg_find_insn(cfg, offset);
+}
+
+static const char *decode_flow(const struct brw_cfg *cfg,
+			       struct brw_sim_insn *si, unsigned int i)
+{
+	const struct brw_instruction *insn = &cfg->insn[i].insn;
+	int64_t jump[2];
+	int n;
+
+	brw_cfg_get_jumps(cfg, insn, jump);
+	for (n = 0; n < 2; n++)
+		si->target[n] = find_target(cfg, i, jump[n]);
+
+	switch (si->opcode) {
+	case BRW_OPCODE_JMPI:
+	case BRW_OPCODE_IF:
+	case BRW_OPCODE_ELSE:
+	case BRW_OPCODE_WHILE:
+		/* gen6 IF can compare its sources itself */
+		if (si->opcode == BRW_OPCODE_IF &&
+		    insn->header.destreg__conditionalmod)
+			return "IF with a conditional modifier";
+		if (si->target[0] < 0)
+			return "jump outside the program";
+		/* IF may point at the ELSE, whose channels start past it */
+		if (si->opcode == BRW_OPCODE_IF &&
+		    cfg->insn[si->target[0]].insn.header.opcode ==
+		    BRW_OPCODE_ELSE)
+			si->target[0]++;
+		return NULL;
+	case BRW_OPCODE_BREAK:
+	case BRW_OPCODE_CONTINUE:
+	case BRW_OPCODE_HALT:
+		/* UIP from gen6 on: the loop's end, or where HALT resumes */
+		if (cfg->gen >= 60)
+			si->target[0] = si->target[1];
+		else if (si->opcode == BRW_OPCODE_HALT)
+			return "HALT before gen6";
+		if (si->target[0] < 0)
+			return "jump outside the program";
+		/* BREAK may point at the WHILE, and leaves past it */
+		if (si->opcode == BRW_OPCODE_BREAK &&
+		    cfg->insn[si->target[0]].insn.header.opcode ==
+		    BRW_OPCODE_WHILE)
+			si->target[0]++;
+		return NULL;
+	case BRW_OPCODE_ENDIF:
+	case BRW_OPCODE_DO:
+		return NULL;
+	default:
+		return "unsupported flow control";
+	}
+}
+
+static const char *decode_send(const struct brw_cfg *cfg,
+			       struct brw_sim_insn *si,
+			       const struct brw_cfg_insn *ci)
+{
+	const struct brw_instruction *insn = &ci->insn;
+	int base;
+
+	/* the message's first register, and where the response goes */
+	if (cfg->gen >= 60)
+		base = set_file(cfg, &si->src[0], insn->bits1.da1.src0_reg_file,
+				insn->bits2.da1.src0_reg_nr);
+	else
+		base = set_file(cfg, &si->src[0], BRW_MESSAGE_REGISTER_FILE,
+				insn->header.destreg__conditionalmod);
+	if (base < 0 || (si->src[0].file != SIM_GRF &&
+			 si->src[0].file != SIM_MRF))
+		return "unsupported message register";
+	si->src[0].offset[0] = base;
+	if (base + ci->mlen * REG_SIZE > file_size(si->src[0].file))
+		return "message outside the register file";
+
+	/* before gen6, src0 is moved to the first message register */
+	if (cfg->gen < 60 && ci->mlen) {
+		if (insn->bits1.da1.src0_reg_file != BRW_GENERAL_REGISTER_FILE)
+			return "unsupported register";
+		si->src[1].file = SIM_GRF;
+		si->src[1].offset[0] = insn->bits2.da1.src0_reg_nr * REG_SIZE;
+	}
+
+	base = set_file(cfg, &si->dst, insn->bits1.da1.dest_reg_file,
+			insn->bits1.da1.dest_reg_nr);
+	if (base < 0 || (si->dst.file != SIM_GRF && si->dst.file != SIM_NULL))
+		return "unsupported response register";
+	si->dst.offset[0] = base;
+	if (si->dst.file == SIM_GRF &&
+	    base + ci->rlen * REG_SIZE > file_size(SIM_GRF))
+		return "response outside the register file";
+	return NULL;
+}
+
+static void decode_insn(const struct brw_cfg *cfg, struct brw_sim_insn *si,
+			unsigned int i)
+{
+	const struct brw_cfg_insn *ci = &cfg->insn[i];
+	const struct brw_instruction *insn = &ci->insn;
+	unsigned int opcode = insn->header.opcode;
+	unsigned int n, pred = insn->header.predicate_control;
+	bool three_src = cfg->gen >= 60 && opcode_descs[opcode].nsrc == 3;
+
+	si->opcode = opcode;
+	si->exec_size = 1 << insn->header.execution_size;
+	si->nsrc = opcode_descs[opcode].nsrc;
+	si->target[0] = si->target[1] = -1;
+	if (si->exec_size > MAX_CHANNELS) {
+		si->unsupported = "execution size";
+		return;
+	}
+
+	if (cfg->gen >= 60)
+		si->group = insn->header.compression_control * 8;
+	else if (insn->header.compression_control == BRW_COMPRESSION_2NDHALF)
+		si->group = 8;
+	if (si->group + si->exec_size > MAX_CHANNELS)
+		si->group = 0;
+
+	if (cfg->gen >= 70)
+		si->flag = three_src ?
+			insn->bits1.da3src.flag_reg_nr * 2 +
+			insn->bits1.da3src.flag_subreg_nr :
+			insn->bits2.da1.flag_reg_nr * 2 +
+			insn->bits2.da1.flag_subreg_nr;
+	else if (cfg->gen >= 60)
+		si->flag = three_src ? insn->bits1.da3src.flag_subreg_nr :
+				       insn->bits2.da1.flag_subreg_nr;
+
+	if (insn->header.access_mode == BRW_ALIGN_1 ?
+	    pred == BRW_PREDICATE_ALIGN1_ANYV ||
+	    pred == BRW_PREDICATE_ALIGN1_ALLV || pred > 11 :
+	    pred > BRW_PREDICATE_ALIGN16_ALL4H) {
+		si->unsupported = "unsupported predicate";
+		return;
+	}
+
+	switch (opcode) {
+	case BRW_OPCODE_SEND:
+	case BRW_OPCODE_SENDC:
+		si->unsupported = decode_send(cfg, si, ci);
+		return;
+	case BRW_OPCODE_NOP:
+	case BRW_OPCODE_WAIT:
+		return;
+	case BRW_OPCODE_MOV:
+	case BRW_OPCODE_SEL:
+	case BRW_OPCODE_NOT:
+	case BRW_OPCODE_AND:
+	case BRW_OPCODE_OR:
+	case BRW_OPCODE_XOR:
+	case BRW_OPCODE_SHR:
+	case BRW_OPCODE_SHL:
+	case BRW_OPCODE_ASR:
+	case BRW_OPCODE_CMP:
+	case BRW_OPCODE_CMPN:
+	case BRW_OPCODE_ADD:
+	case BRW_OPCODE_MUL:
+	case BRW_OPCODE_AVG:
+	case BRW_OPCODE_FRC:
+	case BRW_OPCODE_RNDU:
+	case BRW_OPCODE_RNDD:
+	case BRW_OPCODE_RNDE:
+	case BRW_OPCODE_RNDZ:
+	case BRW_OPCODE_MAC:
+	case BRW_OPCODE_LZD:
+	case BRW_OPCODE_DP4:
+	case BRW_OPCODE_DPH:
+	case BRW_OPCODE_DP3:
+	case BRW_OPCODE_DP2:
+	case BRW_OPCODE_LINE:
+	case BRW_OPCODE_PLN:
+		break;
+	case BRW_OPCODE_MATH:
+	case BRW_OPCODE_MAD:
+		if (cfg->gen >= 60)
+			break;
+		/* fall through */
+	default:
+		if (opcode >= BRW_OPCODE_JMPI && opcode < BRW_OPCODE_WAIT)
+			si->unsupported = decode_flow(cfg, si, i);
+		else
+			si->unsupported = "unsupported instruction";
+		return;
+	}
+
+	if (three_src) {
+		si->unsupported = decode_3src(cfg, si, insn);
+	} else {
+		si->unsupported = decode_dst(cfg, si, insn);
+		for (n = 0; n < si->nsrc && !si->unsupported; n++)
+			si->unsupported = decode_src(cfg, si, insn, n);
+	}
+	if (si->unsupported)
+		return;
+
+	if (opcode == BRW_OPCODE_MATH) {
+		si->float_exec = !is_int_math(insn->header.destreg__conditionalmod);
+		/* only the functions with two operands read src1 */
+		if (insn->header.destreg__conditionalmod != BRW_MATH_FUNCTION_POW &&
+		    insn->header.destreg__conditionalmod != BRW_MATH_FUNCTION_FDIV &&
+		    si->float_exec)
+			si->nsrc = 1;
+		return;
+	}
+
+	si->float_exec = is_float_only(opcode);
+	for (n = 0; n < si->nsrc; n++)
+		if (si->src[n].type == BRW_REGISTER_TYPE_F)
+			si->float_exec = true;
+	if (si->float_exec && is_int_only(opcode))
+		si->unsupported = "logic operation on floats";
+	if ((opcode == BRW_OPCODE_DP4 || opcode == BRW_OPCODE_DPH ||
+	     opcode == BRW_OPCODE_DP3 || opcode == BRW_OPCODE_DP2) &&
+	    insn->header.access_mode != BRW_ALIGN_16)
+		si->unsupported = "align1 dot product";
+}
+
+int brw_sim_init(struct brw_sim *sim, struct brw_cfg *cfg)
+{
+	unsigned int i;
+
+	memset(sim, 0, sizeof(*sim));
+	sim->cfg = cfg;
+	sim->insn = calloc(cfg->num_insn + 1, sizeof(*sim->insn));
+	sim->block = calloc(cfg->num_block + 1, sizeof(*sim->block));
+	if (sim->insn == NULL || sim->block == NULL) {
+		brw_sim_fini(sim);
+		return -1;
+	}
+
+	for (i = 0; i < cfg->num_insn; i++)
+		decode_insn(cfg, &sim->insn[i], i);
+	brw_sim_reset(sim, 8);
+	return 0;
+}
+
+void brw_sim_fini(struct brw_sim *sim)
+{
+	free(sim->insn);
+	free(sim->block);
+	sim->insn = NULL;
+	sim->block = NULL;
+}
+
+void brw_sim_reset(struct brw_sim *sim, unsigned int dispatch_width)
+{
+	memset(sim->grf, 0, sizeof(sim->grf));
+	memset(sim->mrf, 0, sizeof(sim->mrf));
+	memset(sim->acc, 0, sizeof(sim->acc));
+	memset(sim->address, 0, sizeof(sim->address));
+	memset(sim->control, 0, sizeof(sim->control));
+	memset(sim->flag, 0, sizeof(sim->flag));
+	if (dispatch_width == 0 || dispatch_width > MAX_CHANNELS)
+		dispatch_width = 8;
+	sim->dispatch_width = dispatch_width;
+	sim->ended = false;
+}
+
+static uint32_t channel_mask(unsigned int n, unsigned int first)
+{
+	return (uint32_t)(((1ull << n) - 1) << first);
+}
+
+static uint32_t read_raw(const uint8_t *p, unsigned int size)
+{
+	uint16_t w;
+	uint32_t d;
+
+	switch (size) {
+	case 1:
+		return *p;
+	case 2:
+		memcpy(&w, p, 2);
+		return w;
+	default:
+		memcpy(&d, p, 4);
+		return d;
+	}
+}
+
+static void write_raw(uint8_t *p, unsigned int size, uint32_t value)
+{
+	uint16_t w = value;
+
+	switch (size) {
+	case 1:
+		*p = value;
+		break;
+	case 2:
+		memcpy(p, &w, 2);
+		break;
+	default:
+		memcpy(p, &value, 4);
+		break;
+	}
+}
+
+static union sim_value to_value(uint32_t raw, unsigned int type,
+				 bool as_float)
+{
+	union sim_value v;
+	int64_t i;
+
+	switch (type) {
+	case BRW_REGISTER_TYPE_F:
+		memcpy(&v.f, &raw, 4);
+		return v;
+	case BRW_REGISTER_TYPE_D:
+		i = (int32_t)raw;
+		break;
+	case BRW_REGISTER_TYPE_W:
+		i = (int16_t)raw;
+		break;
+	case BRW_REGISTER_TYPE_B:
+		i = (int8_t)raw;
+		break;
+	default:
+		i = raw;
+		break;
+	}
+	if (as_float)
+		v.f = i;
+	else
+		v.i = i;
+	return v;
+}
+
+/* Where a register-indirect operand's offsets start, as a0 now says */
+static int indirect_base(struct brw_sim *sim, const struct sim_operand *op)
+{
+	if (!op->indirect)
+		return 0;
+	return read_raw(sim->address + op->address * 2, 2) + op->displacement;
+}
+
+/* Reads an operand for every channel, shifted by bytes, modifiers applied */
+static void fetch(struct brw_sim *sim, const struct brw_sim_insn *si,
+		  const struct sim_operand *op, unsigned int shift,
+		  union sim_value *v)
+{
+	const uint8_t *base = file_base(sim, op->file);
+	unsigned int c, size = type_size[op->type];
+	int limit = file_size(op->file), start = indirect_base(sim, op);
+
+	for (c = 0; c < si->exec_size; c++) {
+		int offset = start + op->offset[c] + shift;
+		uint32_t raw = 0;
+
+		if (op->file == SIM_IMM)
+			raw = op->imm[c & 7];
+		else if (base && offset >= 0 && offset + (int)size <= limit)
+			raw = read_raw(base + offset, size);
+		v[c] = to_value(raw, op->type, si->float_exec);
+	}
+
+	if (si->float_exec) {
+		for (c = 0; c < si->exec_size; c++) {
+			if (op->abs)
+				v[c].f = fabsf(v[c].f);
+			if (op->negate)
+				v[c].f = -v[c].f;
+		}
+	} else {
+		for (c = 0; c < si->exec_size; c++) {
+			if (op->abs && v[c].i < 0)
+				v[c].i = -v[c].i;
+			if (op->negate)
+				v[c].i = -v[c].i;
+		}
+	}
+}
+
+/* A float element of a scalar operand, for LINE and PLN */
+static float fetch_scalar(struct brw_sim *sim, const struct sim_operand *op,
+			  unsigned int element)
+{
+	int offset = indirect_base(sim, op) + op->offset[0] + element * 4;
+	uint32_t raw;
+	float f;
+
+	if (op->file == SIM_IMM) {
+		raw = op->imm[0];
+	} else {
+		if (offset < 0 || offset + 4 > (int)file_size(op->file))
+			return 0;
+		raw = read_raw(file_base(sim, op->file) + offset, 4);
+	}
+	if (op->type != BRW_REGISTER_TYPE_F)
+		return to_value(raw, op->type, true).f;
+	memcpy(&f, &raw, 4);
+	return f;
+}
+
+static int64_t clamp(int64_t i, int64_t lo, int64_t hi)
+{
+	return i < lo ? lo : i > hi ? hi : i;
+}
+
+/*
+ * Converts a result to the destination type: returns its bits, and the
+ * value as the destination type holds it for the conditional modifier.
+ */
+static uint32_t convert(union sim_value r, bool is_float, unsigned int type,
+			bool saturate, union sim_value *held)
+{
+	static const int64_t lo[8] = {
+		[BRW_REGISTER_TYPE_D] = INT32_MIN,
+		[BRW_REGISTER_TYPE_W] = INT16_MIN,
+		[BRW_REGISTER_TYPE_B] = INT8_MIN,
+	};
+	static const int64_t hi[8] = {
+		[BRW_REGISTER_TYPE_UD] = UINT32_MAX,
+		[BRW_REGISTER_TYPE_D] = INT32_MAX,
+		[BRW_REGISTER_TYPE_UW] = UINT16_MAX,
+		[BRW_REGISTER_TYPE_W] = INT16_MAX,
+		[BRW_REGISTER_TYPE_UB] = UINT8_MAX,
+		[BRW_REGISTER_TYPE_B] = INT8_MAX,
+	};
+	uint32_t bits;
+	int64_t i;
+
+	if (type == BRW_REGISTER_TYPE_F) {
+		float f = is_float ? r.f : (float)r.i;
+
+		if (saturate)
+			f = f > 1 ? 1 : f > 0 ? f : 0;	/* NaN too */
+		memcpy(&bits, &f, 4);
+		held->f = f;
+		return bits;
+	}
+
+	if (is_float) {
+		/* float to integer conversions saturate */
+		if (isnan(r.f))
+			i = 0;
+		else if (r.f <= lo[type])
+			i = lo[type];
+		else if (r.f >= hi[type])
+			i = hi[type];
+		else
+			i = (int64_t)r.f;
+	} else {
+		i = saturate ? clamp(r.i, lo[type], hi[type]) : r.i;
+	}
+	bits = (uint32_t)i;
+	if (type_size[type] < 4)
+		bits &= (1u << type_size[type] * 8) - 1;
+	*held = to_value(bits, type, false);
+	return bits;
+}
+
+static bool test(unsigned int mod, bool is_float, union sim_value a,
+		 union sim_value b)
+{
+	if (is_float) {
+		switch (mod) {
+		case BRW_CONDITIONAL_Z:
+			return a.f == b.f;
+		case BRW_CONDITIONAL_NZ:
+			return a.f != b.f;
+		case BRW_CONDITIONAL_G:
+			return a.f > b.f;
+		case BRW_CONDITIONAL_GE:
+			return a.f >= b.f;
+		case BRW_CONDITIONAL_L:
+			return a.f < b.f;
+		case BRW_CONDITIONAL_LE:
+			return a.f <= b.f;
+		case BRW_CONDITIONAL_U:
+			return isnan(a.f) || isnan(b.f);
+		default:
+			return false;
+		}
+	}
+
+	switch (mod) {
+	case BRW_CONDITIONAL_Z:
+		return a.i == b.i;
+	case BRW_CONDITIONAL_NZ:
+		return a.i != b.i;
+	case BRW_CONDITIONAL_G:
+		return a.i > b.i;
+	case BRW_CONDITIONAL_GE:
+		return a.i >= b.i;
+	case BRW_CONDITIONAL_L:
+		return a.i < b.i;
+	case BRW_CONDITIONAL_LE:
+		return a.i <= b.i;
+	default:
+		return false;
+	}
+}
+
+static void set_flag(struct brw_sim *sim, unsigned int flag,
+		     unsigned int channel, bool value)
+{
+	uint32_t bit = 1u << (((flag & 1) * 16 + channel) & 31);
+
+	if (value)
+		sim->flag[flag >> 1] |= bit;
+	else
+		sim->flag[flag >> 1] &= ~bit;
+}
+
+/* The channels, counted from 0, whose predicate passes */
+static uint32_t predicate(const struct brw_sim *sim,
+			  const struct brw_sim_insn *si,
+			  const struct brw_instruction *insn)
+{
+	unsigned int ctrl = insn->header.predicate_control;
+	uint32_t f = sim->flag[si->flag >> 1] >> ((si->flag & 1) * 16);
+	uint32_t p = 0, group;
+	unsigned int c, n = 1;
+
+	if (ctrl == BRW_PREDICATE_NONE)
+		return ~0u;
+
+	if (insn->header.access_mode == BRW_ALIGN_16) {
+		if (ctrl >= BRW_PREDICATE_ALIGN16_REPLICATE_X &&
+		    ctrl <= BRW_PREDICATE_ALIGN16_REPLICATE_W) {
+			for (c = 0; c < MAX_CHANNELS; c++)
+				if (f >> ((c & ~3) + ctrl - 2) & 1)
+					p |= 1u << c;
+			return insn->header.predicate_inverse ? ~p : p;
+		}
+		if (ctrl != BRW_PREDICATE_NORMAL) {
+			n = 4;
+			ctrl = ctrl == BRW_PREDICATE_ALIGN16_ANY4H ?
+			       BRW_PREDICATE_ALIGN1_ANY4H :
+			       BRW_PREDICATE_ALIGN1_ALL4H;
+		}
+	} else if (ctrl != BRW_PREDICATE_NORMAL) {
+		n = 1 << ((ctrl - BRW_PREDICATE_ALIGN1_ANY2H) / 2 + 1);
+	}
+
+	if (n == 1) {
+		p = f;
+	} else {
+		for (c = 0; c < MAX_CHANNELS; c += n) {
+			group = f >> c & channel_mask(n, 0);
+			if (ctrl % 2 == BRW_PREDICATE_ALIGN1_ANY2H % 2 ?
+			    group != 0 : group == channel_mask(n, 0))
+				p |= channel_mask(n, c);
+		}
+	}
+	return insn->header.predicate_inverse ? ~p : p;
+}
+
+static uint32_t count_leading_zeros(uint32_t x)
+{
+	uint32_t n = 0;
+
+	if (x == 0)
+		return 32;
+	while (!(x & 0x80000000u)) {
+		x <<= 1;
+		n++;
+	}
+	return n;
+}
+
+static float math_float(unsigned int function, float a, float b,
+			float *second)
+{
+	switch (function) {
+	case BRW_MATH_FUNCTION_INV:
+		return 1 / a;
+	case BRW_MATH_FUNCTION_LOG:
+		return log2f(a);
+	case BRW_MATH_FUNCTION_EXP:
+		return exp2f(a);
+	case BRW_MATH_FUNCTION_SQRT:
+		return sqrtf(a);
+	case BRW_MATH_FUNCTION_RSQ:
+		return 1 / sqrtf(a);
+	case BRW_MATH_FUNCTION_SIN:
+		return sinf(a);
+	case BRW_MATH_FUNCTION_COS:
+		return cosf(a);
+	case BRW_MATH_FUNCTION_SINCOS:
+		*second = cosf(a);
+		return sinf(a);
+	case BRW_MATH_FUNCTION_FDIV:
+		return a / b;
+	case BRW_MATH_FUNCTION_POW:
+		return powf(a, b);
+	default:
+		return 0;
+	}
+}
+
+/* Integer division; dividing by zero gives all ones and the dividend */
+static int64_t math_int(unsigned int function, int64_t a, int64_t b,
+			int64_t *second)
+{
+	int64_t q = b ? a / b : -1, r = b ? a % b : a;
+
+	*second = r;
+	return function == BRW_MATH_FUNCTION_INT_DIV_REMAINDER ? r : q;
+}
+
+/* Writes a result to the enabled channels, and the flag if asked to */
+static void store(struct brw_sim *sim, const struct brw_sim_insn *si,
+		  const struct brw_instruction *insn, const union sim_value *r,
+		  uint32_t enabled, unsigned int shift, bool cond)
+{
+	uint8_t *base = file_base(sim, si->dst.file);
+	unsigned int c, size = type_size[si->dst.type];
+	unsigned int limit = file_size(si->dst.file);
+	unsigned int mod = insn->header.destreg__conditionalmod;
+	union sim_value held, zero = { .i = 0 };
+	uint32_t bits;
+
+	for (c = 0; c < si->exec_size; c++) {
+		if (!(enabled >> c & 1))
+			continue;
+		bits = convert(r[c], si->float_exec, si->dst.type,
+			       insn->header.saturate, &held);
+		if (base && (si->write_mask >> c & 1) &&
+		    si->dst.offset[c] + shift + size <= limit)
+			write_raw(base + si->dst.offset[c] + shift, size, bits);
+		if (insn->header.acc_wr_control && c < 16)
+			memcpy(sim->acc + c * 4, &bits, 4);
+		if (cond && mod)
+			set_flag(sim, si->flag, si->group + c,
+				 test(mod, si->dst.type == BRW_REGISTER_TYPE_F,
+				      held, zero));
+	}
+}
+
+static void execute_alu(struct brw_sim *sim, const struct brw_sim_insn *si,
+			const struct brw_instruction *insn, uint32_t enabled,
+			uint32_t pred)
+{
+	union sim_value s[3][MAX_CHANNELS], r[MAX_CHANNELS], extra[MAX_CHANNELS];
+	unsigned int c, n, mod = insn->header.destreg__conditionalmod;
+	unsigned int exec_size = si->exec_size;
+	bool f = si->float_exec, cond = true;
+	float p[4];
+
+	for (n = 0; n < si->nsrc; n++)
+		fetch(sim, si, &si->src[n], 0, s[n]);
+
+	switch (si->opcode) {
+	case BRW_OPCODE_MOV:
+		memcpy(r, s[0], exec_size * sizeof(*r));
+		break;
+	case BRW_OPCODE_SEL:
+		/* the predicate picks a source rather than disabling */
+		for (c = 0; c < exec_size; c++) {
+			bool first = mod ? test(mod, f, s[0][c], s[1][c]) :
+					   pred >> c & 1;
+			r[c] = first ? s[0][c] : s[1][c];
+		}
+		cond = false;
+		break;
+	case BRW_OPCODE_NOT:
+		for (c = 0; c < exec_size; c++)
+			r[c].i = ~s[0][c].i;
+		break;
+	case BRW_OPCODE_AND:
+		for (c = 0; c < exec_size; c++)
+			r[c].i = s[0][c].i & s[1][c].i;
+		break;
+	case BRW_OPCODE_OR:
+		for (c = 0; c < exec_size; c++)
+			r[c].i = s[0][c].i | s[1][c].i;
+		break;
+	case BRW_OPCODE_XOR:
+		for (c = 0; c < exec_size; c++)
+			r[c].i = s[0][c].i ^ s[1][c].i;
+		break;
+	case BRW_OPCODE_SHR:
+		for (c = 0; c < exec_size; c++)
+			r[c].i = (uint32_t)s[0][c].i >> (s[1][c].i & 31);
+		break;
+	case BRW_OPCODE_SHL:
+		for (c = 0; c < exec_size; c++)
+			r[c].i = (uint32_t)s[0][c].i << (s[1][c].i & 31);
+		break;
+	case BRW_OPCODE_ASR:
+		for (c = 0; c < exec_size; c++)
+			r[c].i = (int32_t)s[0][c].i >> (s[1][c].i & 31);
+		break;
+	case BRW_OPCODE_CMP:
+	case BRW_OPCODE_CMPN:
+		/* all ones where it holds, which is what the flag gets */
+		for (c = 0; c < exec_size; c++) {
+			bool t = test(mod, f, s[0][c], s[1][c]);
+
+			if (f)
+				r[c].f = t ? -1 : 0;
+			else
+				r[c].i = t ? -1 : 0;
+			if (mod && (enabled >> c & 1))
+				set_flag(sim, si->flag, si->group + c, t);
+		}
+		cond = false;
+		break;
+	case BRW_OPCODE_ADD:
+		for (c = 0; c < exec_size; c++) {
+			if (f)
+				r[c].f = s[0][c].f + s[1][c].f;
+			else
+				r[c].i = s[0][c].i + s[1][c].i;
+		}
+		break;
+	case BRW_OPCODE_MUL:
+		for (c = 0; c < exec_size; c++) {
+			if (f)
+				r[c].f = s[0][c].f * s[1][c].f;
+			else
+				r[c].i = (int64_t)((uint64_t)s[0][c].i *
+						   (uint64_t)s[1][c].i);
+		}
+		break;
+	case BRW_OPCODE_AVG:
+		for (c = 0; c < exec_size; c++)
+			r[c].i = (s[0][c].i + s[1][c].i + 1) >> 1;
+		break;
+	case BRW_OPCODE_FRC:
+		for (c = 0; c < exec_size; c++)
+			r[c].f = s[0][c].f - floorf(s[0][c].f);
+		break;
+	case BRW_OPCODE_RNDU:
+		for (c = 0; c < exec_size; c++)
+			r[c].f = ceilf(s[0][c].f);
+		break;
+	case BRW_OPCODE_RNDD:
+		for (c = 0; c < exec_size; c++)
+			r[c].f = floorf(s[0][c].f);
+		break;
+	case BRW_OPCODE_RNDE:
+		for (c = 0; c < exec_size; c++)
+			r[c].f = rintf(s[0][c].f);
+		break;
+	case BRW_OPCODE_RNDZ:
+		for (c = 0; c < exec_size; c++)
+			r[c].f = truncf(s[0][c].f);
+		break;
+	case BRW_OPCODE_MAC:
+		for (c = 0; c < exec_size; c++) {
+			union sim_value acc = to_value(
+				c < 16 ? read_raw(sim->acc + c * 4, 4) : 0,
+				f ? BRW_REGISTER_TYPE_F : BRW_REGISTER_TYPE_D, f);
+
+			if (f)
+				r[c].f = acc.f + s[0][c].f * s[1][c].f;
+			else
+				r[c].i = acc.i + s[0][c].i * s[1][c].i;
+		}
+		break;
+	case BRW_OPCODE_LZD:
+		for (c = 0; c < exec_size; c++)
+			r[c].i = count_leading_zeros(s[0][c].i);
+		break;
+	case BRW_OPCODE_DP4:
+	case BRW_OPCODE_DPH:
+	case BRW_OPCODE_DP3:
+	case BRW_OPCODE_DP2:
+		for (c = 0; c < exec_size; c += 4) {
+			unsigned int k, len = si->opcode == BRW_OPCODE_DP2 ? 2 :
+				si->opcode == BRW_OPCODE_DP4 ? 4 : 3;
+			float dot = 0;
+
+			for (k = 0; k < len && c + k < exec_size; k++)
+				dot += s[0][c + k].f * s[1][c + k].f;
+			if (si->opcode == BRW_OPCODE_DPH && c + 3 < exec_size)
+				dot += s[1][c + 3].f;
+			for (k = 0; k < 4 && c + k < exec_size; k++)
+				r[c + k].f = dot;
+		}
+		break;
+	case BRW_OPCODE_LINE:
+		p[0] = fetch_scalar(sim, &si->src[0], 0);
+		p[3] = fetch_scalar(sim, &si->src[0], 3);
+		for (c = 0; c < exec_size; c++)
+			r[c].f = p[0] * s[1][c].f + p[3];
+		break;
+	case BRW_OPCODE_PLN:
+		/* y follows x in the next register, or two when compressed */
+		for (n = 0; n < 4; n++)
+			p[n] = fetch_scalar(sim, &si->src[0], n);
+		fetch(sim, si, &si->src[1], exec_size > 8 ? 2 * REG_SIZE :
+		      REG_SIZE, extra);
+		for (c = 0; c < exec_size; c++)
+			r[c].f = p[0] * s[1][c].f + p[1] * extra[c].f + p[3];
+		break;
+	case BRW_OPCODE_MAD:
+		for (c = 0; c < exec_size; c++)
+			r[c].f = s[0][c].f + s[1][c].f * s[2][c].f;
+		break;
+	case BRW_OPCODE_MATH:
+		/* the conditional modifier field holds the function */
+		cond = false;
+		for (c = 0; c < exec_size; c++) {
+			if (f) {
+				r[c].f = math_float(mod, s[0][c].f,
+						    si->nsrc > 1 ? s[1][c].f : 0,
+						    &extra[c].f);
+			} else {
+				r[c].i = math_int(mod, s[0][c].i, s[1][c].i,
+						  &extra[c].i);
+			}
+		}
+		if (mod == BRW_MATH_FUNCTION_INT_DIV_QUOTIENT_AND_REMAINDER)
+			store(sim, si, insn, extra, enabled,
+			      (exec_size * 4 + REG_SIZE - 1) / REG_SIZE *
+			      REG_SIZE, false);
+		break;
+	}
+
+	store(sim, si, insn, r, enabled, 0, cond);
+}
+
+/* Copies between a surface and registers; what's outside reads as 0 */
+static void surface_read(const struct brw_sim_surface *surface,
+			 uint64_t offset, uint8_t *dst, unsigned int size)
+{
+	unsigned int i;
+
+	for (i = 0; i < size; i++)
+		dst[i] = surface->data && offset + i < surface->size ?
+			 ((const uint8_t *)surface->data)[offset + i] : 0;
+}
+
+static void surface_write(struct brw_sim_surface *surface, uint64_t offset,
+			  const uint8_t *src, unsigned int size)
+{
+	unsigned int i;
+
+	for (i = 0; i < size; i++)
+		if (surface->data && offset + i < surface->size)
+			((uint8_t *)surface->data)[offset + i] = src[i];
+}
+
+/* The gen4/5 math box: operands in the message, results in the response */
+static bool math_message(struct brw_sim *sim, const struct brw_sim_insn *si,
+			 const struct brw_cfg_insn *ci, const uint8_t *msg,
+			 uint8_t *resp, uint32_t enabled)
+{
+	const struct brw_instruction *insn = &ci->insn;
+	unsigned int function = insn->bits3.math.function;
+	unsigned int c, regs = (si->exec_size * 4 + REG_SIZE - 1) / REG_SIZE;
+	bool is_int = is_int_math(function);
+	bool is_signed = insn->bits3.math.int_type == BRW_MATH_INTEGER_SIGNED;
+
+	if (resp == NULL || ci->mlen < regs || ci->rlen < regs)
+		return false;
+
+	for (c = 0; c < si->exec_size; c++) {
+		uint32_t a = read_raw(msg + c * 4, 4), b = 0, r, r2 = 0;
+
+		if (!(enabled >> c & 1))
+			continue;
+		if (ci->mlen >= 2 * regs)
+			b = read_raw(msg + regs * REG_SIZE + c * 4, 4);
+
+		if (is_int) {
+			int64_t x = is_signed ? (int32_t)a : (int64_t)a;
+			int64_t y = is_signed ? (int32_t)b : (int64_t)b;
+			int64_t second;
+
+			r = math_int(function, x, y, &second);
+			r2 = second;
+		} else {
+			float x, y, second = 0, result;
+
+			memcpy(&x, &a, 4);
+			memcpy(&y, &b, 4);
+			result = math_float(function, x, y, &second);
+			memcpy(&r, &result, 4);
+			memcpy(&r2, &second, 4);
+		}
+		write_raw(resp + c * 4, 4, r);
+		if (ci->rlen >= 2 * regs)
+			write_raw(resp + regs * REG_SIZE + c * 4, 4, r2);
+	}
+	return true;
+}
+
+/*
+ * Gen7 data cache OWord block and DWord scattered messages.  Block offsets
+ * are in OWords, scattered ones in bytes, plus the header's global offset.
+ */
+static bool data_cache_message(struct brw_sim *sim,
+			       const struct brw_sim_insn *si,
+			       const struct brw_cfg_insn *ci,
+			       const uint8_t *msg, uint8_t *resp,
+			       uint32_t enabled)
+{
+	static const unsigned int oword_block[8] = { 1, 1, 2, 4, 8 };
+	const struct brw_instruction *insn = &ci->insn;
+	struct brw_sim_surface *surface =
+		&sim->surface[insn->bits3.gen7_dp.binding_table_index];
+	unsigned int control = insn->bits3.gen7_dp.msg_control;
+	unsigned int header = insn->bits3.gen7_dp.header_present;
+	unsigned int c, size, regs = (si->exec_size * 4 + REG_SIZE - 1) / REG_SIZE;
+	uint64_t global = header ? read_raw(msg + 8, 4) : 0;
+	const uint8_t *data = msg + header * REG_SIZE;
+
+	switch (insn->bits3.gen7_dp.msg_type) {
+	case BRW_DATAPORT_READ_MESSAGE_OWORD_BLOCK_READ:
+		size = oword_block[control & 7] * 16;
+		if (!header || size == 0 || resp == NULL ||
+		    ci->rlen * REG_SIZE < size)
+			return false;
+		if ((control & 7) == BRW_DATAPORT_OWORD_BLOCK_1_OWORDHIGH)
+			resp += 16;
+		surface_read(surface, global * 16, resp, size);
+		return true;
+	case GEN6_DATAPORT_WRITE_MESSAGE_OWORD_BLOCK_WRITE:
+		size = oword_block[control & 7] * 16;
+		if (!header || size == 0 || (ci->mlen - 1) * REG_SIZE < size)
+			return false;
+		surface_write(surface, global * 16, data, size);
+		return true;
+	case GEN7_DATAPORT_DC_DWORD_SCATTERED_READ:
+		if (resp == NULL || ci->mlen < header + regs || ci->rlen < regs)
+			return false;
+		for (c = 0; c < si->exec_size; c++)
+			if (enabled >> c & 1)
+				surface_read(surface, global +
+					     read_raw(data + c * 4, 4),
+					     resp + c * 4, 4);
+		return true;
+	case GEN6_DATAPORT_WRITE_MESSAGE_DWORD_SCATTERED_WRITE:
+		if (ci->mlen < header + 2 * regs)
+			return false;
+		for (c = 0; c < si->exec_size; c++)
+			if (enabled >> c & 1)
+				surface_write(surface, global +
+					      read_raw(data + c * 4, 4),
+					      data + regs * REG_SIZE + c * 4,
+					      4);
+		return true;
+	default:
+		return false;
+	}
+}
+
+static void execute_send(struct brw_sim *sim, const struct brw_sim_insn *si,
+			 const struct brw_cfg_insn *ci, uint32_t enabled)
+{
+	const struct brw_cfg *cfg = sim->cfg;
+	uint8_t *msg = file_base(sim, si->src[0].file) + si->src[0].offset[0];
+	uint8_t *resp = NULL;
+	bool done = false;
+
+	if (si->dst.file == SIM_GRF)
+		resp = sim->grf + si->dst.offset[0];
+	if (si->src[1].file == SIM_GRF)
+		memcpy(msg, sim->grf + si->src[1].offset[0], REG_SIZE);
+
+	if (cfg->gen < 60 && ci->sfid == BRW_SFID_MATH)
+		done = math_message(sim, si, ci, msg, resp, enabled);
+	else if (cfg->gen >= 70 && ci->sfid == GEN7_SFID_DATAPORT_DATA_CACHE)
+		done = data_cache_message(sim, si, ci, msg, resp, enabled);
+
+	if (!done) {
+		sim->unsimulated++;
+		if (resp)
+			memset(resp, 0, ci->rlen * REG_SIZE);
+	}
+
+	if (cfg->gen >= 50 ? ci->insn.bits3.generic_gen5.end_of_thread :
+			     ci->insn.bits3.generic.end_of_thread)
+		sim->ended = true;
+}
+
+/*
+ * Moves the active channels on.  Flow control sends channels to its
+ * targets; everything else sends them to the next instruction.
+ */
+static void execute_flow(struct brw_sim *sim, const struct brw_sim_insn *si,
+			 const struct brw_instruction *insn, unsigned int ip,
+			 uint32_t active, uint32_t pred, unsigned int *pc)
+{
+	uint32_t taken = 0, group = channel_mask(si->exec_size, si->group);
+	unsigned int c;
+
+	switch (si->opcode) {
+	case BRW_OPCODE_IF:
+		/* the channels that fail wait for ELSE or ENDIF */
+		taken = active & group & ~(pred << si->group);
+		break;
+	case BRW_OPCODE_ELSE:
+		taken = active & group;
+		break;
+	case BRW_OPCODE_WHILE:
+	case BRW_OPCODE_BREAK:
+	case BRW_OPCODE_CONTINUE:
+	case BRW_OPCODE_HALT:
+		taken = active & group & (pred << si->group);
+		break;
+	case BRW_OPCODE_JMPI:
+		/* a scalar jump, taking every channel along */
+		if (pred & 1)
+			taken = active;
+		break;
+	}
+
+	for (c = 0; c < MAX_CHANNELS; c++)
+		if (active >> c & 1)
+			pc[c] = taken >> c & 1 ? (unsigned int)si->target[0] :
+				ip + 1;
+}
+
+static bool is_flow(unsigned int opcode)
+{
+	return opcode >= BRW_OPCODE_JMPI && opcode < BRW_OPCODE_WAIT;
+}
+
+static int stop(struct brw_sim *sim, unsigned int ip, const char *error)
+{
+	sim->error = error;
+	sim->error_insn = ip;
+	return -1;
+}
+
+int brw_sim_run(struct brw_sim *sim, uint64_t max_steps)
+{
+	const struct brw_cfg *cfg = sim->cfg;
+	uint32_t dispatch = channel_mask(sim->dispatch_width, 0);
+	unsigned int pc[MAX_CHANNELS], ip = 0, c;
+	uint64_t steps = 0;
+
+	memset(pc, 0, sizeof(pc));
+	sim->runs++;
+	sim->error = NULL;
+	sim->ended = false;
+
+	while (ip < cfg->num_insn) {
+		const struct brw_cfg_insn *ci = &cfg->insn[ip];
+		const struct brw_sim_insn *si = &sim->insn[ip];
+		uint32_t active = 0, enabled, pred;
+
+		if (steps++ == max_steps)
+			return stop(sim, ip, "step limit reached");
+		if (si->unsupported)
+			return stop(sim, ip, si->unsupported);
+
+		for (c = 0; c < MAX_CHANNELS; c++)
+			if ((dispatch >> c & 1) && pc[c] == ip)
+				active |= 1u << c;
+
+		if (cfg->block[ci->block].start == ip)
+			sim->block[ci->block]++;
+
+		/* channels of the execution size, from 0 */
+		pred = predicate(sim, si, &ci->insn);
+		enabled = ci->insn.header.mask_control == BRW_MASK_DISABLE ?
+			  ~0u : active >> si->group;
+		enabled &= channel_mask(si->exec_size, 0);
+		if (si->opcode != BRW_OPCODE_SEL && !is_flow(si->opcode))
+			enabled &= pred;
+
+		sim->instructions++;
+		sim->opcode[si->opcode]++;
+		sim->channels += __builtin_popcount(enabled);
+
+		if (is_flow(si->opcode)) {
+			execute_flow(sim, si, &ci->insn, ip, active, pred, pc);
+		} else {
+			if (si->opcode == BRW_OPCODE_SEND ||
+			    si->opcode == BRW_OPCODE_SENDC)
+				execute_send(sim, si, ci, enabled);
+			else if (si->opcode != BRW_OPCODE_NOP &&
+				 si->opcode != BRW_OPCODE_WAIT)
+				execute_alu(sim, si, &ci->insn, enabled, pred);
+			for (c = 0; c < MAX_CHANNELS; c++)
+				if (active >> c & 1)
+					pc[c] = ip + 1;
+		}
+		if (sim->ended)
+			break;
+
+		/* the thread goes where the furthest behind channel is */
+		ip = ~0u;
+		for (c = 0; c < MAX_CHANNELS; c++)
+			if ((dispatch >> c & 1) && pc[c] < ip)
+				ip = pc[c];
+	}
+	return 0;
+}
+
+static bool is_zero(const uint8_t *p, unsigned int size)
+{
+	unsigned int i;
+
+	for (i = 0; i < size; i++)
+		if (p[i])
+			return false;
+	return true;
+}
+
+static void dump_regs(FILE *out, const char *name, const uint8_t *regs,
+		      unsigned int count)
+{
+	unsigned int r, i;
+
+	for (r = 0; r < count; r++) {
+		const uint8_t *reg = regs + r * REG_SIZE;
+
+		if (is_zero(reg, REG_SIZE))
+			continue;
+		fprintf(out, "\t%s%u:", name, r);
+		for (i = 0; i < REG_SIZE; i += 4)
+			fprintf(out, " %08x", read_raw(reg + i, 4));
+		fprintf(out, "\n");
+	}
+}
+
+void brw_sim_dump(FILE *out, const struct brw_sim *sim)
+{
+	const struct brw_cfg *cfg = sim->cfg;
+	unsigned int i;
+
+	fprintf(out, "%" PRIu64 " instructions executed in %" PRIu64
+		" run%s", sim->instructions, sim->runs,
+		sim->runs == 1 ? "" : "s");
+	if (sim->instructions)
+		fprintf(out, ", %" PRIu64 " channels enabled on average",
+			sim->channels / sim->instructions);
+	fprintf(out, "\n");
+	if (sim->unsimulated)
+		fprintf(out, "%" PRIu64 " messages not simulated, "
+			"their responses zeroed\n", sim->unsimulated);
+	if (sim->error)
+		fprintf(out, "stopped at 0x%04x: %s\n",
+			cfg->insn[sim->error_insn].offset, sim->error);
+	else
+		fprintf(out, "%s\n", sim->ended ? "ended by EOT" :
+			"ran off the end of the program");
+
+	fprintf(out, "\nopcodes:\n");
+	for (i = 0; i < 128; i++)
+		if (sim->opcode[i])
+			fprintf(out, "\t%-8s %" PRIu64 "\n",
+				opcode_descs[i].name ? opcode_descs[i].name :
+				"?", sim->opcode[i]);
+
+	fprintf(out, "\nblocks:\n");
+	for (i = 0; i < cfg->num_block; i++)
+		fprintf(out, "\tblock %u (0x%04x): %" PRIu64 "\n", i,
+			cfg->insn[cfg->block[i].start].offset, sim->block[i]);
+
+	fprintf(out, "\nregisters:\n");
+	dump_regs(out, "g", sim->grf, BRW_CFG_NUM_GRF);
+	dump_regs(out, "m", sim->mrf, BRW_CFG_NUM_MRF);
+	dump_regs(out, "acc", sim->acc, 2);
+	if (!is_zero(sim->address, REG_SIZE))
+		dump_regs(out, "a", sim->address, 1);
+	if (!is_zero(sim->control, REG_SIZE))
+		dump_regs(out, "cr", sim->control, 1);
+	for (i = 0; i < 2; i++)
+		if (sim->flag[i])
+			fprintf(out, "\tf%u: %08x\n", i, sim->flag[i]);
+}
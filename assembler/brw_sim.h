@@ -0,0 +1,113 @@
+/*
+ * Copyright © 2013 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef __BRW_SIM_H__
+#define __BRW_SIM_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "brw_cfg.h"
+
+/**
+ * Software interpreter for one EU thread, to check what kernels compute
+ * and count what they execute without a GPU.
+ *
+ * The program is decoded once into per-channel operand offsets, so each
+ * instruction then runs as a loop over up to 32 channels.  Channels have
+ * their own instruction pointers, which is how divergent IF/ELSE and loops
+ * are followed: the thread always executes the lowest one, with the
+ * channels waiting there enabled.
+ *
+ * Covered are the ALU instructions in align1 and align16 with direct
+ * addressing, IF/ELSE/ENDIF, loops, BREAK/CONT, HALT and JMPI, and a few
+ * messages: the gen4/5 math box, gen7 data cache OWord block and DWord
+ * scattered reads and writes, and EOT.  Other messages aren't simulated:
+ * they are counted and their responses zeroed.  Anything else stops the
+ * run with an error.  Results are those of IEEE float arithmetic on the
+ * host, not the hardware's precision.
+ */
+
+#define BRW_SIM_MAX_CHANNELS	32
+#define BRW_SIM_MAX_SURFACES	256
+
+struct brw_sim_insn;
+
+/* Memory behind a binding table entry, for data port messages */
+struct brw_sim_surface {
+	void *data;
+	size_t size;			/* accesses past it read 0, writes drop */
+};
+
+struct brw_sim {
+	struct brw_cfg *cfg;
+	struct brw_sim_insn *insn;	/* decoded, one per instruction */
+
+	/* thread state, cleared by brw_sim_reset() */
+	uint8_t grf[BRW_CFG_NUM_GRF * 32];
+	uint8_t mrf[BRW_CFG_NUM_MRF * 32];
+	uint8_t acc[2 * 32];
+	uint8_t address[32];
+	uint8_t control[32];		/* cr0, the modes it sets ignored */
+	uint32_t flag[2];		/* f0 and f1, .1 in the high half */
+	unsigned int dispatch_width;
+	bool ended;			/* by EOT, rather than running off */
+
+	struct brw_sim_surface surface[BRW_SIM_MAX_SURFACES];
+
+	/* counts over every run since brw_sim_init() */
+	uint64_t runs;
+	uint64_t instructions;
+	uint64_t channels;		/* enabled channels, summed */
+	uint64_t opcode[128];
+	uint64_t *block;		/* times each block was entered */
+	uint64_t unsimulated;		/* messages answered with zeros */
+
+	/* why the last run stopped early, else NULL */
+	const char *error;
+	unsigned int error_insn;
+};
+
+/**
+ * Decodes the program.  The graph must stay around until brw_sim_fini().
+ * Returns -1 if we ran out of memory.
+ */
+int brw_sim_init(struct brw_sim *sim, struct brw_cfg *cfg);
+void brw_sim_fini(struct brw_sim *sim);
+
+/* Clears the registers for a new thread of dispatch_width channels */
+void brw_sim_reset(struct brw_sim *sim, unsigned int dispatch_width);
+
+/**
+ * Runs the thread from the first instruction until EOT, the end of the
+ * program or max_steps instructions.  Returns 0, or -1 with \c error set
+ * if it hit something it can't execute or the step limit.
+ */
+int brw_sim_run(struct brw_sim *sim, uint64_t max_steps);
+
+/* Counts per opcode and block, then the registers that aren't zero */
+void brw_sim_dump(FILE *out, const struct brw_sim *sim);
+
+#endif /* __BRW_SIM_H__ */
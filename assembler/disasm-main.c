@@ -20,16 +20,36 @@
  * OF THIS SOFTWARE.
  */
 
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <getopt.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "gen4asm.h"
+#include "brw_asm.h"
+#include "brw_cfg.h"
+#include "brw_sim.h"
 #include "brw_eu.h"
 
 static const struct option longopts[] = {
+	{ "binary", no_argument, NULL, 'b' },
+	{ "raw", no_argument, NULL, 'R' },
+	{ "output", required_argument, NULL, 'o' },
+	{ "gen", required_argument, NULL, 'g' },
+	{ "jobs", required_argument, NULL, 'j' },
+	{ "analyze", no_argument, NULL, 'a' },
+	{ "dot", no_argument, NULL, 'd' },
+	{ "estimate", no_argument, NULL, 'e' },
+	{ "execute", no_argument, NULL, 'x' },
+	{ "width", required_argument, NULL, 'w' },
+	{ "input", required_argument, NULL, 'i' },
+	{ "runs", required_argument, NULL, 'n' },
 	{ NULL, 0, NULL, 0 }
 };
 
@@ -38,23 +58,18 @@ read_program (FILE *input)
 {
     uint32_t			    inst[4];
     struct brw_program		    *program;
-    struct brw_program_instruction  *entry, **prev;
+    struct brw_instruction	    insn;
     int			c;
     int			n = 0;
 
-    program = malloc (sizeof (struct brw_program));
-    program->first = NULL;
-    prev = &program->first;
+    program = calloc (1, sizeof (struct brw_program));
     while ((c = getc (input)) != EOF) {
 	if (c == '0') {
 	    if (fscanf (input, "x%x", &inst[n]) == 1) {
 		++n;
 		if (n == 4) {
-		    entry = malloc (sizeof (struct brw_program_instruction));
-		    memcpy (&entry->insn, inst, 4 * sizeof (uint32_t));
-		    entry->next = NULL;
-		    *prev = entry;
-		    prev = &entry->next;
+		    memcpy (&insn, inst, 4 * sizeof (uint32_t));
+		    brw_program_append (program, &insn);
 		    n = 0;
 		}
 	    }
@@ -69,23 +84,18 @@ read_program_binary (FILE *input)
     uint32_t			    temp;
     uint8_t			    inst[16];
     struct brw_program		    *program;
-    struct brw_program_instruction  *entry, **prev;
+    struct brw_instruction	    insn;
     int			c;
     int			n = 0;
 
-    program = malloc (sizeof (struct brw_program));
-    program->first = NULL;
-    prev = &program->first;
+    program = calloc (1, sizeof (struct brw_program));
     while ((c = getc (input)) != EOF) {
 	if (c == '0') {
 	    if (fscanf (input, "x%2x", &temp) == 1) {
 		inst[n++] = (uint8_t)temp;
 		if (n == 16) {
-		    entry = malloc (sizeof (struct brw_program_instruction));
-		    memcpy (&entry->insn, inst, 16 * sizeof (uint8_t));
-		    entry->next = NULL;
-		    *prev = entry;
-		    prev = &entry->next;
+		    memcpy (&insn, inst, 16 * sizeof (uint8_t));
+		    brw_program_append (program, &insn);
 		    n = 0;
 		}
 	    }
@@ -94,27 +104,262 @@ read_program_binary (FILE *input)
     return program;
 }
 
+/*
+ * Maps the whole input, or reads it into memory when it can't be mapped,
+ * e.g. from a pipe.  *mapped tells which one to undo.
+ */
+static void *
+map_input (int fd, size_t *size, int *mapped)
+{
+    struct stat st;
+    size_t alloc = 65536;
+    char *buf;
+    ssize_t len;
+
+    if (fstat (fd, &st) == 0 && S_ISREG (st.st_mode) && st.st_size > 0) {
+	buf = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (buf != MAP_FAILED) {
+	    *size = st.st_size;
+	    *mapped = 1;
+	    return buf;
+	}
+    }
+
+    *size = 0;
+    *mapped = 0;
+    buf = malloc (alloc);
+    while (buf) {
+	len = read (fd, buf + *size, alloc - *size);
+	if (len < 0 && errno == EINTR)
+	    continue;
+	if (len < 0) {
+	    free (buf);
+	    return NULL;
+	}
+	if (len == 0)
+	    break;
+	*size += len;
+	if (*size == alloc) {
+	    char *tmp = realloc (buf, alloc *= 2);
+
+	    if (tmp == NULL)
+		free (buf);
+	    buf = tmp;
+	}
+    }
+    return buf;
+}
+
+#define MAX_STEPS	1000000	/* instructions executed per run */
+
+/*
+ * Runs the program on the software EU, from registers loaded from
+ * grf_file (g0 onwards) if given, and prints the counts and final state.
+ */
+static int
+execute (FILE *output, struct brw_cfg *cfg, unsigned int width,
+	 const char *grf_file, unsigned long runs)
+{
+    struct brw_sim *sim;
+    uint8_t grf[sizeof (sim->grf)];
+    size_t grf_size = 0;
+    unsigned long i;
+    int ret = 0;
+
+    sim = malloc (sizeof (*sim));
+    if (sim == NULL || brw_sim_init (sim, cfg)) {
+	fprintf (stderr, "Couldn't execute the program, out of memory\n");
+	free (sim);
+	return 1;
+    }
+
+    if (grf_file) {
+	FILE *f = fopen (grf_file, "rb");
+
+	if (f == NULL) {
+	    perror ("Couldn't open register file");
+	    ret = 1;
+	    goto out;
+	}
+	grf_size = fread (grf, 1, sizeof (grf), f);
+	fclose (f);
+    }
+
+    for (i = 0; i < runs; i++) {
+	brw_sim_reset (sim, width);
+	memcpy (sim->grf, grf, grf_size);
+	if (brw_sim_run (sim, MAX_STEPS))
+	    break;
+    }
+    brw_sim_dump (output, sim);
+    ret = sim->error != NULL;
+out:
+    brw_sim_fini (sim);
+    free (sim);
+    return ret;
+}
+
+#define CHUNK_INSNS	1024	/* instructions disassembled per job */
+
+/* A run of instructions formatted on its own, and the labels before them */
+struct disasm_chunk {
+    unsigned int	start, end;	/* byte offsets in the code */
+    unsigned int	label;		/* first label to print */
+    struct brw_disasm_buf buf;
+};
+
+struct disasm_job {
+    const struct brw_asm_container *container;
+    struct brw_context	*brw;
+    int			gen;
+    struct disasm_chunk	*chunks;
+    unsigned int	num_chunks;
+    unsigned int	next;
+    unsigned int	end_label;	/* first label after the code */
+};
+
+static void
+print_labels (struct brw_disasm_buf *buf,
+	      const struct brw_asm_container *container,
+	      unsigned int *label, unsigned int offset)
+{
+    for (; *label < container->num_labels &&
+	   container->labels[*label].offset <= offset; (*label)++) {
+	brw_disasm_buf_append (buf,
+			       container->strtab + container->labels[*label].name);
+	brw_disasm_buf_append (buf, ":\n");
+    }
+}
+
+static void
+disasm_chunk (struct disasm_job *job, struct disasm_chunk *chunk)
+{
+    const struct brw_asm_container *container = job->container;
+    unsigned int offset, label = chunk->label;
+
+    /* Compacted instructions take 8 bytes, and are expanded to be printed */
+    for (offset = chunk->start; offset < chunk->end;) {
+	struct brw_instruction *insn = (void *)((char *)container->code + offset);
+	struct brw_instruction uncompacted;
+
+	print_labels (&chunk->buf, container, &label, offset);
+
+	if (job->gen >= 6 && insn->header.cmpt_control) {
+	    brw_uncompact_instruction(&job->brw->intel, &uncompacted,
+				      (void *)insn);
+	    insn = &uncompacted;
+	    offset += 8;
+	} else {
+	    offset += 16;
+	}
+	brw_disasm_buf (&chunk->buf, insn, job->gen);
+    }
+}
+
+static void *
+disasm_worker (void *arg)
+{
+    struct disasm_job *job = arg;
+    unsigned int i;
+
+    while ((i = __sync_fetch_and_add (&job->next, 1)) < job->num_chunks)
+	disasm_chunk (job, &job->chunks[i]);
+    return NULL;
+}
+
+/*
+ * Splits the code into chunks of CHUNK_INSNS instructions, which only
+ * takes a look at the compaction bits, and returns how many there are.
+ */
+static unsigned int
+split_chunks (struct disasm_job *job)
+{
+    const struct brw_asm_container *container = job->container;
+    unsigned int offset = 0, label = 0, n = 0, i;
+    struct disasm_chunk *chunk;
+
+    /* at least one chunk per CHUNK_INSNS * 8 bytes */
+    job->chunks = calloc (container->size / (CHUNK_INSNS * 8) + 1,
+			  sizeof (*job->chunks));
+    if (job->chunks == NULL)
+	return 0;
+
+    while (offset < container->size) {
+	chunk = &job->chunks[n++];
+	chunk->start = offset;
+	chunk->label = label;
+
+	for (i = 0; i < CHUNK_INSNS && offset < container->size; i++) {
+	    const struct brw_instruction *insn =
+		(const void *)((const char *)container->code + offset);
+
+	    for (; label < container->num_labels &&
+		   container->labels[label].offset <= offset; label++)
+		;
+	    if (job->gen >= 6 && insn->header.cmpt_control) {
+		offset += 8;
+	    } else if (container->size - offset >= 16) {
+		offset += 16;
+	    } else {
+		fprintf (stderr, "Truncated instruction at offset %u\n",
+			 offset);
+		exit (1);
+	    }
+	}
+	chunk->end = offset;
+    }
+
+    job->end_label = label;
+    job->num_chunks = n;
+    return n;
+}
+
 static void usage(void)
 {
     fprintf(stderr, "usage: intel-gen4disasm [options] inputfile\n");
-    fprintf(stderr, "\t-b, --binary                         C style binary output\n");
+    fprintf(stderr, "\t-b, --binary                         C style binary input\n");
+    fprintf(stderr, "\t-R, --raw                            Raw binary input\n");
     fprintf(stderr, "\t-o, --output {outputfile}            Specify output file\n");
     fprintf(stderr, "\t-g, --gen <4|5|6|7>                  Specify GPU generation\n");
+    fprintf(stderr, "\t-j, --jobs {n}                       Threads to use (default: one per cpu)\n");
+    fprintf(stderr, "\t-a, --analyze                        Report blocks, instruction mix and register pressure\n");
+    fprintf(stderr, "\t-d, --dot                            Print the control flow graph for graphviz\n");
+    fprintf(stderr, "\t-e, --estimate                       Estimate cycles per block and the critical path\n");
+    fprintf(stderr, "\t-x, --execute                        Run the program on a software EU\n");
+    fprintf(stderr, "\t-w, --width <8|16|32>                Channels dispatched when executing (default: 8)\n");
+    fprintf(stderr, "\t-i, --input {grffile}                Raw register contents to execute from, g0 on\n");
+    fprintf(stderr, "\t-n, --runs {n}                       Times to execute it (default: 1)\n");
 }
 
 int main(int argc, char **argv)
 {
-    struct brw_program	*program;
-    FILE		*input = stdin;
+    struct brw_program	*program = NULL;
+    struct brw_asm_container container;
+    FILE		*input;
     FILE		*output = stdout;
     char		*input_filename = NULL;
     char		*output_file = NULL;
     int			byte_array_input = 0;
+    int			raw_input = 0;
+    int			analyze = 0;
+    int			dot = 0;
+    int			estimate = 0;
+    int			exec = 0;
+    unsigned int	width = 8;
+    unsigned long	runs = 1;
+    char		*grf_file = NULL;
+    int			gen_set = 0;
     int			o;
     int			gen = 4;
-    struct brw_program_instruction  *inst;
+    int			fd = STDIN_FILENO, mapped;
+    unsigned int	label, i;
+    long		jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    struct brw_context	brw;
+    struct disasm_job	job;
+    void		*data;
+    size_t		size;
 
-    while ((o = getopt_long(argc, argv, "o:bg:", longopts, NULL)) != -1) {
+    while ((o = getopt_long(argc, argv, "o:bRg:j:adexw:i:n:", longopts, NULL)) != -1) {
 	switch (o) {
 	case 'o':
 	    if (strcmp(optarg, "-") != 0)
@@ -123,8 +368,40 @@ int main(int argc, char **argv)
 	case 'b':
 	    byte_array_input = 1;
 	    break;
+	case 'R':
+	    raw_input = 1;
+	    break;
+	case 'j':
+	    jobs = atoi(optarg);
+	    break;
+	case 'a':
+	    analyze = 1;
+	    break;
+	case 'd':
+	    dot = 1;
+	    break;
+	case 'e':
+	    estimate = 1;
+	    break;
+	case 'x':
+	    exec = 1;
+	    break;
+	case 'w':
+	    width = strtoul(optarg, NULL, 10);
+	    if (width != 8 && width != 16 && width != 32) {
+		usage();
+		exit(1);
+	    }
+	    break;
+	case 'i':
+	    grf_file = optarg;
+	    break;
+	case 'n':
+	    runs = strtoul(optarg, NULL, 10);
+	    break;
 	case 'g':
 	    gen = strtol(optarg, NULL, 10);
+	    gen_set = 1;
 
 	    if (gen < 4 || gen > 7) {
 		    usage();
@@ -146,18 +423,42 @@ int main(int argc, char **argv)
 
     if (strcmp(argv[0], "-") != 0) {
 	input_filename = argv[0];
-	input = fopen(input_filename, "r");
-	if (input == NULL) {
+	fd = open(input_filename, O_RDONLY);
+	if (fd < 0) {
 	    perror("Couldn't open input file");
 	    exit(1);
 	}
     }
-    if (byte_array_input)
-	program = read_program_binary (input);
-    else
-	program = read_program (input);
-    if (!program)
-	exit (1);
+    data = map_input (fd, &size, &mapped);
+    if (data == NULL) {
+	perror("Couldn't read input file");
+	exit(1);
+    }
+
+    /* Containers say what they hold, anything else is as the options say */
+    memset (&container, 0, sizeof (container));
+    if (brw_asm_parse_container (data, size, &container) == 0) {
+	if (!gen_set)
+	    gen = container.gen / 10;
+    } else if (raw_input) {
+	container.code = data;
+	container.size = size & ~7;
+    } else {
+	input = fmemopen (data, size, "r");
+	if (input == NULL) {
+	    perror("Couldn't read input file");
+	    exit(1);
+	}
+	if (byte_array_input)
+	    program = read_program_binary (input);
+	else
+	    program = read_program (input);
+	fclose (input);
+	if (!program)
+	    exit (1);
+	container.code = program->insn;
+	container.size = program->num_insn * 16;
+    }
     if (output_file) {
 	output = fopen (output_file, "w");
 	if (output == NULL) {
@@ -166,7 +467,70 @@ int main(int argc, char **argv)
 	}
     }
 
-    for (inst = program->first; inst; inst = inst->next)
-	brw_disasm (output, &inst->insn.gen, gen);
+    /* only containers tell Haswell, whose JMPI offsets are in bytes */
+    if (!gen_set && container.gen)
+	brw_init_context(&brw, container.gen);
+    else
+	brw_init_context(&brw, gen * 10);
+    brw_init_compaction_tables(&brw.intel);
+
+    if (analyze || dot || estimate || exec) {
+	struct brw_cfg cfg;
+
+	if (brw_cfg_build (&cfg, &brw, container.code, container.size)) {
+	    fprintf (stderr, "Couldn't analyze the program, "
+		     "truncated or out of memory\n");
+	    exit (1);
+	}
+	if (exec) {
+	    int ret = execute (output, &cfg, width, grf_file, runs);
+
+	    brw_cfg_fini (&cfg);
+	    exit (ret);
+	}
+	if (analyze)
+	    brw_cfg_dump_report (output, &cfg);
+	else if (estimate)
+	    brw_cfg_dump_estimate (output, &cfg);
+	else
+	    brw_cfg_dump_dot (output, &cfg);
+	brw_cfg_fini (&cfg);
+	exit (0);
+    }
+
+    memset (&job, 0, sizeof (job));
+    job.container = &container;
+    job.brw = &brw;
+    job.gen = gen;
+    if (container.size && split_chunks (&job) == 0) {
+	perror("Couldn't disassemble");
+	exit(1);
+    }
+
+    if (jobs > job.num_chunks)
+	jobs = job.num_chunks;
+    if (jobs > 1) {
+	pthread_t *threads = calloc (jobs - 1, sizeof (*threads));
+
+	/* this thread is the last worker */
+	for (i = 0; threads && i < jobs - 1; i++)
+	    if (pthread_create (&threads[i], NULL, disasm_worker, &job))
+		break;
+	disasm_worker (&job);
+	while (threads && i--)
+	    pthread_join (threads[i], NULL);
+	free (threads);
+    } else {
+	disasm_worker (&job);
+    }
+
+    for (i = 0; i < job.num_chunks; i++) {
+	fwrite (job.chunks[i].buf.str, 1, job.chunks[i].buf.len, output);
+	brw_disasm_buf_fini (&job.chunks[i].buf);
+    }
+    for (label = job.end_label; label < container.num_labels; label++)
+	fprintf (output, "%s:\n",
+		 container.strtab + container.labels[label].name);
+    free (job.chunks);
     exit (0);
 }
@@ -0,0 +1,452 @@
+/* -*- c-basic-offset: 8 -*- */
+/*
+ * Copyright © 2013 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+/*
+ * Times intel-gen4asm on synthetic Gen7 kernels of 1k up to 1M instructions.
+ *
+ * The kernels are shaped like generated media kernels: a label on every
+ * basic block, forward jumps and backward loops between them, a label
+ * name that is reused many times (resolved to the nearest following
+ * definition), lots of .declare'd registers and an entry point table.
+ *
+ * With -c, times a corpus of small kernels instead (e.g. assembler/test,
+ * replicated -c times): one intel-gen4asm process per kernel against a
+ * single -m manifest run, and checks that both produce the same bytes.
+ *
+ * With -C, the synthetic kernels are also assembled in-process and
+ * brw_compact_instructions() is timed on them on its own.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#include "ralloc.h"
+#include "brw_asm.h"
+#include "brw_eu.h"
+
+#define BLOCK_SIZE	8	/* instructions per labelled block */
+#define DUP_INTERVAL	64	/* blocks between redefinitions of "loop" */
+#define ENTRY_INTERVAL	16	/* blocks between entry points */
+#define MAX_DECLARES	65536
+#define COMPACT_RUNS	10	/* compaction passes timed per kernel */
+
+static double get_time_in_secs(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+
+	return (double)tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static int write_kernel(const char *kernel, const char *entries, int count,
+			int *num_labels)
+{
+	FILE *k, *e;
+	int blocks = (count + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	int declares = count / 16;
+	int b, i, n = 0;
+
+	if (declares < 1)
+		declares = 1;
+	if (declares > MAX_DECLARES)
+		declares = MAX_DECLARES;
+
+	k = fopen(kernel, "w");
+	e = fopen(entries, "w");
+	if (k == NULL || e == NULL) {
+		perror("Couldn't create kernel");
+		return -1;
+	}
+
+	for (i = 0; i < declares; i++)
+		fprintf(k, ".declare v%d Base=g%d.0 ElementSize=4 "
+			"SrcRegion=<8,8,1> DstRegion=<1> Type=F\n",
+			i, 10 + i % 100);
+
+	*num_labels = 0;
+	for (b = 0; b < blocks; b++) {
+		fprintf(k, "b%d:\n", b);
+		(*num_labels)++;
+		if (b % DUP_INTERVAL == 0) {
+			fprintf(k, "loop:\n");
+			(*num_labels)++;
+		}
+		if (b % ENTRY_INTERVAL == 0)
+			fprintf(e, "b%d\n", b);
+
+		for (i = 0; i < BLOCK_SIZE && n < count; i++, n++) {
+			switch (i) {
+			case 0:
+				fprintf(k, "add (8) v%d g4<8,8,1>F v%d { align1 };\n",
+					b % declares, (b + 1) % declares);
+				break;
+			case 3:
+				fprintf(k, "jmpi (1) b%d;\n",
+					b + 1 < blocks ? b + 1 : 0);
+				break;
+			case 5:
+				fprintf(k, "jmpi (1) loop;\n");
+				break;
+			case 7:
+				fprintf(k, "while (8) b%d { align1 };\n",
+					b > 4 ? b - 4 : b);
+				break;
+			default:
+				fprintf(k, "mov (8) g%d<1>F g%d<8,8,1>F { align1 };\n",
+					2 + i, 3 + i);
+				break;
+			}
+		}
+	}
+
+	fclose(e);
+	return fclose(k);
+}
+
+static int run(char **argv)
+{
+	int status;
+	pid_t pid;
+
+	pid = fork();
+	if (pid == 0) {
+		execv(argv[0], argv);
+		perror(argv[0]);
+		_exit(127);
+	}
+	if (pid < 0 || waitpid(pid, &status, 0) < 0 ||
+	    !WIFEXITED(status) || WEXITSTATUS(status))
+		return -1;
+
+	return 0;
+}
+
+static double run_assembler(const char *assembler, const char *kernel,
+			    const char *entries)
+{
+	double start = get_time_in_secs();
+	char *argv[] = {
+		(char *)assembler, "-g", "7", "-l", (char *)entries,
+		"-o", "/dev/null", (char *)kernel, NULL
+	};
+
+	if (run(argv)) {
+		fprintf(stderr, "%s failed on %s\n", assembler, kernel);
+		return -1;
+	}
+
+	return get_time_in_secs() - start;
+}
+
+static char *read_file(const char *name, long *size)
+{
+	FILE *file = fopen(name, "r");
+	char *buf = NULL;
+
+	if (file == NULL)
+		return NULL;
+	if (fseek(file, 0, SEEK_END) == 0 && (*size = ftell(file)) >= 0 &&
+	    (buf = malloc(*size + 1)) != NULL) {
+		rewind(file);
+		if (fread(buf, 1, *size, file) != (size_t)*size) {
+			free(buf);
+			buf = NULL;
+		}
+	}
+	fclose(file);
+	return buf;
+}
+
+static int same_file(const char *a, const char *b)
+{
+	long size_a, size_b;
+	char *data_a = read_file(a, &size_a);
+	char *data_b = read_file(b, &size_b);
+	int same;
+
+	same = data_a && data_b && size_a == size_b &&
+		memcmp(data_a, data_b, size_a) == 0;
+	free(data_a);
+	free(data_b);
+	return same;
+}
+
+/*
+ * Assembles copies * nsources kernels, first one process each, then all of
+ * them from a single manifest, and compares the outputs.
+ */
+static int run_corpus(const char *assembler, const char *gen, const char *jobs,
+		      int copies, char **sources, int nsources)
+{
+	char dir[] = "/tmp/gen4asm-bench-XXXXXX";
+	char manifest[64], check[64], serial[4096], batch[4096];
+	double serial_time = 0, batch_time;
+	int c, i, kernels = 0, mismatches = 0;
+	FILE *m;
+
+	if (mkdtemp(dir) == NULL) {
+		perror("Couldn't create output directory");
+		return -1;
+	}
+	snprintf(manifest, sizeof(manifest), "%s/manifest", dir);
+	snprintf(check, sizeof(check), "%s/check", dir);
+	m = fopen(manifest, "w");
+	if (m == NULL) {
+		perror("Couldn't create manifest");
+		return -1;
+	}
+
+	for (i = 0; i < nsources; i++) {
+		char *argv[] = {
+			(char *)assembler, "-g", (char *)gen, "-o", check,
+			sources[i], NULL
+		};
+
+		/* leave out the kernels the assembler rejects */
+		if (run(argv)) {
+			fprintf(stderr, "skipping %s, it doesn't assemble\n",
+				sources[i]);
+			sources[i] = NULL;
+			continue;
+		}
+
+		for (c = 0; c < copies; c++) {
+			double start = get_time_in_secs();
+
+			snprintf(serial, sizeof(serial), "%s/%d-%d.serial",
+				 dir, i, c);
+			argv[4] = serial;
+			if (run(argv))
+				return -1;
+			serial_time += get_time_in_secs() - start;
+
+			fprintf(m, "%s %s/%d-%d.batch\n", sources[i], dir, i, c);
+			kernels++;
+		}
+	}
+	fclose(m);
+	unlink(check);
+
+	{
+		char *argv[] = {
+			(char *)assembler, "-g", (char *)gen, "-j", (char *)jobs,
+			"-m", manifest, NULL
+		};
+		double start = get_time_in_secs();
+
+		if (run(argv)) {
+			fprintf(stderr, "%s failed on %s\n", assembler, manifest);
+			return -1;
+		}
+		batch_time = get_time_in_secs() - start;
+	}
+
+	for (i = 0; i < nsources; i++) {
+		if (sources[i] == NULL)
+			continue;
+		for (c = 0; c < copies; c++) {
+			snprintf(serial, sizeof(serial), "%s/%d-%d.serial",
+				 dir, i, c);
+			snprintf(batch, sizeof(batch), "%s/%d-%d.batch",
+				 dir, i, c);
+			if (!same_file(serial, batch)) {
+				fprintf(stderr, "%s differs from %s\n",
+					batch, serial);
+				mismatches++;
+			}
+			unlink(serial);
+			unlink(batch);
+		}
+	}
+	unlink(manifest);
+	rmdir(dir);
+
+	printf("%8d kernels: %8.3fs serial, %8.3fs manifest (-j %s), %.1fx\n",
+	       kernels, serial_time, batch_time, jobs,
+	       batch_time > 0 ? serial_time / batch_time : 0);
+
+	return mismatches ? -1 : 0;
+}
+
+/* Returns the average time of one compaction pass over the kernel */
+static double time_compaction(const char *kernel)
+{
+	struct brw_asm_options options = { .gen = 70, .filename = kernel };
+	struct brw_asm_result result;
+	struct brw_context brw;
+	struct brw_compile p;
+	void *mem_ctx, *store;
+	double start, elapsed;
+	char *source;
+	long size;
+	int i;
+
+	source = read_file(kernel, &size);
+	if (source == NULL ||
+	    brw_asm_assemble(&options, source, size, &result)) {
+		fprintf(stderr, "Couldn't assemble %s\n", kernel);
+		free(source);
+		return -1;
+	}
+	free(source);
+
+	brw_init_context(&brw, options.gen);
+	mem_ctx = ralloc_context(NULL);
+	brw_init_compile(&brw, &p, mem_ctx);
+	store = malloc(result.size);
+
+	start = get_time_in_secs();
+	for (i = 0; i < COMPACT_RUNS; i++) {
+		memcpy(store, result.code, result.size);
+		p.store = store;
+		p.nr_insn = result.size / 16;
+		p.next_insn_offset = result.size;
+		brw_compact_instructions(&p, 0, NULL);
+	}
+	elapsed = (get_time_in_secs() - start) / COMPACT_RUNS;
+
+	free(store);
+	ralloc_free(mem_ctx);
+	brw_asm_result_fini(&result);
+
+	return elapsed;
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: intel-gen4asm-bench [options]\n");
+	fprintf(stderr, "       intel-gen4asm-bench [options] -c {copies} kernel...\n");
+	fprintf(stderr, "OPTIONS:\n");
+	fprintf(stderr, "\t-a, --assembler {path}    Assembler to time (default: next to this binary)\n");
+	fprintf(stderr, "\t-m, --max {count}         Largest kernel in instructions (default: 1000000)\n");
+	fprintf(stderr, "\t-k, --keep                Keep the generated kernels\n");
+	fprintf(stderr, "\t-C, --compaction          Also time instruction compaction\n");
+	fprintf(stderr, "\t-c, --copies {count}      Time the given kernels, each assembled count times\n");
+	fprintf(stderr, "\t-g, --gen {gen}           Generation of the given kernels (default: 4)\n");
+	fprintf(stderr, "\t-j, --jobs {n}            Threads for the manifest run (default: one per cpu)\n");
+}
+
+static const struct option longopts[] = {
+	{"assembler", required_argument, 0, 'a'},
+	{"max", required_argument, 0, 'm'},
+	{"keep", no_argument, 0, 'k'},
+	{"compaction", no_argument, 0, 'C'},
+	{"copies", required_argument, 0, 'c'},
+	{"gen", required_argument, 0, 'g'},
+	{"jobs", required_argument, 0, 'j'},
+	{ NULL, 0, NULL, 0 }
+};
+
+int main(int argc, char **argv)
+{
+	char assembler[4096], kernel[64], entries[64], jobs[16];
+	const char *gen = "4";
+	int max = 1000000, keep = 0, copies = 0, compaction = 0;
+	int count, labels, o;
+
+	snprintf(assembler, sizeof(assembler), "%s/intel-gen4asm",
+		 dirname(strdup(argv[0])));
+
+	snprintf(jobs, sizeof(jobs), "%ld", sysconf(_SC_NPROCESSORS_ONLN));
+
+	while ((o = getopt_long(argc, argv, "a:m:kc:g:j:C", longopts, NULL)) != -1) {
+		switch (o) {
+		case 'a':
+			snprintf(assembler, sizeof(assembler), "%s", optarg);
+			break;
+		case 'm':
+			max = atoi(optarg);
+			break;
+		case 'k':
+			keep = 1;
+			break;
+		case 'C':
+			compaction = 1;
+			break;
+		case 'c':
+			copies = atoi(optarg);
+			break;
+		case 'g':
+			gen = optarg;
+			break;
+		case 'j':
+			snprintf(jobs, sizeof(jobs), "%s", optarg);
+			break;
+		default:
+			usage();
+			exit(1);
+		}
+	}
+
+	if (copies > 0) {
+		if (optind == argc) {
+			usage();
+			exit(1);
+		}
+		return run_corpus(assembler, gen, jobs, copies,
+				  argv + optind, argc - optind) ? 1 : 0;
+	}
+
+	for (count = 1000; count <= max; count *= 10) {
+		double elapsed;
+
+		snprintf(kernel, sizeof(kernel), "gen4asm-bench-%d.g7a", count);
+		snprintf(entries, sizeof(entries), "gen4asm-bench-%d.entry", count);
+
+		if (write_kernel(kernel, entries, count, &labels))
+			exit(1);
+
+		elapsed = run_assembler(assembler, kernel, entries);
+		if (elapsed < 0)
+			exit(1);
+
+		printf("%8d instructions, %7d labels: %8.3fs (%.0f instructions/s)\n",
+		       count, labels, elapsed, count / elapsed);
+
+		if (compaction) {
+			elapsed = time_compaction(kernel);
+			if (elapsed < 0)
+				exit(1);
+
+			printf("%8d instructions, compaction:   %8.3fs (%.0f instructions/s)\n",
+			       count, elapsed, count / elapsed);
+		}
+
+		if (!keep) {
+			unlink(kernel);
+			unlink(entries);
+		}
+	}
+
+	return 0;
+}
@@ -36,30 +36,24 @@
 #include "brw_reg.h"
 #include "brw_defines.h"
 #include "brw_structs.h"
-
-extern long int gen_level;
-extern int advanced_flag;
-extern int errors;
+#include "brw_eu.h"
 
 #define WARN_ALWAYS	(1 << 0)
 #define WARN_ALL	(1 << 31)
-extern unsigned int warning_flags;
-
-extern char *input_filename;
 
-extern struct brw_context genasm_context;
-extern struct brw_compile genasm_compile;
+/*
+ * The generation predicates below, and the parser's error() and warn()
+ * macros, expect the current struct gen4asm_state to be in scope as "state".
+ */
 
 /* Predicate for Gen X and above */
-#define IS_GENp(x) (gen_level >= (x)*10)
+#define IS_GENp(x) (state->gen_level >= (x)*10)
 
 /* Predicate for Gen X exactly */
-#define IS_GENx(x) (gen_level >= (x)*10 && gen_level < ((x)+1)*10)
+#define IS_GENx(x) (state->gen_level >= (x)*10 && state->gen_level < ((x)+1)*10)
 
 /* Predicate to match Haswell processors */
-#define IS_HASWELL(x) (gen_level == 75)
-
-void yyerror (char *msg);
+#define IS_HASWELL(x) (state->gen_level == 75)
 
 #define STRUCT_SIZE_ASSERT(TYPE, SIZE) \
 typedef struct { \
@@ -144,46 +138,69 @@ struct relocation {
 };
 
 /**
- * This structure is just the list container for instructions accumulated by
- * the parser and labels.
+ * A single instruction, or a label, as produced by the parser's grammar
+ * rules before it is appended to the program.
  */
 struct brw_program_instruction {
     enum assembler_instruction_type type;
-    unsigned inst_offset;
     union {
 	struct brw_instruction gen;
 	struct label_instruction label;
     } insn;
     struct relocation reloc;
-    struct brw_program_instruction *next;
 };
 
-static inline bool is_label(struct brw_program_instruction *instruction)
-{
-    return instruction->type == GEN4ASM_INSTRUCTION_LABEL;
-}
-
-static inline char *label_name(struct brw_program_instruction *i)
-{
-    assert(is_label(i));
-    return i->insn.label.name;
-}
+/** A label, placed before the instruction at index \c insn */
+struct program_label {
+    char *name;
+    unsigned insn;
+    int offset;		/* instruction offset, assigned after parsing */
+};
 
-static inline bool is_relocatable(struct brw_program_instruction *intruction)
-{
-    return intruction->type == GEN4ASM_INSTRUCTION_GEN_RELOCATABLE;
-}
+/** The relocation needed by the instruction at index \c insn */
+struct program_reloc {
+    unsigned insn;
+    int offset;		/* instruction offset, assigned after parsing */
+    struct relocation reloc;
+};
 
 /**
- * This structure is a list of instructions.  It is the final output of the
- * parser.
+ * This structure is the final output of the parser.  Instructions are kept
+ * in one contiguous, growable array; labels and relocations live in side
+ * tables that refer to it by index, in program order.
  */
 struct brw_program {
-	struct brw_program_instruction *first;
-	struct brw_program_instruction *last;
+	struct brw_instruction *insn;
+	unsigned num_insn, insn_size;
+
+	struct program_label *label;
+	unsigned num_label, label_size;
+
+	struct program_reloc *reloc;
+	unsigned num_reloc, reloc_size;
 };
 
-extern struct brw_program compiled_program;
+/* Make room for one more element in a growable program array */
+#define brw_program_grow(array, count, size)				\
+    do {								\
+	if ((count) == (size)) {					\
+	    (size) = (size) ? (size) * 2 : 64;				\
+	    (array) = realloc((array), (size) * sizeof(*(array)));	\
+	    if ((array) == NULL) {					\
+		fprintf(stderr, "Out of memory growing program\n");	\
+		exit(1);						\
+	    }								\
+	}								\
+    } while (0)
+
+static inline void brw_program_append(struct brw_program *p,
+				      const struct brw_instruction *insn)
+{
+    brw_program_grow(p->insn, p->num_insn, p->insn_size);
+    p->insn[p->num_insn++] = *insn;
+}
+
+void brw_program_free(struct brw_program *p);
 
 #define TYPE_B_INDEX            0
 #define TYPE_UB_INDEX           1
@@ -205,7 +222,6 @@ struct program_defaults {
     struct region dest_region;
     struct region dest_region_type[TOTAL_TYPES];
 };
-extern struct program_defaults program_defaults;
 
 struct declared_register {
     char *name;
@@ -214,14 +230,57 @@ struct declared_register {
     struct region src_region;
     int dst_region;
 };
-struct declared_register *find_register(char *name);
-void insert_register(struct declared_register *reg);
 
-int yyparse(void);
-int yylex(void);
-int yylex_destroy(void);
+struct hash_item;
+
+/* String-keyed chained hash table, see brw_asm.c */
+struct hash_table {
+    struct hash_item **buckets;
+    unsigned int size;
+    unsigned int count;
+    int ignore_case;
+};
+
+/**
+ * Everything one assembly needs: the options it was started with, the
+ * parser's and scanner's state, the symbol tables and the program being
+ * built.  Nothing is kept in globals, so independent assemblies can run
+ * concurrently on different threads.
+ */
+struct gen4asm_state {
+    long int gen_level;
+    int advanced_flag; /* 0: in unit of byte, 1: in unit of data element size */
+    unsigned int warning_flags;
+    const char *input_filename;
+    int errors;
+
+    struct brw_context brw_context;
+    struct brw_compile compile;
+    void *mem_ctx;
+
+    void *scanner;
+    struct program_defaults program_defaults;
+    struct hash_table declared_register_table;
+    struct hash_table label_table;
+    struct hash_table entry_point_table;
+
+    struct brw_program program;
+};
+
+struct declared_register *find_register(struct gen4asm_state *state,
+					 char *name);
+void insert_register(struct gen4asm_state *state,
+		     struct declared_register *reg);
+
+int yyparse(struct gen4asm_state *state);
 
+int
+lex_init(struct gen4asm_state *state, const char *source, size_t size);
+void
+lex_fini(struct gen4asm_state *state);
 char *
-lex_text(void);
+lex_text(void *scanner);
+int
+lex_lineno(void *scanner);
 
 #endif /* __GEN4ASM_H__ */
@@ -35,7 +35,7 @@
 #include "gen4asm.h"
 #include "brw_eu.h"
 
-#define DEFAULT_EXECSIZE (ffs(program_defaults.execute_size) - 1)
+#define DEFAULT_EXECSIZE (ffs(state->program_defaults.execute_size) - 1)
 #define DEFAULT_DSTREGION -1
 
 #define SWIZZLE(reg) (reg.dw1.bits.swizzle)
@@ -51,19 +51,18 @@ typedef struct YYLTYPE
  int last_column;
 } YYLTYPE;
 
-extern int need_export;
-static struct src_operand src_null_reg =
+static const struct src_operand src_null_reg =
 {
     .reg.file = BRW_ARCHITECTURE_REGISTER_FILE,
     .reg.nr = BRW_ARF_NULL,
     .reg.type = BRW_REGISTER_TYPE_UD,
 };
-static struct brw_reg dst_null_reg =
+static const struct brw_reg dst_null_reg =
 {
     .file = BRW_ARCHITECTURE_REGISTER_FILE,
     .nr = BRW_ARF_NULL,
 };
-static struct brw_reg ip_dst =
+static const struct brw_reg ip_dst =
 {
     .file = BRW_ARCHITECTURE_REGISTER_FILE,
     .nr = BRW_ARF_IP,
@@ -72,7 +71,7 @@ static struct brw_reg ip_dst =
     .hstride = 1,
     .dw1.bits.writemask = BRW_WRITEMASK_XYZW,
 };
-static struct src_operand ip_src =
+static const struct src_operand ip_src =
 {
     .reg.file = BRW_ARCHITECTURE_REGISTER_FILE,
     .reg.nr = BRW_ARF_IP,
@@ -84,29 +83,47 @@ static struct src_operand ip_src =
 static int get_type_size(unsigned type);
 static void set_instruction_opcode(struct brw_program_instruction *instr,
 				   unsigned opcode);
-static int set_instruction_dest(struct brw_program_instruction *instr,
+static int set_instruction_dest(struct gen4asm_state *state,
+				struct brw_program_instruction *instr,
 				struct brw_reg *dest);
-static int set_instruction_src0(struct brw_program_instruction *instr,
+static int set_instruction_src0(struct gen4asm_state *state,
+				struct brw_program_instruction *instr,
 				struct src_operand *src,
 				YYLTYPE *location);
-static int set_instruction_src1(struct brw_program_instruction *instr,
+static int set_instruction_src1(struct gen4asm_state *state,
+				struct brw_program_instruction *instr,
 				struct src_operand *src,
 				YYLTYPE *location);
-static int set_instruction_dest_three_src(struct brw_program_instruction *instr,
+static int set_instruction_dest_three_src(struct gen4asm_state *state,
+					  struct brw_program_instruction *instr,
 					  struct brw_reg *dest);
-static int set_instruction_src0_three_src(struct brw_program_instruction *instr,
+static int set_instruction_src0_three_src(struct gen4asm_state *state,
+					  struct brw_program_instruction *instr,
 					  struct src_operand *src);
-static int set_instruction_src1_three_src(struct brw_program_instruction *instr,
+static int set_instruction_src1_three_src(struct gen4asm_state *state,
+					  struct brw_program_instruction *instr,
 					  struct src_operand *src);
-static int set_instruction_src2_three_src(struct brw_program_instruction *instr,
+static int set_instruction_src2_three_src(struct gen4asm_state *state,
+					  struct brw_program_instruction *instr,
 					  struct src_operand *src);
+static int set_instruction_dest_template(struct gen4asm_state *state,
+					 struct brw_program_instruction *instr,
+					 const struct brw_reg *template,
+					 int width);
+static int set_instruction_src0_template(struct gen4asm_state *state,
+					 struct brw_program_instruction *instr,
+					 const struct src_operand *template);
+static int set_instruction_src1_template(struct gen4asm_state *state,
+					 struct brw_program_instruction *instr,
+					 const struct src_operand *template);
 static void set_instruction_saturate(struct brw_program_instruction *instr,
 				     int saturate);
 static void set_instruction_options(struct brw_program_instruction *instr,
 				    struct options options);
 static void set_instruction_predicate(struct brw_program_instruction *instr,
 				      struct predicate *p);
-static void set_instruction_pred_cond(struct brw_program_instruction *instr,
+static void set_instruction_pred_cond(struct gen4asm_state *state,
+				      struct brw_program_instruction *instr,
 				      struct predicate *p,
 				      struct condition *c,
 				      YYLTYPE *location);
@@ -120,17 +137,18 @@ enum message_level {
     ERROR,
 };
 
-static void message(enum message_level level, YYLTYPE *location,
+static void message(struct gen4asm_state *state,
+		    enum message_level level, YYLTYPE *location,
 		    const char *fmt, ...)
 {
     static const char *level_str[] = { "warning", "error" };
     va_list args;
 
     if (location)
-	fprintf(stderr, "%s:%d:%d: %s: ", input_filename, location->first_line,
+	fprintf(stderr, "%s:%d:%d: %s: ", state->input_filename, location->first_line,
 		location->first_column, level_str[level]);
     else
-	fprintf(stderr, "%s:%s: ", input_filename, level_str[level]);
+	fprintf(stderr, "%s:%s: ", state->input_filename, level_str[level]);
 
     va_start(args, fmt);
     vfprintf(stderr, fmt, args);
@@ -139,13 +157,13 @@ static void message(enum message_level level, YYLTYPE *location,
 
 #define warn(flag, l, fmt, ...)					\
     do {							\
-	if (warning_flags & WARN_ ## flag)			\
-	    message(WARN, l, fmt, ## __VA_ARGS__);	\
+	if (state->warning_flags & WARN_ ## flag)		\
+	    message(state, WARN, l, fmt, ## __VA_ARGS__);	\
     } while(0)
 
 #define error(l, fmt, ...)			\
     do {					\
-	message(ERROR, l, fmt, ## __VA_ARGS__);	\
+	message(state, ERROR, l, fmt, ## __VA_ARGS__);	\
     } while(0)
 
 /* like strcmp, but handles NULL pointers */
@@ -192,50 +210,53 @@ static void brw_program_init(struct brw_program *p)
    memset(p, 0, sizeof(struct brw_program));
 }
 
-static void brw_program_append_entry(struct brw_program *p,
-				     struct brw_program_instruction *entry)
-{
-    entry->next = NULL;
-    if (p->last)
-	p->last->next = entry;
-    else
-	p->first = entry;
-    p->last = entry;
-}
-
 static void
 brw_program_add_instruction(struct brw_program *p,
 			    struct brw_program_instruction *instruction)
 {
-    struct brw_program_instruction *list_entry;
-
-    list_entry = calloc(sizeof(struct brw_program_instruction), 1);
-    list_entry->type = GEN4ASM_INSTRUCTION_GEN;
-    list_entry->insn.gen = instruction->insn.gen;
-    brw_program_append_entry(p, list_entry);
+    brw_program_append(p, &instruction->insn.gen);
 }
 
 static void
 brw_program_add_relocatable(struct brw_program *p,
 			    struct brw_program_instruction *instruction)
 {
-    struct brw_program_instruction *list_entry;
+    struct program_reloc *reloc;
+
+    brw_program_grow(p->reloc, p->num_reloc, p->reloc_size);
+    reloc = &p->reloc[p->num_reloc++];
+    reloc->insn = p->num_insn;
+    reloc->offset = 0;
+    reloc->reloc = instruction->reloc;
+    brw_program_add_instruction(p, instruction);
+}
+
+/* Takes ownership of the label name */
+static void brw_program_add_label(struct brw_program *p, char *label)
+{
+    struct program_label *l;
 
-    list_entry = calloc(sizeof(struct brw_program_instruction), 1);
-    list_entry->type = GEN4ASM_INSTRUCTION_GEN_RELOCATABLE;
-    list_entry->insn.gen = instruction->insn.gen;
-    list_entry->reloc = instruction->reloc;
-    brw_program_append_entry(p, list_entry);
+    brw_program_grow(p->label, p->num_label, p->label_size);
+    l = &p->label[p->num_label++];
+    l->name = label;
+    l->insn = p->num_insn;
+    l->offset = 0;
 }
 
-static void brw_program_add_label(struct brw_program *p, const char *label)
+void brw_program_free(struct brw_program *p)
 {
-    struct brw_program_instruction *list_entry;
+    unsigned i;
 
-    list_entry = calloc(sizeof(struct brw_program_instruction), 1);
-    list_entry->type = GEN4ASM_INSTRUCTION_LABEL;
-    list_entry->insn.label.name = strdup(label);
-    brw_program_append_entry(p, list_entry);
+    for (i = 0; i < p->num_label; i++)
+	free(p->label[i].name);
+    for (i = 0; i < p->num_reloc; i++) {
+	free(p->reloc[i].reloc.first_reloc_target);
+	free(p->reloc[i].reloc.second_reloc_target);
+    }
+    free(p->label);
+    free(p->reloc);
+    free(p->insn);
+    brw_program_init(p);
 }
 
 static int resolve_dst_region(struct declared_register *reference, int region)
@@ -268,7 +289,8 @@ static bool validate_dst_reg(struct brw_instruction *insn, struct brw_reg *reg)
     return true;
 }
 
-static bool validate_src_reg(struct brw_instruction *insn,
+static bool validate_src_reg(struct gen4asm_state *state,
+			     struct brw_instruction *insn,
 			     struct brw_reg reg,
 			     YYLTYPE *location)
 {
@@ -339,14 +361,15 @@ static bool validate_src_reg(struct brw_instruction *insn,
     return true;
 }
 
-static int get_subreg_address(unsigned regfile, unsigned type, unsigned subreg, unsigned address_mode)
+static int get_subreg_address(struct gen4asm_state *state,
+			      unsigned regfile, unsigned type, unsigned subreg, unsigned address_mode)
 {
     int unit_size = 1;
 
     assert(address_mode == BRW_ADDRESS_DIRECT);
     assert(regfile != BRW_IMMEDIATE_VALUE);
 
-    if (advanced_flag)
+    if (state->advanced_flag)
 	unit_size = get_type_size(type);
 
     return subreg * unit_size;
@@ -370,26 +393,31 @@ static int get_subreg_address(unsigned regfile, unsigned type, unsigned subreg,
  *  a0.12            6                  invalid input
  *  a0.14            7                  invalid input
  */
-static int get_indirect_subreg_address(unsigned subreg)
+static int get_indirect_subreg_address(struct gen4asm_state *state,
+				       unsigned subreg)
 {
-    return advanced_flag == 0 ? subreg / 2 : subreg;
+    return state->advanced_flag == 0 ? subreg / 2 : subreg;
 }
 
-static void resolve_subnr(struct brw_reg *reg)
+static void resolve_subnr(struct gen4asm_state *state,
+			  struct brw_reg *reg)
 {
    if (reg->file == BRW_IMMEDIATE_VALUE)
 	return;
 
    if (reg->address_mode == BRW_ADDRESS_DIRECT)
-	reg->subnr = get_subreg_address(reg->file, reg->type, reg->subnr,
+	reg->subnr = get_subreg_address(state, reg->file, reg->type, reg->subnr,
 					reg->address_mode);
    else
-        reg->subnr = get_indirect_subreg_address(reg->subnr);
+        reg->subnr = get_indirect_subreg_address(state, reg->subnr);
 }
 
 
 %}
 %locations
+%define api.pure
+%parse-param { struct gen4asm_state *state }
+%lex-param { struct gen4asm_state *state }
 
 %start ROOT
 
@@ -491,6 +519,9 @@ static void resolve_subnr(struct brw_reg *reg)
 %type <instruction> multibranchinstruction subroutineinstruction jumpinstruction
 %type <string> label
 %type <program> instrseq
+
+%destructor { free($$); } <string>
+%destructor { brw_program_free(&$$); } <program>
 %type <integer> instoption
 %type <integer> unaryop binaryop binaryaccop breakop
 %type <integer> trinaryop
@@ -527,14 +558,21 @@ static void resolve_subnr(struct brw_reg *reg)
 
 %code {
 
+int yylex(YYSTYPE *lval, YYLTYPE *lloc, void *scanner);
+void yyerror(YYLTYPE *location, struct gen4asm_state *state, const char *msg);
+
+/* the reentrant scanner is reached through the parser's state */
+#define yylex(lval, lloc, state) yylex(lval, lloc, (state)->scanner)
+
 #undef error
 #define error(l, fmt, ...)			\
     do {					\
-	message(ERROR, l, fmt, ## __VA_ARGS__);	\
+	message(state, ERROR, l, fmt, ## __VA_ARGS__);	\
 	YYERROR;				\
     } while(0)
 
-static void add_option(struct options *options, int option)
+static void add_option(struct gen4asm_state *state,
+		       struct options *options, int option)
 {
     switch (option) {
     case ALIGN1:
@@ -595,7 +633,7 @@ exp:		INTEGER { $$ = $1; }
 
 ROOT:		instrseq
 		{
-		  compiled_program = $1;
+		  state->program = $1;
 		}
 ;
 
@@ -651,7 +689,7 @@ declare_pragma:	DECLARE_PRAGMA STRING declare_base declare_elementsize declare_s
 		    reg.dst_region = $6;
 		    reg.reg.type = $7;
 
-		    found = find_register($2);
+		    found = find_register(state, $2);
 		    if (found) {
 		        if (!declared_register_equal(&reg, found))
 			    error(&@1, "%s already defined and definitions "
@@ -660,7 +698,7 @@ declare_pragma:	DECLARE_PRAGMA STRING declare_base declare_elementsize declare_s
 		    } else {
 			new_reg = malloc(sizeof(struct declared_register));
 			*new_reg = reg;
-			insert_register(new_reg);
+			insert_register(state, new_reg);
 		    }
 		}
 ;
@@ -672,12 +710,12 @@ reg_count_payload_pragma: 	REG_COUNT_PAYLOAD_PRAGMA exp
 
 default_exec_size_pragma:	DEFAULT_EXEC_SIZE_PRAGMA exp
 				{
-				    program_defaults.execute_size = $2;
+				    state->program_defaults.execute_size = $2;
 				}
 ;
 default_reg_type_pragma:	DEFAULT_REG_TYPE_PRAGMA regtype
 				{
-				    program_defaults.register_type = $2.type;
+				    state->program_defaults.register_type = $2.type;
 				}
 ;
 pragma:		reg_count_total_pragma
@@ -727,8 +765,7 @@ instrseq:	instrseq pragma
 		}
 		| pragma
 		{
-		  $$.first = NULL;
-		  $$.last = NULL;
+		  brw_program_init(&$$);
 		}
 		| instrseq error SEMICOLON {
 		  $$ = $1;
@@ -792,10 +829,9 @@ ifelseinstruction: ENDIF
 		    memset(&$$, 0, sizeof($$));
 		    set_instruction_opcode(&$$, $1);
 		    GEN(&$$)->header.thread_control |= BRW_THREAD_SWITCH;
-		    ip_dst.width = $2;
-		    set_instruction_dest(&$$, &ip_dst);
-		    set_instruction_src0(&$$, &ip_src, NULL);
-		    set_instruction_src1(&$$, &$3, NULL);
+		    set_instruction_dest_template(state, &$$, &ip_dst, $2);
+		    set_instruction_src0_template(state, &$$, &ip_src);
+		    set_instruction_src1(state, &$$, &$3, NULL);
 		    $$.reloc.first_reloc_target = $3.reloc_target;
 		    $$.reloc.first_reloc_offset = $3.imm32;
 		  } else if(IS_GENp(6)) {
@@ -823,10 +859,9 @@ ifelseinstruction: ENDIF
 		  set_instruction_opcode(&$$, $2);
 		  if(!IS_GENp(6)) {
 		    GEN(&$$)->header.thread_control |= BRW_THREAD_SWITCH;
-		    ip_dst.width = $3;
-		    set_instruction_dest(&$$, &ip_dst);
-		    set_instruction_src0(&$$, &ip_src, NULL);
-		    set_instruction_src1(&$$, &$4, NULL);
+		    set_instruction_dest_template(state, &$$, &ip_dst, $3);
+		    set_instruction_src0_template(state, &$$, &ip_src);
+		    set_instruction_src1(state, &$$, &$4, NULL);
 		  }
 		  $$.reloc.first_reloc_target = $4.reloc_target;
 		  $$.reloc.first_reloc_offset = $4.imm32;
@@ -856,14 +891,13 @@ loopinstruction: predicate WHILE execsize relativelocation instoptions
 		     * offset is the second source operand.  The offset is added
 		     * to the pre-incremented IP.
 		     */
-		    ip_dst.width = $3;
-		    set_instruction_dest(&$$, &ip_dst);
+		    set_instruction_dest_template(state, &$$, &ip_dst, $3);
 		    memset(&$$, 0, sizeof($$));
 		    set_instruction_predicate(&$$, &$1);
 		    set_instruction_opcode(&$$, $2);
 		    GEN(&$$)->header.thread_control |= BRW_THREAD_SWITCH;
-		    set_instruction_src0(&$$, &ip_src, NULL);
-		    set_instruction_src1(&$$, &$4, NULL);
+		    set_instruction_src0_template(state, &$$, &ip_src);
+		    set_instruction_src1(state, &$$, &$4, NULL);
 		    $$.reloc.first_reloc_target = $4.reloc_target;
 		    $$.reloc.first_reloc_offset = $4.imm32;
 		  } else if (IS_GENp(6)) {
@@ -898,9 +932,8 @@ haltinstruction: predicate HALT execsize relativelocation relativelocation insto
 		  $$.reloc.first_reloc_offset = $4.imm32;
 		  $$.reloc.second_reloc_target = $5.reloc_target;
 		  $$.reloc.second_reloc_offset = $5.imm32;
-		  dst_null_reg.width = $3;
-		  set_instruction_dest(&$$, &dst_null_reg);
-		  set_instruction_src0(&$$, &src_null_reg, NULL);
+		  set_instruction_dest_template(state, &$$, &dst_null_reg, $3);
+		  set_instruction_src0_template(state, &$$, &src_null_reg);
 		};
 
 multibranchinstruction:
@@ -913,8 +946,7 @@ multibranchinstruction:
 		  GEN(&$$)->header.thread_control |= BRW_THREAD_SWITCH;
 		  $$.reloc.first_reloc_target = $4.reloc_target;
 		  $$.reloc.first_reloc_offset = $4.imm32;
-		  dst_null_reg.width = $3;
-		  set_instruction_dest(&$$, &dst_null_reg);
+		  set_instruction_dest_template(state, &$$, &dst_null_reg, $3);
 		}
 		| predicate BRC execsize relativelocation relativelocation instoptions
 		{
@@ -927,9 +959,8 @@ multibranchinstruction:
 		  $$.reloc.first_reloc_offset = $4.imm32;
 		  $$.reloc.second_reloc_target = $5.reloc_target;
 		  $$.reloc.second_reloc_offset = $5.imm32;
-		  dst_null_reg.width = $3;
-		  set_instruction_dest(&$$, &dst_null_reg);
-		  set_instruction_src0(&$$, &src_null_reg, NULL);
+		  set_instruction_dest_template(state, &$$, &dst_null_reg, $3);
+		  set_instruction_src0_template(state, &$$, &src_null_reg);
 		}
 ;
 
@@ -956,7 +987,7 @@ subroutineinstruction:
 
 		  $4.type = BRW_REGISTER_TYPE_D; /* dest type should be DWORD */
 		  $4.width = BRW_WIDTH_2; /* execution size must be 2. */
-		  set_instruction_dest(&$$, &$4);
+		  set_instruction_dest(state, &$$, &$4);
 
 		  struct src_operand src0;
 		  memset(&src0, 0, sizeof(src0));
@@ -965,7 +996,7 @@ subroutineinstruction:
 		  src0.reg.hstride = 1; /*encoded 1*/
 		  src0.reg.width = BRW_WIDTH_2;
 		  src0.reg.vstride = 2; /*encoded 2*/
-		  set_instruction_src0(&$$, &src0, NULL);
+		  set_instruction_src0(state, &$$, &src0, NULL);
 
 		  $$.reloc.first_reloc_target = $5.reloc_target;
 		  $$.reloc.first_reloc_offset = $5.imm32;
@@ -981,13 +1012,12 @@ subroutineinstruction:
 		  memset(&$$, 0, sizeof($$));
 		  set_instruction_predicate(&$$, &$1);
 		  set_instruction_opcode(&$$, $2);
-		  dst_null_reg.width = BRW_WIDTH_2; /* execution size of RET should be 2 */
-		  set_instruction_dest(&$$, &dst_null_reg);
+		  set_instruction_dest_template(state, &$$, &dst_null_reg, BRW_WIDTH_2); /* execution size of RET should be 2 */
 		  $5.reg.type = BRW_REGISTER_TYPE_D;
 		  $5.reg.hstride = 1; /*encoded 1*/
 		  $5.reg.width = BRW_WIDTH_2;
 		  $5.reg.vstride = 2; /*encoded 2*/
-		  set_instruction_src0(&$$, &$5, NULL);
+		  set_instruction_src0(state, &$$, &$5, NULL);
 		}
 ;
 
@@ -1000,10 +1030,10 @@ unaryinstruction:
 		  set_instruction_saturate(&$$, $4);
 		  $6.width = $5;
 		  set_instruction_options(&$$, $8);
-		  set_instruction_pred_cond(&$$, &$1, &$3, &@3);
-		  if (set_instruction_dest(&$$, &$6) != 0)
+		  set_instruction_pred_cond(state, &$$, &$1, &$3, &@3);
+		  if (set_instruction_dest(state, &$$, &$6) != 0)
 		    YYERROR;
-		  if (set_instruction_src0(&$$, &$7, &@7) != 0)
+		  if (set_instruction_src0(state, &$$, &$7, &@7) != 0)
 		    YYERROR;
 
 		  if (!IS_GENp(6) && 
@@ -1025,13 +1055,13 @@ binaryinstruction:
 		  set_instruction_opcode(&$$, $2);
 		  set_instruction_saturate(&$$, $4);
 		  set_instruction_options(&$$, $9);
-		  set_instruction_pred_cond(&$$, &$1, &$3, &@3);
+		  set_instruction_pred_cond(state, &$$, &$1, &$3, &@3);
 		  $6.width = $5;
-		  if (set_instruction_dest(&$$, &$6) != 0)
+		  if (set_instruction_dest(state, &$$, &$6) != 0)
 		    YYERROR;
-		  if (set_instruction_src0(&$$, &$7, &@7) != 0)
+		  if (set_instruction_src0(state, &$$, &$7, &@7) != 0)
 		    YYERROR;
-		  if (set_instruction_src1(&$$, &$8, &@8) != 0)
+		  if (set_instruction_src1(state, &$$, &$8, &@8) != 0)
 		    YYERROR;
 
 		  if (!IS_GENp(6) && 
@@ -1054,12 +1084,12 @@ binaryaccinstruction:
 		  set_instruction_saturate(&$$, $4);
 		  $6.width = $5;
 		  set_instruction_options(&$$, $9);
-		  set_instruction_pred_cond(&$$, &$1, &$3, &@3);
-		  if (set_instruction_dest(&$$, &$6) != 0)
+		  set_instruction_pred_cond(state, &$$, &$1, &$3, &@3);
+		  if (set_instruction_dest(state, &$$, &$6) != 0)
 		    YYERROR;
-		  if (set_instruction_src0(&$$, &$7, &@7) != 0)
+		  if (set_instruction_src0(state, &$$, &$7, &@7) != 0)
 		    YYERROR;
-		  if (set_instruction_src1(&$$, &$8, &@8) != 0)
+		  if (set_instruction_src1(state, &$$, &$8, &@8) != 0)
 		    YYERROR;
 
 		  if (!IS_GENp(6) && 
@@ -1081,19 +1111,19 @@ trinaryinstruction:
 {
 		  memset(&$$, 0, sizeof($$));
 
-		  set_instruction_pred_cond(&$$, &$1, &$3, &@3);
+		  set_instruction_pred_cond(state, &$$, &$1, &$3, &@3);
 
 		  set_instruction_opcode(&$$, $2);
 		  set_instruction_saturate(&$$, $4);
 
 		  $6.width = $5;
-		  if (set_instruction_dest_three_src(&$$, &$6))
+		  if (set_instruction_dest_three_src(state, &$$, &$6))
 		    YYERROR;
-		  if (set_instruction_src0_three_src(&$$, &$7))
+		  if (set_instruction_src0_three_src(state, &$$, &$7))
 		    YYERROR;
-		  if (set_instruction_src1_three_src(&$$, &$8))
+		  if (set_instruction_src1_three_src(state, &$$, &$8))
 		    YYERROR;
-		  if (set_instruction_src2_three_src(&$$, &$9))
+		  if (set_instruction_src2_three_src(state, &$$, &$9))
 		    YYERROR;
 		  set_instruction_options(&$$, $10);
 }
@@ -1116,7 +1146,7 @@ sendinstruction: predicate SEND execsize exp post_dst payload msgtarget
 		  $5.width = $3;
 		  GEN(&$$)->header.destreg__conditionalmod = $4; /* msg reg index */
 		  set_instruction_predicate(&$$, &$1);
-		  if (set_instruction_dest(&$$, &$5) != 0)
+		  if (set_instruction_dest(state, &$$, &$5) != 0)
 		    YYERROR;
 
 		  if (IS_GENp(6)) {
@@ -1133,9 +1163,9 @@ sendinstruction: predicate SEND execsize exp post_dst payload msgtarget
                       src0.reg.type = BRW_REGISTER_TYPE_D;
                       src0.reg.nr = $4;
                       src0.reg.subnr = 0;
-                      set_instruction_src0(&$$, &src0, NULL);
+                      set_instruction_src0(state, &$$, &src0, NULL);
 		  } else {
-                      if (set_instruction_src0(&$$, &$6, &@6) != 0)
+                      if (set_instruction_src0(state, &$$, &$6, &@6) != 0)
                           YYERROR;
 		  }
 
@@ -1172,12 +1202,12 @@ sendinstruction: predicate SEND execsize exp post_dst payload msgtarget
 		  set_instruction_predicate(&$$, &$1);
 
 		  $4.width = $3;
-		  if (set_instruction_dest(&$$, &$4) != 0)
+		  if (set_instruction_dest(state, &$$, &$4) != 0)
 		    YYERROR;
-		  if (set_instruction_src0(&$$, &$6, &@6) != 0)
+		  if (set_instruction_src0(state, &$$, &$6, &@6) != 0)
 		    YYERROR;
 		  /* XXX is this correct? */
-		  if (set_instruction_src1(&$$, &$7, &@7) != 0)
+		  if (set_instruction_src1(state, &$$, &$7, &@7) != 0)
 		    YYERROR;
 
 		  }
@@ -1195,11 +1225,11 @@ sendinstruction: predicate SEND execsize exp post_dst payload msgtarget
 
 		  set_instruction_predicate(&$$, &$1);
 		  $4.width = $3;
-		  if (set_instruction_dest(&$$, &$4) != 0)
+		  if (set_instruction_dest(state, &$$, &$4) != 0)
 		    YYERROR;
-		  if (set_instruction_src0(&$$, &$6, &@6) != 0)
+		  if (set_instruction_src0(state, &$$, &$6, &@6) != 0)
 		    YYERROR;
-		  if (set_instruction_src1(&$$, &$7, &@7) != 0)
+		  if (set_instruction_src1(state, &$$, &$7, &@7) != 0)
 		    YYERROR;
                 }
 		| predicate SEND execsize dst sendleadreg sndopr imm32reg instoptions
@@ -1222,7 +1252,7 @@ sendinstruction: predicate SEND execsize exp post_dst payload msgtarget
 		  set_instruction_predicate(&$$, &$1);
 
 		  $4.width = $3;
-		  if (set_instruction_dest(&$$, &$4) != 0)
+		  if (set_instruction_dest(state, &$$, &$4) != 0)
                       YYERROR;
 
                   memset(&src0, 0, sizeof(src0));
@@ -1238,8 +1268,8 @@ sendinstruction: predicate SEND execsize exp post_dst payload msgtarget
 
                   src0.reg.nr = $5.nr;
                   src0.reg.subnr = 0;
-                  set_instruction_src0(&$$, &src0, NULL);
-		  set_instruction_src1(&$$, &$7, NULL);
+                  set_instruction_src0(state, &$$, &src0, NULL);
+		  set_instruction_src1(state, &$$, &$7, NULL);
 
                   GEN(&$$)->bits3.generic_gen5.end_of_thread = !!($6 & EX_DESC_EOT_MASK);
 		}
@@ -1263,7 +1293,7 @@ sendinstruction: predicate SEND execsize exp post_dst payload msgtarget
 		  set_instruction_predicate(&$$, &$1);
 
 		  $4.width = $3;
-		  if (set_instruction_dest(&$$, &$4) != 0)
+		  if (set_instruction_dest(state, &$$, &$4) != 0)
                       YYERROR;
 
                   memset(&src0, 0, sizeof(src0));
@@ -1279,9 +1309,9 @@ sendinstruction: predicate SEND execsize exp post_dst payload msgtarget
 
                   src0.reg.nr = $5.nr;
                   src0.reg.subnr = 0;
-                  set_instruction_src0(&$$, &src0, NULL);
+                  set_instruction_src0(state, &$$, &src0, NULL);
 
-                  set_instruction_src1(&$$, &$7, &@7);
+                  set_instruction_src1(state, &$$, &$7, &@7);
                   GEN(&$$)->bits3.generic_gen5.end_of_thread = !!($6 & EX_DESC_EOT_MASK);
 		}
 		| predicate SEND execsize dst sendleadreg payload sndopr imm32reg instoptions
@@ -1298,11 +1328,11 @@ sendinstruction: predicate SEND execsize exp post_dst payload msgtarget
 
 		  set_instruction_predicate(&$$, &$1);
 		  $4.width = $3;
-		  if (set_instruction_dest(&$$, &$4) != 0)
+		  if (set_instruction_dest(state, &$$, &$4) != 0)
 		    YYERROR;
-		  if (set_instruction_src0(&$$, &$6, &@6) != 0)
+		  if (set_instruction_src0(state, &$$, &$6, &@6) != 0)
 		    YYERROR;
-		  if (set_instruction_src1(&$$, &$8, &@8) != 0)
+		  if (set_instruction_src1(state, &$$, &$8, &@8) != 0)
 		    YYERROR;
 
 		  if (IS_GENx(5)) {
@@ -1319,12 +1349,12 @@ sendinstruction: predicate SEND execsize exp post_dst payload msgtarget
 		  set_instruction_predicate(&$$, &$1);
 
 		  $4.width = $3;
-		  if (set_instruction_dest(&$$, &$4) != 0)
+		  if (set_instruction_dest(state, &$$, &$4) != 0)
 		    YYERROR;
-		  if (set_instruction_src0(&$$, &$6, &@6) != 0)
+		  if (set_instruction_src0(state, &$$, &$6, &@6) != 0)
 		    YYERROR;
 		  /* XXX is this correct? */
-		  if (set_instruction_src1(&$$, &$8, &@8) != 0)
+		  if (set_instruction_src1(state, &$$, &$8, &@8) != 0)
 		    YYERROR;
 		  if (IS_GENx(5)) {
                       GEN(&$$)->bits2.send_gen5.sfid = $7;
@@ -1348,13 +1378,12 @@ jumpinstruction: predicate JMPI execsize relativelocation2
 		   */
 		  memset(&$$, 0, sizeof($$));
 		  set_instruction_opcode(&$$, $2);
-		  if(advanced_flag)
+		  if(state->advanced_flag)
 			GEN(&$$)->header.mask_control = BRW_MASK_DISABLE;
 		  set_instruction_predicate(&$$, &$1);
-		  ip_dst.width = BRW_WIDTH_1;
-		  set_instruction_dest(&$$, &ip_dst);
-		  set_instruction_src0(&$$, &ip_src, NULL);
-		  set_instruction_src1(&$$, &$4, NULL);
+		  set_instruction_dest_template(state, &$$, &ip_dst, BRW_WIDTH_1);
+		  set_instruction_src0_template(state, &$$, &ip_src);
+		  set_instruction_src1(state, &$$, &$4, NULL);
 		  $$.reloc.first_reloc_target = $4.reloc_target;
 		  $$.reloc.first_reloc_offset = $4.imm32;
 		}
@@ -1368,11 +1397,11 @@ mathinstruction: predicate MATH_INST execsize dst src srcimm math_function insto
 		  set_instruction_options(&$$, $8);
 		  set_instruction_predicate(&$$, &$1);
 		  $4.width = $3;
-		  if (set_instruction_dest(&$$, &$4) != 0)
+		  if (set_instruction_dest(state, &$$, &$4) != 0)
 		    YYERROR;
-		  if (set_instruction_src0(&$$, &$5, &@5) != 0)
+		  if (set_instruction_src0(state, &$$, &$5, &@5) != 0)
 		    YYERROR;
-		  if (set_instruction_src1(&$$, &$6, &@6) != 0)
+		  if (set_instruction_src1(state, &$$, &$6, &@6) != 0)
 		    YYERROR;
 		}
 ;
@@ -1408,10 +1437,10 @@ syncinstruction: predicate WAIT notifyreg
 		  set_instruction_opcode(&$$, $2);
 		  set_direct_dst_operand(&notify_dst, &$3, BRW_REGISTER_TYPE_D);
 		  notify_dst.width = BRW_WIDTH_1;
-		  set_instruction_dest(&$$, &notify_dst);
+		  set_instruction_dest(state, &$$, &notify_dst);
 		  set_direct_src_operand(&notify_src, &$3, BRW_REGISTER_TYPE_D);
-		  set_instruction_src0(&$$, &notify_src, NULL);
-		  set_instruction_src1(&$$, &src_null_reg, NULL);
+		  set_instruction_src0(state, &$$, &notify_src, NULL);
+		  set_instruction_src1_template(state, &$$, &src_null_reg);
 		}
 		
 ;
@@ -1680,7 +1709,7 @@ msgtarget:	NULL_TOKEN
 		} 
 		| CRE LPAREN INTEGER COMMA INTEGER RPAREN
 		{
-		   if (gen_level < 75)
+		   if (state->gen_level < 75)
                       error (&@1, "Below Gen7.5 doesn't have CRE function\n");
 
 		   GEN(&$$)->bits3.generic.msg_target = HSW_SFID_CRE;
@@ -1823,7 +1852,7 @@ dstoperandex_typed: accreg | flagreg | addrreg | maskreg
 
 symbol_reg:	STRING %prec STR_SYMBOL_REG 
 		{
-		    struct declared_register *dcl_reg = find_register($1);
+		    struct declared_register *dcl_reg = find_register(state, $1);
 
 		    if (dcl_reg == NULL)
 			error(&@1, "can't find register %s\n", $1);
@@ -1839,7 +1868,7 @@ symbol_reg:	STRING %prec STR_SYMBOL_REG
 
 symbol_reg_p: STRING LPAREN exp RPAREN 
 		{
-		    struct declared_register *dcl_reg = find_register($1);	
+		    struct declared_register *dcl_reg = find_register(state, $1);	
 
 		    if (dcl_reg == NULL)
 			error(&@1, "can't find register %s\n", $1);
@@ -1850,14 +1879,14 @@ symbol_reg_p: STRING LPAREN exp RPAREN
 		}
 		| STRING LPAREN exp COMMA exp RPAREN
 		{
-		    struct declared_register *dcl_reg = find_register($1);	
+		    struct declared_register *dcl_reg = find_register(state, $1);	
 
 		    if (dcl_reg == NULL)
 			error(&@1, "can't find register %s\n", $1);
 
 		    memcpy(&$$, dcl_reg, sizeof(*dcl_reg));
 		    $$.reg.nr += $3;
-		    if(advanced_flag) {
+		    if(state->advanced_flag) {
 			int size = get_type_size(dcl_reg->reg.type);
 		        $$.reg.nr += ($$.reg.subnr + $5) / (32 / size);
 		        $$.reg.subnr = ($$.reg.subnr + $5) % (32 / size);
@@ -2523,7 +2552,7 @@ indirectregion:	region | region_wh
  * instruction.
  */
 regtype:	/* empty */
-		{ $$.type = program_defaults.register_type;$$.is_default = 1;}
+		{ $$.type = state->program_defaults.register_type;$$.is_default = 1;}
 		| TYPE_F { $$.type = BRW_REGISTER_TYPE_F;$$.is_default = 0; }
 		| TYPE_UD { $$.type = BRW_REGISTER_TYPE_UD;$$.is_default = 0; }
 		| TYPE_D { $$.type = BRW_REGISTER_TYPE_D;$$.is_default = 0; }
@@ -2652,7 +2681,7 @@ abs:		/* empty */ { $$ = 0; }
 
 execsize:	/* empty */ %prec EMPTEXECSIZE
 		{
-		  $$ = ffs(program_defaults.execute_size) - 1;
+		  $$ = ffs(state->program_defaults.execute_size) - 1;
 		}
 		|LPAREN exp RPAREN
 		{
@@ -2707,12 +2736,12 @@ instoptions:	/* empty */
 instoption_list:instoption_list COMMA instoption
 		{
 		  $$ = $1;
-		  add_option(&$$, $3);
+		  add_option(state, &$$, $3);
 		}
 		| instoption_list instoption
 		{
 		  $$ = $1;
-		  add_option(&$$, $2);
+		  add_option(state, &$$, $2);
 		}
 		| /* empty, header defaults to zeroes. */
 		{
@@ -2735,13 +2764,12 @@ instoption:	ALIGN1 { $$ = ALIGN1; }
 ;
 
 %%
-extern int yylineno;
-
-void yyerror (char *msg)
+void yyerror(YYLTYPE *location, struct gen4asm_state *state, const char *msg)
 {
 	fprintf(stderr, "%s: %d: %s at \"%s\"\n",
-		input_filename, yylineno, msg, lex_text());
-	++errors;
+		state->input_filename, lex_lineno(state->scanner), msg,
+		lex_text(state->scanner));
+	++state->errors;
 }
 
 static int get_type_size(unsigned type)
@@ -2852,7 +2880,8 @@ static void set_instruction_opcode(struct brw_program_instruction *instr,
 /**
  * Fills in the destination register information in instr from the bits in dst.
  */
-static int set_instruction_dest(struct brw_program_instruction *instr,
+static int set_instruction_dest(struct gen4asm_state *state,
+				struct brw_program_instruction *instr,
 				struct brw_reg *dest)
 {
 	if (!validate_dst_reg(GEN(instr), dest))
@@ -2860,99 +2889,138 @@ static int set_instruction_dest(struct brw_program_instruction *instr,
 
 	/* the assembler support expressing subnr in bytes or in number of
 	 * elements. */
-	resolve_subnr(dest);
+	resolve_subnr(state, dest);
 
-	brw_set_dest(&genasm_compile, GEN(instr), *dest);
+	brw_set_dest(&state->compile, GEN(instr), *dest);
 
 	return 0;
 }
 
 /* Sets the first source operand for the instruction.  Returns 0 on success. */
-static int set_instruction_src0(struct brw_program_instruction *instr,
+static int set_instruction_src0(struct gen4asm_state *state,
+				struct brw_program_instruction *instr,
 				struct src_operand *src,
 				YYLTYPE *location)
 {
 
-	if (advanced_flag)
+	if (state->advanced_flag)
 		reset_instruction_src_region(GEN(instr), src);
 
-	if (!validate_src_reg(GEN(instr), src->reg, location))
+	if (!validate_src_reg(state, GEN(instr), src->reg, location))
 		return 1;
 
 	/* the assembler support expressing subnr in bytes or in number of
 	 * elements. */
-	resolve_subnr(&src->reg);
+	resolve_subnr(state, &src->reg);
 
-	brw_set_src0(&genasm_compile, GEN(instr), src->reg);
+	brw_set_src0(&state->compile, GEN(instr), src->reg);
 
 	return 0;
 }
 
 /* Sets the second source operand for the instruction.  Returns 0 on success.
  */
-static int set_instruction_src1(struct brw_program_instruction *instr,
+static int set_instruction_src1(struct gen4asm_state *state,
+				struct brw_program_instruction *instr,
 				struct src_operand *src,
 				YYLTYPE *location)
 {
-	if (advanced_flag)
+	if (state->advanced_flag)
 		reset_instruction_src_region(GEN(instr), src);
 
-	if (!validate_src_reg(GEN(instr), src->reg, location))
+	if (!validate_src_reg(state, GEN(instr), src->reg, location))
 		return 1;
 
 	/* the assembler support expressing subnr in bytes or in number of
 	 * elements. */
-	resolve_subnr(&src->reg);
+	resolve_subnr(state, &src->reg);
 
-	brw_set_src1(&genasm_compile, GEN(instr), src->reg);
+	brw_set_src1(&state->compile, GEN(instr), src->reg);
 
 	return 0;
 }
 
-static int set_instruction_dest_three_src(struct brw_program_instruction *instr,
+/*
+ * The fixed operands (ip, null) are shared read-only templates; these set a
+ * private copy of one so that concurrent parsers never write to them.
+ */
+static int set_instruction_dest_template(struct gen4asm_state *state,
+					 struct brw_program_instruction *instr,
+					 const struct brw_reg *template,
+					 int width)
+{
+	struct brw_reg dest = *template;
+
+	dest.width = width;
+	return set_instruction_dest(state, instr, &dest);
+}
+
+static int set_instruction_src0_template(struct gen4asm_state *state,
+					 struct brw_program_instruction *instr,
+					 const struct src_operand *template)
+{
+	struct src_operand src = *template;
+
+	return set_instruction_src0(state, instr, &src, NULL);
+}
+
+static int set_instruction_src1_template(struct gen4asm_state *state,
+					 struct brw_program_instruction *instr,
+					 const struct src_operand *template)
+{
+	struct src_operand src = *template;
+
+	return set_instruction_src1(state, instr, &src, NULL);
+}
+
+static int set_instruction_dest_three_src(struct gen4asm_state *state,
+					  struct brw_program_instruction *instr,
 					  struct brw_reg *dest)
 {
-    resolve_subnr(dest);
-    brw_set_3src_dest(&genasm_compile, GEN(instr), *dest);
+    resolve_subnr(state, dest);
+    brw_set_3src_dest(&state->compile, GEN(instr), *dest);
     return 0;
 }
 
-static int set_instruction_src0_three_src(struct brw_program_instruction *instr,
+static int set_instruction_src0_three_src(struct gen4asm_state *state,
+					  struct brw_program_instruction *instr,
 					  struct src_operand *src)
 {
-    if (advanced_flag)
+    if (state->advanced_flag)
 	reset_instruction_src_region(GEN(instr), src);
 
-    resolve_subnr(&src->reg);
+    resolve_subnr(state, &src->reg);
 
     // TODO: src0 modifier, src0 rep_ctrl
-    brw_set_3src_src0(&genasm_compile, GEN(instr), src->reg);
+    brw_set_3src_src0(&state->compile, GEN(instr), src->reg);
     return 0;
 }
 
-static int set_instruction_src1_three_src(struct brw_program_instruction *instr,
+static int set_instruction_src1_three_src(struct gen4asm_state *state,
+					  struct brw_program_instruction *instr,
 					  struct src_operand *src)
 {
-    if (advanced_flag)
+    if (state->advanced_flag)
 	reset_instruction_src_region(GEN(instr), src);
 
-    resolve_subnr(&src->reg);
+    resolve_subnr(state, &src->reg);
 
     // TODO: src1 modifier, src1 rep_ctrl
-    brw_set_3src_src1(&genasm_compile, GEN(instr), src->reg);
+    brw_set_3src_src1(&state->compile, GEN(instr), src->reg);
     return 0;
 }
 
-static int set_instruction_src2_three_src(struct brw_program_instruction *instr,
+static int set_instruction_src2_three_src(struct gen4asm_state *state,
+					  struct brw_program_instruction *instr,
 					  struct src_operand *src)
 {
-    if (advanced_flag)
+    if (state->advanced_flag)
 	reset_instruction_src_region(GEN(instr), src);
 
-    resolve_subnr(&src->reg);
+    resolve_subnr(state, &src->reg);
 
     // TODO: src2 modifier, src2 rep_ctrl
-    brw_set_3src_src2(&genasm_compile, GEN(instr), src->reg);
+    brw_set_3src_src2(&state->compile, GEN(instr), src->reg);
     return 0;
 }
 
@@ -2984,7 +3052,8 @@ static void set_instruction_predicate(struct brw_program_instruction *instr,
 	GEN(instr)->bits2.da1.flag_subreg_nr = p->flag_subreg_nr;
 }
 
-static void set_instruction_pred_cond(struct brw_program_instruction *instr,
+static void set_instruction_pred_cond(struct gen4asm_state *state,
+				      struct brw_program_instruction *instr,
 				      struct predicate *p,
 				      struct condition *c,
 				      YYLTYPE *location)
@@ -26,56 +26,25 @@
  *
  */
 
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <getopt.h>
 #include <unistd.h>
-#include <assert.h>
+#include <pthread.h>
 
-#include "ralloc.h"
-#include "gen4asm.h"
-#include "brw_eu.h"
-
-extern FILE *yyin;
-
-long int gen_level = 40;
-int advanced_flag = 0; /* 0: in unit of byte, 1: in unit of data element size */
-unsigned int warning_flags = WARN_ALWAYS;
-int need_export = 0;
-char *input_filename = "<stdin>";
-int errors;
-
-struct brw_context genasm_brw_context;
-struct brw_compile genasm_compile;
-
-struct brw_program compiled_program;
-struct program_defaults program_defaults = {.register_type = BRW_REGISTER_TYPE_F};
+#include "brw_asm.h"
 
 /* 0: default output style, 1: nice C-style output */
 static int binary_like_output = 0;
+static int raw_output = 0;
+static int container_output = 0;
+static int need_export = 0;
 static char *export_filename = NULL;
+static char *manifest_file = NULL;
 static const char binary_prepend[] = "static const char gen_eu_bytes[] = {\n";
 
-#define HASH_SIZE 37
-
-struct hash_item {
-	char *key;
-	void *value;
-	struct hash_item *next;
-};
-
-typedef struct hash_item *hash_table[HASH_SIZE];
-
-static hash_table declared_register_table;
-
-struct label_item {
-	char *name;
-	int addr;
-	struct label_item *next;
-};
-static struct label_item *label_table;
-
 static const struct option longopts[] = {
 	{"advanced", no_argument, 0, 'a'},
 	{"binary", no_argument, 0, 'b'},
@@ -83,218 +52,403 @@ static const struct option longopts[] = {
 	{"input_list", required_argument, 0, 'l'},
 	{"output", required_argument, 0, 'o'},
 	{"gen", required_argument, 0, 'g'},
+	{"manifest", required_argument, 0, 'm'},
+	{"jobs", required_argument, 0, 'j'},
+	{"compact", no_argument, 0, 'c'},
+	{"compact_report", no_argument, 0, 'r'},
+	{"optimize", no_argument, 0, 'O'},
+	{"schedule", no_argument, 0, 's'},
+	{"raw", no_argument, 0, 'R'},
+	{"container", no_argument, 0, 'C'},
 	{ NULL, 0, NULL, 0 }
 };
 
-// jump distance used in branch instructions as JIP or UIP
-static int jump_distance(int offset)
-{
-    // Gen4- bspec: the jump distance is in number of sixteen-byte units
-    // Gen5+ bspec: the jump distance is in number of eight-byte units
-    if(IS_GENp(5))
-        offset *= 2;
-    return offset;
-}
-
 static void usage(void)
 {
 	fprintf(stderr, "usage: intel-gen4asm [options] inputfile\n");
+	fprintf(stderr, "       intel-gen4asm [options] -m manifest\n");
 	fprintf(stderr, "OPTIONS:\n");
 	fprintf(stderr, "\t-a, --advanced                       Set advanced flag\n");
 	fprintf(stderr, "\t-b, --binary                         C style binary output\n");
+	fprintf(stderr, "\t-R, --raw                            Raw binary output\n");
+	fprintf(stderr, "\t-C, --container                      Binary output with a label table\n");
 	fprintf(stderr, "\t-e, --export {exportfile}            Export label file\n");
 	fprintf(stderr, "\t-l, --input_list {entrytablefile}    Input entry_table_list file\n");
 	fprintf(stderr, "\t-o, --output {outputfile}            Specify output file\n");
 	fprintf(stderr, "\t-g, --gen <4|5|6|7>                  Specify GPU generation\n");
+	fprintf(stderr, "\t-m, --manifest {manifestfile}        Assemble every \"input output [export]\" line\n");
+	fprintf(stderr, "\t-j, --jobs {n}                       Threads for -m (default: one per cpu)\n");
+	fprintf(stderr, "\t-c, --compact                        Compact instructions (gen6+)\n");
+	fprintf(stderr, "\t-r, --compact_report                 Compact and report what didn't and why\n");
+	fprintf(stderr, "\t-O, --optimize                       Peephole optimize the program\n");
+	fprintf(stderr, "\t-s, --schedule                       Reorder instructions to hide latency\n");
 }
 
-static int hash(char *key)
+static int read_entry_file(char *fn, char ***entry_points, unsigned int *count)
 {
-    unsigned ret = 0;
-    while(*key)
-        ret = (ret << 1) + (*key++);
-    return ret % HASH_SIZE;
-}
+	FILE *entry_table_file;
+	char buf[2048];
+	unsigned int size = 0;
 
-static void *find_hash_item(hash_table t, char *key)
-{
-    struct hash_item *p;
-    for(p = t[hash(key)]; p; p = p->next)
-	if(strcasecmp(p->key, key) == 0)
-	    return p->value;
-    return NULL;
+	*entry_points = NULL;
+	*count = 0;
+	if (!fn)
+		return 0;
+	if ((entry_table_file = fopen(fn, "r")) == NULL)
+		return -1;
+	while (fgets(buf, sizeof(buf)-1, entry_table_file) != NULL) {
+		// drop the final char '\n'
+		if(buf[strlen(buf)-1] == '\n')
+			buf[strlen(buf)-1] = 0;
+		if (*count == size) {
+			size = size ? size * 2 : 64;
+			*entry_points = realloc(*entry_points,
+						size * sizeof(**entry_points));
+			if (*entry_points == NULL)
+				return -1;
+		}
+		(*entry_points)[(*count)++] = strdup(buf);
+	}
+	fclose(entry_table_file);
+	return 0;
 }
 
-static void insert_hash_item(hash_table t, char *key, void *v)
+static char *read_source(FILE *input, size_t *size)
 {
-    int index = hash(key);
-    struct hash_item *p = malloc(sizeof(*p));
-    p->key = key;
-    p->value = v;
-    p->next = t[index];
-    t[index] = p;
-}
+	size_t len = 0, alloc = 65536;
+	char *buf = malloc(alloc);
 
-static void free_hash_table(hash_table t)
-{
-    struct hash_item *p, *next;
-    int i;
-    for (i = 0; i < HASH_SIZE; i++) {
-	p = t[i];
-	while(p) {
-	    next = p->next;
-	    free(p->key);
-	    free(p->value);
-	    free(p);
-	    p = next;
+	while (buf) {
+		len += fread(buf + len, 1, alloc - len, input);
+		if (len < alloc)
+			break;
+		alloc *= 2;
+		buf = realloc(buf, alloc);
+	}
+	if (buf == NULL || ferror(input)) {
+		free(buf);
+		return NULL;
 	}
-    }
-}
 
-struct declared_register *find_register(char *name)
-{
-    return find_hash_item(declared_register_table, name);
+	*size = len;
+	return buf;
 }
 
-void insert_register(struct declared_register *reg)
+static void
+print_instruction(FILE *output, const void *instruction)
 {
-    insert_hash_item(declared_register_table, reg->name, reg);
+	if (binary_like_output) {
+		fprintf(output, "\t0x%02x, 0x%02x, 0x%02x, 0x%02x, "
+				"0x%02x, 0x%02x, 0x%02x, 0x%02x,\n"
+				"\t0x%02x, 0x%02x, 0x%02x, 0x%02x, "
+				"0x%02x, 0x%02x, 0x%02x, 0x%02x,\n",
+			((const unsigned char *)instruction)[0],
+			((const unsigned char *)instruction)[1],
+			((const unsigned char *)instruction)[2],
+			((const unsigned char *)instruction)[3],
+			((const unsigned char *)instruction)[4],
+			((const unsigned char *)instruction)[5],
+			((const unsigned char *)instruction)[6],
+			((const unsigned char *)instruction)[7],
+			((const unsigned char *)instruction)[8],
+			((const unsigned char *)instruction)[9],
+			((const unsigned char *)instruction)[10],
+			((const unsigned char *)instruction)[11],
+			((const unsigned char *)instruction)[12],
+			((const unsigned char *)instruction)[13],
+			((const unsigned char *)instruction)[14],
+			((const unsigned char *)instruction)[15]);
+	} else {
+		fprintf(output, "   { 0x%08x, 0x%08x, 0x%08x, 0x%08x },\n",
+			((const int *)instruction)[0],
+			((const int *)instruction)[1],
+			((const int *)instruction)[2],
+			((const int *)instruction)[3]);
+	}
 }
-
-static void add_label(struct brw_program_instruction *i)
+/* Reads and assembles one source file, "-" being stdin */
+static int assemble_file(const struct brw_asm_options *defaults,
+			 const char *filename, struct brw_asm_result *result)
 {
-    struct label_item **p = &label_table;
+	struct brw_asm_options options = *defaults;
+	FILE *input = stdin;
+	char *source;
+	size_t size;
+	int err;
+
+	if (strcmp(filename, "-") != 0) {
+		options.filename = filename;
+		input = fopen(filename, "r");
+		if (input == NULL) {
+			fprintf(stderr, "Couldn't open input file %s: %s\n",
+				filename, strerror(errno));
+			return -1;
+		}
+	}
 
-    assert(is_label(i));
+	source = read_source(input, &size);
+	if (input != stdin)
+		fclose(input);
+	if (source == NULL) {
+		fprintf(stderr, "Couldn't read input file %s: %s\n",
+			filename, strerror(errno));
+		return -1;
+	}
 
-    while(*p)
-        p = &((*p)->next);
-    *p = calloc(1, sizeof(**p));
-    (*p)->name = label_name(i);
-    (*p)->addr = i->inst_offset;
-}
+	err = brw_asm_assemble(&options, source, size, result);
+	free(source);
 
-/* Some assembly code have duplicated labels.
-   Start from start_addr. Search as a loop. Return the first label found. */
-static int label_to_addr(char *name, int start_addr)
-{
-    /* return the first label just after start_addr, or the first label from the head */
-    struct label_item *p;
-    int r = -1;
-    for(p = label_table; p; p = p->next) {
-        if(strcmp(p->name, name) == 0) {
-            if(p->addr >= start_addr) // the first label just after start_addr
-                return p->addr;
-            else if(r == -1) // the first label from the head
-                r = p->addr;
-        }
-    }
-    if(r == -1) {
-        fprintf(stderr, "Can't find label %s\n", name);
-        exit(1);
-    }
-    return r;
+	if (err == 0 && options.optimize && result->opt.instructions) {
+		const struct brw_asm_opt_stats *opt = &result->opt;
+
+		fprintf(stderr, "%s: optimized %u instructions to %zu: "
+			"%u operands propagated, %u folded, %u dead, "
+			"%u nops\n",
+			options.filename ? options.filename : "<stdin>",
+			opt->instructions,
+			result->uncompacted_size / 16,
+			opt->copies, opt->folded, opt->dead, opt->nops);
+	}
+
+	if (err == 0 && options.schedule && result->sched.instructions) {
+		const struct brw_asm_sched_stats *sched = &result->sched;
+
+		fprintf(stderr, "%s: scheduled %u instructions, %u moved, "
+			"estimated %u cycles to %u\n",
+			options.filename ? options.filename : "<stdin>",
+			sched->instructions, sched->moved,
+			sched->before, sched->after);
+	}
+
+	if (err == 0 && options.compact && options.gen >= 60) {
+		size_t saved = result->uncompacted_size - result->size;
+
+		fprintf(stderr, "%s: compacted %zu bytes to %zu, %zu saved (%zu%%)\n",
+			options.filename ? options.filename : "<stdin>",
+			result->uncompacted_size, result->size, saved,
+			result->uncompacted_size ?
+			saved * 100 / result->uncompacted_size : 0);
+	}
+	return err;
 }
 
-static void free_label_table(struct label_item *p)
+/*
+ * Writes the program to output_file (stdout if NULL) and, when
+ * export_file isn't NULL, the label offsets to export_file.
+ */
+static int write_program(const struct brw_asm_options *options,
+			 const struct brw_asm_result *result,
+			 const char *output_file, const char *export_file)
 {
-    if(p) {
-        free_label_table(p->next);
-        free(p);
-    }
-}
+	FILE *output = stdout;
+	unsigned int i;
+	int err = 0;
 
-struct entry_point_item {
-	char *str;
-	struct entry_point_item *next;
-} *entry_point_table;
+	if (output_file) {
+		output = fopen(output_file, "w");
+		if (output == NULL) {
+			fprintf(stderr, "Couldn't open output file %s: %s\n",
+				output_file, strerror(errno));
+			return -1;
+		}
 
-static int read_entry_file(char *fn)
-{
-	FILE *entry_table_file;
-	char buf[2048];
-	struct entry_point_item **p = &entry_point_table;
-	if (!fn)
-		return 0;
-	if ((entry_table_file = fopen(fn, "r")) == NULL)
-		return -1;
-	while (fgets(buf, sizeof(buf)-1, entry_table_file) != NULL) {
-		// drop the final char '\n'
-		if(buf[strlen(buf)-1] == '\n')
-			buf[strlen(buf)-1] = 0;
-		*p = calloc(1, sizeof(struct entry_point_item));
-		(*p)->str = strdup(buf);
-		p = &((*p)->next);
 	}
-	fclose(entry_table_file);
-	return 0;
+
+	if (export_file) {
+		/* Gen5 jump offsets count 64 bit units */
+		int scale = options->gen >= 50 && options->gen < 60 ? 2 : 1;
+		FILE *export = fopen(export_file, "w");
+
+		if (export == NULL) {
+			fprintf(stderr, "Couldn't open export file %s: %s\n",
+				export_file, strerror(errno));
+			err = -1;
+		} else {
+			for (i = 0; i < result->num_labels; i++) {
+			    const struct brw_asm_label *label = &result->labels[i];
+
+			    if (label->offset % 16) {
+				fprintf(stderr, "Can't export label %s, it's "
+					"not on an instruction boundary after "
+					"compaction\n", label->name);
+				err = -1;
+				continue;
+			    }
+			    fprintf(export, "#define %s_IP %d\n",
+				    label->name, scale * label->offset / 16);
+			}
+			fclose(export);
+		}
+	}
+
+	if (container_output) {
+		/* write errors are reported by the ferror() check below */
+		if (brw_asm_write_container(output, options->gen, result) &&
+		    !ferror(output)) {
+			fprintf(stderr, "Couldn't write output file %s: %s\n",
+				output_file ? output_file : "<stdout>",
+				strerror(errno));
+			err = -1;
+		}
+	} else if (raw_output) {
+		fwrite(result->code, 1, result->size, output);
+	} else {
+		if (binary_like_output)
+			fprintf(output, "%s", binary_prepend);
+
+		for (i = 0; i < result->size / 16; i++)
+		    print_instruction(output,
+				      (unsigned char *)result->code + 16 * i);
+		if (binary_like_output)
+			fprintf(output, "};");
+	}
+
+	fflush (output);
+	if (ferror (output)) {
+	    fprintf (stderr, "Could not flush output file %s: %s\n",
+		     output_file ? output_file : "<stdout>", strerror(errno));
+	    if (output_file)
+		unlink (output_file);
+	    err = -1;
+	}
+	if (output_file)
+		fclose(output);
+	return err;
 }
 
-static int is_entry_point(struct brw_program_instruction *i)
+struct manifest_job {
+	char *input;
+	char *output;
+	char *export;
+	int err;
+};
+
+static struct brw_asm_options batch_options;
+static struct manifest_job *batch;
+static unsigned int batch_count;
+static unsigned int batch_next;
+
+/* Each thread takes the next unclaimed job until the manifest is done */
+static void *batch_worker(void *arg)
 {
-	struct entry_point_item *p;
+	unsigned int i;
 
-	assert(i->type == GEN4ASM_INSTRUCTION_LABEL);
+	while ((i = __sync_fetch_and_add(&batch_next, 1)) < batch_count) {
+		struct manifest_job *job = &batch[i];
+		struct brw_asm_result result;
 
-	for (p = entry_point_table; p; p = p->next) {
-	    if (strcmp(p->str, i->insn.label.name) == 0)
-		return 1;
+		job->err = assemble_file(&batch_options, job->input, &result);
+		if (job->err == 0) {
+			job->err = write_program(&batch_options, &result,
+						 job->output, job->export);
+			brw_asm_result_fini(&result);
+		}
 	}
-	return 0;
+
+	return NULL;
 }
 
-static void free_entry_point_table(struct entry_point_item *p) {
-	if (p) {
-		free_entry_point_table(p->next);
-		free(p->str);
-		free(p);
+/*
+ * A manifest lists one kernel per line: the source, the output and,
+ * optionally, the label export file, separated by white space.  Empty
+ * lines and lines starting with '#' are ignored.
+ */
+static int read_manifest(const char *fn)
+{
+	FILE *file;
+	char buf[4096];
+	unsigned int size = 0;
+
+	if ((file = fopen(fn, "r")) == NULL) {
+		fprintf(stderr, "Couldn't open manifest %s: %s\n",
+			fn, strerror(errno));
+		return -1;
+	}
+	while (fgets(buf, sizeof(buf), file) != NULL) {
+		char *input, *output, *export, *save;
+
+		input = strtok_r(buf, " \t\r\n", &save);
+		if (input == NULL || input[0] == '#')
+			continue;
+		output = strtok_r(NULL, " \t\r\n", &save);
+		export = strtok_r(NULL, " \t\r\n", &save);
+		if (output == NULL || strtok_r(NULL, " \t\r\n", &save)) {
+			fprintf(stderr, "%s:%u: expected \"input output [export]\"\n",
+				fn, batch_count + 1);
+			fclose(file);
+			return -1;
+		}
+
+		if (batch_count == size) {
+			size = size ? size * 2 : 64;
+			batch = realloc(batch, size * sizeof(*batch));
+			if (batch == NULL) {
+				fclose(file);
+				return -1;
+			}
+		}
+		batch[batch_count].input = strdup(input);
+		batch[batch_count].output = strdup(output);
+		batch[batch_count].export = export ? strdup(export) : NULL;
+		batch[batch_count].err = 0;
+		batch_count++;
 	}
+	fclose(file);
+	return 0;
 }
 
-static void
-print_instruction(FILE *output, struct brw_instruction *instruction)
+static int run_manifest(const struct brw_asm_options *options, int jobs)
 {
-	if (binary_like_output) {
-		fprintf(output, "\t0x%02x, 0x%02x, 0x%02x, 0x%02x, "
-				"0x%02x, 0x%02x, 0x%02x, 0x%02x,\n"
-				"\t0x%02x, 0x%02x, 0x%02x, 0x%02x, "
-				"0x%02x, 0x%02x, 0x%02x, 0x%02x,\n",
-			((unsigned char *)instruction)[0],
-			((unsigned char *)instruction)[1],
-			((unsigned char *)instruction)[2],
-			((unsigned char *)instruction)[3],
-			((unsigned char *)instruction)[4],
-			((unsigned char *)instruction)[5],
-			((unsigned char *)instruction)[6],
-			((unsigned char *)instruction)[7],
-			((unsigned char *)instruction)[8],
-			((unsigned char *)instruction)[9],
-			((unsigned char *)instruction)[10],
-			((unsigned char *)instruction)[11],
-			((unsigned char *)instruction)[12],
-			((unsigned char *)instruction)[13],
-			((unsigned char *)instruction)[14],
-			((unsigned char *)instruction)[15]);
+	pthread_t *threads;
+	unsigned int i;
+	int err = 0;
+
+	if (read_manifest(manifest_file))
+		return 1;
+
+	batch_options = *options;
+	if (jobs > (int)batch_count)
+		jobs = batch_count;
+
+	threads = calloc(jobs, sizeof(*threads));
+	if (jobs > 1 && threads == NULL)
+		jobs = 1;
+
+	if (jobs <= 1) {
+		batch_worker(NULL);
 	} else {
-		fprintf(output, "   { 0x%08x, 0x%08x, 0x%08x, 0x%08x },\n",
-			((int *)instruction)[0],
-			((int *)instruction)[1],
-			((int *)instruction)[2],
-			((int *)instruction)[3]);
+		for (i = 0; i < (unsigned int)jobs; i++)
+			pthread_create(&threads[i], NULL, batch_worker, NULL);
+		for (i = 0; i < (unsigned int)jobs; i++)
+			pthread_join(threads[i], NULL);
 	}
+	free(threads);
+
+	for (i = 0; i < batch_count; i++) {
+		if (batch[i].err)
+			err = 1;
+		free(batch[i].input);
+		free(batch[i].output);
+		free(batch[i].export);
+	}
+	free(batch);
+
+	return err;
 }
+
 int main(int argc, char **argv)
 {
+	struct brw_asm_options options = { .gen = 40 };
+	struct brw_asm_result result;
 	char *output_file = NULL;
 	char *entry_table_file = NULL;
-	FILE *output = stdout;
-	FILE *export_file;
-	struct brw_program_instruction *entry, *entry1, *tmp_entry;
-	int err, inst_offset;
+	char **entry_points;
+	unsigned int num_entry_points, i;
+	int jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	int err;
 	char o;
-	void *mem_ctx;
 
-	while ((o = getopt_long(argc, argv, "e:l:o:g:abW", longopts, NULL)) != -1) {
+	while ((o = getopt_long(argc, argv, "e:l:o:g:abWm:j:crOsRC", longopts, NULL)) != -1) {
 		switch (o) {
 		case 'o':
 			if (strcmp(optarg, "-") != 0)
@@ -306,7 +460,7 @@ int main(int argc, char **argv)
 			char *dec_ptr, *end_ptr;
 			unsigned long decimal;
 
-			gen_level = strtol(optarg, &dec_ptr, 10) * 10;
+			options.gen = strtol(optarg, &dec_ptr, 10) * 10;
 
 			if (*dec_ptr == '.') {
 				decimal = strtoul(++dec_ptr, &end_ptr, 10);
@@ -315,11 +469,11 @@ int main(int argc, char **argv)
 						fprintf(stderr, "Invalid Gen X decimal version\n");
 						exit(1);
 					}
-					gen_level += decimal;
+					options.gen += decimal;
 				}
 			}
 
-			if (gen_level < 40 || gen_level > 75) {
+			if (options.gen < 40 || options.gen > 75) {
 				usage();
 				exit(1);
 			}
@@ -328,11 +482,17 @@ int main(int argc, char **argv)
 		}
 
 		case 'a':
-			advanced_flag = 1;
+			options.advanced = 1;
 			break;
 		case 'b':
 			binary_like_output = 1;
 			break;
+		case 'R':
+			raw_output = 1;
+			break;
+		case 'C':
+			container_output = 1;
+			break;
 
 		case 'e':
 			need_export = 1;
@@ -346,7 +506,32 @@ int main(int argc, char **argv)
 			break;
 
 		case 'W':
-			warning_flags |= WARN_ALL;
+			options.warn_all = 1;
+			break;
+
+		case 'c':
+			options.compact = 1;
+			break;
+
+		case 'r':
+			options.compact = 1;
+			options.compaction_report = stderr;
+			break;
+
+		case 'O':
+			options.optimize = 1;
+			break;
+
+		case 's':
+			options.schedule = 1;
+			break;
+
+		case 'm':
+			manifest_file = optarg;
+			break;
+
+		case 'j':
+			jobs = atoi(optarg);
 			break;
 
 		default:
@@ -356,165 +541,36 @@ int main(int argc, char **argv)
 	}
 	argc -= optind;
 	argv += optind;
-	if (argc != 1) {
+	if (manifest_file ? argc != 0 || output_file || need_export : argc != 1) {
 		usage();
 		exit(1);
 	}
 
-	if (strcmp(argv[0], "-") != 0) {
-		input_filename = argv[0];
-		yyin = fopen(input_filename, "r");
-		if (yyin == NULL) {
-			perror("Couldn't open input file");
-			exit(1);
-		}
-	}
-
-	brw_init_context(&genasm_brw_context, gen_level);
-	mem_ctx = ralloc_context(NULL);
-	brw_init_compile(&genasm_brw_context, &genasm_compile, mem_ctx);
-
-	err = yyparse();
-
-	if (strcmp(argv[0], "-"))
-		fclose(yyin);
-
-	yylex_destroy();
-
-	if (err || errors)
-		exit (1);
-
-	if (output_file) {
-		output = fopen(output_file, "w");
-		if (output == NULL) {
-			perror("Couldn't open output file");
-			exit(1);
-		}
-
-	}
-
-	if (read_entry_file(entry_table_file)) {
+	if (read_entry_file(entry_table_file, &entry_points, &num_entry_points)) {
 		fprintf(stderr, "Read entry file error\n");
 		exit(1);
 	}
-	inst_offset = 0 ;
-	for (entry = compiled_program.first;
-		entry != NULL; entry = entry->next) {
-	    entry->inst_offset = inst_offset;
-	    entry1 = entry->next;
-	    if (entry1 && is_label(entry1) && is_entry_point(entry1)) {
-		// insert NOP instructions until (inst_offset+1) % 4 == 0
-		while (((inst_offset+1) % 4) != 0) {
-		    tmp_entry = calloc(sizeof(*tmp_entry), 1);
-		    tmp_entry->insn.gen.header.opcode = BRW_OPCODE_NOP;
-		    entry->next = tmp_entry;
-		    tmp_entry->next = entry1;
-		    entry = tmp_entry;
-		    tmp_entry->inst_offset = ++inst_offset;
-		}
-	    }
-	    if (!is_label(entry))
-              inst_offset++;
-	}
-
-	for (entry = compiled_program.first; entry; entry = entry->next)
-	    if (is_label(entry))
-		add_label(entry);
-
-	if (need_export) {
-		if (export_filename) {
-			export_file = fopen(export_filename, "w");
-		} else {
-			export_file = fopen("export.inc", "w");
-		}
-		for (entry = compiled_program.first;
-			entry != NULL; entry = entry->next) {
-		    if (is_label(entry))
-			fprintf(export_file, "#define %s_IP %d\n",
-				label_name(entry), (IS_GENx(5) ? 2 : 1)*(entry->inst_offset));
-		}
-		fclose(export_file);
-	}
+	options.entry_points = (const char * const *)entry_points;
+	options.num_entry_points = num_entry_points;
 
-	for (entry = compiled_program.first; entry; entry = entry->next) {
-	    struct relocation *reloc = &entry->reloc;
-	    struct brw_instruction *inst = &entry->insn.gen;
-
-	    if (!is_relocatable(entry))
-		continue;
-
-	    if (reloc->first_reloc_target)
-		reloc->first_reloc_offset = label_to_addr(reloc->first_reloc_target, entry->inst_offset) - entry->inst_offset;
-
-	    if (reloc->second_reloc_target)
-		reloc->second_reloc_offset = label_to_addr(reloc->second_reloc_target, entry->inst_offset) - entry->inst_offset;
-
-	    if (reloc->second_reloc_offset) {
-		// this is a branch instruction with two offset arguments
-		inst->bits3.break_cont.jip = jump_distance(reloc->first_reloc_offset);
-		inst->bits3.break_cont.uip = jump_distance(reloc->second_reloc_offset);
-	    } else if (reloc->first_reloc_offset) {
-		// this is a branch instruction with one offset argument
-		int offset = reloc->first_reloc_offset;
-		/* bspec: Unlike other flow control instructions, the offset used by JMPI is relative to the incremented instruction pointer rather than the IP value for the instruction itself. */
-
-		int is_jmpi = inst->header.opcode == BRW_OPCODE_JMPI; // target relative to the post-incremented IP, so delta == 1 if JMPI
-		if(is_jmpi)
-		    offset --;
-		offset = jump_distance(offset);
-		if (is_jmpi && (gen_level == 75))
-			offset = offset * 8;
-
-		if(!IS_GENp(6)) {
-		    inst->bits3.JIP = offset;
-		    if(inst->header.opcode == BRW_OPCODE_ELSE)
-			inst->bits3.break_cont.uip = 1; /* Set the istack pop count, which must always be 1. */
-		} else if(IS_GENx(6)) {
-		    /* TODO: endif JIP pos is not in Gen6 spec. may be bits1 */
-		    int opcode = inst->header.opcode;
-		    if(opcode == BRW_OPCODE_CALL || opcode == BRW_OPCODE_JMPI)
-			inst->bits3.JIP = offset; // for CALL, JMPI
-		    else
-			inst->bits1.branch_gen6.jump_count = offset; // for CASE,ELSE,FORK,IF,WHILE
-		} else if(IS_GENp(7)) {
-		    int opcode = inst->header.opcode;
-		    /* Gen7 JMPI Restrictions in bspec:
-		     * The JIP data type must be Signed DWord
-		     */
-		    if(opcode == BRW_OPCODE_JMPI)
-			inst->bits3.JIP = offset;
-		    else
-			inst->bits3.break_cont.jip = offset;
+	if (manifest_file) {
+		err = run_manifest(&options, jobs);
+	} else {
+		err = assemble_file(&options, argv[0], &result);
+		if (err == 0) {
+			const char *export_file = NULL;
+
+			if (need_export)
+				export_file = export_filename ? export_filename : "export.inc";
+			err = write_program(&options, &result, output_file,
+					    export_file) ? 1 : 0;
+			brw_asm_result_fini(&result);
 		}
-	    }
 	}
 
-	if (binary_like_output)
-		fprintf(output, "%s", binary_prepend);
-
-	for (entry = compiled_program.first;
-		entry != NULL;
-		entry = entry1) {
-	    entry1 = entry->next;
-	    if (!is_label(entry))
-		print_instruction(output, &entry->insn.gen);
-	    else
-		free(entry->insn.label.name);
-	    free(entry);
-	}
-	if (binary_like_output)
-		fprintf(output, "};");
-
-	free_entry_point_table(entry_point_table);
-	free_hash_table(declared_register_table);
-	free_label_table(label_table);
+	for (i = 0; i < num_entry_points; i++)
+		free(entry_points[i]);
+	free(entry_points);
 
-	fflush (output);
-	if (ferror (output)) {
-	    perror ("Could not flush output file");
-	    if (output_file)
-		unlink (output_file);
-	    err = 1;
-	}
-	return err;
+	return err ? 1 : 0;
 }
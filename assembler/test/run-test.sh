@@ -4,10 +4,12 @@
 
 DIR="$( cd -P "$( dirname "$0" )" && pwd )"
 ASSEMBLER="${DIR}/../src/intel-gen4asm"
+DISASSEMBLER="${DIR}/../src/intel-gen4disasm"
 
 # Tests that are expected to success because they contain correct code.
 # $1 is the gen level, e.g., 4 or 7
 # $2 is the test case name
+# $3 are extra assembler options, if any
 function check_if_work()
 {
     GEN_LEVEL="$1"
@@ -15,8 +17,29 @@ function check_if_work()
     SOURCE="${TEST_CASE_NAME}.g${1}a"
     EXPECTED="${TEST_CASE_NAME}.expected"
     TEMP_OUT="temp.out"
-    ${ASSEMBLER} -g ${GEN_LEVEL} ${DIR}/${SOURCE} -o ${TEMP_OUT}
+    ${ASSEMBLER} -g ${GEN_LEVEL} $3 ${DIR}/${SOURCE} -o ${TEMP_OUT}
     if cmp ${TEMP_OUT} ${DIR}/${EXPECTED} 2> /dev/null;
+    then
+        echo "[ OK ] ${TEST_CASE_NAME} $3";
+    else
+        echo "[FAIL] ${TEST_CASE_NAME} $3";
+        diff -u ${DIR}/${EXPECTED} ${TEMP_OUT};
+    fi
+}
+
+# Compacted gen6+ code: the output must match, and disassemble to the
+# expected ${TEST_CASE_NAME}.disasm, compacted instructions included.
+function check_compact()
+{
+    GEN_LEVEL="$1"
+    TEST_CASE_NAME="$2"
+    SOURCE="${TEST_CASE_NAME}.g${1}a"
+    EXPECTED="${TEST_CASE_NAME}.expected"
+    DISASM="${TEST_CASE_NAME}.disasm"
+    TEMP_OUT="temp.out"
+    ${ASSEMBLER} -g ${GEN_LEVEL} --compact ${DIR}/${SOURCE} -o ${TEMP_OUT} 2> /dev/null
+    if cmp ${TEMP_OUT} ${DIR}/${EXPECTED} 2> /dev/null &&
+       ${DISASSEMBLER} -g ${GEN_LEVEL} ${TEMP_OUT} | cmp - ${DIR}/${DISASM} 2> /dev/null;
     then
         echo "[ OK ] ${TEST_CASE_NAME}";
     else
@@ -25,6 +48,70 @@ function check_if_work()
     fi
 }
 
+# The raw and container binary formats must disassemble like the hex
+# text does; containers add the label names, which are filtered out.
+function check_raw()
+{
+    GEN_LEVEL="$1"
+    TEST_CASE_NAME="$2"
+    SOURCE="${TEST_CASE_NAME}.g${1}a"
+    DISASM="${TEST_CASE_NAME}.disasm"
+    RAW_OUT="temp-raw.out"
+    CONTAINER_OUT="temp-container.out"
+    ${ASSEMBLER} -g ${GEN_LEVEL} --compact --raw ${DIR}/${SOURCE} -o ${RAW_OUT} 2> /dev/null
+    ${ASSEMBLER} -g ${GEN_LEVEL} --compact --container ${DIR}/${SOURCE} -o ${CONTAINER_OUT} 2> /dev/null
+    if ${DISASSEMBLER} -g ${GEN_LEVEL} --raw ${RAW_OUT} | cmp - ${DIR}/${DISASM} 2> /dev/null &&
+       ${DISASSEMBLER} ${CONTAINER_OUT} | grep -v ':$' | cmp - ${DIR}/${DISASM} 2> /dev/null;
+    then
+        echo "[ OK ] ${TEST_CASE_NAME} raw";
+    else
+        echo "[FAIL] ${TEST_CASE_NAME} raw";
+    fi
+}
+
+# Kernels run on the disassembler's software EU: the counts and the final
+# registers must match ${TEST_CASE_NAME}.sim.  $3 are extra assembler
+# options, which must not change what the kernel computes.
+function check_exec()
+{
+    GEN_LEVEL="$1"
+    TEST_CASE_NAME="$2"
+    SOURCE="${TEST_CASE_NAME}.g${1}a"
+    SIM="${TEST_CASE_NAME}.sim"
+    TEMP_OUT="temp.out"
+    ${ASSEMBLER} -g ${GEN_LEVEL} $3 ${DIR}/${SOURCE} -o ${TEMP_OUT} 2> /dev/null
+    if ${DISASSEMBLER} -g ${GEN_LEVEL} --execute ${TEMP_OUT} | cmp - ${DIR}/${SIM} 2> /dev/null;
+    then
+        echo "[ OK ] ${TEST_CASE_NAME} execute $3";
+    else
+        echo "[FAIL] ${TEST_CASE_NAME} execute $3";
+        ${DISASSEMBLER} -g ${GEN_LEVEL} --execute ${TEMP_OUT} | diff -u ${DIR}/${SIM} -;
+    fi
+}
+
+# Optimized kernels: -O drops writes nothing reads, so only the registers
+# the EOT message sends, g112 on, must match ${TEST_CASE_NAME}.sim.
+function check_opt_exec()
+{
+    GEN_LEVEL="$1"
+    TEST_CASE_NAME="$2"
+    SOURCE="${TEST_CASE_NAME}.g${1}a"
+    SIM="${TEST_CASE_NAME}.sim"
+    TEMP_OUT="temp.out"
+    TEMP_SIM="temp-sim.out"
+    ${ASSEMBLER} -g ${GEN_LEVEL} -O ${DIR}/${SOURCE} -o ${TEMP_OUT} 2> /dev/null
+    grep '^	g11[2-9]:' ${DIR}/${SIM} > ${TEMP_SIM}
+    if ${DISASSEMBLER} -g ${GEN_LEVEL} --execute ${TEMP_OUT} |
+       grep '^	g11[2-9]:' | cmp - ${TEMP_SIM} 2> /dev/null;
+    then
+        echo "[ OK ] ${TEST_CASE_NAME} execute -O";
+    else
+        echo "[FAIL] ${TEST_CASE_NAME} execute -O";
+        ${DISASSEMBLER} -g ${GEN_LEVEL} --execute ${TEMP_OUT} |
+            grep '^	g11[2-9]:' | diff -u ${TEMP_SIM} -;
+    fi
+}
+
 # Tests that are expected to fail because they contain wrong code.
 function check_if_fail()
 {
@@ -81,3 +168,42 @@ do
     check_if_fail 4 ${T}
 done
 
+# Compaction only applies to gen6+, so gen4 code must come out unchanged.
+for T in ${TEST_GEN4_SHOULD_WORK}
+do
+    check_if_work 4 ${T} --compact
+done
+
+TEST_GEN7_COMPACT="\
+	compact \
+	"
+
+for T in ${TEST_GEN7_COMPACT}
+do
+    check_compact 7 ${T}
+    check_raw 7 ${T}
+done
+
+TEST_GEN7_EXEC="\
+	exec \
+	opt \
+	"
+
+for T in ${TEST_GEN7_EXEC}
+do
+    check_exec 7 ${T}
+    check_exec 7 ${T} --schedule
+    check_opt_exec 7 ${T}
+done
+
+# The optimized code itself: a folded immediate, jumps re-encoded around
+# the deleted instructions, and the writes PLN reads past its region or
+# an instruction reads through a0 kept.
+TEST_GEN7_OPT="\
+	opt \
+	"
+
+for T in ${TEST_GEN7_OPT}
+do
+    check_if_work 7 ${T} -O
+done
@@ -0,0 +1,207 @@
+/*
+ * Copyright © 2013 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/**
+ * Microbenchmark of the GTT run-length encoder used by intel_gtt.
+ *
+ * Synthetic PTE arrays covering a 4GB aperture are scanned both with the
+ * original per-run rescanning loop and with gtt_next_run(), the run counts
+ * are checked against each other and the throughput of both is printed.
+ * No GPU is required.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/time.h>
+
+#include "intel_gtt_rle.h"
+
+#define APERTURE_SIZE	(4ULL << 30)
+#define NUM_PTES	(APERTURE_SIZE / GTT_PAGE_SIZE)
+#define SCRATCH_PTE	0x00001001
+#define ITERATIONS	20
+
+static double
+get_time_in_secs(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+
+	return (double)tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/* Mostly idle: a few large linear objects in a sea of scratch PTEs */
+static void
+fill_sparse(uint32_t *pte, uint32_t count)
+{
+	uint32_t i;
+
+	for (i = 0; i < count; i++)
+		pte[i] = SCRATCH_PTE;
+	for (i = 0; i < count / 4; i++)
+		pte[count / 2 + i] = 0x10000001 + i * GTT_PAGE_SIZE;
+}
+
+/* Many small objects of random size and backing, as after a long session */
+static void
+fill_fragmented(uint32_t *pte, uint32_t count)
+{
+	uint32_t i = 0, j, len, base;
+
+	while (i < count) {
+		len = random() % 64 + 1;
+		base = (random() << 12) | 1;
+		for (j = 0; j < len && i < count; j++, i++)
+			pte[i] = random() % 4 ? base + j * GTT_PAGE_SIZE : SCRATCH_PTE;
+	}
+}
+
+/* Alternating two-entry linear and constant pairs */
+static void
+fill_adversarial(uint32_t *pte, uint32_t count)
+{
+	uint32_t i;
+
+	for (i = 0; i < count; i++) {
+		switch (i % 6) {
+		case 0: pte[i] = 0x20000001 + i * 3 * GTT_PAGE_SIZE; break;
+		case 1: pte[i] = pte[i - 1] + GTT_PAGE_SIZE; break;
+		case 2: pte[i] = (i << 12) | 0x3; break;
+		case 3: pte[i] = pte[i - 1]; break;
+		default: pte[i] = random(); break;
+		}
+	}
+}
+
+/* The loop intel_gtt used before gtt_next_run() */
+static uint32_t
+count_runs_reference(const uint32_t *pte, uint32_t count)
+{
+	uint32_t start, end, runs = 0;
+
+	for (start = 0; start < count; start++) {
+		uint32_t start_pte = pte[start];
+		int constant_length = 0;
+		int linear_length = 0;
+
+		runs++;
+
+		for (end = start + 1; end < count; end++) {
+			if (pte[end] == start_pte + (end - start) * GTT_PAGE_SIZE)
+				linear_length++;
+			else
+				break;
+		}
+		if (linear_length > 0) {
+			start = end - 1;
+			continue;
+		}
+
+		for (end = start + 1; end < count; end++) {
+			if (pte[end] == start_pte)
+				constant_length++;
+			else
+				break;
+		}
+		if (constant_length > 0)
+			start = end - 1;
+	}
+
+	return runs;
+}
+
+static uint32_t
+count_runs(const uint32_t *pte, uint32_t count)
+{
+	struct gtt_run run;
+	uint32_t start, runs = 0;
+
+	for (start = 0; start < count; start += run.length) {
+		gtt_next_run(pte, count, start, &run);
+		runs++;
+	}
+
+	return runs;
+}
+
+static int
+run_pattern(const char *name, void (*fill)(uint32_t *, uint32_t),
+	    uint32_t *pte)
+{
+	double start_time, ref_time, rle_time;
+	uint32_t ref_runs = 0, rle_runs = 0;
+	int i;
+
+	fill(pte, NUM_PTES);
+
+	start_time = get_time_in_secs();
+	for (i = 0; i < ITERATIONS; i++)
+		ref_runs = count_runs_reference(pte, NUM_PTES);
+	ref_time = get_time_in_secs() - start_time;
+
+	start_time = get_time_in_secs();
+	for (i = 0; i < ITERATIONS; i++)
+		rle_runs = count_runs(pte, NUM_PTES);
+	rle_time = get_time_in_secs() - start_time;
+
+	printf("%-12s %8u runs: reference %7.1f MPTE/sec, "
+	       "rle %7.1f MPTE/sec (%.2fx)\n",
+	       name, rle_runs,
+	       (double)ITERATIONS * NUM_PTES / ref_time / 1e6,
+	       (double)ITERATIONS * NUM_PTES / rle_time / 1e6,
+	       ref_time / rle_time);
+
+	if (ref_runs != rle_runs) {
+		fprintf(stderr, "%s: run count mismatch, %u vs %u\n",
+			name, ref_runs, rle_runs);
+		return 1;
+	}
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t *pte;
+	int ret = 0;
+
+	pte = malloc(NUM_PTES * sizeof(uint32_t));
+	if (pte == NULL) {
+		fprintf(stderr, "Failed to allocate PTE array\n");
+		return 1;
+	}
+
+	srandom(0xdeadbeef);
+
+	ret |= run_pattern("sparse", fill_sparse, pte);
+	ret |= run_pattern("fragmented", fill_fragmented, pte);
+	ret |= run_pattern("adversarial", fill_adversarial, pte);
+
+	free(pte);
+
+	return ret;
+}
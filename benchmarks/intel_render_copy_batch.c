@@ -0,0 +1,127 @@
+/*
+ * Copyright © 2013 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+/**
+ * Reports the batch bytes a gen6+ render copy costs on its own, and what
+ * each further copy costs when consecutive copies share the batch, its
+ * pipeline setup and its state, the way gem_stress copies tiles.
+ */
+
+#include <unistd.h>
+#include "rendercopy.h"
+
+#define WIDTH 512
+#define HEIGHT 512
+#define STRIDE (WIDTH * 4)
+#define TILE 16
+#define COPIES 64
+
+typedef void (*render_copy_emit_t)(struct intel_batchbuffer *batch,
+				   struct scratch_buf *src, unsigned src_x, unsigned src_y,
+				   unsigned width, unsigned height,
+				   struct scratch_buf *dst, unsigned dst_x, unsigned dst_y);
+
+static unsigned int
+batch_bytes(struct intel_batchbuffer *batch)
+{
+	return (batch->ptr - batch->buffer) +
+		(batch->buffer + batch->size - batch->state);
+}
+
+static void
+init_buf(drm_intel_bufmgr *bufmgr, struct scratch_buf *buf, const char *name)
+{
+	memset(buf, 0, sizeof(*buf));
+	buf->bo = drm_intel_bo_alloc(bufmgr, name, STRIDE * HEIGHT, 4096);
+	buf->stride = STRIDE;
+	buf->tiling = I915_TILING_NONE;
+	buf->size = STRIDE * HEIGHT;
+}
+
+int main(int argc, char **argv)
+{
+	drm_intel_bufmgr *bufmgr;
+	struct intel_batchbuffer *batch;
+	struct scratch_buf src, dst;
+	render_copy_emit_t emit;
+	unsigned int first, total, used, i;
+	int fd, devid;
+
+	fd = drm_open_any();
+	devid = intel_get_drm_devid(fd);
+
+	if (IS_GEN6(devid))
+		emit = gen6_render_copy_emit;
+	else if (IS_GEN7(devid))
+		emit = gen7_render_copy_emit;
+	else {
+		fprintf(stderr, "no gen6+ render copy for device 0x%04x\n",
+			devid);
+		return 77;
+	}
+
+	bufmgr = drm_intel_bufmgr_gem_init(fd, 4096);
+	batch = intel_batchbuffer_alloc(bufmgr, devid);
+
+	init_buf(bufmgr, &src, "src");
+	init_buf(bufmgr, &dst, "dst");
+
+	/* A copy on its own, as render_copyfunc_t does it. */
+	emit(batch, &src, 0, 0, TILE, TILE, &dst, 0, 0);
+	first = batch_bytes(batch);
+	intel_batchbuffer_flush_on_ring(batch, I915_EXEC_RENDER);
+
+	/* Tile copies sharing the batch until it fills up. */
+	total = 0;
+	used = 0;
+	for (i = 0; i < COPIES; i++) {
+		unsigned int x = (i * TILE) % WIDTH;
+		unsigned int y = (i * TILE) / WIDTH * TILE;
+		unsigned int before = batch_bytes(batch);
+
+		emit(batch, &src, x, y, TILE, TILE, &dst, y, x);
+		if (batch_bytes(batch) < before)
+			before = 0;
+		if (i) {
+			total += batch_bytes(batch) - before;
+			used++;
+		}
+	}
+	intel_batchbuffer_flush_on_ring(batch, I915_EXEC_RENDER);
+
+	printf("render copy alone: %u batch bytes\n", first);
+	printf("render copy sharing a batch: %u batch bytes (%u%% less)\n",
+	       total / used, 100 - 100 * (total / used) / first);
+	printf("state cache: %lu reused, %lu copied\n",
+	       batch->state_hits, batch->state_misses);
+
+	drm_intel_bo_unreference(src.bo);
+	drm_intel_bo_unreference(dst.bo);
+	intel_batchbuffer_free(batch);
+	drm_intel_bufmgr_destroy(bufmgr);
+
+	close(fd);
+
+	return 0;
+}
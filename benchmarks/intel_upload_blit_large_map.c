@@ -155,6 +155,9 @@ int main(int argc, char **argv)
 	       (double)i * OBJECT_WIDTH * OBJECT_HEIGHT * 4 / 1024.0 / 1024.0 /
 	       (end_time - start_time));
 
+	printf("batch bo pool: %lu reused, %lu allocated\n",
+	       batch->pool_hits, batch->pool_misses);
+
 	intel_batchbuffer_free(batch);
 	drm_intel_bufmgr_destroy(bufmgr);
 
@@ -132,6 +132,7 @@
 #define BASE_ADDRESS_MODIFY		(1 << 0)
 
 /* for GEN6_PIPE_CONTROL */
+#define GEN6_PIPE_CONTROL_CS_STALL      (1 << 20)
 #define GEN6_PIPE_CONTROL_NOWRITE       (0 << 14)
 #define GEN6_PIPE_CONTROL_WRITE_QWORD   (1 << 14)
 #define GEN6_PIPE_CONTROL_WRITE_DEPTH   (2 << 14)
@@ -26,10 +26,16 @@
  **************************************************************************/
 
 #include <inttypes.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/uio.h>
 
 #include "drm.h"
 #include "drmtest.h"
@@ -39,27 +45,319 @@
 #include "intel_reg.h"
 #include <i915_drm.h>
 
+/*
+ * Captured batches are queued for a writer thread, which appends them to
+ * $INTEL_BATCH_CAPTURE, so that the submitting thread doesn't wait for
+ * the disk.  The batch's buffer and relocations are handed over rather
+ * than copied, and the batch starts over with new ones.  Forked children
+ * don't have the thread and write straight away.
+ */
+struct capture_batch {
+	struct capture_batch *next;
+	struct intel_batch_trace header;
+	struct intel_batch_trace_reloc *relocs;
+	void *data;
+};
+
+static struct {
+	pthread_once_t once;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	pthread_t thread;
+	pid_t pid;
+	int fd;
+	int done;
+	struct capture_batch *first, **last;
+} capture = {
+	PTHREAD_ONCE_INIT, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+	.fd = -1,
+};
+
+static void
+capture_write(struct capture_batch *c)
+{
+	struct iovec iov[4];
+	ssize_t len;
+
+	iov[0].iov_base = &c->header;
+	iov[0].iov_len = sizeof(c->header);
+	iov[1].iov_base = c->relocs;
+	iov[1].iov_len = c->header.num_relocs * sizeof(*c->relocs);
+	iov[2].iov_base = c->data;
+	iov[2].iov_len = c->header.size;
+	iov[3].iov_base = (char *)c->data + c->header.state_offset;
+	iov[3].iov_len = c->header.state_size;
+
+	/* One writev, so that the batches of several processes don't mix. */
+	len = writev(capture.fd, iov, 4);
+	if (len != iov[0].iov_len + iov[1].iov_len + iov[2].iov_len +
+		   iov[3].iov_len)
+		fprintf(stderr, "failed to capture batch: %s\n",
+			len < 0 ? strerror(errno) : "short write");
+
+	free(c->relocs);
+	free(c->data);
+	free(c);
+}
+
+static void *
+capture_thread(void *arg)
+{
+	struct capture_batch *c;
+
+	pthread_mutex_lock(&capture.mutex);
+	for (;;) {
+		while (capture.first == NULL && !capture.done)
+			pthread_cond_wait(&capture.cond, &capture.mutex);
+		if (capture.first == NULL)
+			break;
+
+		c = capture.first;
+		capture.first = NULL;
+		capture.last = &capture.first;
+		pthread_mutex_unlock(&capture.mutex);
+
+		while (c) {
+			struct capture_batch *next = c->next;
+			capture_write(c);
+			c = next;
+		}
+
+		pthread_mutex_lock(&capture.mutex);
+	}
+	pthread_mutex_unlock(&capture.mutex);
+
+	return NULL;
+}
+
+/* Writes out what is still queued when the process exits */
+static void
+capture_fini(void)
+{
+	if (getpid() != capture.pid)
+		return;
+
+	pthread_mutex_lock(&capture.mutex);
+	capture.done = 1;
+	pthread_cond_signal(&capture.cond);
+	pthread_mutex_unlock(&capture.mutex);
+
+	pthread_join(capture.thread, NULL);
+	close(capture.fd);
+}
+
+static void
+capture_init(void)
+{
+	const char *path = getenv("INTEL_BATCH_CAPTURE");
+
+	if (path == NULL)
+		return;
+
+	capture.fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0666);
+	if (capture.fd < 0) {
+		fprintf(stderr, "failed to open %s: %s\n",
+			path, strerror(errno));
+		return;
+	}
+
+	capture.pid = getpid();
+	capture.last = &capture.first;
+	if (pthread_create(&capture.thread, NULL, capture_thread, NULL)) {
+		close(capture.fd);
+		capture.fd = -1;
+		return;
+	}
+
+	atexit(capture_fini);
+}
+
+static void
+capture_reloc(struct intel_batchbuffer *batch, uint32_t offset,
+	      drm_intel_bo *target, uint32_t delta,
+	      uint32_t read_domains, uint32_t write_domain)
+{
+	struct intel_batch_trace_reloc *r;
+
+	if (batch->num_relocs == batch->max_relocs) {
+		batch->max_relocs = batch->max_relocs ? 2 * batch->max_relocs : 64;
+		batch->relocs = realloc(batch->relocs,
+					batch->max_relocs * sizeof(*r));
+		assert(batch->relocs);
+	}
+
+	r = &batch->relocs[batch->num_relocs++];
+	r->offset = offset;
+	r->handle = target->handle;
+	r->delta = delta;
+	r->presumed_offset = target->offset;
+	r->read_domains = read_domains;
+	r->write_domain = write_domain;
+}
+
+/* Queues the commands and state of the current bo, once they were uploaded */
+static void
+capture_batch(struct intel_batchbuffer *batch, unsigned int used,
+	      uint32_t ring)
+{
+	struct capture_batch *c;
+
+	if (!batch->capture)
+		return;
+
+	c = malloc(sizeof(*c));
+	assert(c);
+	c->next = NULL;
+	c->header.magic = INTEL_BATCH_TRACE_MAGIC;
+	c->header.devid = batch->devid;
+	c->header.ring = ring;
+	c->header.pid = getpid();
+	c->header.num_relocs = batch->num_relocs;
+	c->header.size = used;
+	c->header.state_offset = batch->state - batch->buffer;
+	c->header.state_size = batch->size - c->header.state_offset;
+	c->relocs = batch->relocs;
+	c->data = batch->buffer;
+
+	batch->relocs = NULL;
+	batch->num_relocs = batch->max_relocs = 0;
+	batch->buffer = malloc(batch->size);
+	assert(batch->buffer);
+
+	if (c->header.pid != capture.pid) {
+		capture_write(c);
+		return;
+	}
+
+	pthread_mutex_lock(&capture.mutex);
+	*capture.last = c;
+	capture.last = &c->next;
+	pthread_cond_signal(&capture.cond);
+	pthread_mutex_unlock(&capture.mutex);
+}
+
+#define BATCH_POOL_DEFAULT 4
+
+/*
+ * Takes the oldest bo from the pool if the GPU is done with it, else
+ * allocates a new one.  Later bos were executed after it, so there is no
+ * point in looking further.
+ */
+static drm_intel_bo *
+pool_get(struct intel_batchbuffer *batch)
+{
+	drm_intel_bo *bo;
+
+	if (batch->pool_count && !drm_intel_bo_busy(batch->pool[batch->pool_first])) {
+		bo = batch->pool[batch->pool_first];
+		batch->pool_first = (batch->pool_first + 1) % batch->pool_size;
+		batch->pool_count--;
+		batch->pool_hits++;
+		return bo;
+	}
+
+	batch->pool_misses++;
+	return drm_intel_bo_alloc(batch->bufmgr, "batchbuffer",
+				  batch->size, 4096);
+}
+
+/*
+ * Keeps a bo for reuse, dropping the oldest one when the pool is full.
+ * Its relocations go now, so that the buffers it pointed at aren't kept
+ * alive by the pool.
+ */
+static void
+pool_put(struct intel_batchbuffer *batch, drm_intel_bo *bo)
+{
+	if (batch->pool_size == 0) {
+		drm_intel_bo_unreference(bo);
+		return;
+	}
+
+	if (batch->pool_count == batch->pool_size) {
+		drm_intel_bo_unreference(batch->pool[batch->pool_first]);
+		batch->pool_first = (batch->pool_first + 1) % batch->pool_size;
+		batch->pool_count--;
+	}
+
+	drm_intel_gem_bo_clear_relocs(bo, 0);
+	batch->pool[(batch->pool_first + batch->pool_count) % batch->pool_size] = bo;
+	batch->pool_count++;
+}
+
+static void
+pool_drain(struct intel_batchbuffer *batch)
+{
+	while (batch->pool_count) {
+		drm_intel_bo_unreference(batch->pool[batch->pool_first]);
+		batch->pool_first = (batch->pool_first + 1) % batch->pool_size;
+		batch->pool_count--;
+	}
+	batch->pool_first = 0;
+}
+
 void
 intel_batchbuffer_reset(struct intel_batchbuffer *batch)
 {
-	if (batch->bo != NULL) {
+	/* The rest of a chain is only referenced by the relocations. */
+	if (batch->head != NULL) {
 		drm_intel_bo_unreference(batch->bo);
+		batch->bo = batch->head;
+		batch->head = NULL;
+	}
+
+	if (batch->bo != NULL) {
+		pool_put(batch, batch->bo);
 		batch->bo = NULL;
 	}
 
-	batch->bo = drm_intel_bo_alloc(batch->bufmgr, "batchbuffer",
-				       BATCH_SZ, 4096);
+	batch->bo = pool_get(batch);
 
 	batch->ptr = batch->buffer;
+	batch->state = batch->buffer + batch->size;
+	batch->num_relocs = 0;
+	batch->num_states = 0;
+	batch->pipeline = NULL;
 }
 
 struct intel_batchbuffer *
 intel_batchbuffer_alloc(drm_intel_bufmgr *bufmgr, uint32_t devid)
+{
+	return intel_batchbuffer_alloc_size(bufmgr, devid, BATCH_SZ, 0);
+}
+
+/*
+ * A batch of size bytes per bo.  When it fills up, a chaining batch jumps
+ * to a new bo and carries on there instead of flushing, so that long
+ * command streams go to the kernel in one execbuf.
+ */
+struct intel_batchbuffer *
+intel_batchbuffer_alloc_size(drm_intel_bufmgr *bufmgr, uint32_t devid,
+			     unsigned int size, int chain)
 {
 	struct intel_batchbuffer *batch = calloc(sizeof(*batch), 1);
+	char *pool;
+
+	assert((size & 3) == 0 && size > BATCH_RESERVED);
 
 	batch->bufmgr = bufmgr;
 	batch->devid = devid;
+	batch->size = size;
+	batch->chain = chain;
+
+	batch->pool_size = BATCH_POOL_DEFAULT;
+	pool = getenv("INTEL_BATCH_POOL");
+	if (pool) {
+		batch->pool_size = atoi(pool);
+		if (batch->pool_size > BATCH_POOL_MAX)
+			batch->pool_size = BATCH_POOL_MAX;
+	}
+
+	pthread_once(&capture.once, capture_init);
+	batch->capture = capture.fd >= 0;
+
+	batch->buffer = malloc(size);
+	assert(batch->buffer);
 	intel_batchbuffer_reset(batch);
 
 	return batch;
@@ -68,11 +366,97 @@ intel_batchbuffer_alloc(drm_intel_bufmgr *bufmgr, uint32_t devid)
 void
 intel_batchbuffer_free(struct intel_batchbuffer *batch)
 {
+	if (batch->head != NULL)
+		drm_intel_bo_unreference(batch->head);
 	drm_intel_bo_unreference(batch->bo);
 	batch->bo = NULL;
+	pool_drain(batch);
+	free(batch->relocs);
+	free(batch->buffer);
 	free(batch);
 }
 
+/*
+ * Sets how many executed bos are kept for reuse, 0 to allocate a new bo
+ * for every batch.  The default is 4, or $INTEL_BATCH_POOL.
+ */
+void
+intel_batchbuffer_set_pool(struct intel_batchbuffer *batch, unsigned int size)
+{
+	assert(size <= BATCH_POOL_MAX);
+
+	pool_drain(batch);
+	batch->pool_size = size;
+}
+
+/* Copies the commands and state to the bo, returns the commands' length */
+static unsigned int
+upload(struct intel_batchbuffer *batch)
+{
+	unsigned int used = batch->ptr - batch->buffer;
+	unsigned int state = batch->state - batch->buffer;
+
+	do_or_die(drm_intel_bo_subdata(batch->bo, 0, used, batch->buffer));
+	if (state < batch->size)
+		do_or_die(drm_intel_bo_subdata(batch->bo, state,
+					       batch->size - state,
+					       batch->state));
+
+	return used;
+}
+
+/*
+ * Ends the current bo with a jump to a new one and continues there.  Each
+ * bo holds a reference to the next through the jump's relocation, so only
+ * the first is kept, and it is what gets executed at the next flush.
+ * Jumping between batches needs gen4+, older chips just flush.
+ */
+void
+intel_batchbuffer_chain(struct intel_batchbuffer *batch)
+{
+	uint32_t cmd = MI_BATCH_BUFFER_START | MI_BATCH_NON_SECURE_I965;
+	unsigned int used;
+	drm_intel_bo *next;
+	int ret;
+
+	if (!IS_965(batch->devid)) {
+		intel_batchbuffer_flush(batch);
+		return;
+	}
+
+	next = pool_get(batch);
+	assert(next);
+
+	if (IS_HASWELL(batch->devid))
+		cmd |= MI_BATCH_NON_SECURE_HSW;
+
+	/* The jump fits in the space reserved for ending the batch. */
+	*(uint32_t *)(batch->ptr) = cmd;
+	batch->ptr += 4;
+	ret = drm_intel_bo_emit_reloc(batch->bo, batch->ptr - batch->buffer,
+				      next, 0, I915_GEM_DOMAIN_COMMAND, 0);
+	assert(ret == 0);
+	if (batch->capture)
+		capture_reloc(batch, batch->ptr - batch->buffer,
+			      next, 0, I915_GEM_DOMAIN_COMMAND, 0);
+	*(uint32_t *)(batch->ptr) = next->offset;
+	batch->ptr += 4;
+
+	used = upload(batch);
+	capture_batch(batch, used, INTEL_BATCH_TRACE_CHAINED);
+	if (batch->head == NULL) {
+		batch->head = batch->bo;
+		batch->head_used = used;
+	} else
+		drm_intel_bo_unreference(batch->bo);
+
+	batch->bo = next;
+	batch->ptr = batch->buffer;
+	batch->state = batch->buffer + batch->size;
+	batch->num_states = 0;
+	batch->pipeline = NULL;
+}
+
 #define CMD_POLY_STIPPLE_OFFSET       0x7906
 
 static unsigned int
@@ -80,7 +464,7 @@ flush_on_ring_common(struct intel_batchbuffer *batch, int ring)
 {
 	unsigned int used = batch->ptr - batch->buffer;
 
-	if (used == 0)
+	if (used == 0 && batch->head == NULL)
 		return 0;
 
 	if (IS_GEN5(batch->devid)) {
@@ -100,22 +484,29 @@ flush_on_ring_common(struct intel_batchbuffer *batch, int ring)
 	/* Mark the end of the buffer. */
 	*(uint32_t *)(batch->ptr) = MI_BATCH_BUFFER_END; /* noop */
 	batch->ptr += 4;
-	return batch->ptr - batch->buffer;
+
+	used = upload(batch);
+	capture_batch(batch, used, ring);
+	return used;
 }
 
 void
 intel_batchbuffer_flush_on_ring(struct intel_batchbuffer *batch, int ring)
 {
 	unsigned int used = flush_on_ring_common(batch, ring);
+	drm_intel_bo *bo = batch->bo;
 
 	if (used == 0)
 		return;
 
-	do_or_die(drm_intel_bo_subdata(batch->bo, 0, used, batch->buffer));
-
 	batch->ptr = NULL;
 
-	do_or_die(drm_intel_bo_mrb_exec(batch->bo, used, NULL, 0, 0, ring));
+	if (batch->head != NULL) {
+		bo = batch->head;
+		used = batch->head_used;
+	}
+
+	do_or_die(drm_intel_bo_mrb_exec(bo, used, NULL, 0, 0, ring));
 
 	intel_batchbuffer_reset(batch);
 }
@@ -126,16 +517,19 @@ intel_batchbuffer_flush_with_context(struct intel_batchbuffer *batch,
 {
 	int ret;
 	unsigned int used = flush_on_ring_common(batch, I915_EXEC_RENDER);
+	drm_intel_bo *bo = batch->bo;
 
 	if (used == 0)
 		return;
 
-	ret = drm_intel_bo_subdata(batch->bo, 0, used, batch->buffer);
-	assert(ret == 0);
-
 	batch->ptr = NULL;
 
-	ret = drm_intel_gem_bo_context_exec(batch->bo, context, used,
+	if (batch->head != NULL) {
+		bo = batch->head;
+		used = batch->head_used;
+	}
+
+	ret = drm_intel_gem_bo_context_exec(bo, context, used,
 					    I915_EXEC_RENDER);
 	assert(ret == 0);
 
@@ -162,11 +556,15 @@ intel_batchbuffer_emit_reloc(struct intel_batchbuffer *batch,
 {
 	int ret;
 
-	if (batch->ptr - batch->buffer > BATCH_SZ)
+	if (batch->ptr - batch->buffer > batch->size)
 		printf("bad relocation ptr %p map %p offset %d size %d\n",
 		       batch->ptr, batch->buffer,
 		       (int)(batch->ptr - batch->buffer),
-		       BATCH_SZ);
+		       batch->size);
+
+	if (batch->capture)
+		capture_reloc(batch, batch->ptr - batch->buffer, buffer, delta,
+			      read_domains, write_domain);
 
 	if (fenced)
 		ret = drm_intel_bo_emit_reloc_fence(batch->bo, batch->ptr - batch->buffer,
@@ -180,6 +578,164 @@ intel_batchbuffer_emit_reloc(struct intel_batchbuffer *batch,
 	assert(ret == 0);
 }
 
+/*
+ * Allocates indirect state downwards from the end of the bo, where it can
+ * be addressed relative to batch->bo.  Offsets are from batch->buffer.
+ * State can't move to another bo once commands point at it, so there has
+ * to be room left: callers flush beforehand.
+ */
+void *
+intel_batchbuffer_state_alloc(struct intel_batchbuffer *batch,
+			      unsigned int size, unsigned int align)
+{
+	unsigned int offset = batch->state - batch->buffer;
+
+	assert(size <= offset);
+	offset = (offset - size) & ~(align - 1);
+	assert(offset >= (unsigned int)(batch->ptr - batch->buffer) +
+	       BATCH_RESERVED);
+
+	batch->state = batch->buffer + offset;
+	return batch->state;
+}
+
+/* FNV-1a */
+static uint32_t
+state_hash(uint32_t hash, const void *data, unsigned int size)
+{
+	const uint8_t *p = data;
+
+	while (size--)
+		hash = (hash ^ *p++) * 16777619;
+
+	return hash;
+}
+
+static struct intel_batch_state *
+state_find(struct intel_batchbuffer *batch, const struct intel_batch_state *key,
+	   const void *data)
+{
+	unsigned int i;
+
+	for (i = 0; i < batch->num_states; i++) {
+		struct intel_batch_state *st = &batch->states[i];
+		const uint8_t *state = batch->buffer + st->offset;
+
+		if (st->hash != key->hash || st->size != key->size ||
+		    st->target != key->target)
+			continue;
+
+		if (key->target == NULL) {
+			if (memcmp(state, data, key->size) == 0)
+				return st;
+			continue;
+		}
+
+		/* the address is up to the relocation */
+		if (st->reloc == key->reloc && st->delta == key->delta &&
+		    st->domains == key->domains &&
+		    memcmp(state, data, key->reloc) == 0 &&
+		    memcmp(state + key->reloc + 4,
+			   (const uint8_t *)data + key->reloc + 4,
+			   key->size - key->reloc - 4) == 0)
+			return st;
+	}
+
+	return NULL;
+}
+
+static uint32_t
+state_insert(struct intel_batchbuffer *batch, struct intel_batch_state *key,
+	     const void *data, unsigned int align)
+{
+	void *state = intel_batchbuffer_state_alloc(batch, key->size, align);
+
+	memcpy(state, data, key->size);
+	key->offset = batch->state - batch->buffer;
+	if (batch->num_states < BATCH_STATE_CACHE)
+		batch->states[batch->num_states++] = *key;
+	batch->state_misses++;
+
+	return key->offset;
+}
+
+/*
+ * Copies indirect state into the batch, like intel_batchbuffer_state_alloc()
+ * plus a memcpy, unless the same state is already in the bo, and returns
+ * its offset from batch->buffer.  Each bo can only keep so many, and they
+ * are forgotten when it is flushed or chained.
+ */
+uint32_t
+intel_batchbuffer_state_copy(struct intel_batchbuffer *batch,
+			     const void *data, unsigned int size,
+			     unsigned int align)
+{
+	struct intel_batch_state key, *st;
+
+	memset(&key, 0, sizeof(key));
+	key.hash = state_hash(2166136261u, data, size);
+	key.size = size;
+
+	st = state_find(batch, &key, data);
+	if (st && (st->offset & (align - 1)) == 0) {
+		batch->state_hits++;
+		return st->offset;
+	}
+
+	return state_insert(batch, &key, data, align);
+}
+
+/*
+ * Same for state with the address of target + delta at offset reloc, such
+ * as a surface state: the address is filled in and relocated when the
+ * state is copied, and states are only shared with the same relocation.
+ */
+uint32_t
+intel_batchbuffer_state_reloc(struct intel_batchbuffer *batch,
+			      const void *data, unsigned int size,
+			      unsigned int align, uint32_t reloc,
+			      drm_intel_bo *target, uint32_t delta,
+			      uint32_t read_domains, uint32_t write_domain)
+{
+	struct intel_batch_state key, *st;
+	uint32_t offset;
+	int ret;
+
+	assert((reloc & 3) == 0 && reloc + 4 <= size);
+
+	memset(&key, 0, sizeof(key));
+	key.size = size;
+	key.target = target;
+	key.reloc = reloc;
+	key.delta = delta;
+	key.domains = read_domains << 16 | write_domain;
+	key.hash = state_hash(2166136261u, data, reloc);
+	key.hash = state_hash(key.hash, (const uint8_t *)data + reloc + 4,
+			      size - reloc - 4);
+	key.hash = state_hash(key.hash, &key.target,
+			      sizeof(key) - offsetof(struct intel_batch_state,
+						     target));
+
+	st = state_find(batch, &key, data);
+	if (st && (st->offset & (align - 1)) == 0) {
+		batch->state_hits++;
+		return st->offset;
+	}
+
+	offset = state_insert(batch, &key, data, align);
+	*(uint32_t *)(batch->buffer + offset + reloc) = target->offset + delta;
+
+	if (batch->capture)
+		capture_reloc(batch, offset + reloc, target, delta,
+			      read_domains, write_domain);
+	ret = drm_intel_bo_emit_reloc(batch->bo, offset + reloc,
+				      target, delta,
+				      read_domains, write_domain);
+	assert(ret == 0);
+
+	return offset;
+}
+
 void
 intel_batchbuffer_data(struct intel_batchbuffer *batch,
                        const void *data, unsigned int bytes)
@@ -6,6 +6,50 @@
 
 #define BATCH_SZ 4096
 #define BATCH_RESERVED 16
+#define BATCH_POOL_MAX 16
+#define BATCH_STATE_CACHE 32
+
+/*
+ * With $INTEL_BATCH_CAPTURE set to a file name, every batch submitted
+ * through intel_batchbuffer_flush*() is appended to that file: a header,
+ * the relocations, the commands and then the indirect state from the end
+ * of the bo.  intel_dump_decode reads it.
+ */
+#define INTEL_BATCH_TRACE_MAGIC 0x42544749	/* "IGTB" */
+#define INTEL_BATCH_TRACE_CHAINED 0xffffffff	/* ring of a chained bo */
+
+struct intel_batch_trace {
+	uint32_t magic;
+	uint32_t devid;
+	uint32_t ring;		/* execbuf flags, or continues in the next */
+	uint32_t pid;
+	uint32_t num_relocs;
+	uint32_t size;		/* of the commands, in bytes */
+	uint32_t state_offset;	/* where the state starts in the bo */
+	uint32_t state_size;
+};
+
+struct intel_batch_trace_reloc {
+	uint32_t offset;	/* in the batch */
+	uint32_t handle;	/* of the target */
+	uint32_t delta;
+	uint32_t presumed_offset;
+	uint32_t read_domains;
+	uint32_t write_domain;
+};
+
+/* Indirect state in the current bo, see intel_batchbuffer_state_copy() */
+struct intel_batch_state {
+	uint32_t hash;
+	uint32_t offset;	/* from buffer */
+	uint32_t size;
+
+	/* the relocation in it, if target isn't NULL */
+	drm_intel_bo *target;
+	uint32_t reloc;		/* offset in the state */
+	uint32_t delta;
+	uint32_t domains;	/* read << 16 | write */
+};
 
 struct intel_batchbuffer {
 	drm_intel_bufmgr *bufmgr;
@@ -13,16 +57,54 @@ struct intel_batchbuffer {
 
 	drm_intel_bo *bo;
 
-	uint8_t buffer[BATCH_SZ];
+	/* Commands grow up from buffer, state down from buffer + size. */
+	uint8_t *buffer;
+	unsigned int size;
 	uint8_t *ptr;
 	uint8_t *state;
+
+	/* When chaining, the first bo of the batch and its length. */
+	int chain;
+	drm_intel_bo *head;
+	unsigned int head_used;
+
+	/*
+	 * Executed bos, oldest first, reused as soon as they are idle.  With
+	 * a pool_size of 0 every batch gets a newly allocated bo.
+	 */
+	drm_intel_bo *pool[BATCH_POOL_MAX];
+	unsigned int pool_size;
+	unsigned int pool_first, pool_count;
+	unsigned long pool_hits, pool_misses;
+
+	/* Relocations of the current bo, kept when capturing */
+	int capture;
+	struct intel_batch_trace_reloc *relocs;
+	unsigned int num_relocs, max_relocs;
+
+	/*
+	 * State copied into the current bo, and the 3D pipeline its commands
+	 * set up (NULL for none), so that consecutive render operations only
+	 * add what changed.  Both start over with each bo.
+	 */
+	struct intel_batch_state states[BATCH_STATE_CACHE];
+	unsigned int num_states;
+	const void *pipeline;
+	unsigned long state_hits, state_misses;
 };
 
 struct intel_batchbuffer *intel_batchbuffer_alloc(drm_intel_bufmgr *bufmgr,
 						  uint32_t devid);
+struct intel_batchbuffer *intel_batchbuffer_alloc_size(drm_intel_bufmgr *bufmgr,
+						       uint32_t devid,
+						       unsigned int size,
+						       int chain);
 
 void intel_batchbuffer_free(struct intel_batchbuffer *batch);
 
+void intel_batchbuffer_set_pool(struct intel_batchbuffer *batch,
+				unsigned int size);
+
 
 void intel_batchbuffer_flush(struct intel_batchbuffer *batch);
 void intel_batchbuffer_flush_on_ring(struct intel_batchbuffer *batch, int ring);
@@ -30,6 +112,7 @@ void intel_batchbuffer_flush_with_context(struct intel_batchbuffer *batch,
 					  drm_intel_context *context);
 
 void intel_batchbuffer_reset(struct intel_batchbuffer *batch);
+void intel_batchbuffer_chain(struct intel_batchbuffer *batch);
 
 void intel_batchbuffer_data(struct intel_batchbuffer *batch,
                             const void *data, unsigned int bytes);
@@ -41,6 +124,18 @@ void intel_batchbuffer_emit_reloc(struct intel_batchbuffer *batch,
 				  uint32_t write_domain,
 				  int fenced);
 
+void *intel_batchbuffer_state_alloc(struct intel_batchbuffer *batch,
+				    unsigned int size, unsigned int align);
+uint32_t intel_batchbuffer_state_copy(struct intel_batchbuffer *batch,
+				      const void *data, unsigned int size,
+				      unsigned int align);
+uint32_t intel_batchbuffer_state_reloc(struct intel_batchbuffer *batch,
+				       const void *data, unsigned int size,
+				       unsigned int align, uint32_t reloc,
+				       drm_intel_bo *target, uint32_t delta,
+				       uint32_t read_domains,
+				       uint32_t write_domain);
+
 /* Inline functions - might actually be better off with these
  * non-inlined.  Certainly better off switching all command packets to
  * be passed as structs rather than dwords, but that's a little bit of
@@ -50,7 +145,7 @@ void intel_batchbuffer_emit_reloc(struct intel_batchbuffer *batch,
 static inline int
 intel_batchbuffer_space(struct intel_batchbuffer *batch)
 {
-	return (BATCH_SZ - BATCH_RESERVED) - (batch->ptr - batch->buffer);
+	return (batch->state - batch->ptr) - BATCH_RESERVED;
 }
 
 
@@ -66,9 +161,13 @@ static inline void
 intel_batchbuffer_require_space(struct intel_batchbuffer *batch,
                                 unsigned int sz)
 {
-	assert(sz < BATCH_SZ - BATCH_RESERVED);
-	if (intel_batchbuffer_space(batch) < sz)
-		intel_batchbuffer_flush(batch);
+	assert(sz < batch->size - BATCH_RESERVED);
+	if (intel_batchbuffer_space(batch) < sz) {
+		if (batch->chain)
+			intel_batchbuffer_chain(batch);
+		else
+			intel_batchbuffer_flush(batch);
+	}
 }
 
 /* Here are the crusty old macros, to be removed:
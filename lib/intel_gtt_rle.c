@@ -0,0 +1,82 @@
+/*
+ * Copyright © 2013 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdint.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "intel_gtt_rle.h"
+
+/* Unsigned wraparound is intended, it matches how the PTEs were compared
+ * when they were printed one at a time.
+ */
+uint32_t
+gtt_match_stride(const uint32_t *pte, uint32_t count,
+		 uint32_t start, uint32_t i, uint32_t stride)
+{
+	uint32_t first = pte[start];
+
+#ifdef __SSE2__
+	if (i + 8 <= count) {
+		const __m128i step = _mm_set1_epi32(4 * stride);
+		__m128i expect;
+
+		expect = _mm_add_epi32(_mm_set1_epi32(first + (i - start) * stride),
+				       _mm_setr_epi32(0, stride,
+						      2 * stride, 3 * stride));
+
+		/* Compare blocks of 8 PTEs against the expected sequence
+		 * and stop at the first block containing a mismatch.
+		 */
+		do {
+			__m128i lo, hi, expect_hi;
+			uint32_t mask;
+
+			lo = _mm_loadu_si128((const __m128i *)(pte + i));
+			hi = _mm_loadu_si128((const __m128i *)(pte + i + 4));
+			expect_hi = _mm_add_epi32(expect, step);
+
+			mask = _mm_movemask_epi8(_mm_cmpeq_epi32(lo, expect)) |
+				_mm_movemask_epi8(_mm_cmpeq_epi32(hi, expect_hi)) << 16;
+			if (mask != 0xffffffff)
+				return i + __builtin_ctz(~mask) / 4;
+
+			expect = _mm_add_epi32(expect_hi, step);
+			i += 8;
+		} while (i + 8 <= count);
+	}
+#endif
+
+	for (; i < count; i++)
+		if (pte[i] != first + (i - start) * stride)
+			break;
+
+	return i;
+}
@@ -0,0 +1,95 @@
+/*
+ * Copyright © 2013 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef INTEL_GTT_RLE_H
+#define INTEL_GTT_RLE_H
+
+#include <stdint.h>
+
+#define GTT_PAGE_SIZE		4096
+
+enum gtt_run_type {
+	GTT_RUN_SINGLE,		/* one PTE matching neither of its neighbours */
+	GTT_RUN_LINEAR,		/* each PTE maps the page after the previous */
+	GTT_RUN_CONSTANT,	/* every PTE has the same value */
+};
+
+struct gtt_run {
+	enum gtt_run_type type;
+	uint32_t start;		/* index of the first PTE */
+	uint32_t length;	/* number of PTEs */
+	uint32_t pte;		/* value of the first PTE */
+};
+
+/*
+ * Return the index of the first PTE at or after i that does not continue
+ * the sequence pte[start] + n * stride, comparing blocks of 8 PTEs at a
+ * time where SIMD is available.
+ */
+uint32_t gtt_match_stride(const uint32_t *pte, uint32_t count,
+			  uint32_t start, uint32_t i, uint32_t stride);
+
+/*
+ * Decode the run beginning at pte[start].  A run is linear if the next PTE
+ * maps the following page, constant if it repeats the value, and a single
+ * PTE otherwise; linear and constant runs are extended as far as possible.
+ * Iterating with start += run->length visits every PTE exactly once.
+ *
+ * Most runs in a fragmented GTT are only a few entries long, so those are
+ * checked inline and only longer runs go through gtt_match_stride().
+ */
+static inline void
+gtt_next_run(const uint32_t *pte, uint32_t count, uint32_t start,
+	     struct gtt_run *run)
+{
+	uint32_t stride, i, head;
+
+	run->start = start;
+	run->pte = pte[start];
+	run->type = GTT_RUN_SINGLE;
+	run->length = 1;
+
+	if (start + 1 >= count)
+		return;
+
+	if (pte[start + 1] == pte[start] + GTT_PAGE_SIZE) {
+		run->type = GTT_RUN_LINEAR;
+		stride = GTT_PAGE_SIZE;
+	} else if (pte[start + 1] == pte[start]) {
+		run->type = GTT_RUN_CONSTANT;
+		stride = 0;
+	} else
+		return;
+
+	head = start + 8 < count ? start + 8 : count;
+	for (i = start + 2; i < head; i++)
+		if (pte[i] != pte[start] + (i - start) * stride)
+			break;
+	if (i == head && i < count)
+		i = gtt_match_stride(pte, count, start, i, stride);
+
+	run->length = i - start;
+}
+
+#endif /* INTEL_GTT_RLE_H */
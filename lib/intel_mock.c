@@ -0,0 +1,1624 @@
+/*
+ * Copyright © 2013 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+/** @file intel_mock.c
+ *
+ * A stand-in for the i915 GEM kernel interface, to run tests and benchmarks
+ * on machines without an Intel GPU:
+ *
+ *	LD_PRELOAD=lib/.libs/intel_mock.so tests/gem_linear_blits
+ *
+ * Opening /dev/dri/card0 gives a file whose ioctls and mmaps are answered
+ * here, so drmtest and libdrm_intel run unchanged on top.  Objects live in
+ * anonymous memory, and CPU and GTT maps both return it.  Tiling is
+ * recorded but memory stays linear, which is consistent for everything
+ * but reading tiled objects through a CPU map.
+ *
+ * Batches run on the CPU when they are submitted: the blitter's
+ * XY_SRC_COPY_BLT and XY_COLOR_BLT, MI_STORE_DWORD_IMM and
+ * MI_BATCH_BUFFER_START are carried out, and so are the RECTLISTs of
+ * rendercopy on gen2, gen3, gen6 and gen7, as copies of the texture to the
+ * color buffer.  Other commands are skipped over.
+ * The objects of a batch then stay busy for as long as the GPU would take,
+ * modelled from the bytes it moved, so that busy queries behave.  Waiting
+ * doesn't sleep, it moves the mock's clock forward.
+ *
+ * $INTEL_MOCK_DEVID chooses the chipset, Ivybridge by default, and
+ * $INTEL_MOCK_APERTURE the aperture size in MiB.
+ */
+
+#define _GNU_SOURCE
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#include "drm.h"
+#include "i915_drm.h"
+#include "intel_chipset.h"
+#include "intel_reg.h"
+
+#define MOCK_DEVICE		"/dev/dri/card0"
+#define MOCK_DEFAULT_DEVID	0x0162
+#define MOCK_GTT_START		0x10000
+
+/* Cost model of the GPU, for how long objects stay busy */
+#define MOCK_BATCH_NS		5000
+#define MOCK_BYTES_PER_NS	4
+
+#define LOCAL_I915_EXEC_HANDLE_LUT	(1 << 12)
+
+/* The domains relocations may name, the CPU and GTT aren't among them */
+#define MOCK_GPU_DOMAINS \
+	(I915_GEM_DOMAIN_RENDER | \
+	 I915_GEM_DOMAIN_SAMPLER | \
+	 I915_GEM_DOMAIN_COMMAND | \
+	 I915_GEM_DOMAIN_INSTRUCTION | \
+	 I915_GEM_DOMAIN_VERTEX)
+
+struct local_drm_i915_gem_cacheing {
+	uint32_t handle;
+	uint32_t cacheing;
+};
+
+#define LOCAL_DRM_IOCTL_I915_GEM_SET_CACHEING \
+	DRM_IOW(DRM_COMMAND_BASE + 0x2f, struct local_drm_i915_gem_cacheing)
+#define LOCAL_DRM_IOCTL_I915_GEM_GET_CACHEING \
+	DRM_IOWR(DRM_COMMAND_BASE + 0x30, struct local_drm_i915_gem_cacheing)
+
+struct mock_bo {
+	struct mock_bo *prev, *next;
+	uint8_t *data;
+	uint64_t size;
+
+	unsigned int handles;		/* in all files */
+	unsigned int maps;		/* not yet unmapped */
+	uint32_t name;
+
+	uint32_t tiling, stride;
+	uint32_t cacheing;
+
+	uint64_t offset;		/* in the GTT, while bound */
+	unsigned int bound;		/* GTT generation it has an offset in */
+	uint32_t write_domain;		/* of the batch being relocated */
+	uint64_t busy_until;		/* mock time, in ns */
+};
+
+struct mock_file {
+	struct mock_file *next;
+	int fd;
+
+	struct mock_bo **handle;	/* by handle, 0 is never used */
+	unsigned int num_handles;
+
+	bool *context;			/* by id, 0 is the default */
+	unsigned int num_contexts;
+};
+
+static struct {
+	pthread_once_t once;
+	pthread_mutex_t mutex;
+
+	int (*open)(const char *path, int flags, ...);
+	int (*close)(int fd);
+	int (*ioctl)(int fd, unsigned long request, ...);
+	void *(*mmap)(void *addr, size_t length, int prot, int flags,
+		      int fd, off_t offset);
+	int (*munmap)(void *addr, size_t length);
+
+	uint32_t devid;
+	uint64_t aperture;
+
+	struct mock_file *files;
+	struct mock_bo *bos;
+	struct mock_bo **names;		/* by flink name */
+	unsigned int num_names;
+
+	uint64_t gtt_next;
+	unsigned int gtt_generation;
+
+	int64_t clock_offset;		/* time spent waiting */
+	uint64_t gpu_idle;		/* when the last batch completes */
+
+	uint32_t skipped[4];		/* unknown opcodes already reported */
+} mock = {
+	PTHREAD_ONCE_INIT, PTHREAD_MUTEX_INITIALIZER,
+};
+
+static void
+mock_init(void)
+{
+	const char *env;
+
+	mock.open = dlsym(RTLD_NEXT, "open");
+	mock.close = dlsym(RTLD_NEXT, "close");
+	mock.ioctl = dlsym(RTLD_NEXT, "ioctl");
+	mock.mmap = dlsym(RTLD_NEXT, "mmap");
+	mock.munmap = dlsym(RTLD_NEXT, "munmap");
+
+	mock.devid = MOCK_DEFAULT_DEVID;
+	env = getenv("INTEL_MOCK_DEVID");
+	if (env)
+		mock.devid = strtoul(env, NULL, 0);
+
+	mock.aperture = 256ull << 20;
+	env = getenv("INTEL_MOCK_APERTURE");
+	if (env)
+		mock.aperture = strtoull(env, NULL, 0) << 20;
+
+	mock.gtt_next = MOCK_GTT_START;
+}
+
+static uint64_t
+mock_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec + mock.clock_offset;
+}
+
+/* Waits for the GPU to be done with the object, by skipping ahead. */
+static void
+mock_wait(struct mock_bo *bo)
+{
+	uint64_t now = mock_now();
+
+	if (bo->busy_until > now)
+		mock.clock_offset += bo->busy_until - now;
+}
+
+static struct mock_file *
+mock_file(int fd)
+{
+	struct mock_file *file;
+
+	for (file = mock.files; file; file = file->next)
+		if (file->fd == fd)
+			return file;
+
+	return NULL;
+}
+
+static struct mock_bo *
+mock_lookup(struct mock_file *file, uint32_t handle)
+{
+	if (handle == 0 || handle >= file->num_handles)
+		return NULL;
+
+	return file->handle[handle];
+}
+
+static struct mock_bo *
+mock_bo_find(const void *addr)
+{
+	struct mock_bo *bo;
+
+	for (bo = mock.bos; bo; bo = bo->next)
+		if ((uint8_t *)addr >= bo->data &&
+		    (uint8_t *)addr < bo->data + bo->size)
+			return bo;
+
+	return NULL;
+}
+
+static void
+mock_bo_release(struct mock_bo *bo)
+{
+	if (bo->handles || bo->maps)
+		return;
+
+	if (bo->prev)
+		bo->prev->next = bo->next;
+	else
+		mock.bos = bo->next;
+	if (bo->next)
+		bo->next->prev = bo->prev;
+
+	mock.munmap(bo->data, bo->size);
+	free(bo);
+}
+
+static int
+mock_add_handle(struct mock_file *file, struct mock_bo *bo, uint32_t *handle)
+{
+	unsigned int i;
+
+	for (i = 1; i < file->num_handles; i++)
+		if (file->handle[i] == NULL)
+			break;
+
+	if (i >= file->num_handles) {
+		unsigned int n = file->num_handles ? 2 * file->num_handles : 64;
+		struct mock_bo **h = realloc(file->handle, n * sizeof(*h));
+
+		if (h == NULL)
+			return -ENOMEM;
+		memset(h + file->num_handles, 0,
+		       (n - file->num_handles) * sizeof(*h));
+		file->handle = h;
+		file->num_handles = n;
+	}
+
+	file->handle[i] = bo;
+	bo->handles++;
+	*handle = i;
+	return 0;
+}
+
+static void
+mock_close_handle(struct mock_file *file, uint32_t handle)
+{
+	struct mock_bo *bo = file->handle[handle];
+
+	file->handle[handle] = NULL;
+	if (--bo->handles == 0 && bo->name) {
+		/* names go with the last handle, as in the kernel */
+		mock.names[bo->name] = NULL;
+		bo->name = 0;
+	}
+	mock_bo_release(bo);
+}
+
+static int
+mock_getparam(struct drm_i915_getparam *gp)
+{
+	uint32_t devid = mock.devid;
+	int value;
+
+	switch (gp->param) {
+	case I915_PARAM_CHIPSET_ID:
+		value = devid;
+		break;
+	case I915_PARAM_HAS_GEM:
+	case I915_PARAM_HAS_EXECBUF2:
+	case I915_PARAM_HAS_RELAXED_FENCING:
+	case I915_PARAM_HAS_RELAXED_DELTA:
+		value = 1;
+		break;
+	case I915_PARAM_NUM_FENCES_AVAIL:
+		value = IS_965(devid) ? 14 : 6;
+		break;
+	case I915_PARAM_HAS_BSD:
+		value = IS_965(devid) && !IS_GEN4(devid);
+		break;
+	case I915_PARAM_HAS_BLT:
+	case I915_PARAM_HAS_LLC:
+		value = IS_GEN6(devid) || IS_GEN7(devid);
+		break;
+	case 18: /* HAS_ALIASING_PPGTT */
+		value = 0;
+		break;
+	case 19: /* HAS_WAIT_TIMEOUT */
+	case 26: /* HAS_EXEC_HANDLE_LUT */
+		value = 1;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	*gp->value = value;
+	return 0;
+}
+
+static int
+mock_create(struct mock_file *file, struct drm_i915_gem_create *create)
+{
+	struct mock_bo *bo;
+	uint64_t size = (create->size + 4095) & ~4095ull;
+	int ret;
+
+	if (size == 0)
+		return -EINVAL;
+
+	bo = calloc(1, sizeof(*bo));
+	if (bo == NULL)
+		return -ENOMEM;
+
+	bo->data = mock.mmap(NULL, size, PROT_READ | PROT_WRITE,
+			     MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (bo->data == MAP_FAILED) {
+		free(bo);
+		return -ENOMEM;
+	}
+	bo->size = size;
+
+	bo->next = mock.bos;
+	if (mock.bos)
+		mock.bos->prev = bo;
+	mock.bos = bo;
+
+	ret = mock_add_handle(file, bo, &create->handle);
+	if (ret)
+		mock_bo_release(bo);
+	else
+		create->size = size;
+
+	return ret;
+}
+
+static int
+mock_flink(struct mock_file *file, struct drm_gem_flink *flink)
+{
+	struct mock_bo *bo = mock_lookup(file, flink->handle);
+
+	if (bo == NULL)
+		return -ENOENT;
+
+	if (bo->name == 0) {
+		unsigned int i;
+
+		for (i = 1; i < mock.num_names; i++)
+			if (mock.names[i] == NULL)
+				break;
+
+		if (i >= mock.num_names) {
+			unsigned int n = mock.num_names ? 2 * mock.num_names : 64;
+			struct mock_bo **names = realloc(mock.names,
+							 n * sizeof(*names));
+
+			if (names == NULL)
+				return -ENOMEM;
+			memset(names + mock.num_names, 0,
+			       (n - mock.num_names) * sizeof(*names));
+			mock.names = names;
+			mock.num_names = n;
+		}
+
+		mock.names[i] = bo;
+		bo->name = i;
+	}
+
+	flink->name = bo->name;
+	return 0;
+}
+
+static int
+mock_open_name(struct mock_file *file, struct drm_gem_open *open)
+{
+	struct mock_bo *bo;
+	int ret;
+
+	if (open->name == 0 || open->name >= mock.num_names ||
+	    mock.names[open->name] == NULL)
+		return -ENOENT;
+
+	bo = mock.names[open->name];
+	ret = mock_add_handle(file, bo, &open->handle);
+	if (ret == 0)
+		open->size = bo->size;
+
+	return ret;
+}
+
+static int
+mock_rw(struct mock_file *file, uint32_t handle, uint64_t offset,
+	uint64_t size, uint64_t data, bool write)
+{
+	struct mock_bo *bo = mock_lookup(file, handle);
+
+	if (bo == NULL)
+		return -ENOENT;
+	if (offset > bo->size || size > bo->size - offset)
+		return -EINVAL;
+
+	mock_wait(bo);
+	if (write)
+		memcpy(bo->data + offset, (void *)(uintptr_t)data, size);
+	else
+		memcpy((void *)(uintptr_t)data, bo->data + offset, size);
+
+	return 0;
+}
+
+static int
+mock_set_tiling(struct mock_file *file, struct drm_i915_gem_set_tiling *st)
+{
+	struct mock_bo *bo = mock_lookup(file, st->handle);
+
+	if (bo == NULL)
+		return -ENOENT;
+	if (st->tiling_mode > I915_TILING_Y)
+		return -EINVAL;
+	if (st->tiling_mode != I915_TILING_NONE &&
+	    (st->stride == 0 || st->stride & 127))
+		return -EINVAL;
+
+	bo->tiling = st->tiling_mode;
+	bo->stride = st->tiling_mode == I915_TILING_NONE ? 0 : st->stride;
+	st->swizzle_mode = I915_BIT_6_SWIZZLE_NONE;
+
+	return 0;
+}
+
+static int
+mock_context_create(struct mock_file *file,
+		    struct drm_i915_gem_context_create *create)
+{
+	unsigned int i;
+
+	for (i = 1; i < file->num_contexts; i++)
+		if (!file->context[i])
+			break;
+
+	if (i >= file->num_contexts) {
+		unsigned int n = file->num_contexts ? 2 * file->num_contexts : 16;
+		bool *context = realloc(file->context, n * sizeof(*context));
+
+		if (context == NULL)
+			return -ENOMEM;
+		memset(context + file->num_contexts, 0,
+		       (n - file->num_contexts) * sizeof(*context));
+		file->context = context;
+		file->num_contexts = n;
+	}
+
+	file->context[i] = true;
+	create->ctx_id = i;
+	return 0;
+}
+
+static int
+mock_context_destroy(struct mock_file *file,
+		     struct drm_i915_gem_context_destroy *destroy)
+{
+	if (destroy->ctx_id == 0 || destroy->ctx_id >= file->num_contexts ||
+	    !file->context[destroy->ctx_id])
+		return -ENOENT;
+
+	file->context[destroy->ctx_id] = false;
+	return 0;
+}
+
+/* The objects of a batch being executed */
+struct mock_exec {
+	struct mock_bo **bo;
+	unsigned int count;
+	uint64_t moved;			/* bytes read and written */
+};
+
+/* CPU address of len bytes at a GTT address, inside one of the objects */
+static uint8_t *
+mock_gtt(struct mock_exec *exec, uint64_t address, uint64_t len)
+{
+	unsigned int i;
+
+	for (i = 0; i < exec->count; i++) {
+		struct mock_bo *bo = exec->bo[i];
+
+		if (address >= bo->offset &&
+		    address - bo->offset <= bo->size &&
+		    len <= bo->size - (address - bo->offset))
+			return bo->data + (address - bo->offset);
+	}
+
+	fprintf(stderr, "intel_mock: access to 0x%08llx+0x%llx outside the batch's objects\n",
+		(unsigned long long)address, (unsigned long long)len);
+	return NULL;
+}
+
+static void
+mock_skip(uint32_t cmd)
+{
+	unsigned int client = cmd >> 29;
+
+	/* just tell once for each kind of command */
+	if (client < 4 && mock.skipped[client] & (1u << ((cmd >> 23) & 31)))
+		return;
+	if (client < 4)
+		mock.skipped[client] |= 1u << ((cmd >> 23) & 31);
+
+	fprintf(stderr, "intel_mock: skipping unsupported command 0x%08x\n",
+		cmd);
+}
+
+/* One bit of pattern, source and destination each, as the ROP indexes */
+static uint32_t
+mock_rop(uint8_t rop, uint32_t p, uint32_t s, uint32_t d)
+{
+	uint32_t result = 0;
+	int i;
+
+	switch (rop) {
+	case 0xcc: return s;
+	case 0xf0: return p;
+	case 0x00: return 0;
+	case 0xff: return ~0;
+	}
+
+	for (i = 0; i < 8; i++)
+		if (rop & (1 << i))
+			result |= (i & 4 ? p : ~p) &
+				  (i & 2 ? s : ~s) &
+				  (i & 1 ? d : ~d);
+
+	return result;
+}
+
+static uint32_t
+mock_read_pixel(const uint8_t *p, int cpp)
+{
+	switch (cpp) {
+	case 1: return *p;
+	case 2: return *(const uint16_t *)p;
+	default: return *(const uint32_t *)p;
+	}
+}
+
+static void
+mock_write_pixel(uint8_t *p, int cpp, uint32_t value, uint32_t mask)
+{
+	switch (cpp) {
+	case 1: *p = value; break;
+	case 2: *(uint16_t *)p = value; break;
+	default: *(uint32_t *)p = (*(uint32_t *)p & ~mask) | (value & mask); break;
+	}
+}
+
+/*
+ * XY_SRC_COPY_BLT and XY_COLOR_BLT.  Pitches are in dwords for tiled
+ * surfaces from gen4 on; memory stays linear.
+ */
+static void
+mock_blt(struct mock_exec *exec, const uint32_t *cs, bool copy)
+{
+	static const int cpp_of_depth[4] = { 1, 2, 2, 4 };
+	int cpp = cpp_of_depth[(cs[1] >> 24) & 3];
+	uint8_t rop = (cs[1] >> 16) & 0xff;
+	int dst_pitch = (int16_t)cs[1];
+	int x1 = cs[2] & 0xffff, y1 = cs[2] >> 16;
+	int x2 = cs[3] & 0xffff, y2 = cs[3] >> 16;
+	int src_x = 0, src_y = 0, src_pitch = 0;
+	uint32_t mask = ~0u, color = 0;
+	uint8_t *dst, *src = NULL;
+	int x, y, width, height;
+
+	if (x2 <= x1 || y2 <= y1)
+		return;
+	width = x2 - x1;
+	height = y2 - y1;
+
+	if (IS_965(mock.devid) && cs[0] & XY_SRC_COPY_BLT_DST_TILED)
+		dst_pitch *= 4;
+	if (cpp == 4)
+		mask = (cs[0] & XY_SRC_COPY_BLT_WRITE_ALPHA ? 0xff000000 : 0) |
+		       (cs[0] & XY_SRC_COPY_BLT_WRITE_RGB ? 0x00ffffff : 0);
+
+	if (dst_pitch < 0)
+		return mock_skip(cs[0]);
+	dst = mock_gtt(exec, cs[4] + y1 * dst_pitch + x1 * cpp,
+		       (height - 1) * dst_pitch + width * cpp);
+	if (dst == NULL)
+		return;
+
+	if (copy) {
+		src_x = cs[5] & 0xffff;
+		src_y = cs[5] >> 16;
+		src_pitch = (int16_t)cs[6];
+		if (IS_965(mock.devid) && cs[0] & XY_SRC_COPY_BLT_SRC_TILED)
+			src_pitch *= 4;
+		if (src_pitch < 0)
+			return mock_skip(cs[0]);
+		src = mock_gtt(exec, cs[7] + src_y * src_pitch + src_x * cpp,
+			       (height - 1) * src_pitch + width * cpp);
+		if (src == NULL)
+			return;
+		exec->moved += (uint64_t)width * height * cpp;
+	} else
+		color = cs[5];
+	exec->moved += (uint64_t)width * height * cpp;
+
+	if (copy && rop == 0xcc && mask == ~0u) {
+		/* rows from the far end when they overlap downwards */
+		if (dst > src && dst < src + height * src_pitch) {
+			for (y = height; y--; )
+				memmove(dst + y * dst_pitch,
+					src + y * src_pitch, width * cpp);
+		} else {
+			for (y = 0; y < height; y++)
+				memmove(dst + y * dst_pitch,
+					src + y * src_pitch, width * cpp);
+		}
+		return;
+	}
+
+	for (y = 0; y < height; y++) {
+		for (x = 0; x < width; x++) {
+			uint8_t *d = dst + y * dst_pitch + x * cpp;
+			uint32_t s = src ? mock_read_pixel(src + y * src_pitch + x * cpp, cpp) : 0;
+
+			mock_write_pixel(d, cpp,
+					 mock_rop(rop, color, s,
+						  mock_read_pixel(d, cpp)),
+					 mask);
+		}
+	}
+}
+
+/*
+ * What the 3D pipeline draws with.  The only drawing carried out is
+ * rendercopy's: a RECTLIST copying sampler 0's texture to the color
+ * buffer, nearest sampled.  Both surfaces are taken to be 32bpp.
+ */
+struct mock_surface {
+	uint32_t address, pitch, width, height;
+};
+
+struct mock_render {
+	struct mock_surface target, texture;
+	bool normalized;		/* texture coordinates in 0..1 */
+
+	/* gen6+, where the surfaces come from the binding table and the
+	 * vertices from a vertex buffer */
+	uint32_t surface_base, binding_table;
+	uint32_t vb, vb_pitch;
+	uint32_t element[2];		/* VERTEX_ELEMENTS dword 0 of x,y and s,t */
+};
+
+/* The SURFACE_STATE at offset from the surface state base */
+static bool
+mock_surface_state(struct mock_exec *exec, struct mock_render *r,
+		   uint32_t offset, struct mock_surface *surface)
+{
+	const uint32_t *ss;
+
+	ss = (const uint32_t *)mock_gtt(exec, r->surface_base + offset, 16);
+	if (ss == NULL)
+		return false;
+
+	surface->address = ss[1];
+	if (IS_GEN7(mock.devid)) {
+		surface->width = (ss[2] & 0x3fff) + 1;
+		surface->height = ((ss[2] >> 16) & 0x3fff) + 1;
+		surface->pitch = (ss[3] & 0x3ffff) + 1;
+	} else {
+		surface->width = ((ss[2] >> 6) & 0x1fff) + 1;
+		surface->height = ((ss[2] >> 19) & 0x1fff) + 1;
+		surface->pitch = ((ss[3] >> 3) & 0x1ffff) + 1;
+	}
+	return true;
+}
+
+/* Nearest integer for the pixel centres and texels of a rectangle */
+static int
+mock_round(float f)
+{
+	return f <= 0 ? 0 : (int)(f + .5f);
+}
+
+/*
+ * One RECTLIST rectangle, from its vertices' x, y, s and t: v[0] is the
+ * bottom right corner and v[2] the top left.  Memory stays linear.
+ */
+static void
+mock_rect(struct mock_exec *exec, struct mock_render *r, float v[3][4])
+{
+	const struct mock_surface *dst = &r->target, *src = &r->texture;
+	float ds = (v[0][2] - v[2][2]) / (v[0][0] - v[2][0]);
+	float dt = (v[0][3] - v[2][3]) / (v[0][1] - v[2][1]);
+	int x1 = mock_round(v[2][0]), y1 = mock_round(v[2][1]);
+	int x2 = mock_round(v[0][0]), y2 = mock_round(v[0][1]);
+	float sw = r->normalized ? src->width : 1;
+	float sh = r->normalized ? src->height : 1;
+	uint8_t *d, *s;
+	int x, y;
+
+	if (x2 > (int)dst->width)
+		x2 = dst->width;
+	if (y2 > (int)dst->height)
+		y2 = dst->height;
+	if (x2 <= x1 || y2 <= y1 || dst->pitch == 0 || src->pitch == 0)
+		return;
+
+	d = mock_gtt(exec, dst->address + y1 * dst->pitch + x1 * 4,
+		     (y2 - y1 - 1) * dst->pitch + (x2 - x1) * 4);
+	s = mock_gtt(exec, src->address,
+		     (src->height - 1) * src->pitch + src->width * 4);
+	if (d == NULL || s == NULL)
+		return;
+	exec->moved += 2ull * (x2 - x1) * (y2 - y1) * 4;
+
+	for (y = y1; y < y2; y++) {
+		float t = (v[2][3] + (y + .5f - v[2][1]) * dt) * sh;
+		int ty = t < 0 ? -1 : (int)t;
+
+		for (x = x1; x < x2; x++) {
+			float u = (v[2][2] + (x + .5f - v[2][0]) * ds) * sw;
+			int tx = u < 0 ? -1 : (int)u;
+			uint8_t *pixel = d + (y - y1) * dst->pitch + (x - x1) * 4;
+			uint32_t texel = 0;
+
+			if (tx >= 0 && tx < (int)src->width &&
+			    ty >= 0 && ty < (int)src->height)
+				texel = mock_read_pixel(s + ty * src->pitch + tx * 4, 4);
+			mock_write_pixel(pixel, 4, texel, ~0u);
+		}
+	}
+}
+
+/* Two components of a vertex element, as floats */
+static bool
+mock_fetch(struct mock_exec *exec, uint32_t address, uint32_t element,
+	   float *out)
+{
+	const uint8_t *p = mock_gtt(exec, address + (element & 0x7ff), 8);
+
+	if (p == NULL)
+		return false;
+
+	switch ((element >> 16) & 0x1ff) {
+	case 0x0f6: /* R16G16_SSCALED */
+		out[0] = ((const int16_t *)p)[0];
+		out[1] = ((const int16_t *)p)[1];
+		return true;
+	case 0x085: /* R32G32_FLOAT */
+		memcpy(out, p, 8);
+		return true;
+	default:
+		return false;
+	}
+}
+
+/*
+ * 3DPRIMITIVE's RECTLIST from the vertex buffer, on gen6+.  False for
+ * vertex formats rendercopy doesn't use.
+ */
+static bool
+mock_primitive(struct mock_exec *exec, struct mock_render *r,
+	       uint32_t start, uint32_t count)
+{
+	const uint32_t *table;
+	uint32_t i, j;
+
+	table = (const uint32_t *)mock_gtt(exec,
+					   r->surface_base + r->binding_table, 8);
+	if (table == NULL ||
+	    !mock_surface_state(exec, r, table[0], &r->target) ||
+	    !mock_surface_state(exec, r, table[1], &r->texture))
+		return true;
+
+	/* rendercopy's kernels sample float coordinates and load
+	 * integer ones */
+	r->normalized = ((r->element[1] >> 16) & 0x1ff) == 0x085;
+
+	for (i = 0; i + 3 <= count; i += 3) {
+		float v[3][4];
+
+		for (j = 0; j < 3; j++) {
+			uint32_t address = r->vb + (start + i + j) * r->vb_pitch;
+
+			if (!mock_fetch(exec, address, r->element[0], &v[j][0]) ||
+			    !mock_fetch(exec, address, r->element[1], &v[j][2]))
+				return false;
+		}
+		mock_rect(exec, r, v);
+	}
+	return true;
+}
+
+/*
+ * The 3D state rendercopy sets up, and its RECTLISTs.  Returns false
+ * for commands it doesn't know, which are skipped over.
+ */
+static bool
+mock_3d(struct mock_exec *exec, struct mock_render *r,
+	const uint32_t *cs, unsigned int len)
+{
+	uint32_t cmd = cs[0];
+
+	if (IS_GEN6(mock.devid) || IS_GEN7(mock.devid)) {
+		switch (cmd >> 16) {
+		case 0x6101: /* STATE_BASE_ADDRESS */
+			if (len >= 3 && cs[2] & 1)
+				r->surface_base = cs[2] & ~0xfff;
+			return true;
+		case 0x7801: /* 3DSTATE_BINDING_TABLE_POINTERS on gen6 */
+			if (IS_GEN6(mock.devid) && len >= 4) {
+				if (cmd & (1 << 12))
+					r->binding_table = cs[3] & ~0x1f;
+				return true;
+			}
+			return false;
+		case 0x782a: /* 3DSTATE_BINDING_TABLE_POINTERS_PS */
+			if (len >= 2)
+				r->binding_table = cs[1] & ~0x1f;
+			return true;
+		case 0x7808: /* 3DSTATE_VERTEX_BUFFERS, buffer 0 only */
+			if (len >= 5 && cs[1] >> 26 == 0) {
+				r->vb_pitch = cs[1] & 0xfff;
+				r->vb = cs[2];
+			}
+			return true;
+		case 0x7809: /* 3DSTATE_VERTEX_ELEMENTS, 0 is the VUE header */
+			if (len >= 7) {
+				r->element[0] = cs[3];
+				r->element[1] = cs[5];
+			}
+			return true;
+		case 0x7b00: /* 3DPRIMITIVE */
+			if (IS_GEN7(mock.devid) && len >= 4 &&
+			    (cs[1] & 0x3f) == 0x0f)
+				return mock_primitive(exec, r, cs[3], cs[2]);
+			if (IS_GEN6(mock.devid) && len >= 3 &&
+			    ((cmd >> 10) & 0x1f) == 0x0f)
+				return mock_primitive(exec, r, cs[2], cs[1]);
+			return false;
+		}
+		return false;
+	}
+
+	if (IS_965(mock.devid))
+		return false;
+
+	/* gen2 and gen3 */
+	if ((cmd >> 16) == 0x7d8e && len >= 3) { /* 3DSTATE_BUF_INFO */
+		if (((cs[1] >> 24) & 7) == 3) { /* the color buffer */
+			r->target.pitch = cs[1] & 0x3ffc;
+			r->target.address = cs[2];
+		}
+		return true;
+	} else if ((cmd >> 16) == 0x7d80 && len >= 4) { /* 3DSTATE_DRAW_RECT */
+		r->target.width = (cs[3] & 0xffff) + 1;
+		r->target.height = (cs[3] >> 16) + 1;
+		return true;
+	} else if ((cmd >> 16) == 0x7d00 && IS_GEN3(mock.devid)) {
+		/* 3DSTATE_MAP_STATE, map 0 comes first */
+		if (len >= 5 && cs[1] & 1) {
+			r->texture.address = cs[2];
+			r->texture.height = (cs[3] >> 21) + 1;
+			r->texture.width = ((cs[3] >> 10) & 0x7ff) + 1;
+			r->texture.pitch = ((cs[4] >> 21) + 1) * 4;
+		}
+		return true;
+	} else if ((cmd >> 16) == 0x7d01 && IS_GEN3(mock.devid)) {
+		/* 3DSTATE_SAMPLER_STATE */
+		if (len >= 4 && cs[1] & 1)
+			r->normalized = cs[3] & (1 << 5);
+		return true;
+	} else if ((cmd >> 16) == 0x7d03 && IS_GEN2(mock.devid) &&
+		   (cmd & 0xff80) == 1 << 11) {
+		/* 3DSTATE_LOAD_STATE_IMMEDIATE_2 of texture map 0 alone */
+		if (len >= 4) {
+			r->texture.address = cs[1];
+			r->texture.height = (cs[2] >> 21) + 1;
+			r->texture.width = ((cs[2] >> 10) & 0x7ff) + 1;
+			r->texture.pitch = ((cs[3] >> 21) + 1) * 4;
+		}
+		return true;
+	} else if ((cmd & 0xffff8000) == 0x7c088000 && IS_GEN2(mock.devid)) {
+		/* 3DSTATE_MAP_COORD_SET of set 0 */
+		r->normalized = cmd & (1 << 14);
+		return true;
+	} else if ((cmd & 0xfffc0000) == 0x7f1c0000) {
+		/* PRIM3D_RECTLIST of inline x, y, s, t vertices */
+		unsigned int i;
+
+		for (i = 1; i + 12 <= len; i += 12) {
+			float v[3][4];
+
+			memcpy(v, &cs[i], sizeof(v));
+			mock_rect(exec, r, v);
+		}
+		return true;
+	}
+
+	return false;
+}
+
+#define MOCK_MAX_DWORDS	(1 << 24)	/* how far a batch may run */
+
+static struct mock_bo *
+mock_exec_find(struct mock_exec *exec, uint64_t address)
+{
+	unsigned int i;
+
+	for (i = 0; i < exec->count; i++)
+		if (address >= exec->bo[i]->offset &&
+		    address < exec->bo[i]->offset + exec->bo[i]->size)
+			return exec->bo[i];
+
+	return NULL;
+}
+
+/* Runs the commands from a batch's start until MI_BATCH_BUFFER_END */
+static void
+mock_execute(struct mock_exec *exec, struct mock_bo *batch, uint32_t start)
+{
+	const uint32_t *cs = (const uint32_t *)batch->data;
+	unsigned int end = batch->size / 4, p = start / 4;
+	unsigned int steps = 0, len;
+	struct mock_render render;
+
+	memset(&render, 0, sizeof(render));
+
+	while (p < end) {
+		uint32_t cmd = cs[p];
+
+		if (++steps > MOCK_MAX_DWORDS) {
+			fprintf(stderr, "intel_mock: batch doesn't end\n");
+			return;
+		}
+
+		switch (cmd >> 29) {
+		case 0: /* MI */
+			len = (cmd >> 23) < 0x10 ? 1 : (cmd & 0x3f) + 2;
+			if (p + len > end)
+				break;
+
+			switch (cmd >> 23) {
+			case 0x0a: /* MI_BATCH_BUFFER_END */
+				return;
+
+			case 0x20: /* MI_STORE_DWORD_IMM */ {
+				uint8_t *dst = mock_gtt(exec, cs[p + 2],
+							4 * (len - 3));
+				if (dst)
+					memcpy(dst, &cs[p + 3], 4 * (len - 3));
+				exec->moved += 4 * (len - 3);
+				break;
+			}
+
+			case 0x31: /* MI_BATCH_BUFFER_START */ {
+				uint32_t address = cs[p + 1] & ~3;
+
+				batch = mock_exec_find(exec, address);
+				if (batch == NULL) {
+					fprintf(stderr, "intel_mock: jump to 0x%08x outside the batch's objects\n",
+						address);
+					return;
+				}
+				cs = (const uint32_t *)batch->data;
+				end = batch->size / 4;
+				p = (address - batch->offset) / 4;
+				continue;
+			}
+
+			case 0x00: /* MI_NOOP */
+			case 0x04: /* MI_FLUSH */
+			case 0x26: /* MI_FLUSH_DW */
+				break;
+
+			default:
+				mock_skip(cmd);
+				break;
+			}
+			break;
+
+		case 2: /* 2D */
+			len = (cmd & 0xff) + 2;
+			if (p + len > end)
+				break;
+
+			if (((cmd >> 22) & 0x7f) == 0x53 && len >= 8)
+				mock_blt(exec, &cs[p], true); /* XY_SRC_COPY_BLT */
+			else if (((cmd >> 22) & 0x7f) == 0x50 && len >= 6)
+				mock_blt(exec, &cs[p], false); /* XY_COLOR_BLT */
+			else
+				mock_skip(cmd);
+			break;
+
+		case 3: /* 3D and media */
+			if (IS_965(mock.devid)) {
+				/* pipeline 1, PIPELINE_SELECT among them, and
+				 * 3DSTATE_VF_STATISTICS are single dwords */
+				if (((cmd >> 27) & 3) == 1 ||
+				    (cmd >> 16) == 0x780b)
+					len = 1;
+				else
+					len = (cmd & 0xff) + 2;
+			} else if (((cmd >> 24) & 0x1f) == 0x1f) /* PRIM3D */
+				len = (cmd & 0xffff) + 2;
+			else if ((cmd >> 16) == 0x7d04)
+				/* LOAD_STATE_IMMEDIATE_1, which state from bit 4 */
+				len = (cmd & 0xf) + 2;
+			else if ((cmd >> 16) == 0x7d03 && IS_GEN2(mock.devid))
+				/* LOAD_STATE_IMMEDIATE_2, which state from bit 7 */
+				len = (cmd & 0x7f) + 2;
+			else if (((cmd >> 24) & 0x1f) >= 0x1d)
+				len = (cmd & 0xff) + 2;
+			else
+				len = 1;
+			if (p + len > end)
+				break;
+
+			if (!mock_3d(exec, &render, &cs[p], len))
+				mock_skip(cmd);
+			break;
+
+		default:
+			fprintf(stderr, "intel_mock: invalid command 0x%08x\n",
+				cmd);
+			return;
+		}
+
+		p += len;
+	}
+}
+
+/* Gives an object a GTT offset, evicting everything when it's full */
+static int
+mock_bind(struct mock_bo *bo)
+{
+	if (bo->bound == mock.gtt_generation + 1)
+		return 0;
+
+	if (bo->size > mock.aperture - MOCK_GTT_START)
+		return -ENOSPC;
+	if (mock.gtt_next + bo->size > mock.aperture)
+		return -EAGAIN;
+
+	bo->offset = mock.gtt_next;
+	bo->bound = mock.gtt_generation + 1;
+	mock.gtt_next += bo->size;
+	return 0;
+}
+
+static int
+mock_relocate(struct mock_exec *exec, struct mock_bo *bo,
+	      struct drm_i915_gem_exec_object2 *obj,
+	      struct drm_i915_gem_exec_object2 *objs, uint64_t flags)
+{
+	struct drm_i915_gem_relocation_entry *reloc =
+		(void *)(uintptr_t)obj->relocs_ptr;
+	unsigned int i, j;
+
+	for (i = 0; i < obj->relocation_count; i++) {
+		struct mock_bo *target = NULL;
+
+		if (flags & LOCAL_I915_EXEC_HANDLE_LUT) {
+			if (reloc[i].target_handle < exec->count)
+				target = exec->bo[reloc[i].target_handle];
+		} else {
+			for (j = 0; j < exec->count; j++)
+				if (objs[j].handle == reloc[i].target_handle)
+					target = exec->bo[j];
+		}
+		if (target == NULL)
+			return -ENOENT;
+
+		if (reloc[i].write_domain & (reloc[i].write_domain - 1))
+			return -EINVAL;
+		if ((reloc[i].write_domain | reloc[i].read_domains) &
+		    ~MOCK_GPU_DOMAINS)
+			return -EINVAL;
+		if (reloc[i].write_domain && target->write_domain &&
+		    reloc[i].write_domain != target->write_domain)
+			return -EINVAL;
+		target->write_domain |= reloc[i].write_domain;
+
+		if (reloc[i].offset & 3 || reloc[i].offset > bo->size - 4)
+			return -EINVAL;
+
+		*(uint32_t *)(bo->data + reloc[i].offset) =
+			target->offset + reloc[i].delta;
+		reloc[i].presumed_offset = target->offset;
+	}
+
+	return 0;
+}
+
+static int
+mock_execbuffer2(struct mock_file *file,
+		 struct drm_i915_gem_execbuffer2 *execbuf)
+{
+	struct drm_i915_gem_exec_object2 *obj =
+		(void *)(uintptr_t)execbuf->buffers_ptr;
+	unsigned int ring = execbuf->flags & I915_EXEC_RING_MASK;
+	uint32_t ctx = execbuf->rsvd1;
+	struct mock_exec exec;
+	struct mock_bo *batch;
+	uint64_t done;
+	unsigned int i;
+	bool evicted;
+	int ret;
+
+	if (execbuf->buffer_count == 0 ||
+	    (execbuf->batch_start_offset | execbuf->batch_len) & 7)
+		return -EINVAL;
+	if (ring > I915_EXEC_BLT ||
+	    (ring == I915_EXEC_BSD && !IS_965(mock.devid)) ||
+	    (ring == I915_EXEC_BLT &&
+	     !IS_GEN6(mock.devid) && !IS_GEN7(mock.devid)))
+		return -EINVAL;
+	if (ctx) {
+		if (ring != I915_EXEC_RENDER)
+			return -EINVAL;
+		if (ctx >= file->num_contexts || !file->context[ctx])
+			return -ENOENT;
+	}
+
+	exec.count = execbuf->buffer_count;
+	exec.moved = 0;
+	exec.bo = calloc(exec.count, sizeof(*exec.bo));
+	if (exec.bo == NULL)
+		return -ENOMEM;
+
+	for (i = 0; i < exec.count; i++) {
+		exec.bo[i] = mock_lookup(file, obj[i].handle);
+		if (exec.bo[i] == NULL) {
+			ret = -ENOENT;
+			goto out;
+		}
+		exec.bo[i]->write_domain = 0;
+	}
+
+	/* evict everything once, then the objects just don't fit */
+	for (i = 0, evicted = false; i < exec.count; i++) {
+		ret = mock_bind(exec.bo[i]);
+		if (ret == -EAGAIN && !evicted) {
+			mock.gtt_generation++;
+			mock.gtt_next = MOCK_GTT_START;
+			evicted = true;
+			i = -1;
+			continue;
+		}
+		if (ret == -EAGAIN)
+			ret = -ENOSPC;
+		if (ret)
+			goto out;
+	}
+
+	for (i = 0; i < exec.count; i++) {
+		ret = mock_relocate(&exec, exec.bo[i], &obj[i], obj,
+				    execbuf->flags);
+		if (ret)
+			goto out;
+		obj[i].offset = exec.bo[i]->offset;
+	}
+
+	batch = exec.bo[exec.count - 1];
+	if (execbuf->batch_start_offset >= batch->size) {
+		ret = -EINVAL;
+		goto out;
+	}
+	mock_execute(&exec, batch, execbuf->batch_start_offset);
+
+	/* one batch at a time, whatever the ring */
+	done = mock_now();
+	if (done < mock.gpu_idle)
+		done = mock.gpu_idle;
+	done += MOCK_BATCH_NS + exec.moved / MOCK_BYTES_PER_NS;
+	mock.gpu_idle = done;
+	for (i = 0; i < exec.count; i++)
+		exec.bo[i]->busy_until = done;
+
+out:
+	free(exec.bo);
+	return ret;
+}
+
+static int
+mock_ioctl(struct mock_file *file, unsigned long request, void *arg)
+{
+	struct mock_bo *bo;
+
+	switch (request) {
+	case DRM_IOCTL_VERSION: {
+		struct drm_version *version = arg;
+		static const char name[] = "i915";
+
+		version->version_major = 1;
+		version->version_minor = 6;
+		version->version_patchlevel = 0;
+		if (version->name_len && version->name)
+			strncpy(version->name, name, version->name_len);
+		version->name_len = strlen(name);
+		version->date_len = 0;
+		version->desc_len = 0;
+		return 0;
+	}
+
+	case DRM_IOCTL_GET_CLIENT: {
+		struct drm_client *client = arg;
+
+		/* the only client, and authenticated */
+		if (client->idx != 0)
+			return -EINVAL;
+		client->auth = 1;
+		client->pid = getpid();
+		client->uid = getuid();
+		client->magic = 0;
+		client->iocs = 0;
+		return 0;
+	}
+
+	case DRM_IOCTL_GEM_CLOSE: {
+		struct drm_gem_close *close = arg;
+
+		if (mock_lookup(file, close->handle) == NULL)
+			return -EINVAL;
+		mock_close_handle(file, close->handle);
+		return 0;
+	}
+
+	case DRM_IOCTL_GEM_FLINK:
+		return mock_flink(file, arg);
+
+	case DRM_IOCTL_GEM_OPEN:
+		return mock_open_name(file, arg);
+
+	case DRM_IOCTL_I915_GETPARAM:
+		return mock_getparam(arg);
+
+	case DRM_IOCTL_I915_GEM_GET_APERTURE: {
+		struct drm_i915_gem_get_aperture *aperture = arg;
+
+		aperture->aper_size = mock.aperture;
+		aperture->aper_available_size = mock.aperture;
+		return 0;
+	}
+
+	case DRM_IOCTL_I915_GEM_CREATE:
+		return mock_create(file, arg);
+
+	case DRM_IOCTL_I915_GEM_PREAD: {
+		struct drm_i915_gem_pread *pread = arg;
+
+		return mock_rw(file, pread->handle, pread->offset,
+			       pread->size, pread->data_ptr, false);
+	}
+
+	case DRM_IOCTL_I915_GEM_PWRITE: {
+		struct drm_i915_gem_pwrite *pwrite = arg;
+
+		return mock_rw(file, pwrite->handle, pwrite->offset,
+			       pwrite->size, pwrite->data_ptr, true);
+	}
+
+	case DRM_IOCTL_I915_GEM_MMAP:
+	/* newer libdrm_intel adds a flags field, whose WC maps are the same
+	 * memory here */
+	case DRM_IOC(DRM_IOC_READWRITE, DRM_IOCTL_BASE,
+		     DRM_COMMAND_BASE + DRM_I915_GEM_MMAP,
+		     sizeof(struct drm_i915_gem_mmap) + sizeof(uint64_t)): {
+		struct drm_i915_gem_mmap *mmap = arg;
+
+		bo = mock_lookup(file, mmap->handle);
+		if (bo == NULL)
+			return -ENOENT;
+		if (mmap->offset > bo->size ||
+		    mmap->size > bo->size - mmap->offset)
+			return -EINVAL;
+
+		bo->maps++;
+		mmap->addr_ptr = (uintptr_t)(bo->data + mmap->offset);
+		return 0;
+	}
+
+	case DRM_IOCTL_I915_GEM_MMAP_GTT: {
+		struct drm_i915_gem_mmap_gtt *mmap = arg;
+
+		if (mock_lookup(file, mmap->handle) == NULL)
+			return -ENOENT;
+
+		/* a key for mmap() on the file to find the object by */
+		mmap->offset = (uint64_t)mmap->handle << 32;
+		return 0;
+	}
+
+	case DRM_IOCTL_I915_GEM_SET_DOMAIN: {
+		struct drm_i915_gem_set_domain *domain = arg;
+
+		bo = mock_lookup(file, domain->handle);
+		if (bo == NULL)
+			return -ENOENT;
+		mock_wait(bo);
+		return 0;
+	}
+
+	case DRM_IOCTL_I915_GEM_SW_FINISH: {
+		struct drm_i915_gem_sw_finish *finish = arg;
+
+		return mock_lookup(file, finish->handle) ? 0 : -ENOENT;
+	}
+
+	case DRM_IOCTL_I915_GEM_SET_TILING:
+		return mock_set_tiling(file, arg);
+
+	case DRM_IOCTL_I915_GEM_GET_TILING: {
+		struct drm_i915_gem_get_tiling *gt = arg;
+
+		bo = mock_lookup(file, gt->handle);
+		if (bo == NULL)
+			return -ENOENT;
+		gt->tiling_mode = bo->tiling;
+		gt->swizzle_mode = I915_BIT_6_SWIZZLE_NONE;
+		return 0;
+	}
+
+	case LOCAL_DRM_IOCTL_I915_GEM_SET_CACHEING:
+	case LOCAL_DRM_IOCTL_I915_GEM_GET_CACHEING: {
+		struct local_drm_i915_gem_cacheing *arg_cacheing = arg;
+
+		bo = mock_lookup(file, arg_cacheing->handle);
+		if (bo == NULL)
+			return -ENOENT;
+		if (request == LOCAL_DRM_IOCTL_I915_GEM_SET_CACHEING)
+			bo->cacheing = arg_cacheing->cacheing;
+		else
+			arg_cacheing->cacheing = bo->cacheing;
+		return 0;
+	}
+
+	case DRM_IOCTL_I915_GEM_BUSY: {
+		struct drm_i915_gem_busy *busy = arg;
+
+		bo = mock_lookup(file, busy->handle);
+		if (bo == NULL)
+			return -ENOENT;
+		busy->busy = bo->busy_until > mock_now();
+		return 0;
+	}
+
+	case DRM_IOCTL_I915_GEM_WAIT: {
+		struct drm_i915_gem_wait *wait = arg;
+
+		bo = mock_lookup(file, wait->bo_handle);
+		if (bo == NULL)
+			return -ENOENT;
+		if (wait->timeout_ns == 0 && bo->busy_until > mock_now())
+			return -ETIME;
+		mock_wait(bo);
+		return 0;
+	}
+
+	case DRM_IOCTL_I915_GEM_MADVISE: {
+		struct drm_i915_gem_madvise *madv = arg;
+
+		if (mock_lookup(file, madv->handle) == NULL)
+			return -ENOENT;
+		madv->retained = 1;
+		return 0;
+	}
+
+	case DRM_IOCTL_I915_GEM_THROTTLE:
+		return 0;
+
+	case DRM_IOCTL_I915_GEM_EXECBUFFER2:
+	/* the same command, as newer libdrm_intel asks for it */
+	case DRM_IOWR(DRM_COMMAND_BASE + DRM_I915_GEM_EXECBUFFER2,
+		      struct drm_i915_gem_execbuffer2):
+		return mock_execbuffer2(file, arg);
+
+	case DRM_IOCTL_I915_GEM_CONTEXT_CREATE:
+		return mock_context_create(file, arg);
+
+	case DRM_IOCTL_I915_GEM_CONTEXT_DESTROY:
+		return mock_context_destroy(file, arg);
+
+	default:
+		return -EINVAL;
+	}
+}
+
+/*
+ * The interposed libc entry points.  Everything that isn't about the mock
+ * device is passed on.
+ */
+
+static int
+mock_open_device(const char *path, int flags, mode_t mode)
+{
+	struct mock_file *file;
+	int fd;
+
+	pthread_once(&mock.once, mock_init);
+
+	if (strcmp(path, MOCK_DEVICE))
+		return mock.open(path, flags, mode);
+
+	/* a real descriptor, for a number nobody else gets */
+	fd = mock.open("/dev/null", O_RDWR | (flags & O_CLOEXEC));
+	if (fd < 0)
+		return fd;
+
+	file = calloc(1, sizeof(*file));
+	if (file == NULL) {
+		mock.close(fd);
+		errno = ENOMEM;
+		return -1;
+	}
+	file->fd = fd;
+
+	pthread_mutex_lock(&mock.mutex);
+	file->next = mock.files;
+	mock.files = file;
+	pthread_mutex_unlock(&mock.mutex);
+
+	return fd;
+}
+
+int
+open(const char *path, int flags, ...)
+{
+	mode_t mode = 0;
+
+	if (flags & O_CREAT) {
+		va_list ap;
+
+		va_start(ap, flags);
+		mode = va_arg(ap, int);
+		va_end(ap);
+	}
+
+	return mock_open_device(path, flags, mode);
+}
+
+int
+open64(const char *path, int flags, ...)
+{
+	mode_t mode = 0;
+
+	if (flags & O_CREAT) {
+		va_list ap;
+
+		va_start(ap, flags);
+		mode = va_arg(ap, int);
+		va_end(ap);
+	}
+
+	return mock_open_device(path, flags | O_LARGEFILE, mode);
+}
+
+/* what open() becomes with _FORTIFY_SOURCE */
+int __open_2(const char *path, int flags);
+int __open64_2(const char *path, int flags);
+
+int
+__open_2(const char *path, int flags)
+{
+	return mock_open_device(path, flags, 0);
+}
+
+int
+__open64_2(const char *path, int flags)
+{
+	return mock_open_device(path, flags | O_LARGEFILE, 0);
+}
+
+int
+close(int fd)
+{
+	struct mock_file **prev, *file;
+	unsigned int i;
+
+	pthread_once(&mock.once, mock_init);
+
+	pthread_mutex_lock(&mock.mutex);
+	for (prev = &mock.files; (file = *prev); prev = &file->next) {
+		if (file->fd != fd)
+			continue;
+
+		*prev = file->next;
+		for (i = 1; i < file->num_handles; i++)
+			if (file->handle[i])
+				mock_close_handle(file, i);
+		free(file->handle);
+		free(file->context);
+		free(file);
+		break;
+	}
+	pthread_mutex_unlock(&mock.mutex);
+
+	return mock.close(fd);
+}
+
+int
+ioctl(int fd, unsigned long request, ...)
+{
+	struct mock_file *file;
+	va_list ap;
+	void *arg;
+	int ret;
+
+	va_start(ap, request);
+	arg = va_arg(ap, void *);
+	va_end(ap);
+
+	pthread_once(&mock.once, mock_init);
+
+	pthread_mutex_lock(&mock.mutex);
+	file = mock_file(fd);
+	if (file == NULL) {
+		pthread_mutex_unlock(&mock.mutex);
+		return mock.ioctl(fd, request, arg);
+	}
+
+	ret = mock_ioctl(file, request, arg);
+	pthread_mutex_unlock(&mock.mutex);
+
+	if (ret) {
+		errno = -ret;
+		return -1;
+	}
+
+	return 0;
+}
+
+void *
+mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset)
+{
+	struct mock_file *file;
+	struct mock_bo *bo;
+
+	pthread_once(&mock.once, mock_init);
+
+	pthread_mutex_lock(&mock.mutex);
+	file = fd < 0 ? NULL : mock_file(fd);
+	if (file == NULL) {
+		pthread_mutex_unlock(&mock.mutex);
+		return mock.mmap(addr, length, prot, flags, fd, offset);
+	}
+
+	/* GTT maps, by the offset DRM_IOCTL_I915_GEM_MMAP_GTT handed out */
+	bo = mock_lookup(file, (uint64_t)offset >> 32);
+	if (bo == NULL || length > bo->size) {
+		pthread_mutex_unlock(&mock.mutex);
+		errno = EINVAL;
+		return MAP_FAILED;
+	}
+
+	bo->maps++;
+	pthread_mutex_unlock(&mock.mutex);
+
+	return bo->data;
+}
+
+void *
+mmap64(void *addr, size_t length, int prot, int flags, int fd, off64_t offset)
+{
+	return mmap(addr, length, prot, flags, fd, offset);
+}
+
+int
+munmap(void *addr, size_t length)
+{
+	struct mock_bo *bo;
+
+	pthread_once(&mock.once, mock_init);
+
+	pthread_mutex_lock(&mock.mutex);
+	bo = mock_bo_find(addr);
+	if (bo == NULL) {
+		pthread_mutex_unlock(&mock.mutex);
+		return mock.munmap(addr, length);
+	}
+
+	if (bo->maps)
+		bo->maps--;
+	mock_bo_release(bo);
+	pthread_mutex_unlock(&mock.mutex);
+
+	return 0;
+}
@@ -883,6 +883,9 @@ SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
  */
 #define LP_RING     0x2030
 #define HP_RING     0x2040
+#define BSD_RING    0x4030	/* g4x and gen5 */
+#define GEN6_BSD_RING	0x12030
+#define BLT_RING    0x22030
 
 #define RING_TAIL      0x00
 #define TAIL_ADDR           0x000FFFF8
@@ -2792,6 +2795,7 @@ SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #define MI_BATCH_BUFFER_END	(0xA << 23)
 #define MI_BATCH_NON_SECURE		(1)
 #define MI_BATCH_NON_SECURE_I965	(1 << 8)
+#define MI_BATCH_NON_SECURE_HSW	(1 << 13)
 
 #define MAX_DISPLAY_PIPES	2
 
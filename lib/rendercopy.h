@@ -65,6 +65,51 @@ typedef void (*render_copyfunc_t)(struct intel_batchbuffer *batch,
 
 render_copyfunc_t get_render_copyfunc(int devid);
 
+struct render_copy {
+	struct scratch_buf *src;
+	unsigned src_x, src_y;
+	unsigned width, height;
+	struct scratch_buf *dst;
+	unsigned dst_x, dst_y;
+};
+
+/*
+ * Copies count rectangles with one setup of the pipeline and, as long as
+ * they fit, one batch.  Consecutive copies between the same buffers are
+ * drawn together, so none of them may read what another one writes.
+ */
+typedef void (*render_copyvfunc_t)(struct intel_batchbuffer *batch,
+				   const struct render_copy *copies, int count);
+
+render_copyvfunc_t get_render_copyvfunc(int devid);
+
+/* The number of copies at the start of the array between the same buffers */
+static inline int render_copy_run(const struct render_copy *copies, int count)
+{
+	int n;
+
+	for (n = 1; n < count; n++)
+		if (copies[n].src != copies[0].src ||
+		    copies[n].dst != copies[0].dst)
+			break;
+
+	return n;
+}
+
+/*
+ * The gen6+ copies without the flush: consecutive copies share the batch,
+ * its pipeline setup and state, until the caller flushes it on the render
+ * ring.
+ */
+void gen7_render_copy_emit(struct intel_batchbuffer *batch,
+			   struct scratch_buf *src, unsigned src_x, unsigned src_y,
+			   unsigned width, unsigned height,
+			   struct scratch_buf *dst, unsigned dst_x, unsigned dst_y);
+void gen6_render_copy_emit(struct intel_batchbuffer *batch,
+			   struct scratch_buf *src, unsigned src_x, unsigned src_y,
+			   unsigned width, unsigned height,
+			   struct scratch_buf *dst, unsigned dst_x, unsigned dst_y);
+
 void gen7_render_copyfunc(struct intel_batchbuffer *batch,
 			  struct scratch_buf *src, unsigned src_x, unsigned src_y,
 			  unsigned width, unsigned height,
@@ -81,3 +126,12 @@ void gen2_render_copyfunc(struct intel_batchbuffer *batch,
 			  struct scratch_buf *src, unsigned src_x, unsigned src_y,
 			  unsigned width, unsigned height,
 			  struct scratch_buf *dst, unsigned dst_x, unsigned dst_y);
+
+void gen7_render_copyvfunc(struct intel_batchbuffer *batch,
+			   const struct render_copy *copies, int count);
+void gen6_render_copyvfunc(struct intel_batchbuffer *batch,
+			   const struct render_copy *copies, int count);
+void gen3_render_copyvfunc(struct intel_batchbuffer *batch,
+			   const struct render_copy *copies, int count);
+void gen2_render_copyvfunc(struct intel_batchbuffer *batch,
+			   const struct render_copy *copies, int count);
@@ -3,9 +3,19 @@
 
 #include <assert.h>
 
-#define ALIGN(x, y) (((x) + (y)-1) & ~((y)-1))
 #define VERTEX_SIZE (3*4)
 
+/*
+ * Room a copy needs in a batch: the first sets up the pipeline, the ones
+ * following it only add surfaces, vertices and the primitive, and further
+ * copies between the same buffers just their vertices.
+ */
+#define GEN6_PIPELINE_SPACE 1536
+#define GEN6_COPY_SPACE 320
+
+/* batch->pipeline of a batch set up for copies */
+static const char gen6_pipeline[] = "gen6 render copy";
+
 static const uint32_t ps_kernel_nomask_affine[][4] = {
 	{ 0x0060005a, 0x204077be, 0x000000c0, 0x008d0040 },
 	{ 0x0060005a, 0x206077be, 0x000000c0, 0x008d0080 },
@@ -33,36 +43,10 @@ static const uint32_t ps_kernel_nomask_affine[][4] = {
 	{ 0x0000007e, 0x00000000, 0x00000000, 0x00000000 },
 };
 
-static uint32_t
-batch_used(struct intel_batchbuffer *batch)
-{
-	return batch->ptr - batch->buffer;
-}
-
-static uint32_t
-batch_align(struct intel_batchbuffer *batch, uint32_t align)
-{
-	uint32_t offset = batch_used(batch);
-	offset = ALIGN(offset, align);
-	batch->ptr = batch->buffer + offset;
-	return offset;
-}
-
-static uint32_t
-batch_round_upto(struct intel_batchbuffer *batch, uint32_t divisor)
-{
-	uint32_t offset = batch_used(batch);
-	offset = (offset + divisor-1) / divisor * divisor;
-	batch->ptr = batch->buffer + offset;
-	return offset;
-}
-
 static void *
 batch_alloc(struct intel_batchbuffer *batch, uint32_t size, uint32_t align)
 {
-	uint32_t offset = batch_align(batch, align);
-	batch->ptr += size;
-	return memset(batch->buffer + offset, 0, size);
+	return memset(intel_batchbuffer_state_alloc(batch, size, align), 0, size);
 }
 
 static uint32_t
@@ -71,31 +55,12 @@ batch_offset(struct intel_batchbuffer *batch, void *ptr)
 	return (uint8_t *)ptr - batch->buffer;
 }
 
-static uint32_t
-batch_copy(struct intel_batchbuffer *batch, const void *ptr, uint32_t size, uint32_t align)
-{
-	return batch_offset(batch, memcpy(batch_alloc(batch, size, align), ptr, size));
-}
-
-static void
-gen6_render_flush(struct intel_batchbuffer *batch, uint32_t batch_end)
-{
-	int ret;
-
-	ret = drm_intel_bo_subdata(batch->bo, 0, 4096, batch->buffer);
-	if (ret == 0)
-		ret = drm_intel_bo_mrb_exec(batch->bo, batch_end,
-					    NULL, 0, 0, 0);
-	assert(ret == 0);
-}
-
 static uint32_t
 gen6_bind_buf(struct intel_batchbuffer *batch, struct scratch_buf *buf,
 	      uint32_t format, int is_dst)
 {
-	struct gen6_surface_state *ss;
+	struct gen6_surface_state ss;
 	uint32_t write_domain, read_domain;
-	int ret;
 
 	if (is_dst) {
 		write_domain = read_domain = I915_GEM_DOMAIN_RENDER;
@@ -104,27 +69,23 @@ gen6_bind_buf(struct intel_batchbuffer *batch, struct scratch_buf *buf,
 		read_domain = I915_GEM_DOMAIN_SAMPLER;
 	}
 
-	ss = batch_alloc(batch, sizeof(*ss), 32);
-	ss->ss0.surface_type = GEN6_SURFACE_2D;
-	ss->ss0.surface_format = format;
+	memset(&ss, 0, sizeof(ss));
+	ss.ss0.surface_type = GEN6_SURFACE_2D;
+	ss.ss0.surface_format = format;
 
-	ss->ss0.data_return_format = GEN6_SURFACERETURNFORMAT_FLOAT32;
-	ss->ss0.color_blend = 1;
-	ss->ss1.base_addr = buf->bo->offset;
+	ss.ss0.data_return_format = GEN6_SURFACERETURNFORMAT_FLOAT32;
+	ss.ss0.color_blend = 1;
 
-	ret = drm_intel_bo_emit_reloc(batch->bo,
-				      batch_offset(batch, ss) + 4,
-				      buf->bo, 0,
-				      read_domain, write_domain);
-	assert(ret == 0);
+	ss.ss2.height = buf_height(buf) - 1;
+	ss.ss2.width  = buf_width(buf) - 1;
+	ss.ss3.pitch  = buf->stride - 1;
+	ss.ss3.tiled_surface = buf->tiling != I915_TILING_NONE;
+	ss.ss3.tile_walk     = buf->tiling == I915_TILING_Y;
 
-	ss->ss2.height = buf_height(buf) - 1;
-	ss->ss2.width  = buf_width(buf) - 1;
-	ss->ss3.pitch  = buf->stride - 1;
-	ss->ss3.tiled_surface = buf->tiling != I915_TILING_NONE;
-	ss->ss3.tile_walk     = buf->tiling == I915_TILING_Y;
-
-	return batch_offset(batch, ss);
+	/* ss1 is the base address */
+	return intel_batchbuffer_state_reloc(batch, &ss, sizeof(ss), 32, 4,
+					     buf->bo, 0,
+					     read_domain, write_domain);
 }
 
 static uint32_t
@@ -132,16 +93,15 @@ gen6_bind_surfaces(struct intel_batchbuffer *batch,
 		   struct scratch_buf *src,
 		   struct scratch_buf *dst)
 {
-	uint32_t *binding_table;
-
-	binding_table = batch_alloc(batch, 32, 32);
+	uint32_t binding_table[2];
 
 	binding_table[0] =
 		gen6_bind_buf(batch, dst, GEN6_SURFACEFORMAT_B8G8R8A8_UNORM, 1);
 	binding_table[1] =
 		gen6_bind_buf(batch, src, GEN6_SURFACEFORMAT_B8G8R8A8_UNORM, 0);
 
-	return batch_offset(batch, binding_table);
+	return intel_batchbuffer_state_copy(batch, binding_table,
+					    sizeof(binding_table), 32);
 }
 
 static void
@@ -285,10 +245,16 @@ gen6_emit_invariant(struct intel_batchbuffer *batch)
 static void
 gen6_emit_cc(struct intel_batchbuffer *batch, uint32_t blend)
 {
+	static const uint32_t zero[16];
+	uint32_t off;
+
+	/* depth/stencil and color calculator state, all disabled */
+	off = intel_batchbuffer_state_copy(batch, zero, sizeof(zero), 64);
+
 	OUT_BATCH(GEN6_3DSTATE_CC_STATE_POINTERS | (4 - 2));
 	OUT_BATCH(blend | 1);
-	OUT_BATCH(1024 | 1);
-	OUT_BATCH(1024 | 1);
+	OUT_BATCH(off | 1);
+	OUT_BATCH(off | 1);
 }
 
 static void
@@ -409,40 +375,38 @@ gen6_emit_vertex_elements(struct intel_batchbuffer *batch)
 static uint32_t
 gen6_create_cc_viewport(struct intel_batchbuffer *batch)
 {
-	struct gen6_cc_viewport *vp;
-
-	vp = batch_alloc(batch, sizeof(*vp), 32);
+	struct gen6_cc_viewport vp;
 
-	vp->min_depth = -1.e35;
-	vp->max_depth = 1.e35;
+	memset(&vp, 0, sizeof(vp));
+	vp.min_depth = -1.e35;
+	vp.max_depth = 1.e35;
 
-	return batch_offset(batch, vp);
+	return intel_batchbuffer_state_copy(batch, &vp, sizeof(vp), 32);
 }
 
 static uint32_t
 gen6_create_cc_blend(struct intel_batchbuffer *batch)
 {
-	struct gen6_blend_state *blend;
+	struct gen6_blend_state blend;
 
-	blend = batch_alloc(batch, sizeof(*blend), 64);
+	memset(&blend, 0, sizeof(blend));
+	blend.blend0.dest_blend_factor = GEN6_BLENDFACTOR_ZERO;
+	blend.blend0.source_blend_factor = GEN6_BLENDFACTOR_ONE;
+	blend.blend0.blend_func = GEN6_BLENDFUNCTION_ADD;
+	blend.blend0.blend_enable = 1;
 
-	blend->blend0.dest_blend_factor = GEN6_BLENDFACTOR_ZERO;
-	blend->blend0.source_blend_factor = GEN6_BLENDFACTOR_ONE;
-	blend->blend0.blend_func = GEN6_BLENDFUNCTION_ADD;
-	blend->blend0.blend_enable = 1;
+	blend.blend1.post_blend_clamp_enable = 1;
+	blend.blend1.pre_blend_clamp_enable = 1;
 
-	blend->blend1.post_blend_clamp_enable = 1;
-	blend->blend1.pre_blend_clamp_enable = 1;
-
-	return batch_offset(batch, blend);
+	return intel_batchbuffer_state_copy(batch, &blend, sizeof(blend), 64);
 }
 
 static uint32_t
 gen6_create_kernel(struct intel_batchbuffer *batch)
 {
-	return batch_copy(batch, ps_kernel_nomask_affine,
-			  sizeof(ps_kernel_nomask_affine),
-			  64);
+	return intel_batchbuffer_state_copy(batch, ps_kernel_nomask_affine,
+					    sizeof(ps_kernel_nomask_affine),
+					    64);
 }
 
 static uint32_t
@@ -450,98 +414,130 @@ gen6_create_sampler(struct intel_batchbuffer *batch,
 		    sampler_filter_t filter,
 		   sampler_extend_t extend)
 {
-	struct gen6_sampler_state *ss;
+	struct gen6_sampler_state ss;
 
-	ss = batch_alloc(batch, sizeof(*ss), 32);
-	ss->ss0.lod_preclamp = 1;	/* GL mode */
+	memset(&ss, 0, sizeof(ss));
+	ss.ss0.lod_preclamp = 1;	/* GL mode */
 
 	/* We use the legacy mode to get the semantics specified by
 	 * the Render extension. */
-	ss->ss0.border_color_mode = GEN6_BORDER_COLOR_MODE_LEGACY;
+	ss.ss0.border_color_mode = GEN6_BORDER_COLOR_MODE_LEGACY;
 
 	switch (filter) {
 	default:
 	case SAMPLER_FILTER_NEAREST:
-		ss->ss0.min_filter = GEN6_MAPFILTER_NEAREST;
-		ss->ss0.mag_filter = GEN6_MAPFILTER_NEAREST;
+		ss.ss0.min_filter = GEN6_MAPFILTER_NEAREST;
+		ss.ss0.mag_filter = GEN6_MAPFILTER_NEAREST;
 		break;
 	case SAMPLER_FILTER_BILINEAR:
-		ss->ss0.min_filter = GEN6_MAPFILTER_LINEAR;
-		ss->ss0.mag_filter = GEN6_MAPFILTER_LINEAR;
+		ss.ss0.min_filter = GEN6_MAPFILTER_LINEAR;
+		ss.ss0.mag_filter = GEN6_MAPFILTER_LINEAR;
 		break;
 	}
 
 	switch (extend) {
 	default:
 	case SAMPLER_EXTEND_NONE:
-		ss->ss1.r_wrap_mode = GEN6_TEXCOORDMODE_CLAMP_BORDER;
-		ss->ss1.s_wrap_mode = GEN6_TEXCOORDMODE_CLAMP_BORDER;
-		ss->ss1.t_wrap_mode = GEN6_TEXCOORDMODE_CLAMP_BORDER;
+		ss.ss1.r_wrap_mode = GEN6_TEXCOORDMODE_CLAMP_BORDER;
+		ss.ss1.s_wrap_mode = GEN6_TEXCOORDMODE_CLAMP_BORDER;
+		ss.ss1.t_wrap_mode = GEN6_TEXCOORDMODE_CLAMP_BORDER;
 		break;
 	case SAMPLER_EXTEND_REPEAT:
-		ss->ss1.r_wrap_mode = GEN6_TEXCOORDMODE_WRAP;
-		ss->ss1.s_wrap_mode = GEN6_TEXCOORDMODE_WRAP;
-		ss->ss1.t_wrap_mode = GEN6_TEXCOORDMODE_WRAP;
+		ss.ss1.r_wrap_mode = GEN6_TEXCOORDMODE_WRAP;
+		ss.ss1.s_wrap_mode = GEN6_TEXCOORDMODE_WRAP;
+		ss.ss1.t_wrap_mode = GEN6_TEXCOORDMODE_WRAP;
 		break;
 	case SAMPLER_EXTEND_PAD:
-		ss->ss1.r_wrap_mode = GEN6_TEXCOORDMODE_CLAMP;
-		ss->ss1.s_wrap_mode = GEN6_TEXCOORDMODE_CLAMP;
-		ss->ss1.t_wrap_mode = GEN6_TEXCOORDMODE_CLAMP;
+		ss.ss1.r_wrap_mode = GEN6_TEXCOORDMODE_CLAMP;
+		ss.ss1.s_wrap_mode = GEN6_TEXCOORDMODE_CLAMP;
+		ss.ss1.t_wrap_mode = GEN6_TEXCOORDMODE_CLAMP;
 		break;
 	case SAMPLER_EXTEND_REFLECT:
-		ss->ss1.r_wrap_mode = GEN6_TEXCOORDMODE_MIRROR;
-		ss->ss1.s_wrap_mode = GEN6_TEXCOORDMODE_MIRROR;
-		ss->ss1.t_wrap_mode = GEN6_TEXCOORDMODE_MIRROR;
+		ss.ss1.r_wrap_mode = GEN6_TEXCOORDMODE_MIRROR;
+		ss.ss1.s_wrap_mode = GEN6_TEXCOORDMODE_MIRROR;
+		ss.ss1.t_wrap_mode = GEN6_TEXCOORDMODE_MIRROR;
 		break;
 	}
 
-	return batch_offset(batch, ss);
+	return intel_batchbuffer_state_copy(batch, &ss, sizeof(ss), 32);
+}
+
+static uint32_t
+gen6_create_vertex_buffer(struct intel_batchbuffer *batch,
+			  const struct render_copy *copies, int count)
+{
+	union { float f; uint32_t ui; } *v, *vb;
+	int i;
+
+	vb = batch_alloc(batch, 3 * count * VERTEX_SIZE, 8);
+
+	/* x,y as two shorts, then the normalized texture coordinates */
+	for (v = vb, i = 0; i < count; i++, v += 9) {
+		const struct render_copy *c = &copies[i];
+		float w = buf_width(c->src), h = buf_height(c->src);
+
+		v[0].ui = (c->dst_y + c->height) << 16 | (c->dst_x + c->width);
+		v[1].f = (c->src_x + c->width) / w;
+		v[2].f = (c->src_y + c->height) / h;
+
+		v[3].ui = (c->dst_y + c->height) << 16 | c->dst_x;
+		v[4].f = c->src_x / w;
+		v[5].f = (c->src_y + c->height) / h;
+
+		v[6].ui = c->dst_y << 16 | c->dst_x;
+		v[7].f = c->src_x / w;
+		v[8].f = c->src_y / h;
+	}
+
+	return batch_offset(batch, vb);
 }
 
-static void gen6_emit_vertex_buffer(struct intel_batchbuffer *batch)
+static void gen6_emit_vertex_buffer(struct intel_batchbuffer *batch,
+				    uint32_t offset, int count)
 {
 	OUT_BATCH(GEN6_3DSTATE_VERTEX_BUFFERS | 3);
 	OUT_BATCH(VB0_VERTEXDATA |
 		  0 << VB0_BUFFER_INDEX_SHIFT |
 		  VERTEX_SIZE << VB0_BUFFER_PITCH_SHIFT);
-	OUT_RELOC(batch->bo, I915_GEM_DOMAIN_VERTEX, 0, 0);
-	OUT_RELOC(batch->bo, I915_GEM_DOMAIN_VERTEX, 0, batch->bo->size-1);
+	OUT_RELOC(batch->bo, I915_GEM_DOMAIN_VERTEX, 0, offset);
+	OUT_RELOC(batch->bo, I915_GEM_DOMAIN_VERTEX, 0,
+		  offset + 3 * count * VERTEX_SIZE - 1);
 	OUT_BATCH(0);
 }
 
-static uint32_t gen6_emit_primitive(struct intel_batchbuffer *batch)
+static void gen6_emit_primitive(struct intel_batchbuffer *batch,
+				int start, int count)
 {
-	uint32_t offset;
-
 	OUT_BATCH(GEN6_3DPRIMITIVE |
 		  GEN6_3DPRIMITIVE_VERTEX_SEQUENTIAL |
 		  _3DPRIM_RECTLIST << GEN6_3DPRIMITIVE_TOPOLOGY_SHIFT |
 		  0 << 9 |
 		  4);
-	OUT_BATCH(3);	/* vertex count */
-	offset = batch_used(batch);
-	OUT_BATCH(0);	/* vertex_index */
+	OUT_BATCH(3 * count);	/* vertex count */
+	OUT_BATCH(3 * start);	/* vertex_index */
 	OUT_BATCH(1);	/* single instance */
 	OUT_BATCH(0);	/* start instance location */
 	OUT_BATCH(0);	/* index buffer offset, ignored */
-
-	return offset;
 }
 
-void gen6_render_copyfunc(struct intel_batchbuffer *batch,
-			  struct scratch_buf *src, unsigned src_x, unsigned src_y,
-			  unsigned width, unsigned height,
-			  struct scratch_buf *dst, unsigned dst_x, unsigned dst_y)
+/* Between copies: the next may read what the last one wrote */
+static void
+gen6_emit_flush(struct intel_batchbuffer *batch)
 {
-	uint32_t wm_state, wm_kernel, wm_table;
-	uint32_t cc_vp, cc_blend, offset;
-	uint32_t batch_end;
+	OUT_BATCH(GEN6_PIPE_CONTROL | (4 - 2));
+	OUT_BATCH(GEN6_PIPE_CONTROL_WC_FLUSH |
+		  GEN6_PIPE_CONTROL_TC_FLUSH |
+		  GEN6_PIPE_CONTROL_CS_STALL);
+	OUT_BATCH(0);
+	OUT_BATCH(0);
+}
 
-	intel_batchbuffer_flush(batch);
+static void
+gen6_emit_pipeline(struct intel_batchbuffer *batch)
+{
+	uint32_t wm_state, wm_kernel;
+	uint32_t cc_vp, cc_blend;
 
-	batch->ptr = batch->buffer + 1024;
-	batch_alloc(batch, 64, 64);
-	wm_table  = gen6_bind_surfaces(batch, src, dst);
 	wm_kernel = gen6_create_kernel(batch);
 	wm_state  = gen6_create_sampler(batch,
 					SAMPLER_FILTER_NEAREST,
@@ -550,8 +546,6 @@ void gen6_render_copyfunc(struct intel_batchbuffer *batch,
 	cc_vp = gen6_create_cc_viewport(batch);
 	cc_blend = gen6_create_cc_blend(batch);
 
-	batch->ptr = batch->buffer;
-
 	gen6_emit_invariant(batch);
 	gen6_emit_state_base_address(batch);
 
@@ -565,35 +559,122 @@ void gen6_render_copyfunc(struct intel_batchbuffer *batch,
 	gen6_emit_wm_constants(batch);
 	gen6_emit_null_depth_buffer(batch);
 
-	gen6_emit_drawing_rectangle(batch, dst);
 	gen6_emit_cc(batch, cc_blend);
 	gen6_emit_sampler(batch, wm_state);
 	gen6_emit_sf(batch);
 	gen6_emit_wm(batch, wm_kernel);
 	gen6_emit_vertex_elements(batch);
-	gen6_emit_binding_table(batch, wm_table);
+}
+
+/* How many of the copies the rest of the batch has room for */
+static int
+gen6_copies_fit(struct intel_batchbuffer *batch,
+		const struct render_copy *copies, int count)
+{
+	unsigned int space = intel_batchbuffer_space(batch);
+	unsigned int used = 0;
+	int n;
+
+	for (n = 0; n < count; n++) {
+		if (n == 0 ||
+		    copies[n].src != copies[n-1].src ||
+		    copies[n].dst != copies[n-1].dst)
+			used += GEN6_COPY_SPACE;
+		else
+			used += 3 * VERTEX_SIZE;
+		if (used > space)
+			break;
+	}
 
-	gen6_emit_vertex_buffer(batch);
-	offset = gen6_emit_primitive(batch);
+	return n;
+}
 
-	OUT_BATCH(MI_BATCH_BUFFER_END);
-	batch_end = batch_align(batch, 8);
+/*
+ * Adds as many of the copies as fit to the batch without submitting them,
+ * and returns how many.  The pipeline is set up by the first copy in a
+ * batch and the state its copies have in common is only there once, so
+ * the following ones just add surfaces, vertices and the primitive.  The
+ * vertices all go into one buffer, and copies between the same buffers
+ * into one primitive.  Anything else in the batch is flushed first.
+ */
+static int
+gen6_emit_copies(struct intel_batchbuffer *batch,
+		 const struct render_copy *copies, int count)
+{
+	uint32_t vb;
+	int first, n, i, run;
 
-	*(uint32_t*)(batch->buffer + offset) =
-		batch_round_upto(batch, VERTEX_SIZE)/VERTEX_SIZE;
+	assert(batch->size - BATCH_RESERVED >= GEN6_PIPELINE_SPACE);
 
-	emit_vertex_2s(batch, dst_x + width, dst_y + height);
-	emit_vertex_normalized(batch, src_x + width, buf_width(src));
-	emit_vertex_normalized(batch, src_y + height, buf_height(src));
+	if (batch->pipeline != gen6_pipeline)
+		intel_batchbuffer_flush(batch);
+	else if (intel_batchbuffer_space(batch) < GEN6_COPY_SPACE)
+		intel_batchbuffer_flush_on_ring(batch, I915_EXEC_RENDER);
+
+	first = batch->pipeline != gen6_pipeline;
+	if (first) {
+		gen6_emit_pipeline(batch);
+		batch->pipeline = gen6_pipeline;
+	}
 
-	emit_vertex_2s(batch, dst_x, dst_y + height);
-	emit_vertex_normalized(batch, src_x, buf_width(src));
-	emit_vertex_normalized(batch, src_y + height, buf_height(src));
+	n = gen6_copies_fit(batch, copies, count);
+	assert(n > 0);
 
-	emit_vertex_2s(batch, dst_x, dst_y);
-	emit_vertex_normalized(batch, src_x, buf_width(src));
-	emit_vertex_normalized(batch, src_y, buf_height(src));
+	if (!first)
+		gen6_emit_flush(batch);
+
+	vb = gen6_create_vertex_buffer(batch, copies, n);
+	gen6_emit_vertex_buffer(batch, vb, n);
+
+	for (i = 0; i < n; i += run) {
+		run = render_copy_run(copies + i, n - i);
+
+		if (i)
+			gen6_emit_flush(batch);
+		gen6_emit_drawing_rectangle(batch, copies[i].dst);
+		gen6_emit_binding_table(batch,
+					gen6_bind_surfaces(batch,
+							   copies[i].src,
+							   copies[i].dst));
+		gen6_emit_primitive(batch, i, run);
+	}
+
+	return n;
+}
+
+/*
+ * Adds a copy to the batch without submitting it, see gen6_emit_copies().
+ * The copies go to the GPU with intel_batchbuffer_flush_on_ring(batch,
+ * I915_EXEC_RENDER), or when the batch is full.
+ */
+void gen6_render_copy_emit(struct intel_batchbuffer *batch,
+			   struct scratch_buf *src, unsigned src_x, unsigned src_y,
+			   unsigned width, unsigned height,
+			   struct scratch_buf *dst, unsigned dst_x, unsigned dst_y)
+{
+	struct render_copy copy = {
+		src, src_x, src_y, width, height, dst, dst_x, dst_y
+	};
+
+	gen6_emit_copies(batch, &copy, 1);
+}
+
+void gen6_render_copyfunc(struct intel_batchbuffer *batch,
+			  struct scratch_buf *src, unsigned src_x, unsigned src_y,
+			  unsigned width, unsigned height,
+			  struct scratch_buf *dst, unsigned dst_x, unsigned dst_y)
+{
+	gen6_render_copy_emit(batch, src, src_x, src_y, width, height,
+			      dst, dst_x, dst_y);
+	intel_batchbuffer_flush_on_ring(batch, I915_EXEC_RENDER);
+}
+
+void gen6_render_copyvfunc(struct intel_batchbuffer *batch,
+			   const struct render_copy *copies, int count)
+{
+	int n;
 
-	gen6_render_flush(batch, batch_end);
-	intel_batchbuffer_reset(batch);
+	for (; count > 0; copies += n, count -= n)
+		n = gen6_emit_copies(batch, copies, count);
+	intel_batchbuffer_flush_on_ring(batch, I915_EXEC_RENDER);
 }
@@ -3,7 +3,19 @@
 
 #include <assert.h>
 
-#define ALIGN(x, y) (((x) + (y)-1) & ~((y)-1))
+/*
+ * Room a copy needs in a batch: the first sets up the pipeline, the ones
+ * following it only add surfaces, vertices and the primitive, and further
+ * copies between the same buffers just their vertices.
+ */
+#define GEN7_PIPELINE_SPACE 1536
+#define GEN7_COPY_SPACE 320
+
+/* x,y and s,t as shorts */
+#define VERTEX_SIZE (4*2)
+
+/* batch->pipeline of a batch set up for copies */
+static const char gen7_pipeline[] = "gen7 render copy";
 
 static const uint32_t ps_kernel[][4] = {
 	{ 0x0080005a, 0x2e2077bd, 0x000000c0, 0x008d0040 },
@@ -16,27 +28,10 @@ static const uint32_t ps_kernel[][4] = {
 	{ 0x05800031, 0x20001fa8, 0x008d0e20, 0x90031000 },
 };
 
-static uint32_t
-batch_used(struct intel_batchbuffer *batch)
-{
-	return batch->state - batch->buffer;
-}
-
-static uint32_t
-batch_align(struct intel_batchbuffer *batch, uint32_t align)
-{
-	uint32_t offset = batch_used(batch);
-	offset = ALIGN(offset, align);
-	batch->state = batch->buffer + offset;
-	return offset;
-}
-
 static void *
 batch_alloc(struct intel_batchbuffer *batch, uint32_t size, uint32_t align)
 {
-	uint32_t offset = batch_align(batch, align);
-	batch->state += size;
-	return memset(batch->buffer + offset, 0, size);
+	return memset(intel_batchbuffer_state_alloc(batch, size, align), 0, size);
 }
 
 static uint32_t
@@ -45,24 +40,6 @@ batch_offset(struct intel_batchbuffer *batch, void *ptr)
 	return (uint8_t *)ptr - batch->buffer;
 }
 
-static uint32_t
-batch_copy(struct intel_batchbuffer *batch, const void *ptr, uint32_t size, uint32_t align)
-{
-	return batch_offset(batch, memcpy(batch_alloc(batch, size, align), ptr, size));
-}
-
-static void
-gen7_render_flush(struct intel_batchbuffer *batch, uint32_t batch_end)
-{
-	int ret;
-
-	ret = drm_intel_bo_subdata(batch->bo, 0, 4096, batch->buffer);
-	if (ret == 0)
-		ret = drm_intel_bo_mrb_exec(batch->bo, batch_end,
-					    NULL, 0, 0, 0);
-	assert(ret == 0);
-}
-
 static uint32_t
 gen7_tiling_bits(uint32_t tiling)
 {
@@ -80,9 +57,8 @@ gen7_bind_buf(struct intel_batchbuffer *batch,
 	      uint32_t format,
 	      int is_dst)
 {
-	uint32_t *ss;
+	uint32_t ss[8];
 	uint32_t write_domain, read_domain;
-	int ret;
 
 	if (is_dst) {
 		write_domain = read_domain = I915_GEM_DOMAIN_RENDER;
@@ -91,12 +67,10 @@ gen7_bind_buf(struct intel_batchbuffer *batch,
 		read_domain = I915_GEM_DOMAIN_SAMPLER;
 	}
 
-	ss = batch_alloc(batch, sizeof(*ss), 32);
-
 	ss[0] = (GEN7_SURFACE_2D << GEN7_SURFACE_TYPE_SHIFT |
 		 gen7_tiling_bits(buf->tiling) |
 		format << GEN7_SURFACE_FORMAT_SHIFT);
-	ss[1] = buf->bo->offset;
+	ss[1] = 0; /* relocated */
 	ss[2] = ((buf_width(buf) - 1)  << GEN7_SURFACE_WIDTH_SHIFT |
 		 (buf_height(buf) - 1) << GEN7_SURFACE_HEIGHT_SHIFT);
 	ss[3] = (buf->stride - 1) << GEN7_SURFACE_PITCH_SHIFT;
@@ -107,13 +81,9 @@ gen7_bind_buf(struct intel_batchbuffer *batch,
 	if (IS_HASWELL(batch->devid))
 		ss[7] |= HSW_SURFACE_SWIZZLE(RED, GREEN, BLUE, ALPHA);
 
-	ret = drm_intel_bo_emit_reloc(batch->bo,
-				      batch_offset(batch, ss) + 4,
-				      buf->bo, 0,
-				      read_domain, write_domain);
-	assert(ret == 0);
-
-	return batch_offset(batch, ss);
+	return intel_batchbuffer_state_reloc(batch, ss, sizeof(ss), 32, 4,
+					     buf->bo, 0,
+					     read_domain, write_domain);
 }
 
 static void
@@ -152,49 +122,43 @@ gen7_emit_vertex_elements(struct intel_batchbuffer *batch)
 
 static uint32_t
 gen7_create_vertex_buffer(struct intel_batchbuffer *batch,
-			  uint32_t src_x, uint32_t src_y,
-			  uint32_t dst_x, uint32_t dst_y,
-			  uint32_t width, uint32_t height)
+			  const struct render_copy *copies, int count)
 {
-	uint16_t *v;
+	uint16_t *v, *vb;
+	int i;
 
-	v = batch_alloc(batch, 12*sizeof(*v), 8);
+	vb = batch_alloc(batch, 3 * count * VERTEX_SIZE, 8);
 
-	v[0] = dst_x + width;
-	v[1] = dst_y + height;
-	v[2] = src_x + width;
-	v[3] = src_y + height;
+	for (v = vb, i = 0; i < count; i++, v += 12) {
+		const struct render_copy *c = &copies[i];
 
-	v[4] = dst_x;
-	v[5] = dst_y + height;
-	v[6] = src_x;
-	v[7] = src_y + height;
+		v[0] = c->dst_x + c->width;
+		v[1] = c->dst_y + c->height;
+		v[2] = c->src_x + c->width;
+		v[3] = c->src_y + c->height;
 
-	v[8] = dst_x;
-	v[9] = dst_y;
-	v[10] = src_x;
-	v[11] = src_y;
+		v[4] = c->dst_x;
+		v[5] = c->dst_y + c->height;
+		v[6] = c->src_x;
+		v[7] = c->src_y + c->height;
 
-	return batch_offset(batch, v);
+		v[8] = c->dst_x;
+		v[9] = c->dst_y;
+		v[10] = c->src_x;
+		v[11] = c->src_y;
+	}
+
+	return batch_offset(batch, vb);
 }
 
 static void gen7_emit_vertex_buffer(struct intel_batchbuffer *batch,
-				    int src_x, int src_y,
-				    int dst_x, int dst_y,
-				    int width, int height)
+				    uint32_t offset)
 {
-	uint32_t offset;
-
-	offset = gen7_create_vertex_buffer(batch,
-					   src_x, src_y,
-					   dst_x, dst_y,
-					   width, height);
-
 	OUT_BATCH(GEN7_3DSTATE_VERTEX_BUFFERS | (5 - 2));
 	OUT_BATCH(0 << GEN7_VB0_BUFFER_INDEX_SHIFT |
 		  GEN7_VB0_VERTEXDATA |
 		  GEN7_VB0_ADDRESS_MODIFY_ENABLE |
-		  4*2 << GEN7_VB0_BUFFER_PITCH_SHIFT);
+		  VERTEX_SIZE << GEN7_VB0_BUFFER_PITCH_SHIFT);
 
 	OUT_RELOC(batch->bo, I915_GEM_DOMAIN_VERTEX, 0, offset);
 	OUT_BATCH(~0);
@@ -206,16 +170,15 @@ gen7_bind_surfaces(struct intel_batchbuffer *batch,
 		   struct scratch_buf *src,
 		   struct scratch_buf *dst)
 {
-	uint32_t *binding_table;
-
-	binding_table = batch_alloc(batch, 8, 32);
+	uint32_t binding_table[2];
 
 	binding_table[0] =
 		gen7_bind_buf(batch, dst, GEN7_SURFACEFORMAT_B8G8R8A8_UNORM, 1);
 	binding_table[1] =
 		gen7_bind_buf(batch, src, GEN7_SURFACEFORMAT_B8G8R8A8_UNORM, 0);
 
-	return batch_offset(batch, binding_table);
+	return intel_batchbuffer_state_copy(batch, binding_table,
+					    sizeof(binding_table), 32);
 }
 
 static void
@@ -239,17 +202,16 @@ gen7_emit_drawing_rectangle(struct intel_batchbuffer *batch, struct scratch_buf
 static uint32_t
 gen7_create_blend_state(struct intel_batchbuffer *batch)
 {
-	struct gen7_blend_state *blend;
+	struct gen7_blend_state blend;
 
-	blend = batch_alloc(batch, sizeof(*blend), 64);
+	memset(&blend, 0, sizeof(blend));
+	blend.blend0.dest_blend_factor = GEN7_BLENDFACTOR_ZERO;
+	blend.blend0.source_blend_factor = GEN7_BLENDFACTOR_ONE;
+	blend.blend0.blend_func = GEN7_BLENDFUNCTION_ADD;
+	blend.blend1.post_blend_clamp_enable = 1;
+	blend.blend1.pre_blend_clamp_enable = 1;
 
-	blend->blend0.dest_blend_factor = GEN7_BLENDFACTOR_ZERO;
-	blend->blend0.source_blend_factor = GEN7_BLENDFACTOR_ONE;
-	blend->blend0.blend_func = GEN7_BLENDFUNCTION_ADD;
-	blend->blend1.post_blend_clamp_enable = 1;
-	blend->blend1.pre_blend_clamp_enable = 1;
-
-	return batch_offset(batch, blend);
+	return intel_batchbuffer_state_copy(batch, &blend, sizeof(blend), 64);
 }
 
 static void
@@ -271,13 +233,13 @@ gen7_emit_state_base_address(struct intel_batchbuffer *batch)
 static uint32_t
 gen7_create_cc_viewport(struct intel_batchbuffer *batch)
 {
-	struct gen7_cc_viewport *vp;
+	struct gen7_cc_viewport vp;
 
-	vp = batch_alloc(batch, sizeof(*vp), 32);
-	vp->min_depth = -1.e35;
-	vp->max_depth = 1.e35;
+	memset(&vp, 0, sizeof(vp));
+	vp.min_depth = -1.e35;
+	vp.max_depth = 1.e35;
 
-	return batch_offset(batch, vp);
+	return intel_batchbuffer_state_copy(batch, &vp, sizeof(vp), 32);
 }
 
 static void
@@ -293,20 +255,19 @@ gen7_emit_cc(struct intel_batchbuffer *batch)
 static uint32_t
 gen7_create_sampler(struct intel_batchbuffer *batch)
 {
-	struct gen7_sampler_state *ss;
-
-	ss = batch_alloc(batch, sizeof(*ss), 32);
+	struct gen7_sampler_state ss;
 
-	ss->ss0.min_filter = GEN7_MAPFILTER_NEAREST;
-	ss->ss0.mag_filter = GEN7_MAPFILTER_NEAREST;
+	memset(&ss, 0, sizeof(ss));
+	ss.ss0.min_filter = GEN7_MAPFILTER_NEAREST;
+	ss.ss0.mag_filter = GEN7_MAPFILTER_NEAREST;
 
-	ss->ss3.r_wrap_mode = GEN7_TEXCOORDMODE_CLAMP;
-	ss->ss3.s_wrap_mode = GEN7_TEXCOORDMODE_CLAMP;
-	ss->ss3.t_wrap_mode = GEN7_TEXCOORDMODE_CLAMP;
+	ss.ss3.r_wrap_mode = GEN7_TEXCOORDMODE_CLAMP;
+	ss.ss3.s_wrap_mode = GEN7_TEXCOORDMODE_CLAMP;
+	ss.ss3.t_wrap_mode = GEN7_TEXCOORDMODE_CLAMP;
 
-	ss->ss3.non_normalized_coord = 1;
+	ss.ss3.non_normalized_coord = 1;
 
-	return batch_offset(batch, ss);
+	return intel_batchbuffer_state_copy(batch, &ss, sizeof(ss), 32);
 }
 
 static void
@@ -461,7 +422,8 @@ gen7_emit_ps(struct intel_batchbuffer *batch)
 		threads = 40 << IVB_PS_MAX_THREADS_SHIFT;
 
 	OUT_BATCH(GEN7_3DSTATE_PS | (8 - 2));
-	OUT_BATCH(batch_copy(batch, ps_kernel, sizeof(ps_kernel), 64));
+	OUT_BATCH(intel_batchbuffer_state_copy(batch, ps_kernel,
+					       sizeof(ps_kernel), 64));
 	OUT_BATCH(1 << GEN7_PS_SAMPLER_COUNT_SHIFT |
 		  2 << GEN7_PS_BINDING_TABLE_ENTRY_COUNT_SHIFT);
 	OUT_BATCH(0); /* scratch address */
@@ -511,18 +473,21 @@ gen7_emit_null_depth_buffer(struct intel_batchbuffer *batch)
         OUT_BATCH(0);
 }
 
-#define BATCH_STATE_SPLIT 2048
-void gen7_render_copyfunc(struct intel_batchbuffer *batch,
-			  struct scratch_buf *src, unsigned src_x, unsigned src_y,
-			  unsigned width, unsigned height,
-			  struct scratch_buf *dst, unsigned dst_x, unsigned dst_y)
+/* Between copies: the next may read what the last one wrote */
+static void
+gen7_emit_flush(struct intel_batchbuffer *batch)
 {
-	uint32_t batch_end;
-
-	intel_batchbuffer_flush(batch);
-
-	batch->state = &batch->buffer[BATCH_STATE_SPLIT];
+	OUT_BATCH(GEN7_PIPE_CONTROL | (4 - 2));
+	OUT_BATCH(GEN7_PIPE_CONTROL_WC_FLUSH |
+		  GEN7_PIPE_CONTROL_TC_FLUSH |
+		  GEN7_PIPE_CONTROL_CS_STALL);
+	OUT_BATCH(0);
+	OUT_BATCH(0);
+}
 
+static void
+gen7_emit_pipeline(struct intel_batchbuffer *batch)
+{
 	OUT_BATCH(GEN7_PIPELINE_SELECT | PIPELINE_SELECT_3D);
 
 	gen7_emit_state_base_address(batch);
@@ -540,29 +505,130 @@ void gen7_render_copyfunc(struct intel_batchbuffer *batch,
 	gen7_emit_null_depth_buffer(batch);
 
 	gen7_emit_cc(batch);
-        gen7_emit_sampler(batch);
-        gen7_emit_sbe(batch);
-        gen7_emit_ps(batch);
-        gen7_emit_vertex_elements(batch);
-        gen7_emit_vertex_buffer(batch,
-				src_x, src_y, dst_x, dst_y, width, height);
-	gen7_emit_binding_table(batch, src, dst);
-	gen7_emit_drawing_rectangle(batch, dst);
-
-        OUT_BATCH(GEN7_3DPRIMITIVE | (7- 2));
-        OUT_BATCH(GEN7_3DPRIMITIVE_VERTEX_SEQUENTIAL | _3DPRIM_RECTLIST);
-        OUT_BATCH(3);
-        OUT_BATCH(0);
-        OUT_BATCH(1);   /* single instance */
-        OUT_BATCH(0);   /* start instance location */
-        OUT_BATCH(0);   /* index buffer offset, ignored */
-
-	OUT_BATCH(MI_BATCH_BUFFER_END);
-
-	batch_end = batch->ptr - batch->buffer;
-	batch_end = ALIGN(batch_end, 8);
-	assert(batch_end < BATCH_STATE_SPLIT);
-
-	gen7_render_flush(batch, batch_end);
-	intel_batchbuffer_reset(batch);
+	gen7_emit_sampler(batch);
+	gen7_emit_sbe(batch);
+	gen7_emit_ps(batch);
+	gen7_emit_vertex_elements(batch);
+}
+
+static void
+gen7_emit_primitive(struct intel_batchbuffer *batch, int start, int count)
+{
+	OUT_BATCH(GEN7_3DPRIMITIVE | (7- 2));
+	OUT_BATCH(GEN7_3DPRIMITIVE_VERTEX_SEQUENTIAL | _3DPRIM_RECTLIST);
+	OUT_BATCH(3 * count);
+	OUT_BATCH(3 * start);
+	OUT_BATCH(1);   /* single instance */
+	OUT_BATCH(0);   /* start instance location */
+	OUT_BATCH(0);   /* index buffer offset, ignored */
+}
+
+/* How many of the copies the rest of the batch has room for */
+static int
+gen7_copies_fit(struct intel_batchbuffer *batch,
+		const struct render_copy *copies, int count)
+{
+	unsigned int space = intel_batchbuffer_space(batch);
+	unsigned int used = 0;
+	int n;
+
+	for (n = 0; n < count; n++) {
+		if (n == 0 ||
+		    copies[n].src != copies[n-1].src ||
+		    copies[n].dst != copies[n-1].dst)
+			used += GEN7_COPY_SPACE;
+		else
+			used += 3 * VERTEX_SIZE;
+		if (used > space)
+			break;
+	}
+
+	return n;
+}
+
+/*
+ * Adds as many of the copies as fit to the batch without submitting them,
+ * and returns how many.  The pipeline is set up by the first copy in a
+ * batch and the state its copies have in common is only there once, so
+ * the following ones just add surfaces, vertices and the primitive.  The
+ * vertices all go into one buffer, and copies between the same buffers
+ * into one primitive.  Anything else in the batch is flushed first.
+ */
+static int
+gen7_emit_copies(struct intel_batchbuffer *batch,
+		 const struct render_copy *copies, int count)
+{
+	uint32_t vb;
+	int first, n, i, run;
+
+	assert(batch->size - BATCH_RESERVED >= GEN7_PIPELINE_SPACE);
+
+	if (batch->pipeline != gen7_pipeline)
+		intel_batchbuffer_flush(batch);
+	else if (intel_batchbuffer_space(batch) < GEN7_COPY_SPACE)
+		intel_batchbuffer_flush_on_ring(batch, I915_EXEC_RENDER);
+
+	first = batch->pipeline != gen7_pipeline;
+	if (first) {
+		gen7_emit_pipeline(batch);
+		batch->pipeline = gen7_pipeline;
+	}
+
+	n = gen7_copies_fit(batch, copies, count);
+	assert(n > 0);
+
+	if (!first)
+		gen7_emit_flush(batch);
+
+	vb = gen7_create_vertex_buffer(batch, copies, n);
+	gen7_emit_vertex_buffer(batch, vb);
+
+	for (i = 0; i < n; i += run) {
+		run = render_copy_run(copies + i, n - i);
+
+		if (i)
+			gen7_emit_flush(batch);
+		gen7_emit_binding_table(batch, copies[i].src, copies[i].dst);
+		gen7_emit_drawing_rectangle(batch, copies[i].dst);
+		gen7_emit_primitive(batch, i, run);
+	}
+
+	return n;
+}
+
+/*
+ * Adds a copy to the batch without submitting it, see gen7_emit_copies().
+ * The copies go to the GPU with intel_batchbuffer_flush_on_ring(batch,
+ * I915_EXEC_RENDER), or when the batch is full.
+ */
+void gen7_render_copy_emit(struct intel_batchbuffer *batch,
+			   struct scratch_buf *src, unsigned src_x, unsigned src_y,
+			   unsigned width, unsigned height,
+			   struct scratch_buf *dst, unsigned dst_x, unsigned dst_y)
+{
+	struct render_copy copy = {
+		src, src_x, src_y, width, height, dst, dst_x, dst_y
+	};
+
+	gen7_emit_copies(batch, &copy, 1);
+}
+
+void gen7_render_copyfunc(struct intel_batchbuffer *batch,
+			  struct scratch_buf *src, unsigned src_x, unsigned src_y,
+			  unsigned width, unsigned height,
+			  struct scratch_buf *dst, unsigned dst_x, unsigned dst_y)
+{
+	gen7_render_copy_emit(batch, src, src_x, src_y, width, height,
+			      dst, dst_x, dst_y);
+	intel_batchbuffer_flush_on_ring(batch, I915_EXEC_RENDER);
+}
+
+void gen7_render_copyvfunc(struct intel_batchbuffer *batch,
+			   const struct render_copy *copies, int count)
+{
+	int n;
+
+	for (; count > 0; copies += n, count -= n)
+		n = gen7_emit_copies(batch, copies, count);
+	intel_batchbuffer_flush_on_ring(batch, I915_EXEC_RENDER);
 }
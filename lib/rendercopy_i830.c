@@ -54,6 +54,14 @@
 #define TB0A_ARG1_SEL_TEXEL2		(8 << 6)
 #define TB0A_ARG1_SEL_TEXEL3		(9 << 6)
 
+/*
+ * Room the setup of a batch of copies needs, and a run of copies between
+ * the same buffers in addition to its rectangles.
+ */
+#define GEN2_SETUP_SPACE 256
+#define GEN2_COPY_SPACE 128
+#define GEN2_RECT_SPACE (3*4*4)
+
 
 static void gen2_emit_invariant(struct intel_batchbuffer *batch)
 {
@@ -190,17 +198,8 @@ static void gen2_emit_copy_pipeline(struct intel_batchbuffer *batch)
 		  TB0A_OP_ARG1 | TB0A_ARG1_SEL_TEXEL0);
 }
 
-void gen2_render_copyfunc(struct intel_batchbuffer *batch,
-			  struct scratch_buf *src, unsigned src_x, unsigned src_y,
-			  unsigned width, unsigned height,
-			  struct scratch_buf *dst, unsigned dst_x, unsigned dst_y)
+static void gen2_emit_vertex_format(struct intel_batchbuffer *batch)
 {
-	gen2_emit_invariant(batch);
-	gen2_emit_copy_pipeline(batch);
-
-	gen2_emit_target(batch, dst);
-	gen2_emit_texture(batch, src, 0);
-
 	OUT_BATCH(_3DSTATE_LOAD_STATE_IMMEDIATE_1 |
 		  I1_LOAD_S(2) | I1_LOAD_S(3) | I1_LOAD_S(8) | 2);
 	OUT_BATCH(1<<12);
@@ -208,26 +207,93 @@ void gen2_render_copyfunc(struct intel_batchbuffer *batch,
 	OUT_BATCH(S8_ENABLE_COLOR_BUFFER_WRITE);
 
 	OUT_BATCH(_3DSTATE_VERTEX_FORMAT_2_CMD | TEXCOORDFMT_2D << 0);
+}
 
-	OUT_BATCH(PRIM3D_INLINE | PRIM3D_RECTLIST | (3*4 -1));
-	emit_vertex(batch, dst_x + width);
-	emit_vertex(batch, dst_y + height);
-	emit_vertex_normalized(batch, src_x + width, buf_width(src));
-	emit_vertex_normalized(batch, src_y + height, buf_height(src));
+static void gen2_emit_rects(struct intel_batchbuffer *batch,
+			    const struct render_copy *copies, int count)
+{
+	int i;
 
-	emit_vertex(batch, dst_x);
-	emit_vertex(batch, dst_y + height);
-	emit_vertex_normalized(batch, src_x, buf_width(src));
-	emit_vertex_normalized(batch, src_y + height, buf_height(src));
+	OUT_BATCH(PRIM3D_INLINE | PRIM3D_RECTLIST | (3*4*count -1));
+	for (i = 0; i < count; i++) {
+		const struct render_copy *c = &copies[i];
+		struct scratch_buf *src = c->src;
+
+		emit_vertex(batch, c->dst_x + c->width);
+		emit_vertex(batch, c->dst_y + c->height);
+		emit_vertex_normalized(batch, c->src_x + c->width, buf_width(src));
+		emit_vertex_normalized(batch, c->src_y + c->height, buf_height(src));
+
+		emit_vertex(batch, c->dst_x);
+		emit_vertex(batch, c->dst_y + c->height);
+		emit_vertex_normalized(batch, c->src_x, buf_width(src));
+		emit_vertex_normalized(batch, c->src_y + c->height, buf_height(src));
+
+		emit_vertex(batch, c->dst_x);
+		emit_vertex(batch, c->dst_y);
+		emit_vertex_normalized(batch, c->src_x, buf_width(src));
+		emit_vertex_normalized(batch, c->src_y, buf_height(src));
+	}
+}
 
-	emit_vertex(batch, dst_x);
-	emit_vertex(batch, dst_y);
-	emit_vertex_normalized(batch, src_x, buf_width(src));
-	emit_vertex_normalized(batch, src_y, buf_height(src));
+/*
+ * Same as gen3_render_copyvfunc(): the state is set up once per batch, and
+ * each run of copies between the same buffers adds its target, texture and
+ * one primitive for all their rectangles, after a flush.
+ */
+void gen2_render_copyvfunc(struct intel_batchbuffer *batch,
+			   const struct render_copy *copies, int count)
+{
+	int setup = 0;
+	int i, n;
+
+	for (i = 0; i < count; i += n) {
+		unsigned int space;
+
+		if (setup &&
+		    intel_batchbuffer_space(batch) < GEN2_COPY_SPACE + GEN2_RECT_SPACE) {
+			intel_batchbuffer_flush(batch);
+			setup = 0;
+		}
+
+		if (!setup) {
+			intel_batchbuffer_require_space(batch, GEN2_SETUP_SPACE +
+							GEN2_COPY_SPACE +
+							GEN2_RECT_SPACE);
+			gen2_emit_invariant(batch);
+			gen2_emit_copy_pipeline(batch);
+			gen2_emit_vertex_format(batch);
+		}
+
+		space = intel_batchbuffer_space(batch) - GEN2_COPY_SPACE;
+		n = render_copy_run(copies + i, count - i);
+		if (n > space / GEN2_RECT_SPACE)
+			n = space / GEN2_RECT_SPACE;
+
+		if (setup)
+			OUT_BATCH(MI_FLUSH | MI_INVALIDATE_MAP_CACHE);
+		setup = 1;
+
+		gen2_emit_target(batch, copies[i].dst);
+		gen2_emit_texture(batch, copies[i].src, 0);
+		gen2_emit_rects(batch, copies + i, n);
+	}
 
 	intel_batchbuffer_flush(batch);
 }
 
+void gen2_render_copyfunc(struct intel_batchbuffer *batch,
+			  struct scratch_buf *src, unsigned src_x, unsigned src_y,
+			  unsigned width, unsigned height,
+			  struct scratch_buf *dst, unsigned dst_x, unsigned dst_y)
+{
+	struct render_copy copy = {
+		src, src_x, src_y, width, height, dst, dst_x, dst_y
+	};
+
+	gen2_render_copyvfunc(batch, &copy, 1);
+}
+
 render_copyfunc_t get_render_copyfunc(int devid)
 {
 	render_copyfunc_t copy = NULL;
@@ -243,3 +309,19 @@ render_copyfunc_t get_render_copyfunc(int devid)
 
 	return copy;
 }
+
+render_copyvfunc_t get_render_copyvfunc(int devid)
+{
+	render_copyvfunc_t copy = NULL;
+
+	if (IS_GEN2(devid))
+		copy = gen2_render_copyvfunc;
+	else if (IS_GEN3(devid))
+		copy = gen3_render_copyvfunc;
+	else if (IS_GEN6(devid))
+		copy = gen6_render_copyvfunc;
+	else if (IS_GEN7(devid))
+		copy = gen7_render_copyvfunc;
+
+	return copy;
+}
@@ -2,10 +2,15 @@
 #include "i915_3d.h"
 #include "rendercopy.h"
 
-void gen3_render_copyfunc(struct intel_batchbuffer *batch,
-			  struct scratch_buf *src, unsigned src_x, unsigned src_y,
-			  unsigned width, unsigned height,
-			  struct scratch_buf *dst, unsigned dst_x, unsigned dst_y)
+/*
+ * Room the setup of a batch of copies needs, and a run of copies between
+ * the same buffers in addition to its rectangles.
+ */
+#define GEN3_SETUP_SPACE 256
+#define GEN3_COPY_SPACE 128
+#define GEN3_RECT_SPACE (3*4*4)
+
+static void gen3_emit_invariant(struct intel_batchbuffer *batch)
 {
 	/* invariant state */
 	{
@@ -62,7 +67,11 @@ void gen3_render_copyfunc(struct intel_batchbuffer *batch,
 		OUT_BATCH(0x00000000);
 		OUT_BATCH(_3DSTATE_BACKFACE_STENCIL_OPS | BFO_ENABLE_STENCIL_TWO_SIDE | 0);
 	}
+}
 
+static void gen3_emit_texture(struct intel_batchbuffer *batch,
+			      struct scratch_buf *src)
+{
 	/* samler state */
 	{
 #define TEX_COUNT 1
@@ -91,7 +100,11 @@ void gen3_render_copyfunc(struct intel_batchbuffer *batch,
 			  0 << SS3_TEXTUREMAP_INDEX_SHIFT);
 		OUT_BATCH(0x00000000);
 	}
+}
 
+static void gen3_emit_target(struct intel_batchbuffer *batch,
+			     struct scratch_buf *dst)
+{
 	/* render target state */
 	{
 		uint32_t tiling_bits = 0;
@@ -119,7 +132,10 @@ void gen3_render_copyfunc(struct intel_batchbuffer *batch,
 		/* yorig, xorig (relate to color buffer?) */
 		OUT_BATCH(0x00000000);
 	}
+}
 
+static void gen3_emit_copy_pipeline(struct intel_batchbuffer *batch)
+{
 	/* texfmt */
 	{
 		OUT_BATCH(_3DSTATE_LOAD_STATE_IMMEDIATE_1 |
@@ -159,22 +175,87 @@ void gen3_render_copyfunc(struct intel_batchbuffer *batch,
 			  (REG_NR(FS_T0) << T1_ADDRESS_REG_NR_SHIFT));
 		OUT_BATCH(0);
 	}
+}
+
+static void gen3_emit_rects(struct intel_batchbuffer *batch,
+			    const struct render_copy *copies, int count)
+{
+	int i;
+
+	OUT_BATCH(PRIM3D_RECTLIST | (3*4*count - 1));
+	for (i = 0; i < count; i++) {
+		const struct render_copy *c = &copies[i];
+
+		emit_vertex(batch, c->dst_x + c->width);
+		emit_vertex(batch, c->dst_y + c->height);
+		emit_vertex(batch, c->src_x + c->width);
+		emit_vertex(batch, c->src_y + c->height);
+
+		emit_vertex(batch, c->dst_x);
+		emit_vertex(batch, c->dst_y + c->height);
+		emit_vertex(batch, c->src_x);
+		emit_vertex(batch, c->src_y + c->height);
+
+		emit_vertex(batch, c->dst_x);
+		emit_vertex(batch, c->dst_y);
+		emit_vertex(batch, c->src_x);
+		emit_vertex(batch, c->src_y);
+	}
+}
+
+/*
+ * The state is set up once per batch, then each run of copies between the
+ * same buffers adds its texture, target and one primitive for all their
+ * rectangles, after a flush so that it sees what the runs before it wrote.
+ */
+void gen3_render_copyvfunc(struct intel_batchbuffer *batch,
+			   const struct render_copy *copies, int count)
+{
+	int setup = 0;
+	int i, n;
 
-	OUT_BATCH(PRIM3D_RECTLIST | (3*4 - 1));
-	emit_vertex(batch, dst_x + width);
-	emit_vertex(batch, dst_y + height);
-	emit_vertex(batch, src_x + width);
-	emit_vertex(batch, src_y + height);
+	for (i = 0; i < count; i += n) {
+		unsigned int space;
 
-	emit_vertex(batch, dst_x);
-	emit_vertex(batch, dst_y + height);
-	emit_vertex(batch, src_x);
-	emit_vertex(batch, src_y + height);
+		if (setup &&
+		    intel_batchbuffer_space(batch) < GEN3_COPY_SPACE + GEN3_RECT_SPACE) {
+			intel_batchbuffer_flush(batch);
+			setup = 0;
+		}
 
-	emit_vertex(batch, dst_x);
-	emit_vertex(batch, dst_y);
-	emit_vertex(batch, src_x);
-	emit_vertex(batch, src_y);
+		if (!setup) {
+			intel_batchbuffer_require_space(batch, GEN3_SETUP_SPACE +
+							GEN3_COPY_SPACE +
+							GEN3_RECT_SPACE);
+			gen3_emit_invariant(batch);
+			gen3_emit_copy_pipeline(batch);
+		}
+
+		space = intel_batchbuffer_space(batch) - GEN3_COPY_SPACE;
+		n = render_copy_run(copies + i, count - i);
+		if (n > space / GEN3_RECT_SPACE)
+			n = space / GEN3_RECT_SPACE;
+
+		if (setup)
+			OUT_BATCH(MI_FLUSH | MI_INVALIDATE_MAP_CACHE);
+		setup = 1;
+
+		gen3_emit_texture(batch, copies[i].src);
+		gen3_emit_target(batch, copies[i].dst);
+		gen3_emit_rects(batch, copies + i, n);
+	}
 
 	intel_batchbuffer_flush(batch);
 }
+
+void gen3_render_copyfunc(struct intel_batchbuffer *batch,
+			  struct scratch_buf *src, unsigned src_x, unsigned src_y,
+			  unsigned width, unsigned height,
+			  struct scratch_buf *dst, unsigned dst_x, unsigned dst_y)
+{
+	struct render_copy copy = {
+		src, src_x, src_y, width, height, dst, dst_x, dst_y
+	};
+
+	gen3_render_copyvfunc(batch, &copy, 1);
+}
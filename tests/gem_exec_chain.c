@@ -0,0 +1,118 @@
+/*
+ * Copyright © 2013 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+/** @file gem_exec_chain.c
+ *
+ * Builds a command stream many times the size of one batch bo with a
+ * chaining intel_batchbuffer, one blit per row, and checks that every row
+ * was copied after the single flush.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include "drm.h"
+#include "i915_drm.h"
+#include "drmtest.h"
+#include "intel_bufmgr.h"
+#include "intel_batchbuffer.h"
+#include "intel_gpu_tools.h"
+
+#define WIDTH 256
+#define HEIGHT 1024
+
+static drm_intel_bufmgr *bufmgr;
+struct intel_batchbuffer *batch;
+static uint32_t data[WIDTH * HEIGHT];
+
+static void
+copy_row(drm_intel_bo *dst, drm_intel_bo *src, int y)
+{
+	BEGIN_BATCH(8);
+	OUT_BATCH(XY_SRC_COPY_BLT_CMD |
+		  XY_SRC_COPY_BLT_WRITE_ALPHA |
+		  XY_SRC_COPY_BLT_WRITE_RGB);
+	OUT_BATCH((3 << 24) | /* 32 bits */
+		  (0xcc << 16) | /* copy ROP */
+		  WIDTH * 4);
+	OUT_BATCH(y << 16); /* dst x1,y1 */
+	OUT_BATCH(((y + 1) << 16) | WIDTH); /* dst x2,y2 */
+	OUT_RELOC(dst, I915_GEM_DOMAIN_RENDER, I915_GEM_DOMAIN_RENDER, 0);
+	OUT_BATCH(y << 16); /* src x1,y1 */
+	OUT_BATCH(WIDTH * 4);
+	OUT_RELOC(src, I915_GEM_DOMAIN_RENDER, 0, 0);
+	ADVANCE_BATCH();
+}
+
+int main(int argc, char **argv)
+{
+	drm_intel_bo *src, *dst;
+	int fd, i;
+
+	fd = drm_open_any();
+
+	bufmgr = drm_intel_bufmgr_gem_init(fd, 4096);
+	drm_intel_bufmgr_gem_enable_reuse(bufmgr);
+	batch = intel_batchbuffer_alloc_size(bufmgr, intel_get_drm_devid(fd),
+					     4096, 1);
+	assert(batch);
+
+	src = drm_intel_bo_alloc(bufmgr, "src", sizeof(data), 4096);
+	dst = drm_intel_bo_alloc(bufmgr, "dst", sizeof(data), 4096);
+
+	for (i = 0; i < WIDTH * HEIGHT; i++)
+		data[i] = i;
+	drm_intel_bo_subdata(src, 0, sizeof(data), data);
+	memset(data, 0, sizeof(data));
+	drm_intel_bo_subdata(dst, 0, sizeof(data), data);
+
+	/* 32 bytes a row, so about eight bos of commands */
+	for (i = 0; i < HEIGHT; i++)
+		copy_row(dst, src, i);
+	intel_batchbuffer_flush(batch);
+
+	drm_intel_bo_get_subdata(dst, 0, sizeof(data), data);
+	for (i = 0; i < WIDTH * HEIGHT; i++) {
+		if (data[i] != i) {
+			fprintf(stderr, "row %d: expected 0x%08x, found 0x%08x\n",
+				i / WIDTH, i, data[i]);
+			exit(1);
+		}
+	}
+
+	drm_intel_bo_unreference(src);
+	drm_intel_bo_unreference(dst);
+	intel_batchbuffer_free(batch);
+	drm_intel_bufmgr_destroy(bufmgr);
+
+	close(fd);
+
+	return 0;
+}
@@ -0,0 +1,147 @@
+/*
+ * Copyright © 2013 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+/** @file gem_render_batched_blits.c
+ *
+ * Copies lots of small rectangles between a few buffers with the batched
+ * render copy, in runs between the same buffers where later runs read what
+ * earlier ones wrote, and checks the buffers against the same copies done
+ * on the CPU.
+ */
+
+#include "rendercopy.h"
+
+#define WIDTH 256
+#define STRIDE (WIDTH*4)
+#define HEIGHT 256
+#define SIZE (HEIGHT*STRIDE)
+
+#define NUM_BUFS 4
+#define TILE 32
+#define NUM_COPIES ((WIDTH / TILE) * (HEIGHT / TILE))
+
+static uint32_t linear[WIDTH*HEIGHT];
+static uint32_t reference[NUM_BUFS][WIDTH*HEIGHT];
+static render_copyvfunc_t render_copyv;
+
+static void
+check_bo(int fd, int n, uint32_t handle)
+{
+	int i;
+
+	gem_read(fd, handle, 0, linear, sizeof(linear));
+	for (i = 0; i < WIDTH*HEIGHT; i++) {
+		if (linear[i] != reference[n][i]) {
+			fprintf(stderr, "Expected 0x%08x, found 0x%08x "
+				"at offset 0x%08x of buffer %d\n",
+				reference[n][i], linear[i], i * 4, n);
+			abort();
+		}
+	}
+}
+
+static void
+cpu_copy(const struct render_copy *copy, int src, int dst)
+{
+	unsigned x, y;
+
+	for (y = 0; y < copy->height; y++)
+		for (x = 0; x < copy->width; x++)
+			reference[dst][(copy->dst_y + y) * WIDTH + copy->dst_x + x] =
+				reference[src][(copy->src_y + y) * WIDTH + copy->src_x + x];
+}
+
+int main(int argc, char **argv)
+{
+	drm_intel_bufmgr *bufmgr;
+	struct intel_batchbuffer *batch;
+	struct scratch_buf buf[NUM_BUFS];
+	struct render_copy copies[NUM_COPIES];
+	uint32_t start = 0;
+	int i, j, fd, loop, loops;
+
+	fd = drm_open_any();
+
+	render_copyv = get_render_copyvfunc(intel_get_drm_devid(fd));
+	if (render_copyv == NULL) {
+		printf("no render-copy function, doing nothing\n");
+		return 77;
+	}
+
+	bufmgr = drm_intel_bufmgr_gem_init(fd, 4096);
+	batch = intel_batchbuffer_alloc(bufmgr, intel_get_drm_devid(fd));
+
+	loops = 0;
+	if (argc > 1)
+		loops = atoi(argv[1]);
+	if (loops <= 0)
+		loops = 64;
+
+	for (i = 0; i < NUM_BUFS; i++) {
+		buf[i].bo = drm_intel_bo_alloc(bufmgr, "", SIZE, 4096);
+		buf[i].stride = STRIDE;
+		buf[i].tiling = I915_TILING_NONE;
+		buf[i].size = SIZE;
+		for (j = 0; j < WIDTH*HEIGHT; j++)
+			reference[i][j] = start++;
+		gem_write(fd, buf[i].bo->handle, 0,
+			  reference[i], sizeof(reference[i]));
+	}
+
+	printf("%d loops of %d copies...\n", loops, NUM_COPIES);
+	for (loop = 0; loop < loops; loop++) {
+		int src = 0, dst = 0;
+
+		/*
+		 * Each copy writes its own tile of the destination, so none
+		 * of them overwrite another between the same buffers.
+		 */
+		for (i = 0; i < NUM_COPIES; i++) {
+			struct render_copy *copy = &copies[i];
+
+			if (i == 0 || random() % 8 == 0) {
+				src = random() % NUM_BUFS;
+				dst = (src + 1 + random() % (NUM_BUFS - 1)) % NUM_BUFS;
+			}
+
+			copy->src = &buf[src];
+			copy->dst = &buf[dst];
+			copy->width = 1 + random() % TILE;
+			copy->height = 1 + random() % TILE;
+			copy->src_x = random() % (WIDTH - copy->width + 1);
+			copy->src_y = random() % (HEIGHT - copy->height + 1);
+			copy->dst_x = i % (WIDTH / TILE) * TILE;
+			copy->dst_y = i / (WIDTH / TILE) * TILE;
+
+			cpu_copy(copy, src, dst);
+		}
+
+		render_copyv(batch, copies, NUM_COPIES);
+	}
+
+	for (i = 0; i < NUM_BUFS; i++)
+		check_bo(fd, i, buf[i].bo->handle);
+
+	return 0;
+}
@@ -318,25 +318,63 @@ static void blitter_copyfunc(struct scratch_buf *src, unsigned src_x, unsigned s
 	}
 }
 
+/* render copies are queued and go to the GPU together, see copy_tiles() */
+#define MAX_RENDER_COPIES	64
+static struct render_copy render_copies[MAX_RENDER_COPIES];
+static int num_render_copies = 0;
+
+static void flush_render_copies(void)
+{
+	static unsigned keep_gpu_busy_counter = 0;
+
+	if (num_render_copies == 0)
+		return;
+
+	/* check both edges of the fence usage */
+	if (keep_gpu_busy_counter & 1)
+		keep_gpu_busy();
+
+	get_render_copyvfunc(devid)(batch, render_copies, num_render_copies);
+	num_render_copies = 0;
+
+	if (!(keep_gpu_busy_counter & 1))
+		keep_gpu_busy();
+
+	keep_gpu_busy_counter++;
+	intel_batchbuffer_flush(batch);
+}
+
 static void render_copyfunc(struct scratch_buf *src, unsigned src_x, unsigned src_y,
 			    struct scratch_buf *dst, unsigned dst_x, unsigned dst_y,
 			    unsigned logical_tile_no)
 {
 	static unsigned keep_gpu_busy_counter = 0;
-	render_copyfunc_t rendercopy = get_render_copyfunc(devid);
+	struct render_copy *copy;
+
+	if (get_render_copyvfunc(devid)) {
+		if (num_render_copies == MAX_RENDER_COPIES)
+			flush_render_copies();
+
+		copy = &render_copies[num_render_copies++];
+		copy->src = src;
+		copy->src_x = src_x;
+		copy->src_y = src_y;
+		copy->width = options.tile_size;
+		copy->height = options.tile_size;
+		copy->dst = dst;
+		copy->dst_x = dst_x;
+		copy->dst_y = dst_y;
+		return;
+	}
 
 	/* check both edges of the fence usage */
 	if (keep_gpu_busy_counter & 1)
 		keep_gpu_busy();
 
-	if (rendercopy)
-		rendercopy(batch, src, src_x, src_y,
-		     options.tile_size, options.tile_size,
-		     dst, dst_x, dst_y);
-	else
-		blitter_copyfunc(src, src_x, src_y,
-				 dst, dst_x, dst_y,
-				 logical_tile_no);
+	blitter_copyfunc(src, src_x, src_y,
+			 dst, dst_x, dst_y,
+			 logical_tile_no);
+
 	if (!(keep_gpu_busy_counter & 1))
 		keep_gpu_busy();
 
@@ -595,11 +633,15 @@ static void copy_tiles(unsigned *permutation)
 		} else {
 			next_copyfunc(i);
 
+			/* the queued render copies go first, in order */
+			if (copyfunc != render_copyfunc)
+				flush_render_copies();
 			copyfunc(src_buf, src_x, src_y, dst_buf, dst_x, dst_y,
 				 i);
 		}
 	}
 
+	flush_render_copies();
 	intel_batchbuffer_flush(batch);
 }
 
@@ -843,6 +885,7 @@ static void check_render_copyfunc(void)
 		}
 
 		render_copyfunc(&src, sx, sy, &dst, dx, dy, 0);
+		flush_render_copies();
 
 		if (options.use_cpu_maps)
 			set_to_cpu_domain(&dst, 0);
@@ -25,8 +25,11 @@
  *
  */
 
+#define _GNU_SOURCE
 #include <errno.h>
 #include <fcntl.h>
+#include <ftw.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -74,53 +77,61 @@ static int tv_present;
 static int lvds_present;
 static int panel_type;
 
-static struct bdb_block *find_section(int section_id, int length)
+/* Every BDB block, indexed by block id; data is NULL for missing blocks */
+static struct bdb_block bdb_blocks[256];
+
+/*
+ * Walk the BDB once, recording where each block lives.  A block that
+ * doesn't fit in the BDB, or in the data we actually have, ends the walk.
+ * Only the first block with a given id is used.
+ */
+static void index_sections(struct bdb_header *header, int length,
+			   struct bdb_block *blocks)
 {
-	struct bdb_block *block;
-	unsigned char *base = (unsigned char *)bdb;
+	unsigned char *base = (unsigned char *)header;
 	int idx = 0;
-	uint16_t total, current_size;
+	int total;
+	uint16_t current_size;
 	unsigned char current_id;
 
+	memset(blocks, 0, 256 * sizeof(*blocks));
+
 	/* skip to first section */
-	idx += bdb->header_size;
-	total = bdb->bdb_size;
+	idx += header->header_size;
+	total = header->bdb_size;
 	if (total > length)
 		total = length;
 
-	block = malloc(sizeof(*block));
-	if (!block) {
-		fprintf(stderr, "out of memory\n");
-		exit(-1);
-	}
-
-	/* walk the sections looking for section_id */
 	while (idx + 3 < total) {
 		current_id = *(base + idx);
 		current_size = *(uint16_t *)(base + idx + 1);
-		if (idx + current_size > total)
-			return NULL;
-
-		if (current_id == section_id) {
-			block->id = current_id;
-			block->size = current_size;
-			block->data = base + idx + 3;
-			return block;
+		if (idx + 3 + current_size > total)
+			break;
+
+		if (!blocks[current_id].data) {
+			blocks[current_id].id = current_id;
+			blocks[current_id].size = current_size;
+			blocks[current_id].data = base + idx + 3;
 		}
 
 		idx += current_size + 3;
 	}
+}
 
-	free(block);
-	return NULL;
+static struct bdb_block *find_section(int section_id)
+{
+	if (!bdb_blocks[section_id].data)
+		return NULL;
+
+	return &bdb_blocks[section_id];
 }
 
-static void dump_general_features(int length)
+static void dump_general_features(void)
 {
 	struct bdb_general_features *features;
 	struct bdb_block *block;
 
-	block = find_section(BDB_GENERAL_FEATURES, length);
+	block = find_section(BDB_GENERAL_FEATURES);
 
 	if (!block)
 		return;
@@ -173,16 +184,15 @@ static void dump_general_features(int length)
 	tv_present = 1;		/* should be based on whether TV DAC exists */
 	lvds_present = 1;	/* should be based on IS_MOBILE() */
 
-	free(block);
 }
 
-static void dump_backlight_info(int length)
+static void dump_backlight_info(void)
 {
 	struct bdb_block *block;
 	struct bdb_lvds_backlight *backlight;
 	struct blc_struct *blc;
 
-	block = find_section(BDB_LVDS_BACKLIGHT, length);
+	block = find_section(BDB_LVDS_BACKLIGHT);
 
 	if (!block)
 		return;
@@ -345,7 +355,7 @@ static void dump_child_device(struct child_device_config *child)
 	}
 }
 
-static void dump_general_definitions(int length)
+static void dump_general_definitions(void)
 {
 	struct bdb_block *block;
 	struct bdb_general_definitions *defs;
@@ -353,7 +363,7 @@ static void dump_general_definitions(int length)
 	int i;
 	int child_device_num;
 
-	block = find_section(BDB_GENERAL_DEFINITIONS, length);
+	block = find_section(BDB_GENERAL_DEFINITIONS);
 
 	if (!block)
 		return;
@@ -374,17 +384,16 @@ static void dump_general_definitions(int length)
 	child_device_num = (block->size - sizeof(*defs)) / sizeof(*child);
 	for (i = 0; i < child_device_num; i++)
 		dump_child_device(&defs->devices[i]);
-	free(block);
 }
 
-static void dump_child_devices(int length)
+static void dump_child_devices(void)
 {
 	struct bdb_block *block;
 	struct bdb_child_devices *child_devs;
 	struct child_device_config *child;
 	int i;
 
-	block = find_section(BDB_CHILD_DEVICE_TABLE, length);
+	block = find_section(BDB_CHILD_DEVICE_TABLE);
 	if (!block) {
 		printf("No child device table found\n");
 		return;
@@ -409,15 +418,14 @@ static void dump_child_devices(int length)
 		printf("\t\tDVO wiring: 0x%02x\n", child->dvo_wiring);
 	}
 
-	free(block);
 }
 
-static void dump_lvds_options(int length)
+static void dump_lvds_options(void)
 {
 	struct bdb_block *block;
 	struct bdb_lvds_options *options;
 
-	block = find_section(BDB_LVDS_OPTIONS, length);
+	block = find_section(BDB_LVDS_OPTIONS);
 	if (!block) {
 		printf("No LVDS options block\n");
 		return;
@@ -438,10 +446,9 @@ static void dump_lvds_options(int length)
 	       YESNO(options->pfit_text_mode_enhanced));
 	printf("\tPFIT mode: %d\n", options->pfit_mode);
 
-	free(block);
 }
 
-static void dump_lvds_ptr_data(int length)
+static void dump_lvds_ptr_data(void)
 {
 	struct bdb_block *block;
 	struct bdb_lvds_lfp_data *lvds_data;
@@ -450,14 +457,14 @@ static void dump_lvds_ptr_data(int length)
 	struct bdb_lvds_lfp_data_entry *entry;
 	int lfp_data_size;
 
-	block = find_section(BDB_LVDS_LFP_DATA_PTRS, length);
+	block = find_section(BDB_LVDS_LFP_DATA_PTRS);
 	if (!block) {
 		printf("No LFP data pointers block\n");
 		return;
 	}
 	ptrs = block->data;
 
-	block = find_section(BDB_LVDS_LFP_DATA, length);
+	block = find_section(BDB_LVDS_LFP_DATA);
 	if (!block) {
 		printf("No LVDS data block\n");
 		return;
@@ -477,10 +484,9 @@ static void dump_lvds_ptr_data(int length)
 	printf("\tpanel type %02i: %dx%d\n", panel_type, fp_timing->x_res,
 	       fp_timing->y_res);
 
-	free(block);
 }
 
-static void dump_lvds_data(int length)
+static void dump_lvds_data(void)
 {
 	struct bdb_block *block;
 	struct bdb_lvds_lfp_data *lvds_data;
@@ -492,7 +498,7 @@ static void dump_lvds_data(int length)
 	float clock;
 	int lfp_data_size, dvo_offset;
 
-	block = find_section(BDB_LVDS_LFP_DATA_PTRS, length);
+	block = find_section(BDB_LVDS_LFP_DATA_PTRS);
 	if (!block) {
 		printf("No LVDS ptr block\n");
 		return;
@@ -502,9 +508,8 @@ static void dump_lvds_data(int length)
 	    ptrs->ptr[1].fp_timing_offset - ptrs->ptr[0].fp_timing_offset;
 	dvo_offset =
 	    ptrs->ptr[0].dvo_timing_offset - ptrs->ptr[0].fp_timing_offset;
-	free(block);
 
-	block = find_section(BDB_LVDS_LFP_DATA, length);
+	block = find_section(BDB_LVDS_LFP_DATA);
 	if (!block) {
 		printf("No LVDS data block\n");
 		return;
@@ -560,15 +565,14 @@ static void dump_lvds_data(int length)
 		       (hsyncend > htotal || vsyncend > vtotal) ?
 		       "BAD!" : "good");
 	}
-	free(block);
 }
 
-static void dump_driver_feature(int length)
+static void dump_driver_feature(void)
 {
 	struct bdb_block *block;
 	struct bdb_driver_feature *feature;
 
-	block = find_section(BDB_DRIVER_FEATURES, length);
+	block = find_section(BDB_DRIVER_FEATURES);
 	if (!block) {
 		printf("No Driver feature data block\n");
 		return;
@@ -636,16 +640,15 @@ static void dump_driver_feature(int length)
 	printf("\tLegacy CRT max Y: %d\n", feature->legacy_crt_max_y);
 	printf("\tLegacy CRT max refresh: %d\n",
 	       feature->legacy_crt_max_refresh);
-	free(block);
 }
 
-static void dump_edp(int length)
+static void dump_edp(void)
 {
 	struct bdb_block *block;
 	struct bdb_edp *edp;
 	int bpp;
 
-	block = find_section(BDB_EDP, length);
+	block = find_section(BDB_EDP);
 	if (!block) {
 		printf("No EDP data block\n");
 		return;
@@ -723,7 +726,6 @@ static void dump_edp(int length)
 		printf("1.2V\n");
 		break;
 	}
-	free(block);
 }
 
 static void
@@ -755,13 +757,13 @@ print_detail_timing_data(struct lvds_dvo_timing2 *dvo_timing)
 	printf("\tclock: %d\n", dvo_timing->clock * 10);
 }
 
-static void dump_sdvo_panel_dtds(int length)
+static void dump_sdvo_panel_dtds(void)
 {
 	struct bdb_block *block;
 	struct lvds_dvo_timing2 *dvo_timing;
 	int n, count;
 
-	block = find_section(BDB_SDVO_PANEL_DTDS, length);
+	block = find_section(BDB_SDVO_PANEL_DTDS);
 	if (!block) {
 		printf("No SDVO panel dtds block\n");
 		return;
@@ -775,15 +777,14 @@ static void dump_sdvo_panel_dtds(int length)
 		print_detail_timing_data(dvo_timing++);
 	}
 
-	free(block);
 }
 
-static void dump_sdvo_lvds_options(int length)
+static void dump_sdvo_lvds_options(void)
 {
 	struct bdb_block *block;
 	struct bdb_sdvo_lvds_options *options;
 
-	block = find_section(BDB_SDVO_LVDS_OPTIONS, length);
+	block = find_section(BDB_SDVO_LVDS_OPTIONS);
 	if (!block) {
 		printf("No SDVO LVDS options block\n");
 		return;
@@ -808,14 +809,20 @@ static void dump_sdvo_lvds_options(int length)
 	printf("\tmisc[2]: %x\n", options->panel_misc_bits_3);
 	printf("\tmisc[3]: %x\n", options->panel_misc_bits_4);
 
-	free(block);
 }
 
 static int
-get_device_id(unsigned char *bios)
+get_device_id(unsigned char *bios, off_t size)
 {
     int device;
-    int offset = (bios[0x19] << 8) + bios[0x18];
+    int offset;
+
+    if (size < 0x1a)
+	return -1;
+
+    offset = (bios[0x19] << 8) + bios[0x18];
+    if (offset + 8 > size)
+	return -1;
 
     if (bios[offset] != 'P' ||
 	bios[offset+1] != 'C' ||
@@ -828,87 +835,134 @@ get_device_id(unsigned char *bios)
     return device;
 }
 
-int main(int argc, char **argv)
+/* A ROM or VBT image in memory and the location of its BDB blocks */
+struct vbt_image {
+	uint8_t *data;
+	off_t size;
+	int mapped;
+	struct vbt_header *vbt;
+	struct bdb_header *bdb;
+	struct bdb_block blocks[256];
+};
+
+static const char *load_image(const char *filename, struct vbt_image *image)
 {
-	int fd;
-	struct vbt_header *vbt = NULL;
-	int vbt_off, bdb_off, i;
-	const char *filename = "bios";
 	struct stat finfo;
-	struct bdb_block *block;
-	char signature[17];
-	char *devid_string;
-
-	if (argc != 2) {
-		printf("usage: %s <rom file>\n", argv[0]);
-		return 1;
-	}
-
-	if ((devid_string = getenv("DEVICE")))
-	    devid = strtoul(devid_string, NULL, 0);
+	int fd;
 
-	filename = argv[1];
+	memset(image, 0, sizeof(*image));
 
 	fd = open(filename, O_RDONLY);
-	if (fd == -1) {
-		printf("Couldn't open \"%s\": %s\n", filename, strerror(errno));
-		return 1;
-	}
+	if (fd == -1)
+		return "open failed";
 
-	if (stat(filename, &finfo)) {
-		printf("failed to stat \"%s\": %s\n", filename,
-		       strerror(errno));
-		return 1;
+	if (fstat(fd, &finfo)) {
+		close(fd);
+		return "stat failed";
 	}
 
 	if (finfo.st_size == 0) {
-		int len = 0, ret;
-		finfo.st_size = 8192;
-		VBIOS = malloc (finfo.st_size);
-		while ((ret = read(fd, VBIOS + len, finfo.st_size - len))) {
+		/* e.g. the rom file in sysfs, which has to be read */
+		off_t len = 0, alloc = 8192;
+		ssize_t ret;
+
+		image->data = malloc(alloc);
+		while (image->data &&
+		       (ret = read(fd, image->data + len, alloc - len))) {
 			if (ret < 0) {
-				printf("failed to read \"%s\": %s\n", filename,
-				       strerror(errno));
-				return 1;
+				free(image->data);
+				close(fd);
+				return "read failed";
 			}
 
 			len += ret;
-			if (len == finfo.st_size) {
-				finfo.st_size *= 2;
-				VBIOS = realloc(VBIOS, finfo.st_size);
+			if (len == alloc) {
+				alloc *= 2;
+				image->data = realloc(image->data, alloc);
 			}
 		}
+		if (!image->data) {
+			close(fd);
+			return "out of memory";
+		}
+		image->size = len;
 	} else {
-		VBIOS = mmap(NULL, finfo.st_size, PROT_READ, MAP_SHARED, fd, 0);
-		if (VBIOS == MAP_FAILED) {
-			printf("failed to map \"%s\": %s\n", filename, strerror(errno));
-			return 1;
+		image->data = mmap(NULL, finfo.st_size, PROT_READ, MAP_SHARED,
+				   fd, 0);
+		if (image->data == MAP_FAILED) {
+			close(fd);
+			return "mmap failed";
 		}
+		image->size = finfo.st_size;
+		image->mapped = 1;
 	}
 
-	/* Scour memory looking for the VBT signature */
-	for (i = 0; i + 4 < finfo.st_size; i++) {
-		if (!memcmp(VBIOS + i, "$VBT", 4)) {
-			vbt_off = i;
-			vbt = (struct vbt_header *)(VBIOS + i);
-			break;
-		}
-	}
+	close(fd);
+	return NULL;
+}
+
+static void unload_image(struct vbt_image *image)
+{
+	if (image->mapped)
+		munmap(image->data, image->size);
+	else
+		free(image->data);
+}
+
+/* Find the VBT and BDB headers and index the BDB blocks */
+static const char *parse_image(struct vbt_image *image)
+{
+	uint8_t *sig;
+	off_t vbt_off, bdb_off;
+
+	sig = memmem(image->data, image->size, "$VBT", 4);
+	if (!sig || sig + sizeof(struct vbt_header) > image->data + image->size)
+		return "VBT signature missing";
+
+	vbt_off = sig - image->data;
+	image->vbt = (struct vbt_header *)sig;
+
+	bdb_off = vbt_off + image->vbt->bdb_offset;
+	if (bdb_off >= image->size - (off_t)sizeof(struct bdb_header))
+		return "Invalid VBT found, BDB points beyond end of data block";
+
+	image->bdb = (struct bdb_header *)(image->data + bdb_off);
+	index_sections(image->bdb, image->size - bdb_off, image->blocks);
 
-	if (!vbt) {
-		printf("VBT signature missing\n");
+	return NULL;
+}
+
+static int dump_file(const char *filename, uint32_t forced_devid)
+{
+	struct vbt_image image;
+	const char *error;
+	char signature[17];
+	int i;
+
+	devid = forced_devid;
+	tv_present = lvds_present = panel_type = 0;
+
+	error = load_image(filename, &image);
+	if (error) {
+		printf("Couldn't load \"%s\": %s: %s\n", filename, error,
+		       strerror(errno));
 		return 1;
 	}
 
-	printf("VBT vers: %d.%d\n", vbt->version / 100, vbt->version % 100);
-
-	bdb_off = vbt_off + vbt->bdb_offset;
-	if (bdb_off >= finfo.st_size - sizeof(struct bdb_header)) {
-		printf("Invalid VBT found, BDB points beyond end of data block\n");
+	error = parse_image(&image);
+	if (error) {
+		printf("%s\n", error);
+		unload_image(&image);
 		return 1;
 	}
 
-	bdb = (struct bdb_header *)(VBIOS + bdb_off);
+	VBIOS = image.data;
+	bdb = image.bdb;
+	memcpy(bdb_blocks, image.blocks, sizeof(bdb_blocks));
+
+	printf("VBT vers: %d.%d\n", image.vbt->version / 100,
+	       image.vbt->version % 100);
+
 	strncpy(signature, (char *)bdb->signature, 16);
 	signature[16] = 0;
 	printf("BDB sig: %s\n", signature);
@@ -916,32 +970,424 @@ int main(int argc, char **argv)
 
 	printf("Available sections: ");
 	for (i = 0; i < 256; i++) {
-		block = find_section(i, finfo.st_size);
-		if (!block)
-			continue;
-		printf("%d ", i);
-		free(block);
+		if (find_section(i))
+			printf("%d ", i);
 	}
 	printf("\n");
 
 	if (devid == -1)
-	    devid = get_device_id(VBIOS);
+	    devid = get_device_id(VBIOS, image.size);
 	if (devid == -1)
 	    printf("Warning: could not find PCI device ID!\n");
 
-	dump_general_features(finfo.st_size);
-	dump_general_definitions(finfo.st_size);
-	dump_child_devices(finfo.st_size);
-	dump_lvds_options(finfo.st_size);
-	dump_lvds_data(finfo.st_size);
-	dump_lvds_ptr_data(finfo.st_size);
-	dump_backlight_info(finfo.st_size);
+	dump_general_features();
+	dump_general_definitions();
+	dump_child_devices();
+	dump_lvds_options();
+	dump_lvds_data();
+	dump_lvds_ptr_data();
+	dump_backlight_info();
 
-	dump_sdvo_lvds_options(finfo.st_size);
-	dump_sdvo_panel_dtds(finfo.st_size);
+	dump_sdvo_lvds_options();
+	dump_sdvo_panel_dtds();
 
-	dump_driver_feature(finfo.st_size);
-	dump_edp(finfo.st_size);
+	dump_driver_feature();
+	dump_edp();
 
+	unload_image(&image);
 	return 0;
 }
+
+/*
+ * Structured output: one JSON object per line and per image, holding the
+ * fields most often needed when surveying a corpus of VBTs.  Unlike the
+ * text dump, every block is checked to be large enough before it is
+ * decoded, since corpora tend to contain truncated images.
+ */
+
+static void *image_section(struct vbt_image *image, int id, size_t min_size)
+{
+	struct bdb_block *block = &image->blocks[id];
+
+	if (!block->data || block->size < min_size)
+		return NULL;
+
+	return block->data;
+}
+
+static void json_string(FILE *out, const char *str)
+{
+	fputc('"', out);
+	for (; *str; str++) {
+		unsigned char c = *str;
+
+		if (c == '"' || c == '\\')
+			fprintf(out, "\\%c", c);
+		else if (c < 0x20 || c >= 0x7f)
+			fprintf(out, "\\u%04x", c);
+		else
+			fputc(c, out);
+	}
+	fputc('"', out);
+}
+
+#define JSON_BOOL(val) ((val) ? "true" : "false")
+
+static void record_general_features(FILE *out, struct vbt_image *image)
+{
+	struct bdb_general_features *features;
+
+	features = image_section(image, BDB_GENERAL_FEATURES,
+				 sizeof(*features));
+	if (!features)
+		return;
+
+	fprintf(out, ",\"general_features\":{\"panel_fitting\":%d,"
+		"\"enable_ssc\":%s,\"ssc_freq\":%d,\"lfp_on_override\":%s,"
+		"\"single_dvi\":%s,\"int_crt\":%s,\"int_tv\":%s}",
+		features->panel_fitting,
+		JSON_BOOL(features->enable_ssc), features->ssc_freq,
+		JSON_BOOL(features->enable_lfp_on_override),
+		JSON_BOOL(features->single_dvi),
+		JSON_BOOL(features->int_crt_support),
+		JSON_BOOL(features->int_tv_support));
+}
+
+static void record_child_devices(FILE *out, struct vbt_image *image)
+{
+	struct bdb_general_definitions *defs;
+	struct child_device_config *child;
+	int i, n, first = 1;
+
+	defs = image_section(image, BDB_GENERAL_DEFINITIONS, sizeof(*defs));
+	if (!defs)
+		return;
+
+	n = (image->blocks[BDB_GENERAL_DEFINITIONS].size - sizeof(*defs)) /
+		sizeof(*child);
+
+	fprintf(out, ",\"child_devices\":[");
+	for (i = 0; i < n; i++) {
+		child = &defs->devices[i];
+		if (!child->device_type)
+			continue;
+
+		fprintf(out, "%s{\"handle\":%d,\"type\":%d,\"name\":",
+			first ? "" : ",", child->handle, child->device_type);
+		json_string(out, child_device_type(child->device_type));
+		fprintf(out, ",\"dvo_port\":%d,\"i2c_pin\":%d,"
+			"\"slave_addr\":%d,\"ddc_pin\":%d,\"dvo_wiring\":%d}",
+			child->dvo_port, child->i2c_pin, child->slave_addr,
+			child->ddc_pin, child->dvo_wiring);
+		first = 0;
+	}
+	fprintf(out, "]");
+}
+
+static int record_lvds(FILE *out, struct vbt_image *image)
+{
+	struct bdb_lvds_options *options;
+	struct bdb_lvds_lfp_data_ptrs *ptrs;
+	struct bdb_lvds_lfp_data_entry *entry;
+	struct bdb_block *data;
+	uint8_t *timing;
+	int type, lfp_data_size, dvo_offset;
+
+	options = image_section(image, BDB_LVDS_OPTIONS, sizeof(*options));
+	if (!options)
+		return -1;
+
+	type = options->panel_type;
+	fprintf(out, ",\"lvds\":{\"panel_type\":%d,\"lvds_edid\":%s,"
+		"\"pixel_dither\":%s,\"pfit_mode\":%d",
+		type, JSON_BOOL(options->lvds_edid),
+		JSON_BOOL(options->pixel_dither), options->pfit_mode);
+
+	ptrs = image_section(image, BDB_LVDS_LFP_DATA_PTRS, sizeof(*ptrs));
+	data = &image->blocks[BDB_LVDS_LFP_DATA];
+	if (ptrs && data->data) {
+		lfp_data_size = ptrs->ptr[1].fp_timing_offset -
+			ptrs->ptr[0].fp_timing_offset;
+		dvo_offset = ptrs->ptr[0].dvo_timing_offset -
+			ptrs->ptr[0].fp_timing_offset;
+
+		if (lfp_data_size > 0 && dvo_offset >= 0 &&
+		    (type + 1) * lfp_data_size <= data->size &&
+		    dvo_offset + 18 <= lfp_data_size &&
+		    sizeof(struct lvds_fp_timing) <= lfp_data_size) {
+			entry = (struct bdb_lvds_lfp_data_entry *)
+				((uint8_t *)data->data + type * lfp_data_size);
+			timing = (uint8_t *)entry + dvo_offset;
+
+			fprintf(out, ",\"panel\":{\"width\":%d,\"height\":%d,"
+				"\"clock\":%d,\"htotal\":%d,\"vtotal\":%d}",
+				entry->fp_timing.x_res, entry->fp_timing.y_res,
+				_PIXEL_CLOCK(timing),
+				_H_ACTIVE(timing) + _H_BLANK(timing),
+				_V_ACTIVE(timing) + _V_BLANK(timing));
+		}
+	}
+	fprintf(out, "}");
+
+	return type;
+}
+
+static void record_backlight(FILE *out, struct vbt_image *image, int type)
+{
+	struct bdb_lvds_backlight *backlight;
+	struct blc_struct *blc;
+
+	backlight = image_section(image, BDB_LVDS_BACKLIGHT,
+				  sizeof(*backlight));
+	if (!backlight || type < 0 || type >= 16 ||
+	    backlight->blcstruct_size != sizeof(struct blc_struct))
+		return;
+
+	blc = &backlight->panels[type];
+	fprintf(out, ",\"backlight\":{\"inverter_type\":%d,"
+		"\"inverter_polarity\":%d,\"pwm_freq\":%d,"
+		"\"min_brightness\":%d}",
+		blc->inverter_type, blc->inverter_polarity,
+		blc->pwm_freq, blc->min_brightness);
+}
+
+static void record_edp(FILE *out, struct vbt_image *image, int type)
+{
+	static const int bpp[] = { 18, 24, 30, 0 };
+	struct bdb_edp *edp;
+
+	edp = image_section(image, BDB_EDP, sizeof(*edp));
+	if (!edp || type < 0 || type >= 16)
+		return;
+
+	fprintf(out, ",\"edp\":{\"t3\":%d,\"t7\":%d,\"t9\":%d,\"t10\":%d,"
+		"\"t12\":%d,\"bpp\":%d,\"rate\":%d,\"lanes\":%d,"
+		"\"preemphasis\":%d,\"vswing\":%d}",
+		edp->power_seqs[type].t3, edp->power_seqs[type].t7,
+		edp->power_seqs[type].t9, edp->power_seqs[type].t10,
+		edp->power_seqs[type].t12,
+		bpp[(edp->color_depth >> (type * 2)) & 3],
+		edp->link_params[type].rate == EDP_RATE_2_7 ? 270 : 162,
+		edp->link_params[type].lanes + 1,
+		edp->link_params[type].preemphasis,
+		edp->link_params[type].vswing);
+}
+
+static int write_record(FILE *out, const char *filename)
+{
+	struct vbt_image image;
+	const char *error;
+	char signature[17];
+	int i, first, type;
+
+	fprintf(out, "{\"file\":");
+	json_string(out, filename);
+
+	error = load_image(filename, &image);
+	if (!error) {
+		fprintf(out, ",\"size\":%lld", (long long)image.size);
+		error = parse_image(&image);
+		if (error)
+			unload_image(&image);
+	}
+	if (error) {
+		fprintf(out, ",\"error\":");
+		json_string(out, error);
+		fprintf(out, "}\n");
+		return -1;
+	}
+
+	strncpy(signature, (char *)image.bdb->signature, 16);
+	signature[16] = 0;
+
+	fprintf(out, ",\"vbt_version\":%d,\"bdb_version\":%d,\"bdb_signature\":",
+		image.vbt->version, image.bdb->version);
+	json_string(out, signature);
+	i = get_device_id(image.data, image.size);
+	if (i != -1)
+		fprintf(out, ",\"devid\":%d", i);
+	else
+		fprintf(out, ",\"devid\":null");
+
+	fprintf(out, ",\"sections\":[");
+	for (i = 0, first = 1; i < 256; i++) {
+		if (!image.blocks[i].data)
+			continue;
+		fprintf(out, "%s%d", first ? "" : ",", i);
+		first = 0;
+	}
+	fprintf(out, "]");
+
+	record_general_features(out, &image);
+	record_child_devices(out, &image);
+	type = record_lvds(out, &image);
+	record_backlight(out, &image, type);
+	record_edp(out, &image, type);
+
+	fprintf(out, "}\n");
+
+	unload_image(&image);
+	return 0;
+}
+
+/* The batch mode work list; records are printed in list order */
+static char **batch_files;
+static char **batch_records;
+static int batch_count, batch_size, batch_next, batch_errors;
+
+static void batch_add(const char *filename)
+{
+	if (batch_count == batch_size) {
+		batch_size = batch_size ? 2 * batch_size : 256;
+		batch_files = realloc(batch_files,
+				      batch_size * sizeof(*batch_files));
+		if (!batch_files) {
+			fprintf(stderr, "out of memory\n");
+			exit(1);
+		}
+	}
+	batch_files[batch_count++] = strdup(filename);
+}
+
+static int batch_add_entry(const char *path, const struct stat *st,
+			   int flag, struct FTW *ftw)
+{
+	if (flag == FTW_F && S_ISREG(st->st_mode))
+		batch_add(path);
+	return 0;
+}
+
+static int compare_paths(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+static void *batch_worker(void *arg)
+{
+	int i;
+
+	while ((i = __sync_fetch_and_add(&batch_next, 1)) < batch_count) {
+		char *buf = NULL;
+		size_t len;
+		FILE *out;
+
+		out = open_memstream(&buf, &len);
+		if (!out) {
+			__sync_fetch_and_add(&batch_errors, 1);
+			continue;
+		}
+		if (write_record(out, batch_files[i]))
+			__sync_fetch_and_add(&batch_errors, 1);
+		fclose(out);
+		batch_records[i] = buf;
+	}
+
+	return NULL;
+}
+
+static int run_batch(int jobs)
+{
+	pthread_t *threads;
+	int i;
+
+	qsort(batch_files, batch_count, sizeof(*batch_files), compare_paths);
+	batch_records = calloc(batch_count, sizeof(*batch_records));
+	threads = calloc(jobs, sizeof(*threads));
+	if ((batch_count && !batch_records) || !threads) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+
+	for (i = 0; i < jobs; i++)
+		pthread_create(&threads[i], NULL, batch_worker, NULL);
+	for (i = 0; i < jobs; i++)
+		pthread_join(threads[i], NULL);
+
+	for (i = 0; i < batch_count; i++) {
+		if (batch_records[i])
+			fputs(batch_records[i], stdout);
+		free(batch_records[i]);
+		free(batch_files[i]);
+	}
+
+	free(threads);
+	free(batch_records);
+	free(batch_files);
+
+	if (batch_errors) {
+		fprintf(stderr, "%d of %d files failed\n",
+			batch_errors, batch_count);
+		return 1;
+	}
+	return 0;
+}
+
+static void usage(const char *appname)
+{
+	printf("usage: %s <rom file> [<rom file>...]\n"
+	       "       %s -j [-t <threads>] <rom file or directory>...\n"
+	       "Options:\n"
+	       "  -j            print one JSON record per image instead of the\n"
+	       "                text dump; directories are searched recursively\n"
+	       "  -t <threads>  number of images to parse in parallel with -j\n"
+	       "                (default: number of cpus)\n"
+	       "  -h            prints this help\n",
+	       appname, appname);
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t forced_devid = -1;
+	char *devid_string;
+	int i, opt, ret = 0;
+	int json = 0, jobs = sysconf(_SC_NPROCESSORS_ONLN);
+
+	while ((opt = getopt(argc, argv, "jt:h")) != -1) {
+		switch (opt) {
+		case 'j':
+			json = 1;
+			break;
+		case 't':
+			jobs = atoi(optarg);
+			break;
+		case 'h':
+			usage(argv[0]);
+			return 0;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (optind == argc) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (json) {
+		struct stat st;
+
+		if (jobs < 1)
+			jobs = 1;
+
+		for (i = optind; i < argc; i++) {
+			if (stat(argv[i], &st) == 0 && S_ISDIR(st.st_mode))
+				nftw(argv[i], batch_add_entry, 16, FTW_PHYS);
+			else
+				batch_add(argv[i]);
+		}
+
+		return run_batch(jobs);
+	}
+
+	if ((devid_string = getenv("DEVICE")))
+	    forced_devid = strtoul(devid_string, NULL, 0);
+
+	for (i = optind; i < argc; i++) {
+		if (argc - optind > 1)
+			printf("%s%s:\n", i > optind ? "\n" : "", argv[i]);
+		ret |= dump_file(argv[i], forced_devid);
+	}
+
+	return ret;
+}
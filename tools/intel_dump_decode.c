@@ -36,6 +36,9 @@
 #include <getopt.h>
 
 #include <intel_bufmgr.h>
+#include <i915_drm.h>
+
+#include "intel_batchbuffer.h"
 
 struct drm_intel_decode *ctx;
 
@@ -123,10 +126,102 @@ read_data_file(const char * filename)
     fclose (file);
 }
 
+static const char *
+ring_name(uint32_t ring)
+{
+	if (ring == INTEL_BATCH_TRACE_CHAINED)
+		return "continued in the next batch";
+
+	switch (ring & I915_EXEC_RING_MASK) {
+	case I915_EXEC_DEFAULT: return "default ring";
+	case I915_EXEC_RENDER: return "render ring";
+	case I915_EXEC_BSD: return "bsd ring";
+	case I915_EXEC_BLT: return "blt ring";
+	default: return "unknown ring";
+	}
+}
+
+/* Batches captured by lib/intel_batchbuffer.c with $INTEL_BATCH_CAPTURE */
+static void
+read_trace_file(const char * filename)
+{
+	struct intel_batch_trace header;
+	struct intel_batch_trace_reloc *relocs = NULL;
+	struct drm_intel_decode *trace_ctx;
+	uint32_t *data = NULL, *state = NULL;
+	FILE *file;
+	unsigned int i, n;
+
+	file = fopen (filename, "r");
+	if (file == NULL) {
+		fprintf (stderr, "Failed to open %s: %s\n",
+			 filename, strerror (errno));
+		exit (1);
+	}
+
+	for (n = 0; fread(&header, sizeof(header), 1, file) == 1; n++) {
+		if (header.magic != INTEL_BATCH_TRACE_MAGIC) {
+			fprintf(stderr, "%s: bad header for batch %u\n",
+				filename, n);
+			break;
+		}
+
+		relocs = realloc(relocs, (header.num_relocs + 1) * sizeof(*relocs));
+		data = realloc(data, header.size + 4);
+		state = realloc(state, header.state_size + 4);
+		if (relocs == NULL || data == NULL || state == NULL) {
+			fprintf (stderr, "Out of memory.\n");
+			exit (1);
+		}
+
+		if (fread(relocs, sizeof(*relocs), header.num_relocs, file) != header.num_relocs ||
+		    fread(data, 1, header.size, file) != header.size ||
+		    fread(state, 1, header.state_size, file) != header.state_size) {
+			fprintf(stderr, "%s: batch %u is truncated\n",
+				filename, n);
+			break;
+		}
+
+		printf("batch %u: devid 0x%04x, %s, %u bytes, %u relocations\n",
+		       n, header.devid, ring_name(header.ring),
+		       header.size, header.num_relocs);
+		for (i = 0; i < header.num_relocs; i++)
+			printf("  reloc 0x%08x: handle %u + 0x%x, presumed 0x%08x, domains 0x%x/0x%x\n",
+			       relocs[i].offset, relocs[i].handle,
+			       relocs[i].delta, relocs[i].presumed_offset,
+			       relocs[i].read_domains, relocs[i].write_domain);
+
+		trace_ctx = drm_intel_decode_context_alloc(header.devid);
+		drm_intel_decode_set_batch_pointer(trace_ctx, data, 0,
+						   header.size / 4);
+		drm_intel_decode(trace_ctx);
+		drm_intel_decode_context_free(trace_ctx);
+
+		/* the indirect state isn't decoded, its dwords are listed
+		 * at their offsets in the bo, which relocations use too */
+		if (header.state_size)
+			printf("state: %u bytes at 0x%08x\n",
+			       header.state_size, header.state_offset);
+		for (i = 0; i < header.state_size / 4; i++) {
+			if (i % 8 == 0)
+				printf("0x%08x:", header.state_offset + 4 * i);
+			printf(" 0x%08x", state[i]);
+			if (i % 8 == 7 || i == header.state_size / 4 - 1)
+				printf("\n");
+		}
+	}
+
+	free (relocs);
+	free (data);
+	free (state);
+	fclose (file);
+}
+
 static void
 read_autodetect_file(const char * filename)
 {
 	int binary = 0, c;
+	uint32_t magic;
 	FILE *file;
 
 	file = fopen (filename, "r");
@@ -136,6 +231,14 @@ read_autodetect_file(const char * filename)
 		exit (1);
 	}
 
+	if (fread(&magic, sizeof(magic), 1, file) == 1 &&
+	    magic == INTEL_BATCH_TRACE_MAGIC) {
+		fclose(file);
+		read_trace_file(filename);
+		return;
+	}
+	rewind(file);
+
 	while ((c = fgetc(file)) != EOF) {
 		/* totally lazy binary detector */
 		if (c < 10) {
@@ -165,10 +268,12 @@ main (int argc, char *argv[])
 	static struct option long_options[] = {
 		{"devid", 1, 0, 'd'},
 		{"ascii", 0, 0, 'a'},
-		{"binary", 0, 0, 'b'}
+		{"binary", 0, 0, 'b'},
+		{"trace", 0, 0, 't'},
+		{0, 0, 0, 0}
 	};
 
-	while((c = getopt_long(argc, argv, "ab",
+	while((c = getopt_long(argc, argv, "abt",
 			       long_options, &option_index)) != -1) {
 		switch(c) {
 		case 'd':
@@ -180,6 +285,9 @@ main (int argc, char *argv[])
 		case 'a':
 			binary = 0;
 			break;
+		case 't':
+			binary = 2;
+			break;
 		default:
 			printf("unkown command options\n");
 			break;
@@ -199,7 +307,9 @@ main (int argc, char *argv[])
 			read_data_file(argv[i]);
 			continue;
 		}
-		if (binary == 1)
+		if (binary == 2)
+			read_trace_file(argv[i]);
+		else if (binary == 1)
 			read_bin_file(argv[i]);
 		else if (binary == 0)
 			read_data_file(argv[i]);
@@ -30,6 +30,9 @@
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
 #include <sys/time.h>
 #include <sys/resource.h>
 #include <sys/wait.h>
@@ -37,9 +40,32 @@
 #include "intel_gpu_tools.h"
 
 #define SAMPLES_PER_SEC             10000
+#define PERIOD_MS                   100
 
 static volatile int goddo;
 
+struct ring {
+	const char *name;
+	uint32_t mmio;
+	int present;
+
+	/* totals over the whole run */
+	uint64_t idle, samples;
+
+	/* the period currently being accumulated */
+	uint64_t period_idle, period_samples;
+
+	/* busy percentage of every completed period */
+	float *timeline;
+	int num_periods, max_periods;
+};
+
+static struct ring rings[] = {
+	{ .name = "render", .mmio = LP_RING },
+	{ .name = "bitstream", .mmio = BSD_RING },
+	{ .name = "blitter", .mmio = BLT_RING },
+};
+
 static pid_t spawn(char **argv)
 {
 	pid_t pid;
@@ -57,45 +83,347 @@ static void sighandler(int sig)
 	goddo = sig;
 }
 
+static void rings_init(uint32_t devid)
+{
+	rings[0].present = 1;
+
+	if (HAS_BSD_RING(devid)) {
+		rings[1].present = 1;
+		if (intel_gen(devid) >= 6)
+			rings[1].mmio = GEN6_BSD_RING;
+	} else if (IS_G4X(devid))
+		rings[1].present = 1;
+
+	rings[2].present = HAS_BLT_RING(devid);
+}
+
+static void ring_sample(struct ring *ring)
+{
+	uint32_t head, tail;
+
+	head = INREG(ring->mmio + RING_HEAD) & HEAD_ADDR;
+	tail = INREG(ring->mmio + RING_TAIL) & TAIL_ADDR;
+
+	if (head == tail)
+		ring->period_idle++;
+	ring->period_samples++;
+}
+
+static double period_busy(struct ring *ring)
+{
+	if (!ring->period_samples)
+		return 0;
+
+	return 100 - ring->period_idle * 100. / ring->period_samples;
+}
+
+static void ring_end_period(struct ring *ring)
+{
+	if (!ring->period_samples)
+		return;
+
+	if (ring->num_periods == ring->max_periods) {
+		ring->max_periods = ring->max_periods ? 2*ring->max_periods : 64;
+		ring->timeline = realloc(ring->timeline,
+					 ring->max_periods * sizeof(float));
+		if (ring->timeline == NULL) {
+			perror("realloc");
+			exit(1);
+		}
+	}
+	ring->timeline[ring->num_periods++] = period_busy(ring);
+
+	ring->idle += ring->period_idle;
+	ring->samples += ring->period_samples;
+	ring->period_idle = ring->period_samples = 0;
+}
+
+static double ring_busy(struct ring *ring)
+{
+	if (!ring->samples)
+		return 0;
+
+	return 100 - ring->idle * 100. / ring->samples;
+}
+
+static int float_cmp(const void *a, const void *b)
+{
+	float fa = *(const float *)a, fb = *(const float *)b;
+
+	return (fa > fb) - (fa < fb);
+}
+
+/* nearest-rank percentile of an already sorted array */
+static double percentile(const float *sorted, int count, int pct)
+{
+	int rank;
+
+	if (!count)
+		return 0;
+
+	rank = (pct * count + 99) / 100;
+	if (rank < 1)
+		rank = 1;
+	return sorted[rank - 1];
+}
+
+static void interval_report(FILE *out, double elapsed)
+{
+	int i;
+
+	fprintf(out, "%.3f", elapsed);
+	for (i = 0; i < ARRAY_SIZE(rings); i++)
+		if (rings[i].present)
+			fprintf(out, "\t%s: %5.1f%%",
+				rings[i].name, period_busy(&rings[i]));
+	fprintf(out, "\n");
+	fflush(out);
+}
+
+struct ring_stats {
+	double busy, p50, p90, p99, max;
+};
+
+static void ring_stats(struct ring *ring, struct ring_stats *stats)
+{
+	float *sorted;
+	int n = ring->num_periods;
+
+	sorted = malloc((n + 1) * sizeof(float));
+	if (sorted == NULL) {
+		perror("malloc");
+		exit(1);
+	}
+	if (n)
+		memcpy(sorted, ring->timeline, n * sizeof(float));
+	qsort(sorted, n, sizeof(float), float_cmp);
+
+	stats->busy = ring_busy(ring);
+	stats->p50 = percentile(sorted, n, 50);
+	stats->p90 = percentile(sorted, n, 90);
+	stats->p99 = percentile(sorted, n, 99);
+	stats->max = percentile(sorted, n, 100);
+
+	free(sorted);
+}
+
+static void ring_report(FILE *out, struct ring *ring)
+{
+	struct ring_stats stats;
+
+	ring_stats(ring, &stats);
+	fprintf(out, "%s: busy: %.1f%%, p50: %.1f%%, p90: %.1f%%, p99: %.1f%%, max: %.1f%%\n",
+		ring->name, stats.busy, stats.p50, stats.p90, stats.p99,
+		stats.max);
+}
+
+/*
+ * The summary file is meant for scripts: one "key value" line per
+ * statistic, followed by the per-period timeline as tab separated columns
+ * in the same spirit as intel_gpu_top -o.
+ */
+static void write_summary(FILE *out, const struct rusage *rusage,
+			  const struct timeval *elapsed, int period_ms,
+			  int status)
+{
+	int i, j, num_periods = 0;
+
+	fprintf(out, "elapsed %ld.%06ld\n", elapsed->tv_sec, elapsed->tv_usec);
+	fprintf(out, "user %ld.%06ld\n",
+		rusage->ru_utime.tv_sec, rusage->ru_utime.tv_usec);
+	fprintf(out, "sys %ld.%06ld\n",
+		rusage->ru_stime.tv_sec, rusage->ru_stime.tv_usec);
+	fprintf(out, "status %d\n", WEXITSTATUS(status));
+	fprintf(out, "period_ms %d\n", period_ms);
+
+	for (i = 0; i < ARRAY_SIZE(rings); i++) {
+		struct ring *ring = &rings[i];
+		struct ring_stats stats;
+
+		if (!ring->present)
+			continue;
+
+		ring_stats(ring, &stats);
+		fprintf(out, "%s.samples %llu\n", ring->name,
+			(unsigned long long)ring->samples);
+		fprintf(out, "%s.busy %.2f\n", ring->name, stats.busy);
+		fprintf(out, "%s.p50 %.2f\n", ring->name, stats.p50);
+		fprintf(out, "%s.p90 %.2f\n", ring->name, stats.p90);
+		fprintf(out, "%s.p99 %.2f\n", ring->name, stats.p99);
+		fprintf(out, "%s.max %.2f\n", ring->name, stats.max);
+
+		if (ring->num_periods > num_periods)
+			num_periods = ring->num_periods;
+	}
+
+	fprintf(out, "# time");
+	for (i = 0; i < ARRAY_SIZE(rings); i++)
+		if (rings[i].present)
+			fprintf(out, "\t%s%%", rings[i].name);
+	fprintf(out, "\n");
+
+	for (j = 0; j < num_periods; j++) {
+		fprintf(out, "%.3f", (j + 1) * period_ms / 1000.);
+		for (i = 0; i < ARRAY_SIZE(rings); i++) {
+			if (!rings[i].present)
+				continue;
+			if (j < rings[i].num_periods)
+				fprintf(out, "\t%.1f", rings[i].timeline[j]);
+			else
+				fprintf(out, "\t-1");
+		}
+		fprintf(out, "\n");
+	}
+}
+
+static void timespec_add_ns(struct timespec *ts, long ns)
+{
+	ts->tv_nsec += ns;
+	while (ts->tv_nsec >= 1000000000) {
+		ts->tv_nsec -= 1000000000;
+		ts->tv_sec++;
+	}
+}
+
+static void usage(const char *appname)
+{
+	fprintf(stderr,
+		"usage: %s [options] cmd [args...]\n"
+		"Options:\n"
+		"  -s <samples>   samples per second (default %d)\n"
+		"  -p <ms>        length of a timeline period in ms (default %d)\n"
+		"  -i             print a report for every period while cmd runs\n"
+		"  -o <file>      write a machine-readable summary to file ('-' for stdout)\n"
+		"  -f <file>      sample registers from an mmio dump instead of the device\n"
+		"  -d <id>        device id (in hex) to assume when using -f\n"
+		"  -h             show this help\n",
+		appname, SAMPLES_PER_SEC, PERIOD_MS);
+}
+
 int main(int argc, char **argv)
 {
 	pid_t child;
-	uint64_t ring_idle = 0, ring_time = 0;
 	struct timeval start, end;
+	struct timespec next, period_end;
 	static struct rusage rusage;
-	int status;
+	int samples_per_sec = SAMPLES_PER_SEC;
+	int period_ms = PERIOD_MS;
+	int interval_reports = 0;
+	char *mmio_file = NULL;
+	char *summary_file = NULL;
+	uint32_t devid = 0;
+	long sample_ns;
+	int status, ch, i;
 
-	intel_get_mmio(intel_get_pci_device());
+	while ((ch = getopt(argc, argv, "+s:p:io:f:d:h")) != -1) {
+		switch (ch) {
+		case 's':
+			samples_per_sec = atoi(optarg);
+			if (samples_per_sec < 1 || samples_per_sec > 1000000) {
+				fprintf(stderr, "samples per second must be in [1, 1000000]\n");
+				return 1;
+			}
+			break;
+		case 'p':
+			period_ms = atoi(optarg);
+			if (period_ms < 1) {
+				fprintf(stderr, "period must be at least 1ms\n");
+				return 1;
+			}
+			break;
+		case 'i':
+			interval_reports = 1;
+			break;
+		case 'o':
+			summary_file = optarg;
+			break;
+		case 'f':
+			mmio_file = optarg;
+			break;
+		case 'd':
+			devid = strtoul(optarg, NULL, 16);
+			break;
+		case 'h':
+			usage(argv[0]);
+			return 0;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
 
-	if (argc == 1) {
-		fprintf(stderr, "usage: %s cmd [args...]\n", argv[0]);
+	if (optind == argc) {
+		usage(argv[0]);
 		return 1;
 	}
 
+	if (mmio_file) {
+		intel_map_file(mmio_file);
+		if (!devid) {
+			fprintf(stderr, "Sampling from file without -d argument. "
+				"Assuming Ironlake machine.\n");
+			devid = 0x0042;
+		}
+	} else {
+		struct pci_device *pci_dev = intel_get_pci_device();
+
+		devid = pci_dev->device_id;
+		intel_get_mmio(pci_dev);
+	}
+
+	rings_init(devid);
+
 	signal(SIGCHLD, sighandler);
 	signal(SIGINT, SIG_IGN);
 	signal(SIGQUIT, SIG_IGN);
 
+	sample_ns = 1000000000L / samples_per_sec;
+
 	gettimeofday(&start, NULL);
-	child = spawn(argv+1);
+	child = spawn(argv + optind);
 	if (child < 0)
 		return 127;
 
-	while (!goddo) {
-		uint32_t ring_head, ring_tail;
+	/* Sample on absolute deadlines so that the time spent reading the
+	 * registers and any oversleeping does not accumulate as drift.
+	 */
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	period_end = next;
+	timespec_add_ns(&period_end, period_ms * 1000000L);
 
-		ring_head = INREG(LP_RING + RING_HEAD) & HEAD_ADDR;
-		ring_tail = INREG(LP_RING + RING_TAIL) & TAIL_ADDR;
+	while (!goddo) {
+		for (i = 0; i < ARRAY_SIZE(rings); i++)
+			if (rings[i].present)
+				ring_sample(&rings[i]);
 
-		if (ring_tail == ring_head)
-			ring_idle++;
-		ring_time++;
+		timespec_add_ns(&next, sample_ns);
+		if (next.tv_sec > period_end.tv_sec ||
+		    (next.tv_sec == period_end.tv_sec &&
+		     next.tv_nsec >= period_end.tv_nsec)) {
+			if (interval_reports) {
+				gettimeofday(&end, NULL);
+				timersub(&end, &start, &end);
+				interval_report(stderr,
+						end.tv_sec + 1e-6*end.tv_usec);
+			}
+			for (i = 0; i < ARRAY_SIZE(rings); i++)
+				if (rings[i].present)
+					ring_end_period(&rings[i]);
+			timespec_add_ns(&period_end, period_ms * 1000000L);
+		}
 
-		usleep(1000000 / SAMPLES_PER_SEC);
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+				       &next, NULL) == EINTR && !goddo)
+			;
 	}
 	gettimeofday(&end, NULL);
 	timersub(&end, &start, &end);
 
+	/* account the trailing partial period */
+	for (i = 0; i < ARRAY_SIZE(rings); i++)
+		if (rings[i].present)
+			ring_end_period(&rings[i]);
+
 	waitpid(child, &status, 0);
 
 	getrusage(RUSAGE_CHILDREN, &rusage);
@@ -104,7 +432,29 @@ int main(int argc, char **argv)
 	       rusage.ru_stime.tv_sec, rusage.ru_stime.tv_usec,
 	       end.tv_sec, end.tv_usec,
 	       100*(rusage.ru_utime.tv_sec + 1e-6*rusage.ru_utime.tv_usec + rusage.ru_stime.tv_sec + 1e-6*rusage.ru_stime.tv_usec) / (end.tv_sec + 1e-6*end.tv_usec),
-	       100 - ring_idle * 100. / ring_time);
+	       ring_busy(&rings[0]));
+
+	for (i = 0; i < ARRAY_SIZE(rings); i++)
+		if (rings[i].present)
+			ring_report(stdout, &rings[i]);
+
+	if (summary_file) {
+		FILE *out = stdout;
+
+		if (strcmp(summary_file, "-")) {
+			out = fopen(summary_file, "w");
+			if (out == NULL) {
+				perror("fopen");
+				return 1;
+			}
+		}
+		write_summary(out, &rusage, &end, period_ms, status);
+		if (out != stdout)
+			fclose(out);
+	}
+
+	for (i = 0; i < ARRAY_SIZE(rings); i++)
+		free(rings[i].timeline);
 
 	return WEXITSTATUS(status);
 }
@@ -29,106 +29,521 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
+#include <errno.h>
 #include <pciaccess.h>
 #include <unistd.h>
 
 #include "intel_gpu_tools.h"
-
-#define INGTT(offset) (*(volatile uint32_t *)(gtt + (offset) / (KB(4) / 4)))
+#include "intel_gtt_rle.h"
 
 #define KB(x) ((x) * 1024)
 #define MB(x) ((x) * 1024 * 1024)
 
-int main(int argc, char **argv)
-{
-	struct pci_device *pci_dev;
-	int start, aper_size;
-	unsigned char *gtt;
+#define GTT_DUMP_MAGIC		0x54544749 /* "IGTT" */
+#define GTT_RLE_MAGIC		0x52544749 /* "IGTR" */
+#define GTT_DUMP_VERSION	1
+
+#define PTE_VALID		(1 << 0)
+
+/* Snapshot file layout: this header followed by num_ptes 32-bit PTEs, or
+ * by a sequence of runs for run-length encoded snapshots.  Everything is in
+ * host byte order, so snapshots are only read back on the same kind of
+ * machine that took them.
+ */
+struct gtt_dump_header {
+	uint32_t magic;
+	uint32_t version;
 	uint32_t devid;
+	uint32_t num_ptes;
+	uint64_t aper_size;
+};
+
+/* Each run in an encoded snapshot starts with a dword holding the run
+ * type in the top two bits and the number of PTEs below.  Linear and
+ * constant runs are followed by the first PTE, literal runs by all of
+ * their PTEs.
+ */
+#define RLE_LITERAL		0
+#define RLE_LINEAR		1
+#define RLE_CONSTANT		2
+#define RLE_TYPE_SHIFT		30
+#define RLE_LENGTH_MASK		((1 << RLE_TYPE_SHIFT) - 1)
+
+struct gtt {
+	uint32_t devid;
+	uint64_t aper_size;
+	uint32_t num_ptes;
+	uint32_t *pte;
+};
+
+static void *map_gtt(struct pci_device *pci_dev, size_t *size)
+{
+	uint32_t devid = pci_dev->device_id;
+	void *gtt;
 	int flag[] = {
 		PCI_DEV_MAP_FLAG_WRITE_COMBINE,
 		PCI_DEV_MAP_FLAG_WRITABLE,
 		0
 	}, f;
 
-	pci_dev = intel_get_pci_device();
-	devid = pci_dev->device_id;
-
-	if (IS_GEN2(devid)) {
-		printf("Unsupported chipset for gtt dumper\n");
-		exit(1);
-	}
-
 	for (f = 0; flag[f] != 0; f++) {
 		if (IS_GEN3(devid)) {
 			/* 915/945 chips has GTT range in bar 3 */
+			*size = pci_dev->regions[3].size;
 			if (pci_device_map_range(pci_dev,
 						 pci_dev->regions[3].base_addr,
-						 pci_dev->regions[3].size,
+						 *size,
 						 flag[f],
-						 (void **)&gtt) == 0)
-				break;
+						 &gtt) == 0)
+				return gtt;
 		} else {
 			int offset;
 			if (IS_GEN4(devid))
 				offset = KB(512);
 			else
 				offset = MB(2);
+			*size = offset;
 			if (pci_device_map_range(pci_dev,
 						 pci_dev->regions[0].base_addr + offset,
 						 offset,
 						 flag[f],
-						 (void **)&gtt) == 0)
-				break;
+						 &gtt) == 0)
+				return gtt;
 		}
 	}
-	if (flag[f] == 0) {
+
+	return NULL;
+}
+
+/*
+ * Copy the whole PTE array out of the (usually write-combined) mapping in
+ * large blocks rather than one volatile dword at a time, so that walking a
+ * multi-GB aperture is bound by the bus and not by uncached read latency.
+ */
+static void read_gtt_live(struct gtt *gtt)
+{
+	struct pci_device *pci_dev;
+	const uint32_t *map;
+	size_t map_size;
+	uint32_t i, chunk;
+
+	pci_dev = intel_get_pci_device();
+	gtt->devid = pci_dev->device_id;
+
+	if (IS_GEN2(gtt->devid)) {
+		printf("Unsupported chipset for gtt dumper\n");
+		exit(1);
+	}
+
+	map = map_gtt(pci_dev, &map_size);
+	if (map == NULL) {
 		printf("Failed to map gtt\n");
 		exit(1);
 	}
 
-	aper_size = pci_dev->regions[2].size;
+	gtt->aper_size = pci_dev->regions[2].size;
+	gtt->num_ptes = gtt->aper_size / KB(4);
+	if (gtt->num_ptes > map_size / 4)
+		gtt->num_ptes = map_size / 4;
 
-	for (start = 0; start < aper_size; start += KB(4)) {
-		uint32_t start_pte = INGTT(start);
-		uint32_t end;
-		int constant_length = 0;
-		int linear_length = 0;
+	gtt->pte = malloc(gtt->num_ptes * sizeof(uint32_t));
+	if (gtt->pte == NULL) {
+		fprintf(stderr, "Failed to allocate %u PTEs\n", gtt->num_ptes);
+		exit(1);
+	}
 
-		/* Check if it's a linear sequence */
-		for (end = start + KB(4); end < aper_size; end += KB(4)) {
-			uint32_t end_pte = INGTT(end);
-			if (end_pte == start_pte + (end - start))
-				linear_length++;
-			else
-				break;
+	for (i = 0; i < gtt->num_ptes; i += chunk) {
+		chunk = gtt->num_ptes - i;
+		if (chunk > KB(16))
+			chunk = KB(16);
+		memcpy(gtt->pte + i, map + i, chunk * sizeof(uint32_t));
+	}
+
+	pci_device_unmap_range(pci_dev, (void *)map, map_size);
+}
+
+static void read_rle_runs(struct gtt *gtt, FILE *file, const char *filename)
+{
+	uint32_t i = 0, j, header, length, pte;
+
+	while (i < gtt->num_ptes) {
+		if (fread(&header, sizeof(header), 1, file) != 1)
+			goto truncated;
+
+		length = header & RLE_LENGTH_MASK;
+		if (length > gtt->num_ptes - i) {
+			fprintf(stderr, "%s: corrupt run at PTE %u\n",
+				filename, i);
+			exit(1);
+		}
+
+		switch (header >> RLE_TYPE_SHIFT) {
+		case RLE_LITERAL:
+			if (fread(gtt->pte + i, sizeof(uint32_t), length, file) !=
+			    length)
+				goto truncated;
+			break;
+		case RLE_LINEAR:
+		case RLE_CONSTANT:
+			if (fread(&pte, sizeof(pte), 1, file) != 1)
+				goto truncated;
+			for (j = 0; j < length; j++) {
+				gtt->pte[i + j] = pte;
+				if (header >> RLE_TYPE_SHIFT == RLE_LINEAR)
+					pte += GTT_PAGE_SIZE;
+			}
+			break;
+		default:
+			fprintf(stderr, "%s: unknown run type at PTE %u\n",
+				filename, i);
+			exit(1);
+		}
+
+		i += length;
+	}
+
+	return;
+
+truncated:
+	fprintf(stderr, "%s: truncated snapshot\n", filename);
+	exit(1);
+}
+
+static void read_gtt_file(struct gtt *gtt, const char *filename)
+{
+	struct gtt_dump_header header;
+	FILE *file;
+
+	file = fopen(filename, "r");
+	if (file == NULL) {
+		fprintf(stderr, "Couldn't open %s: %s\n",
+			filename, strerror(errno));
+		exit(1);
+	}
+
+	if (fread(&header, sizeof(header), 1, file) != 1 ||
+	    (header.magic != GTT_DUMP_MAGIC && header.magic != GTT_RLE_MAGIC)) {
+		fprintf(stderr, "%s is not a GTT snapshot\n", filename);
+		exit(1);
+	}
+	if (header.version != GTT_DUMP_VERSION) {
+		fprintf(stderr, "%s: unsupported snapshot version %u\n",
+			filename, header.version);
+		exit(1);
+	}
+
+	gtt->devid = header.devid;
+	gtt->aper_size = header.aper_size;
+	gtt->num_ptes = header.num_ptes;
+	gtt->pte = malloc(gtt->num_ptes * sizeof(uint32_t));
+	if (gtt->pte == NULL) {
+		fprintf(stderr, "Failed to allocate %u PTEs\n", gtt->num_ptes);
+		exit(1);
+	}
+
+	if (header.magic == GTT_RLE_MAGIC)
+		read_rle_runs(gtt, file, filename);
+	else if (fread(gtt->pte, sizeof(uint32_t), gtt->num_ptes, file) !=
+		 gtt->num_ptes) {
+		fprintf(stderr, "%s: truncated snapshot\n", filename);
+		exit(1);
+	}
+
+	fclose(file);
+}
+
+static int write_rle_runs(struct gtt *gtt, FILE *file)
+{
+	struct gtt_run run;
+	uint32_t i, literal = 0, header;
+
+	/* Neighbouring single PTEs are merged into one literal run */
+	for (i = 0; i < gtt->num_ptes; i += run.length) {
+		gtt_next_run(gtt->pte, gtt->num_ptes, i, &run);
+		if (run.type == GTT_RUN_SINGLE) {
+			literal++;
+			continue;
 		}
-		if (linear_length > 0) {
-			printf("0x%08x - 0x%08x: linear from "
+
+		if (literal) {
+			header = RLE_LITERAL << RLE_TYPE_SHIFT | literal;
+			if (fwrite(&header, sizeof(header), 1, file) != 1 ||
+			    fwrite(gtt->pte + i - literal, sizeof(uint32_t),
+				   literal, file) != literal)
+				return -1;
+			literal = 0;
+		}
+
+		header = (run.type == GTT_RUN_LINEAR ? RLE_LINEAR : RLE_CONSTANT);
+		header = header << RLE_TYPE_SHIFT | run.length;
+		if (fwrite(&header, sizeof(header), 1, file) != 1 ||
+		    fwrite(&run.pte, sizeof(run.pte), 1, file) != 1)
+			return -1;
+	}
+
+	if (literal) {
+		header = RLE_LITERAL << RLE_TYPE_SHIFT | literal;
+		if (fwrite(&header, sizeof(header), 1, file) != 1 ||
+		    fwrite(gtt->pte + i - literal, sizeof(uint32_t),
+			   literal, file) != literal)
+			return -1;
+	}
+
+	return 0;
+}
+
+static void write_gtt_file(struct gtt *gtt, const char *filename, int rle)
+{
+	struct gtt_dump_header header;
+	FILE *file;
+
+	memset(&header, 0, sizeof(header));
+	header.magic = rle ? GTT_RLE_MAGIC : GTT_DUMP_MAGIC;
+	header.version = GTT_DUMP_VERSION;
+	header.devid = gtt->devid;
+	header.num_ptes = gtt->num_ptes;
+	header.aper_size = gtt->aper_size;
+
+	file = fopen(filename, "w");
+	if (file == NULL) {
+		fprintf(stderr, "Couldn't open %s: %s\n",
+			filename, strerror(errno));
+		exit(1);
+	}
+
+	if (fwrite(&header, sizeof(header), 1, file) != 1 ||
+	    (rle ? write_rle_runs(gtt, file) :
+	     fwrite(gtt->pte, sizeof(uint32_t), gtt->num_ptes, file) !=
+	     gtt->num_ptes) ||
+	    fclose(file) != 0) {
+		fprintf(stderr, "Failed to write %s: %s\n",
+			filename, strerror(errno));
+		exit(1);
+	}
+}
+
+static void print_map(struct gtt *gtt)
+{
+	struct gtt_run run;
+	uint32_t start;
+
+	for (start = 0; start < gtt->num_ptes; start += run.length) {
+		unsigned long long end;
+
+		gtt_next_run(gtt->pte, gtt->num_ptes, start, &run);
+		end = (unsigned long long)(start + run.length - 1) * KB(4);
+
+		switch (run.type) {
+		case GTT_RUN_LINEAR:
+			printf("0x%08llx - 0x%08llx: linear from "
 			       "0x%08x to 0x%08x\n",
-			       start, end - KB(4),
-			       start_pte, start_pte + (end - start) - KB(4));
-			start = end - KB(4);
+			       (unsigned long long)start * KB(4), end,
+			       run.pte, run.pte + (run.length - 1) * KB(4));
+			break;
+		case GTT_RUN_CONSTANT:
+			printf("0x%08llx - 0x%08llx: constant 0x%08x\n",
+			       (unsigned long long)start * KB(4), end,
+			       run.pte);
+			break;
+		case GTT_RUN_SINGLE:
+			printf("0x%08llx: 0x%08x\n",
+			       (unsigned long long)start * KB(4), run.pte);
+			break;
+		}
+	}
+}
+
+/*
+ * The kernel points every unbound PTE at a single scratch page, so the
+ * value of the longest constant run is taken to be the scratch PTE.
+ */
+static uint32_t find_scratch_pte(struct gtt *gtt)
+{
+	uint32_t i, run = 0, best_run = 0, scratch = 0;
+
+	for (i = 0; i < gtt->num_ptes; i++) {
+		if (i && gtt->pte[i] == gtt->pte[i - 1])
+			run++;
+		else
+			run = 1;
+		if (run > best_run) {
+			best_run = run;
+			scratch = gtt->pte[i];
+		}
+	}
+
+	return best_run > 1 ? scratch : 0;
+}
+
+static int pte_unused(uint32_t pte, uint32_t scratch)
+{
+	return (pte & PTE_VALID) == 0 || pte == scratch;
+}
+
+static void print_stats(struct gtt *gtt)
+{
+	uint32_t scratch = find_scratch_pte(gtt);
+	uint32_t i, free_ptes = 0, free_regions = 0, used_regions = 0;
+	uint32_t run = 0, largest_free = 0, largest_free_start = 0;
+	uint32_t linear = 0, largest_linear = 0, largest_linear_start = 0;
+
+	for (i = 0; i < gtt->num_ptes; i++) {
+		uint32_t pte = gtt->pte[i];
+
+		if (pte_unused(pte, scratch)) {
+			free_ptes++;
+			if (i == 0 || !pte_unused(gtt->pte[i - 1], scratch)) {
+				free_regions++;
+				run = 0;
+			}
+			if (++run > largest_free) {
+				largest_free = run;
+				largest_free_start = i + 1 - run;
+			}
+			linear = 0;
 			continue;
 		}
 
-		/* Check if it's a constant sequence */
-		for (end = start + KB(4); end < aper_size; end += KB(4)) {
-			uint32_t end_pte = INGTT(end);
-			if (end_pte == start_pte)
-				constant_length++;
-			else
-				break;
+		if (i == 0 || pte_unused(gtt->pte[i - 1], scratch))
+			used_regions++;
+
+		if (linear && pte == gtt->pte[i - 1] + KB(4))
+			linear++;
+		else
+			linear = 1;
+		if (linear > largest_linear) {
+			largest_linear = linear;
+			largest_linear_start = i + 1 - linear;
 		}
-		if (constant_length > 0) {
-			printf("0x%08x - 0x%08x: constant 0x%08x\n",
-			       start, end - KB(4), start_pte);
-			start = end - KB(4);
+	}
+
+	printf("devid: 0x%04x\n", gtt->devid);
+	printf("aperture: %llu KiB, %u PTEs\n",
+	       (unsigned long long)gtt->aper_size / KB(1), gtt->num_ptes);
+	printf("scratch pte: 0x%08x\n", scratch);
+	printf("used: %u pages in %u regions\n",
+	       gtt->num_ptes - free_ptes, used_regions);
+	printf("free: %u pages in %u regions\n", free_ptes, free_regions);
+	printf("largest free region: 0x%08llx, %u pages\n",
+	       (unsigned long long)largest_free_start * KB(4), largest_free);
+	printf("largest contiguous mapping: 0x%08llx, %u pages\n",
+	       (unsigned long long)largest_linear_start * KB(4),
+	       largest_linear);
+	printf("free space fragmentation: %.1f%%\n",
+	       free_ptes ? 100. - 100. * largest_free / free_ptes : 0.);
+}
+
+static void print_diff(struct gtt *a, struct gtt *b)
+{
+	uint32_t i, start, n, changed = 0;
+
+	if (a->devid != b->devid)
+		printf("devid differs: 0x%04x vs 0x%04x\n", a->devid, b->devid);
+
+	n = a->num_ptes < b->num_ptes ? a->num_ptes : b->num_ptes;
+	if (a->num_ptes != b->num_ptes)
+		printf("number of PTEs differs: %u vs %u\n",
+		       a->num_ptes, b->num_ptes);
+
+	for (i = 0; i < n; i++) {
+		if (a->pte[i] == b->pte[i])
 			continue;
+
+		for (start = i; i + 1 < n && a->pte[i + 1] != b->pte[i + 1]; i++)
+			;
+
+		if (start == i)
+			printf("0x%08llx: 0x%08x -> 0x%08x\n",
+			       (unsigned long long)start * KB(4),
+			       a->pte[start], b->pte[start]);
+		else
+			printf("0x%08llx - 0x%08llx: %u PTEs changed\n",
+			       (unsigned long long)start * KB(4),
+			       (unsigned long long)i * KB(4),
+			       i - start + 1);
+		changed += i - start + 1;
+	}
+
+	printf("%u PTEs changed\n", changed);
+}
+
+static void usage(const char *appname)
+{
+	printf("Usage: %s [options]\n"
+	       "Options:\n"
+	       "  -f <file>  read the GTT from a snapshot instead of the device\n"
+	       "  -o <file>  save a snapshot of the GTT to file\n"
+	       "  -r         run-length encode the snapshot saved with -o\n"
+	       "  -s         print usage and fragmentation statistics\n"
+	       "  -c <file>  print the PTEs that differ from another snapshot\n"
+	       "  -n         don't print the GTT map\n"
+	       "  -h         prints this help\n",
+	       appname);
+}
+
+int main(int argc, char **argv)
+{
+	struct gtt gtt;
+	char *input_file = NULL, *output_file = NULL, *diff_file = NULL;
+	int stats = 0, print = 1, rle = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "f:o:rsc:nh")) != -1) {
+		switch (opt) {
+		case 'f':
+			input_file = optarg;
+			break;
+		case 'o':
+			output_file = optarg;
+			break;
+		case 'r':
+			rle = 1;
+			break;
+		case 's':
+			stats = 1;
+			break;
+		case 'c':
+			diff_file = optarg;
+			break;
+		case 'n':
+			print = 0;
+			break;
+		case 'h':
+			usage(argv[0]);
+			return 0;
+		default:
+			usage(argv[0]);
+			return 1;
 		}
+	}
+
+	if (input_file)
+		read_gtt_file(&gtt, input_file);
+	else
+		read_gtt_live(&gtt);
+
+	if (output_file) {
+		write_gtt_file(&gtt, output_file, rle);
+		print = 0;
+	}
+
+	if (stats || diff_file)
+		print = 0;
+
+	if (print)
+		print_map(&gtt);
+
+	if (stats)
+		print_stats(&gtt);
+
+	if (diff_file) {
+		struct gtt other;
 
-		printf("0x%08x: 0x%08x\n", start, start_pte);
+		read_gtt_file(&other, diff_file);
+		print_diff(&gtt, &other);
+		free(other.pte);
 	}
 
+	free(gtt.pte);
 	return 0;
 }